@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "avl_bench_utils.h"
+
+/*
+ * Comparisons and time per operation for batches applied with avl_tree_apply_batch against the
+ * same additions and removals made one call at a time. Batches either cover a run of neighbouring
+ * keys, which share most of their descents, or keys spread over the whole tree, which also pay for
+ * sorting the batch.
+ *
+ * usage: bench_batch [num_values] [num_ops]
+ */
+
+uint64_t comparisons = 0;
+
+int counting_cmp(void const *new_value, void const *node_value) {
+	++comparisons;
+	return int64_t_cmp(new_value, node_value);
+}
+
+int main(int argc, char **argv) {
+	int64_t num_values = argc > 1 ? atoll(argv[1]) : 1 << 20;
+	int64_t num_ops = argc > 2 ? atoll(argv[2]) : 1 << 20;
+
+	struct avl_tree *tree = NULL;
+	if (avl_tree_create(&tree, counting_cmp) < 0) {
+		fprintf(stderr, "avl_tree_create() failed\n");
+		return EXIT_FAILURE;
+	}
+
+	// Even keys in the tree, so that the odd ones can be added and removed again
+	int64_t *values = malloc(sizeof(*values) * num_values);
+	if (values == NULL) {
+		perror("malloc(sizeof(*values) * num_values)");
+		return EXIT_FAILURE;
+	}
+	for (int64_t i = 0; i < num_values; ++i) {
+		values[i] = 2 * i;
+	}
+	uint64_t state = 0x9E3779B97F4A7C15ULL;
+	bench_shuffle(values, num_values, &state);
+	for (int64_t i = 0; i < num_values; ++i) {
+		avl_tree_add(tree, (void *)values[i], (void *)(values[i] + 1));
+	}
+	free(values);
+
+	int64_t *keys = malloc(sizeof(*keys) * num_ops);
+	struct avl_batch_op *ops = malloc(sizeof(*ops) * num_ops);
+	if (keys == NULL || ops == NULL) {
+		perror("malloc(sizeof(*ops) * num_ops)");
+		return EXIT_FAILURE;
+	}
+
+	printf("values: %ld, ops: %ld\n", num_values, num_ops);
+
+	int64_t const batch_sizes[] = {16, 256, 4096};
+	char const *pattern_names[] = {"run", "spread"};
+	for (int pattern = 0; pattern < 2; ++pattern) {
+		for (size_t b = 0; b < sizeof(batch_sizes) / sizeof(*batch_sizes); ++b) {
+			int64_t batch_size = batch_sizes[b];
+			int64_t num_batches = num_ops / batch_size;
+			int64_t count = num_batches * batch_size;
+
+			// Distinct odd keys per batch: a run starting anywhere, or one key from each stretch
+			for (int64_t i = 0; i < count; i += batch_size) {
+				int64_t start = (int64_t)(bench_rand(&state) % (uint64_t)num_values);
+				for (int64_t j = 0; j < batch_size; ++j) {
+					int64_t slot = pattern == 0 ? start + j : j * num_values / batch_size + start % 64;
+					keys[i + j] = 2 * (slot % num_values) + 1;
+				}
+				if (pattern == 1) {
+					bench_shuffle(&keys[i], batch_size, &state);
+				}
+			}
+
+			comparisons = 0;
+			void const *value;
+			void const *data;
+			uint64_t begin = bench_now_ns();
+			for (int64_t i = 0; i < count; i += batch_size) {
+				for (int64_t j = i; j < i + batch_size; ++j) {
+					avl_tree_add(tree, (void *)keys[j], (void *)(keys[j] + 1));
+				}
+				for (int64_t j = i; j < i + batch_size; ++j) {
+					avl_tree_remove(tree, (void *)keys[j], &value, &data);
+				}
+			}
+			double single_ns = (double)(bench_now_ns() - begin) / (2 * count);
+			double single_cmps = (double)comparisons / (2 * count);
+
+			comparisons = 0;
+			begin = bench_now_ns();
+			for (int64_t i = 0; i < count; i += batch_size) {
+				for (int64_t j = i; j < i + batch_size; ++j) {
+					ops[j].kind = AVL_BATCH_ADD;
+					ops[j].value = (void *)keys[j];
+					ops[j].data = (void *)(keys[j] + 1);
+				}
+				avl_tree_apply_batch(tree, &ops[i], batch_size);
+				for (int64_t j = i; j < i + batch_size; ++j) {
+					ops[j].kind = AVL_BATCH_REMOVE;
+				}
+				avl_tree_apply_batch(tree, &ops[i], batch_size);
+			}
+			double batch_ns = (double)(bench_now_ns() - begin) / (2 * count);
+			double batch_cmps = (double)comparisons / (2 * count);
+
+			printf(
+			    "%-6s batch %5ld   single %5.1f cmp %6.1f ns   batch %5.1f cmp %6.1f ns (%.2fx cmp)\n",
+			    pattern_names[pattern], batch_size, single_cmps, single_ns, batch_cmps, batch_ns,
+			    single_cmps / batch_cmps);
+		}
+	}
+
+	free(ops);
+	free(keys);
+	avl_tree_free(&tree, bench_free_node, NULL);
+
+	return EXIT_SUCCESS;
+}
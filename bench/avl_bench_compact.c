@@ -0,0 +1,108 @@
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "avl_bench_utils.h"
+#include "avl_compact.h"
+
+/*
+ * Memory per entry and cost per call of the compact layout against struct avl_node, with and
+ * without AVL_TREE_NODE_POOL.
+ *
+ * usage: bench_compact [num_values]
+ */
+
+size_t heap_bytes() {
+	// Bytes handed out by malloc, including the large blocks it maps separately
+	struct mallinfo2 info = mallinfo2();
+	return info.uordblks + info.hblkhd;
+}
+
+enum layout { GENERIC, POOL, COMPACT, COMPACT_SET };
+
+char const *layout_names[] = {"avl_node", "avl_node pool", "compact", "compact set"};
+
+void run(enum layout layout, int64_t *values, int64_t num_values, uint64_t *state) {
+	struct avl_tree *tree = NULL;
+	struct avl_compact_tree *compact = NULL;
+
+	size_t before = heap_bytes();
+	if (layout == COMPACT || layout == COMPACT_SET) {
+		avl_compact_create(&compact, int64_t_cmp, layout == COMPACT_SET ? AVL_COMPACT_SET : 0);
+		avl_compact_reserve(compact, num_values);
+	} else {
+		avl_tree_create_flags(&tree, int64_t_cmp, layout == POOL ? AVL_TREE_NODE_POOL : 0);
+	}
+
+	uint64_t begin = bench_now_ns();
+	for (int64_t i = 0; i < num_values; ++i) {
+		if (compact != NULL) {
+			avl_compact_add(compact, (void *)values[i], (void *)(values[i] + 1));
+		} else {
+			avl_tree_add(tree, (void *)values[i], (void *)(values[i] + 1));
+		}
+	}
+	uint64_t add_ns = bench_now_ns() - begin;
+	double bytes = (double)(heap_bytes() - before) / num_values;
+
+	bench_shuffle(values, num_values, state);
+	void const *data;
+	begin = bench_now_ns();
+	for (int64_t i = 0; i < num_values; ++i) {
+		if (compact != NULL) {
+			avl_compact_get(compact, (void *)values[i], &data);
+		} else {
+			avl_tree_get(tree, (void *)values[i], &data);
+		}
+	}
+	uint64_t get_ns = bench_now_ns() - begin;
+
+	bench_shuffle(values, num_values, state);
+	void const *value;
+	begin = bench_now_ns();
+	for (int64_t i = 0; i < num_values; ++i) {
+		if (compact != NULL) {
+			avl_compact_remove(compact, (void *)values[i], &value, &data);
+		} else {
+			avl_tree_remove(tree, (void *)values[i], &value, &data);
+		}
+	}
+	uint64_t remove_ns = bench_now_ns() - begin;
+
+	printf(
+	    "%-14s %6.1f B/entry   add %7.1f   get %7.1f   remove %7.1f ns/op\n", layout_names[layout],
+	    bytes, (double)add_ns / num_values, (double)get_ns / num_values,
+	    (double)remove_ns / num_values);
+
+	if (compact != NULL) {
+		avl_compact_free(&compact, NULL, NULL);
+	} else {
+		avl_tree_free(&tree, NULL, NULL);
+	}
+}
+
+int main(int argc, char **argv) {
+	int64_t num_values = argc > 1 ? atoll(argv[1]) : 1 << 22;
+
+	int64_t *values = malloc(sizeof(*values) * num_values);
+	if (values == NULL) {
+		perror("malloc(sizeof(*values) * num_values)");
+		return EXIT_FAILURE;
+	}
+	for (int64_t i = 0; i < num_values; ++i) {
+		values[i] = i;
+	}
+
+	printf("values: %ld\n", num_values);
+
+	for (enum layout layout = GENERIC; layout <= COMPACT_SET; ++layout) {
+		uint64_t state = 0x9E3779B97F4A7C15ULL;
+		bench_shuffle(values, num_values, &state);
+		run(layout, values, num_values, &state);
+	}
+
+	free(values);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,122 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "avl_bench_utils.h"
+
+/*
+ * Restart cost: avl_tree_load of a snapshot against replaying num_values avl_tree_add calls, plus
+ * the time avl_tree_save takes to write it. The snapshot goes to an unlinked temporary file, so
+ * this mostly measures the page cache rather than the disk.
+ *
+ * usage: bench_file [num_values]
+ */
+
+int encode_data(void const *value, void const *data, uint8_t *buffer, size_t *size, void *arg) {
+	(void)value;
+	(void)arg;
+
+	if (*size < sizeof(data)) {
+		*size = sizeof(data);
+		return -ENOSPC;
+	}
+	memcpy(buffer, &data, sizeof(data));
+	*size = sizeof(data);
+	return 0;
+}
+
+int decode_data(
+    uint8_t const *buffer, size_t size, void const **value, void const **data, void *arg) {
+	(void)value;
+	(void)size;
+	(void)arg;
+
+	memcpy(data, buffer, sizeof(*data));
+	return 0;
+}
+
+int encode_entry(void const *value, void const *data, uint8_t *buffer, size_t *size, void *arg) {
+	(void)arg;
+
+	// Without AVL_SAVE_INTEGER_VALUES the codec carries the value as well
+	if (*size < 2 * sizeof(value)) {
+		*size = 2 * sizeof(value);
+		return -ENOSPC;
+	}
+	memcpy(buffer, &value, sizeof(value));
+	memcpy(buffer + sizeof(value), &data, sizeof(data));
+	*size = 2 * sizeof(value);
+	return 0;
+}
+
+int decode_entry(
+    uint8_t const *buffer, size_t size, void const **value, void const **data, void *arg) {
+	(void)size;
+	(void)arg;
+
+	memcpy(value, buffer, sizeof(*value));
+	memcpy(data, buffer + sizeof(*value), sizeof(*data));
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	int64_t num_values = argc > 1 ? atoll(argv[1]) : 1 << 22;
+
+	printf("values: %ld\n", num_values);
+
+	uint64_t begin = bench_now_ns();
+	struct avl_tree *tree = bench_create_tree(0, num_values);
+	uint64_t replay_ns = bench_now_ns() - begin;
+	printf("%-22s %8.1f ms\n", "replay avl_tree_add", replay_ns / 1e6);
+
+	struct avl_codec const entry_codec = {.encode_func = encode_entry, .decode_func = decode_entry};
+	struct avl_codec const data_codec = {.encode_func = encode_data, .decode_func = decode_data};
+	struct {
+		char const *name;
+		uint32_t flags;
+		struct avl_codec const *codec;
+	} const formats[] = {
+	    {"codec values", 0, &entry_codec},
+	    {"integer values", AVL_SAVE_INTEGER_VALUES, &data_codec},
+	    {"integer values only", AVL_SAVE_INTEGER_VALUES, NULL},
+	};
+
+	for (size_t i = 0; i < sizeof(formats) / sizeof(*formats); ++i) {
+		FILE *file = tmpfile();
+		if (file == NULL) {
+			perror("tmpfile()");
+			return EXIT_FAILURE;
+		}
+
+		begin = bench_now_ns();
+		if (avl_tree_save(tree, file, formats[i].flags, formats[i].codec) < 0) {
+			fprintf(stderr, "avl_tree_save() failed\n");
+			return EXIT_FAILURE;
+		}
+		uint64_t save_ns = bench_now_ns() - begin;
+		long size = ftell(file);
+
+		rewind(file);
+		struct avl_tree *loaded = NULL;
+		avl_tree_create_flags(&loaded, int64_t_cmp, 0);
+		begin = bench_now_ns();
+		if (avl_tree_load(loaded, file, formats[i].codec) < 0) {
+			fprintf(stderr, "avl_tree_load() failed\n");
+			return EXIT_FAILURE;
+		}
+		uint64_t load_ns = bench_now_ns() - begin;
+
+		printf(
+		    "%-22s save %8.1f ms   load %8.1f ms (%.1fx replay)   %5.1f B/entry\n",
+		    formats[i].name, save_ns / 1e6, load_ns / 1e6,
+		    (double)replay_ns / load_ns, (double)size / num_values);
+
+		bench_free_tree(loaded);
+		fclose(file);
+	}
+
+	bench_free_tree(tree);
+
+	return EXIT_SUCCESS;
+}
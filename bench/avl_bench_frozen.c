@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "avl_bench_utils.h"
+#include "avl_frozen.h"
+
+/*
+ * Random lookups on the live tree with avl_tree_get against frozen copies of it in both layouts,
+ * through cmp_func and with AVL_FROZEN_INTEGER_VALUES, plus short range scans.
+ *
+ * usage: bench_frozen [num_values] [num_lookups]
+ */
+
+int count_entry(void const *value, void const *data, void *arg) {
+	(void)value;
+	(void)data;
+	++*(int64_t *)arg;
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	int64_t num_values = argc > 1 ? atoll(argv[1]) : 1 << 22;
+	int64_t num_lookups = argc > 2 ? atoll(argv[2]) : 1 << 22;
+
+	struct avl_tree *tree = bench_create_tree(0, num_values);
+
+	void const **values = malloc(sizeof(*values) * num_lookups);
+	if (values == NULL) {
+		perror("malloc(sizeof(*values) * num_lookups)");
+		return EXIT_FAILURE;
+	}
+
+	// Half hits, half misses, in no particular order
+	uint64_t state = 0x2545F4914F6CDD1DULL;
+	for (int64_t i = 0; i < num_lookups; ++i) {
+		values[i] = (void *)(int64_t)(bench_rand(&state) % (uint64_t)(2 * num_values));
+	}
+
+	printf("values: %ld, lookups: %ld\n", num_values, num_lookups);
+
+	void const *data;
+	int64_t hits = 0;
+	uint64_t begin = bench_now_ns();
+	for (int64_t i = 0; i < num_lookups; ++i) {
+		hits += avl_tree_get(tree, values[i], &data);
+	}
+	double tree_ns = (double)(bench_now_ns() - begin) / num_lookups;
+	printf("%-22s get %7.1f ns (%ld hits)\n", "avl_tree_get", tree_ns, hits);
+
+	char const *layout_names[] = {"eytzinger", "veb"};
+	for (int layout = AVL_FROZEN_EYTZINGER; layout <= AVL_FROZEN_VEB; ++layout) {
+		for (uint32_t flags = 0; flags <= AVL_FROZEN_INTEGER_VALUES; ++flags) {
+			struct avl_frozen *frozen = NULL;
+			begin = bench_now_ns();
+			if (avl_tree_freeze(tree, &frozen, layout, flags) < 0) {
+				fprintf(stderr, "avl_tree_freeze() failed\n");
+				return EXIT_FAILURE;
+			}
+			double freeze_ms = (double)(bench_now_ns() - begin) / 1e6;
+
+			hits = 0;
+			begin = bench_now_ns();
+			for (int64_t i = 0; i < num_lookups; ++i) {
+				hits += avl_frozen_get(frozen, values[i], &data);
+			}
+			double get_ns = (double)(bench_now_ns() - begin) / num_lookups;
+
+			// Ranges covering about 16 entries
+			int64_t visited = 0;
+			begin = bench_now_ns();
+			for (int64_t i = 0; i < num_lookups; ++i) {
+				avl_frozen_range(
+				    frozen, values[i], (void *)((int64_t)values[i] + 32), AVL_RANGE_LO_INCLUSIVE,
+				    count_entry, &visited);
+			}
+			double range_ns = (double)(bench_now_ns() - begin) / num_lookups;
+
+			printf(
+			    "%-9s %-12s get %7.1f ns (%ld hits, %.1fx)   range %7.1f ns   freeze %7.1f ms\n",
+			    layout_names[layout], flags ? "integer" : "cmp_func", get_ns, hits, tree_ns / get_ns,
+			    range_ns, freeze_ms);
+
+			avl_frozen_free(&frozen);
+		}
+	}
+
+	free(values);
+	bench_free_tree(tree);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,60 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "avl_bench_utils.h"
+
+/*
+ * Random lookups on a tree much larger than the last-level cache, as a loop of avl_tree_get and as
+ * groups passed to avl_tree_get_many.
+ *
+ * usage: bench_get_many [num_values] [num_lookups] [group_size]
+ */
+
+int main(int argc, char **argv) {
+	int64_t num_values = argc > 1 ? atoll(argv[1]) : 1 << 22;
+	int64_t num_lookups = argc > 2 ? atoll(argv[2]) : 1 << 22;
+	int64_t group_size = argc > 3 ? atoll(argv[3]) : 64;
+
+	struct avl_tree *tree = bench_create_tree(AVL_TREE_NODE_POOL, num_values);
+
+	void const **values = malloc(sizeof(*values) * num_lookups);
+	void const **node_data = malloc(sizeof(*node_data) * num_lookups);
+	int *found = malloc(sizeof(*found) * num_lookups);
+	if (values == NULL || node_data == NULL || found == NULL) {
+		perror("malloc()");
+		return EXIT_FAILURE;
+	}
+
+	// Half hits, half misses, in no particular order
+	uint64_t state = 0x2545F4914F6CDD1DULL;
+	for (int64_t i = 0; i < num_lookups; ++i) {
+		values[i] = (void *)(int64_t)(bench_rand(&state) % (uint64_t)(2 * num_values));
+	}
+
+	printf("values: %ld, lookups: %ld, group: %ld\n", num_values, num_lookups, group_size);
+
+	int64_t hits = 0;
+	uint64_t begin = bench_now_ns();
+	for (int64_t i = 0; i < num_lookups; ++i) {
+		hits += avl_tree_get(tree, values[i], &node_data[i]);
+	}
+	uint64_t end = bench_now_ns();
+	printf("%-10s %8.1f ns/lookup (%ld hits)\n", "get", (double)(end - begin) / num_lookups, hits);
+
+	hits = 0;
+	begin = bench_now_ns();
+	for (int64_t i = 0; i < num_lookups; i += group_size) {
+		int64_t count = num_lookups - i < group_size ? num_lookups - i : group_size;
+		hits += avl_tree_get_many(tree, values + i, count, node_data + i, found + i);
+	}
+	end = bench_now_ns();
+	printf(
+	    "%-10s %8.1f ns/lookup (%ld hits)\n", "get_many", (double)(end - begin) / num_lookups, hits);
+
+	free(values);
+	free(node_data);
+	free(found);
+	avl_tree_free(&tree, NULL, NULL);
+
+	return EXIT_SUCCESS;
+}
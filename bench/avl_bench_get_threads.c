@@ -0,0 +1,129 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "avl_bench_utils.h"
+
+/*
+ * Measures avl_tree_get throughput as the number of threads grows. A small share of operations can
+ * be turned into remove/add pairs to mimic a lookup-heavy service with occasional updates.
+ *
+ * usage: bench_get_threads [num_values] [max_threads] [write_percent] [flags]
+ *
+ * flags is a comma separated list of "writer" (AVL_TREE_WRITER_PREFERENCE), "optimistic"
+ * (AVL_TREE_OPTIMISTIC_READS), "persistent" (AVL_TREE_PERSISTENT) and "combining"
+ * (AVL_TREE_FLAT_COMBINING).
+ */
+
+struct worker {
+	pthread_t thread;
+	struct avl_tree *tree;
+	int64_t num_values;
+	int64_t write_percent;
+	uint64_t seed;
+	pthread_barrier_t *start;
+	atomic_bool *stop;
+	uint64_t ops;
+};
+
+void *_worker_run(void *arg) {
+	struct worker *worker = arg;
+	uint64_t state = worker->seed;
+	uint64_t ops = 0;
+
+	pthread_barrier_wait(worker->start);
+
+	while (!atomic_load_explicit(worker->stop, memory_order_relaxed)) {
+		uint64_t r = bench_rand(&state);
+		int64_t key = 2 * (int64_t)(r % (uint64_t)worker->num_values);
+
+		if ((int64_t)((r >> 32) % 100) < worker->write_percent) {
+			void const *value;
+			void const *data;
+			if (avl_tree_remove(worker->tree, (void *)key, &value, &data) == true) {
+				avl_tree_add(worker->tree, value, data);
+			}
+		} else {
+			void const *data;
+			avl_tree_get(worker->tree, (void *)key, &data);
+		}
+		++ops;
+	}
+
+	worker->ops = ops;
+	return NULL;
+}
+
+double _run(struct avl_tree *tree, int64_t num_values, int64_t num_threads, int64_t write_percent) {
+	struct worker *workers = calloc(num_threads, sizeof(*workers));
+	pthread_barrier_t start;
+	atomic_bool stop = false;
+
+	pthread_barrier_init(&start, NULL, num_threads + 1);
+
+	for (int64_t t = 0; t < num_threads; ++t) {
+		workers[t].tree = tree;
+		workers[t].num_values = num_values;
+		workers[t].write_percent = write_percent;
+		workers[t].seed = 0x9E3779B97F4A7C15ULL * (t + 1);
+		workers[t].start = &start;
+		workers[t].stop = &stop;
+		pthread_create(&workers[t].thread, NULL, _worker_run, &workers[t]);
+	}
+
+	pthread_barrier_wait(&start);
+	uint64_t begin = bench_now_ns();
+	usleep(1000000);
+	atomic_store(&stop, true);
+
+	uint64_t total = 0;
+	for (int64_t t = 0; t < num_threads; ++t) {
+		pthread_join(workers[t].thread, NULL);
+		total += workers[t].ops;
+	}
+	uint64_t end = bench_now_ns();
+
+	pthread_barrier_destroy(&start);
+	free(workers);
+
+	return (double)total / ((double)(end - begin) / 1e9);
+}
+
+int main(int argc, char **argv) {
+	int64_t num_values = argc > 1 ? atoll(argv[1]) : 1 << 20;
+	int64_t max_threads = argc > 2 ? atoll(argv[2]) : sysconf(_SC_NPROCESSORS_ONLN);
+	int64_t write_percent = argc > 3 ? atoll(argv[3]) : 5;
+	uint32_t flags = argc > 4 ? bench_parse_flags(argv[4]) : 0;
+
+	struct avl_tree *tree = bench_create_tree(flags, num_values);
+
+	printf(
+	    "values: %ld, writes: %ld%%, writer preference: %s, optimistic reads: %s, persistent: %s\n",
+	    num_values, write_percent, flags & AVL_TREE_WRITER_PREFERENCE ? "yes" : "no",
+	    flags & AVL_TREE_OPTIMISTIC_READS ? "yes" : "no", flags & AVL_TREE_PERSISTENT ? "yes" : "no");
+	printf("%8s %16s %10s\n", "threads", "ops/s", "speedup");
+
+	// Double the thread count each step, always finishing on max_threads itself
+	double base = 0;
+	for (int64_t threads = 1;; threads *= 2) {
+		if (max_threads < threads) {
+			threads = max_threads;
+		}
+
+		double rate = _run(tree, num_values, threads, write_percent);
+		if (threads == 1) {
+			base = rate;
+		}
+		printf("%8ld %16.0f %10.2f\n", threads, rate, rate / base);
+
+		if (threads == max_threads) {
+			break;
+		}
+	}
+
+	bench_free_tree(tree);
+	return EXIT_SUCCESS;
+}
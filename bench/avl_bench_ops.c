@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "avl_bench_utils.h"
+
+/*
+ * Single-threaded cost of each tree operation, in nanoseconds per call.
+ *
+ * usage: bench_ops [num_values] [flags]
+ *
+ * flags is parsed by bench_parse_flags(), e.g. "pool" or "persistent,pool".
+ */
+
+int main(int argc, char **argv) {
+	int64_t num_values = argc > 1 ? atoll(argv[1]) : 1 << 20;
+	uint32_t flags = argc > 2 ? bench_parse_flags(argv[2]) : 0;
+
+	int64_t *values = malloc(sizeof(*values) * num_values);
+	if (values == NULL) {
+		perror("malloc(sizeof(*values) * num_values)");
+		return EXIT_FAILURE;
+	}
+	for (int64_t i = 0; i < num_values; ++i) {
+		values[i] = i;
+	}
+	uint64_t state = 0x9E3779B97F4A7C15ULL;
+	bench_shuffle(values, num_values, &state);
+
+	struct avl_tree *tree = NULL;
+	if (avl_tree_create_flags(&tree, int64_t_cmp, flags) < 0) {
+		fprintf(stderr, "avl_tree_create_flags() failed\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("values: %ld, flags: %s\n", num_values, argc > 2 ? argv[2] : "none");
+
+	uint64_t begin = bench_now_ns();
+	for (int64_t i = 0; i < num_values; ++i) {
+		avl_tree_add(tree, (void *)values[i], (void *)(values[i] + 1));
+	}
+	uint64_t end = bench_now_ns();
+	printf("%-8s %8.1f ns/op\n", "add", (double)(end - begin) / num_values);
+
+	bench_shuffle(values, num_values, &state);
+	void const *data;
+	begin = bench_now_ns();
+	for (int64_t i = 0; i < num_values; ++i) {
+		avl_tree_get(tree, (void *)values[i], &data);
+	}
+	end = bench_now_ns();
+	printf("%-8s %8.1f ns/op\n", "get", (double)(end - begin) / num_values);
+
+	// Churn: every removal is followed by an addition, as in a steady-state index
+	void const *value;
+	begin = bench_now_ns();
+	for (int64_t i = 0; i < num_values; ++i) {
+		avl_tree_remove(tree, (void *)values[i], &value, &data);
+		avl_tree_add(tree, value, data);
+	}
+	end = bench_now_ns();
+	printf("%-8s %8.1f ns/op\n", "churn", (double)(end - begin) / num_values);
+
+	// Groups of 1024 removals followed by the 1024 matching additions, first one call at a time and
+	// then as batches
+	begin = bench_now_ns();
+	for (int64_t i = 0; i < num_values; i += 1024) {
+		int64_t count = num_values - i < 1024 ? num_values - i : 1024;
+		for (int64_t j = 0; j < count; ++j) {
+			avl_tree_remove(tree, (void *)values[i + j], &value, &data);
+		}
+		for (int64_t j = 0; j < count; ++j) {
+			avl_tree_add(tree, (void *)values[i + j], (void *)(values[i + j] + 1));
+		}
+	}
+	end = bench_now_ns();
+	printf("%-8s %8.1f ns/op\n", "groups", (double)(end - begin) / num_values);
+
+	struct avl_batch_op ops[1024];
+	begin = bench_now_ns();
+	for (int64_t i = 0; i < num_values; i += 1024) {
+		int64_t count = num_values - i < 1024 ? num_values - i : 1024;
+		for (int64_t j = 0; j < count; ++j) {
+			ops[j].kind = AVL_BATCH_REMOVE;
+			ops[j].value = (void *)values[i + j];
+		}
+		avl_tree_apply_batch(tree, ops, count);
+		for (int64_t j = 0; j < count; ++j) {
+			ops[j].kind = AVL_BATCH_ADD;
+			ops[j].value = ops[j].node_value;
+			ops[j].data = ops[j].node_data;
+		}
+		avl_tree_apply_batch(tree, ops, count);
+	}
+	end = bench_now_ns();
+	printf("%-8s %8.1f ns/op\n", "batch", (double)(end - begin) / num_values);
+
+	bench_shuffle(values, num_values, &state);
+	begin = bench_now_ns();
+	for (int64_t i = 0; i < num_values; ++i) {
+		avl_tree_remove(tree, (void *)values[i], &value, &data);
+	}
+	end = bench_now_ns();
+	printf("%-8s %8.1f ns/op\n", "remove", (double)(end - begin) / num_values);
+
+	for (int64_t i = 0; i < num_values; ++i) {
+		avl_tree_add(tree, (void *)values[i], (void *)(values[i] + 1));
+	}
+	begin = bench_now_ns();
+	avl_tree_free(&tree, flags & AVL_TREE_NODE_POOL ? NULL : bench_free_node, NULL);
+	end = bench_now_ns();
+	printf("%-8s %8.3f ms\n", "free", (double)(end - begin) / 1e6);
+
+	// Startup: loading already sorted keys one add at a time versus building the tree directly
+	void const **sorted = malloc(sizeof(*sorted) * num_values);
+	if (sorted == NULL) {
+		perror("malloc(sizeof(*sorted) * num_values)");
+		return EXIT_FAILURE;
+	}
+	for (int64_t i = 0; i < num_values; ++i) {
+		sorted[i] = (void *)i;
+	}
+
+	avl_tree_create_flags(&tree, int64_t_cmp, flags);
+	begin = bench_now_ns();
+	for (int64_t i = 0; i < num_values; ++i) {
+		avl_tree_add(tree, sorted[i], sorted[i]);
+	}
+	end = bench_now_ns();
+	printf("%-8s %8.1f ns/op\n", "load", (double)(end - begin) / num_values);
+	avl_tree_free(&tree, flags & AVL_TREE_NODE_POOL ? NULL : bench_free_node, NULL);
+
+	avl_tree_create_flags(&tree, int64_t_cmp, flags);
+	begin = bench_now_ns();
+	avl_tree_build_sorted(tree, sorted, sorted, num_values);
+	end = bench_now_ns();
+	printf("%-8s %8.1f ns/op\n", "build", (double)(end - begin) / num_values);
+	avl_tree_free(&tree, flags & AVL_TREE_NODE_POOL ? NULL : bench_free_node, NULL);
+
+	free(sorted);
+	free(values);
+	return EXIT_SUCCESS;
+}
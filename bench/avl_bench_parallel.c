@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "avl_bench_utils.h"
+#include "avl_workers.h"
+
+/*
+ * Wall time of summing the data of every node with avl_tree_traverse and with
+ * avl_tree_parallel_reduce, on the calling thread only and on workers.
+ *
+ * usage: bench_parallel [num_values] [threads]
+ *
+ * threads defaults to one per processor.
+ */
+
+int add_data(struct avl_node const *node, void *sum) {
+	*(int64_t *)sum += (int64_t)avl_node_data(node);
+	return 0;
+}
+
+void sum_init(void *sum, void *arg __attribute__((unused))) {
+	*(int64_t *)sum = 0;
+}
+
+void sum_accumulate(void *sum, struct avl_node const *node, void *arg __attribute__((unused))) {
+	*(int64_t *)sum += (int64_t)avl_node_data(node);
+}
+
+void sum_combine(void *sum, void const *other, void *arg __attribute__((unused))) {
+	*(int64_t *)sum += *(int64_t const *)other;
+}
+
+int main(int argc, char **argv) {
+	int64_t num_values = argc > 1 ? atoll(argv[1]) : 1 << 22;
+	int threads = argc > 2 ? atoi(argv[2]) : -1;
+
+	struct avl_workers *workers = NULL;
+	if (avl_workers_create(&workers, threads) < 0) {
+		fprintf(stderr, "avl_workers_create() failed\n");
+		return EXIT_FAILURE;
+	}
+
+	struct avl_tree *tree = bench_create_tree(0, num_values);
+	struct avl_reduce reduce = {
+	    .size = sizeof(int64_t),
+	    .init_func = sum_init,
+	    .accumulate_func = sum_accumulate,
+	    .combine_func = sum_combine,
+	    .arg = NULL};
+
+	printf("values: %ld, workers: %d\n", num_values, workers->count);
+
+	int64_t sum = 0;
+	uint64_t begin = bench_now_ns();
+	avl_tree_traverse(tree, NULL, NULL, add_data, &sum, NULL, NULL);
+	uint64_t end = bench_now_ns();
+	printf("%-16s %8.1f ms  (sum %ld)\n", "traverse", (double)(end - begin) / 1e6, sum);
+
+	begin = bench_now_ns();
+	avl_tree_parallel_reduce(tree, NULL, &reduce, &sum);
+	end = bench_now_ns();
+	printf("%-16s %8.1f ms  (sum %ld)\n", "reduce, 1 thread", (double)(end - begin) / 1e6, sum);
+
+	begin = bench_now_ns();
+	avl_tree_parallel_reduce(tree, workers, &reduce, &sum);
+	end = bench_now_ns();
+	printf("%-16s %8.1f ms  (sum %ld)\n", "reduce, workers", (double)(end - begin) / 1e6, sum);
+
+	bench_free_tree(tree);
+	avl_workers_free(&workers);
+
+	return EXIT_SUCCESS;
+}
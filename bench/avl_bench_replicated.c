@@ -0,0 +1,170 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "avl_bench_utils.h"
+#include "avl_replicated.h"
+
+/*
+ * Compares read-mostly get/remove/add throughput of one avl_tree against an avl_replicated_tree
+ * holding the same values, as the number of threads grows.
+ *
+ * usage: bench_replicated [num_values] [max_threads] [write_percent] [num_replicas]
+ *
+ * num_replicas defaults to one per NUMA node. With more replicas than nodes, thread t is pinned to
+ * replica t % num_replicas, which simulates the topology on a single-node machine.
+ */
+
+struct worker {
+	pthread_t thread;
+	struct avl_tree *tree;
+	struct avl_replicated_tree *replicated;
+	int64_t num_values;
+	int64_t write_percent;
+	uint64_t seed;
+	// Replica to use, or -1 to follow the CPU
+	int node;
+	pthread_barrier_t *start;
+	atomic_bool *stop;
+	uint64_t ops;
+};
+
+void *_worker_run(void *arg) {
+	struct worker *worker = arg;
+	uint64_t state = worker->seed;
+	uint64_t ops = 0;
+
+	if (worker->replicated != NULL && worker->node >= 0) {
+		avl_replicated_set_node(worker->node);
+	}
+
+	pthread_barrier_wait(worker->start);
+
+	while (!atomic_load_explicit(worker->stop, memory_order_relaxed)) {
+		uint64_t r = bench_rand(&state);
+		int64_t key = 2 * (int64_t)(r % (uint64_t)worker->num_values);
+		bool write = (int64_t)((r >> 32) % 100) < worker->write_percent;
+
+		void const *value;
+		void const *data;
+		if (worker->replicated != NULL) {
+			if (!write) {
+				avl_replicated_get(worker->replicated, (void *)key, &data);
+			} else if (avl_replicated_remove(worker->replicated, (void *)key, &value, &data) == true) {
+				avl_replicated_add(worker->replicated, value, data);
+			}
+		} else {
+			if (!write) {
+				avl_tree_get(worker->tree, (void *)key, &data);
+			} else if (avl_tree_remove(worker->tree, (void *)key, &value, &data) == true) {
+				avl_tree_add(worker->tree, value, data);
+			}
+		}
+		++ops;
+	}
+
+	worker->ops = ops;
+	return NULL;
+}
+
+double _run(
+    struct avl_tree *tree, struct avl_replicated_tree *replicated, int64_t num_values,
+    int64_t num_threads, int64_t write_percent, bool simulated) {
+	struct worker *workers = calloc(num_threads, sizeof(*workers));
+	pthread_barrier_t start;
+	atomic_bool stop = false;
+
+	pthread_barrier_init(&start, NULL, num_threads + 1);
+
+	for (int64_t t = 0; t < num_threads; ++t) {
+		workers[t].tree = tree;
+		workers[t].replicated = replicated;
+		workers[t].node = simulated ? (int)t : -1;
+		workers[t].num_values = num_values;
+		workers[t].write_percent = write_percent;
+		workers[t].seed = 0x9E3779B97F4A7C15ULL * (t + 1);
+		workers[t].start = &start;
+		workers[t].stop = &stop;
+		pthread_create(&workers[t].thread, NULL, _worker_run, &workers[t]);
+	}
+
+	pthread_barrier_wait(&start);
+	uint64_t begin = bench_now_ns();
+	usleep(1000000);
+	atomic_store(&stop, true);
+
+	uint64_t total = 0;
+	for (int64_t t = 0; t < num_threads; ++t) {
+		pthread_join(workers[t].thread, NULL);
+		total += workers[t].ops;
+	}
+	uint64_t end = bench_now_ns();
+
+	pthread_barrier_destroy(&start);
+	free(workers);
+
+	return (double)total / ((double)(end - begin) / 1e9);
+}
+
+struct avl_replicated_tree *_create_replicated(int64_t num_values, int64_t num_replicas) {
+	struct avl_replicated_tree *replicated = NULL;
+	if (avl_replicated_create(&replicated, int64_t_cmp, AVL_TREE_NODE_POOL, num_replicas) < 0) {
+		fprintf(stderr, "avl_replicated_create() failed\n");
+		exit(EXIT_FAILURE);
+	}
+
+	int64_t *values = malloc(sizeof(*values) * num_values);
+	if (values == NULL) {
+		perror("malloc(sizeof(*values) * num_values)");
+		exit(EXIT_FAILURE);
+	}
+	for (int64_t i = 0; i < num_values; ++i) {
+		values[i] = 2 * i;
+	}
+	uint64_t state = 0x9E3779B97F4A7C15ULL;
+	bench_shuffle(values, num_values, &state);
+	for (int64_t i = 0; i < num_values; ++i) {
+		avl_replicated_add(replicated, (void *)values[i], (void *)(values[i] + 1));
+	}
+	free(values);
+
+	return replicated;
+}
+
+int main(int argc, char **argv) {
+	int64_t num_values = argc > 1 ? atoll(argv[1]) : 1 << 20;
+	int64_t max_threads = argc > 2 ? atoll(argv[2]) : sysconf(_SC_NPROCESSORS_ONLN);
+	int64_t write_percent = argc > 3 ? atoll(argv[3]) : 5;
+	int64_t num_replicas = argc > 4 ? atoll(argv[4]) : 0;
+
+	struct avl_tree *tree = bench_create_tree(0, num_values);
+	struct avl_replicated_tree *replicated = _create_replicated(num_values, num_replicas);
+	// A count given on the command line may exceed the real nodes, so spread threads over replicas
+	bool simulated = num_replicas > 0;
+
+	printf(
+	    "values: %ld, writes: %ld%%, replicas: %zu\n", num_values, write_percent, replicated->count);
+	printf("%8s %16s %16s %10s\n", "threads", "tree ops/s", "replicated ops/s", "ratio");
+
+	// Double the thread count each step, always finishing on max_threads itself
+	for (int64_t threads = 1;; threads *= 2) {
+		if (max_threads < threads) {
+			threads = max_threads;
+		}
+
+		double single = _run(tree, NULL, num_values, threads, write_percent, simulated);
+		double copies = _run(NULL, replicated, num_values, threads, write_percent, simulated);
+		printf("%8ld %16.0f %16.0f %10.2f\n", threads, single, copies, copies / single);
+
+		if (threads == max_threads) {
+			break;
+		}
+	}
+
+	bench_free_tree(tree);
+	avl_replicated_free(&replicated, NULL, NULL);
+	return EXIT_SUCCESS;
+}
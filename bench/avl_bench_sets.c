@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "avl_bench_utils.h"
+#include "avl_workers.h"
+
+/*
+ * Wall time of union, intersection and difference of two trees, against adding or removing the
+ * second tree's entries one by one, with and without workers.
+ *
+ * usage: bench_sets [num_values] [other_values] [threads]
+ *
+ * The first tree holds num_values even keys, the second other_values keys spread evenly over the
+ * same range, half of them even. threads defaults to one per processor.
+ */
+
+enum set_kind { UNION, INTERSECTION, DIFFERENCE };
+
+char const *kind_names[] = {"union", "intersection", "difference"};
+
+int64_t num_values;
+int64_t other_values;
+
+struct avl_tree *build(int64_t count, int64_t stride) {
+	void const **values = malloc(sizeof(*values) * count);
+	if (values == NULL) {
+		perror("malloc(sizeof(*values) * count)");
+		exit(EXIT_FAILURE);
+	}
+	for (int64_t i = 0; i < count; ++i) {
+		values[i] = (void *)(i * stride);
+	}
+
+	struct avl_tree *tree = NULL;
+	avl_tree_create(&tree, int64_t_cmp);
+	avl_tree_build_sorted(tree, values, values, count);
+
+	free(values);
+	return tree;
+}
+
+int add_to(struct avl_node const *node, void *tree) {
+	avl_tree_add(tree, avl_node_value(node), avl_node_data(node));
+	return 0;
+}
+
+int remove_from(struct avl_node const *node, void *tree) {
+	void const *value;
+	void const *data;
+	avl_tree_remove(tree, avl_node_value(node), &value, &data);
+	return 0;
+}
+
+double run(enum set_kind kind, struct avl_workers *workers, int one_by_one) {
+	struct avl_tree *tree = build(num_values, 2);
+	struct avl_tree *other = build(other_values, 2 * num_values / other_values + 1);
+
+	uint64_t begin = bench_now_ns();
+	if (one_by_one) {
+		avl_tree_traverse(other, NULL, NULL, kind == UNION ? add_to : remove_from, tree, NULL, NULL);
+	} else if (kind == UNION) {
+		avl_tree_union(tree, other, workers, NULL, NULL);
+	} else if (kind == INTERSECTION) {
+		avl_tree_intersect(tree, other, workers, NULL, NULL);
+	} else {
+		avl_tree_difference(tree, other, workers, NULL, NULL);
+	}
+	uint64_t end = bench_now_ns();
+
+	bench_free_tree(tree);
+	bench_free_tree(other);
+
+	return (double)(end - begin) / 1e6;
+}
+
+int main(int argc, char **argv) {
+	num_values = argc > 1 ? atoll(argv[1]) : 1 << 22;
+	other_values = argc > 2 ? atoll(argv[2]) : num_values;
+	int threads = argc > 3 ? atoi(argv[3]) : -1;
+
+	struct avl_workers *workers = NULL;
+	if (avl_workers_create(&workers, threads) < 0) {
+		fprintf(stderr, "avl_workers_create() failed\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("values: %ld, other values: %ld, workers: %d\n", num_values, other_values, workers->count);
+	printf("%-14s %12s %12s %12s\n", "", "one by one", "join-based", "workers");
+
+	for (enum set_kind kind = UNION; kind <= DIFFERENCE; ++kind) {
+		printf("%-14s", kind_names[kind]);
+		if (kind == INTERSECTION) {
+			// There is no single loop over the second tree that computes it
+			printf(" %12s", "-");
+		} else {
+			printf(" %9.1f ms", run(kind, NULL, 1));
+		}
+		printf(" %9.1f ms %9.1f ms\n", run(kind, NULL, 0), run(kind, workers, 0));
+	}
+
+	avl_workers_free(&workers);
+
+	return EXIT_SUCCESS;
+}
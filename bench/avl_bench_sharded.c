@@ -0,0 +1,168 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "avl_bench_utils.h"
+#include "avl_sharded.h"
+
+/*
+ * Compares mixed get/remove/add throughput of one avl_tree against an avl_sharded_tree holding the
+ * same values, as the number of threads grows.
+ *
+ * usage: bench_sharded [num_values] [max_threads] [write_percent] [num_shards]
+ */
+
+struct worker {
+	pthread_t thread;
+	struct avl_tree *tree;
+	struct avl_sharded_tree *sharded;
+	int64_t num_values;
+	int64_t write_percent;
+	uint64_t seed;
+	pthread_barrier_t *start;
+	atomic_bool *stop;
+	uint64_t ops;
+};
+
+void *_worker_run(void *arg) {
+	struct worker *worker = arg;
+	uint64_t state = worker->seed;
+	uint64_t ops = 0;
+
+	pthread_barrier_wait(worker->start);
+
+	while (!atomic_load_explicit(worker->stop, memory_order_relaxed)) {
+		uint64_t r = bench_rand(&state);
+		int64_t key = 2 * (int64_t)(r % (uint64_t)worker->num_values);
+		bool write = (int64_t)((r >> 32) % 100) < worker->write_percent;
+
+		void const *value;
+		void const *data;
+		if (worker->sharded != NULL) {
+			if (!write) {
+				avl_sharded_get(worker->sharded, (void *)key, &data);
+			} else if (avl_sharded_remove(worker->sharded, (void *)key, &value, &data) == true) {
+				avl_sharded_add(worker->sharded, value, data);
+			}
+		} else {
+			if (!write) {
+				avl_tree_get(worker->tree, (void *)key, &data);
+			} else if (avl_tree_remove(worker->tree, (void *)key, &value, &data) == true) {
+				avl_tree_add(worker->tree, value, data);
+			}
+		}
+		++ops;
+	}
+
+	worker->ops = ops;
+	return NULL;
+}
+
+double _run(
+    struct avl_tree *tree, struct avl_sharded_tree *sharded, int64_t num_values,
+    int64_t num_threads, int64_t write_percent) {
+	struct worker *workers = calloc(num_threads, sizeof(*workers));
+	pthread_barrier_t start;
+	atomic_bool stop = false;
+
+	pthread_barrier_init(&start, NULL, num_threads + 1);
+
+	for (int64_t t = 0; t < num_threads; ++t) {
+		workers[t].tree = tree;
+		workers[t].sharded = sharded;
+		workers[t].num_values = num_values;
+		workers[t].write_percent = write_percent;
+		workers[t].seed = 0x9E3779B97F4A7C15ULL * (t + 1);
+		workers[t].start = &start;
+		workers[t].stop = &stop;
+		pthread_create(&workers[t].thread, NULL, _worker_run, &workers[t]);
+	}
+
+	pthread_barrier_wait(&start);
+	uint64_t begin = bench_now_ns();
+	usleep(1000000);
+	atomic_store(&stop, true);
+
+	uint64_t total = 0;
+	for (int64_t t = 0; t < num_threads; ++t) {
+		pthread_join(workers[t].thread, NULL);
+		total += workers[t].ops;
+	}
+	uint64_t end = bench_now_ns();
+
+	pthread_barrier_destroy(&start);
+	free(workers);
+
+	return (double)total / ((double)(end - begin) / 1e9);
+}
+
+struct avl_sharded_tree *_create_sharded(int64_t num_values, int64_t num_shards) {
+	// Everything starts in the first shard, so the rebalance below does the partitioning
+	void const **bounds = malloc(sizeof(*bounds) * num_shards);
+	for (int64_t i = 0; i + 1 < num_shards; ++i) {
+		bounds[i] = (void *)(2 * num_values);
+	}
+
+	struct avl_sharded_tree *sharded = NULL;
+	if (avl_sharded_create(&sharded, int64_t_cmp, 0, bounds, num_shards, NULL, NULL, NULL) < 0) {
+		fprintf(stderr, "avl_sharded_create() failed\n");
+		exit(EXIT_FAILURE);
+	}
+	free(bounds);
+
+	int64_t *values = malloc(sizeof(*values) * num_values);
+	if (values == NULL) {
+		perror("malloc(sizeof(*values) * num_values)");
+		exit(EXIT_FAILURE);
+	}
+	for (int64_t i = 0; i < num_values; ++i) {
+		values[i] = 2 * i;
+	}
+	uint64_t state = 0x9E3779B97F4A7C15ULL;
+	bench_shuffle(values, num_values, &state);
+	for (int64_t i = 0; i < num_values; ++i) {
+		avl_sharded_add(sharded, (void *)values[i], (void *)(values[i] + 1));
+	}
+	free(values);
+
+	uint64_t begin = bench_now_ns();
+	avl_sharded_rebalance(sharded);
+	printf("rebalance: %.3f ms\n", (double)(bench_now_ns() - begin) / 1e6);
+
+	return sharded;
+}
+
+int main(int argc, char **argv) {
+	int64_t num_values = argc > 1 ? atoll(argv[1]) : 1 << 20;
+	int64_t max_threads = argc > 2 ? atoll(argv[2]) : sysconf(_SC_NPROCESSORS_ONLN);
+	int64_t write_percent = argc > 3 ? atoll(argv[3]) : 50;
+	int64_t num_shards = argc > 4 ? atoll(argv[4]) : 64;
+
+	struct avl_tree *tree = bench_create_tree(0, num_values);
+	struct avl_sharded_tree *sharded = _create_sharded(num_values, num_shards);
+
+	printf("values: %ld, writes: %ld%%, shards: %ld\n", num_values, write_percent, num_shards);
+	printf("%8s %16s %16s %10s\n", "threads", "tree ops/s", "sharded ops/s", "ratio");
+
+	// Double the thread count each step, always finishing on max_threads itself
+	for (int64_t threads = 1;; threads *= 2) {
+		if (max_threads < threads) {
+			threads = max_threads;
+		}
+
+		double single = _run(tree, NULL, num_values, threads, write_percent);
+		double split = _run(NULL, sharded, num_values, threads, write_percent);
+		printf("%8ld %16.0f %16.0f %10.2f\n", threads, single, split, split / single);
+
+		if (threads == max_threads) {
+			break;
+		}
+	}
+
+	bench_free_tree(tree);
+	avl_sharded_free(&sharded, bench_free_node, NULL);
+	return EXIT_SUCCESS;
+}
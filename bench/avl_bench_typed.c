@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "avl_bench_utils.h"
+
+/*
+ * The generic tree against trees generated by avl_typed.h, for int64 keys and for 32-byte struct
+ * keys, in nanoseconds per call.
+ *
+ * usage: bench_typed [num_values]
+ */
+
+#define AVL_TYPED_NAME int64_tree
+#define AVL_TYPED_KEY int64_t
+#include "avl_typed.h"
+
+struct key {
+	uint64_t parts[4];
+};
+
+static inline int key_cmp(struct key const *a, struct key const *b) {
+	for (int i = 0; i < 4; ++i) {
+		if (a->parts[i] != b->parts[i]) {
+			return a->parts[i] < b->parts[i] ? -1 : 1;
+		}
+	}
+	return 0;
+}
+
+#define AVL_TYPED_NAME key_tree
+#define AVL_TYPED_KEY struct key
+#define AVL_TYPED_CMP key_cmp
+#include "avl_typed.h"
+
+int key_void_cmp(void const *new_value, void const *node_value) {
+	return key_cmp(new_value, node_value);
+}
+
+struct key make_key(int64_t value) {
+	// Keys share a long prefix, as composite keys often do
+	struct key key = {{1, 2, (uint64_t)value >> 8, (uint64_t)value & 0xFF}};
+	return key;
+}
+
+void report(char const *name, uint64_t generic_ns, uint64_t typed_ns, int64_t count) {
+	printf(
+	    "%-14s generic %8.1f ns/op   typed %8.1f ns/op   %5.2fx\n", name, (double)generic_ns / count,
+	    (double)typed_ns / count, (double)generic_ns / typed_ns);
+}
+
+int main(int argc, char **argv) {
+	int64_t num_values = argc > 1 ? atoll(argv[1]) : 1 << 20;
+
+	int64_t *values = malloc(sizeof(*values) * num_values);
+	struct key *keys = malloc(sizeof(*keys) * num_values);
+	if (values == NULL || keys == NULL) {
+		perror("malloc()");
+		return EXIT_FAILURE;
+	}
+	for (int64_t i = 0; i < num_values; ++i) {
+		values[i] = i;
+	}
+	uint64_t state = 0x9E3779B97F4A7C15ULL;
+	bench_shuffle(values, num_values, &state);
+	// The generic tree only stores pointers, so struct keys have to live somewhere else
+	for (int64_t i = 0; i < num_values; ++i) {
+		keys[i] = make_key(values[i]);
+	}
+
+	printf("values: %ld\n", num_values);
+
+	// int64 keys
+	struct avl_tree *tree = NULL;
+	struct int64_tree *int64_tree = NULL;
+	avl_tree_create(&tree, int64_t_cmp);
+	int64_tree_create(&int64_tree);
+
+	uint64_t begin = bench_now_ns();
+	for (int64_t i = 0; i < num_values; ++i) {
+		avl_tree_add(tree, (void *)values[i], NULL);
+	}
+	uint64_t generic_ns = bench_now_ns() - begin;
+	begin = bench_now_ns();
+	for (int64_t i = 0; i < num_values; ++i) {
+		int64_tree_add(int64_tree, values[i], NULL);
+	}
+	report("int64 add", generic_ns, bench_now_ns() - begin, num_values);
+
+	bench_shuffle(values, num_values, &state);
+	void const *data;
+	begin = bench_now_ns();
+	for (int64_t i = 0; i < num_values; ++i) {
+		avl_tree_get(tree, (void *)values[i], &data);
+	}
+	generic_ns = bench_now_ns() - begin;
+	begin = bench_now_ns();
+	for (int64_t i = 0; i < num_values; ++i) {
+		int64_tree_get(int64_tree, values[i], &data);
+	}
+	report("int64 get", generic_ns, bench_now_ns() - begin, num_values);
+
+	void const *value;
+	int64_t node_key;
+	begin = bench_now_ns();
+	for (int64_t i = 0; i < num_values; ++i) {
+		avl_tree_remove(tree, (void *)values[i], &value, &data);
+	}
+	generic_ns = bench_now_ns() - begin;
+	begin = bench_now_ns();
+	for (int64_t i = 0; i < num_values; ++i) {
+		int64_tree_remove(int64_tree, values[i], &node_key, &data);
+	}
+	report("int64 remove", generic_ns, bench_now_ns() - begin, num_values);
+
+	avl_tree_free(&tree, NULL, NULL);
+	int64_tree_free(&int64_tree, NULL, NULL);
+
+	// Struct keys
+	struct key_tree *key_tree = NULL;
+	avl_tree_create(&tree, key_void_cmp);
+	key_tree_create(&key_tree);
+
+	begin = bench_now_ns();
+	for (int64_t i = 0; i < num_values; ++i) {
+		avl_tree_add(tree, &keys[i], NULL);
+	}
+	generic_ns = bench_now_ns() - begin;
+	begin = bench_now_ns();
+	for (int64_t i = 0; i < num_values; ++i) {
+		key_tree_add(key_tree, keys[i], NULL);
+	}
+	report("struct add", generic_ns, bench_now_ns() - begin, num_values);
+
+	bench_shuffle(values, num_values, &state);
+	begin = bench_now_ns();
+	for (int64_t i = 0; i < num_values; ++i) {
+		struct key key = make_key(values[i]);
+		avl_tree_get(tree, &key, &data);
+	}
+	generic_ns = bench_now_ns() - begin;
+	begin = bench_now_ns();
+	for (int64_t i = 0; i < num_values; ++i) {
+		key_tree_get(key_tree, make_key(values[i]), &data);
+	}
+	report("struct get", generic_ns, bench_now_ns() - begin, num_values);
+
+	struct key removed_key;
+	begin = bench_now_ns();
+	for (int64_t i = 0; i < num_values; ++i) {
+		struct key key = make_key(values[i]);
+		avl_tree_remove(tree, &key, &value, &data);
+	}
+	generic_ns = bench_now_ns() - begin;
+	begin = bench_now_ns();
+	for (int64_t i = 0; i < num_values; ++i) {
+		key_tree_remove(key_tree, make_key(values[i]), &removed_key, &data);
+	}
+	report("struct remove", generic_ns, bench_now_ns() - begin, num_values);
+
+	avl_tree_free(&tree, NULL, NULL);
+	key_tree_free(&key_tree, NULL, NULL);
+
+	free(keys);
+	free(values);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,96 @@
+#include "avl_bench_utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+int int64_t_cmp(void const *new_value, void const *node_value) {
+	// Keys are small integers stored directly in the pointer, as in the tests
+	return (int64_t)new_value - (int64_t)node_value;
+}
+
+uint64_t bench_now_ns() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+uint64_t bench_rand(uint64_t *state) {
+	// xorshift64*: cheap enough that it does not show up next to a tree lookup
+	uint64_t x = *state;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return x * 0x2545F4914F6CDD1DULL;
+}
+
+void bench_shuffle(int64_t *values, int64_t count, uint64_t *state) {
+	for (int64_t i = count - 1; i > 0; --i) {
+		int64_t j = (int64_t)(bench_rand(state) % (uint64_t)(i + 1));
+		int64_t tmp = values[i];
+		values[i] = values[j];
+		values[j] = tmp;
+	}
+}
+
+uint32_t bench_parse_flags(char const *names) {
+	// Comma separated list, e.g. "writer,optimistic" or "persistent"
+	uint32_t flags = 0;
+
+	if (strstr(names, "writer") != NULL) {
+		flags |= AVL_TREE_WRITER_PREFERENCE;
+	}
+	if (strstr(names, "optimistic") != NULL) {
+		flags |= AVL_TREE_OPTIMISTIC_READS;
+	}
+	if (strstr(names, "persistent") != NULL) {
+		flags |= AVL_TREE_PERSISTENT;
+	}
+	if (strstr(names, "pool") != NULL) {
+		flags |= AVL_TREE_NODE_POOL;
+	}
+	if (strstr(names, "combining") != NULL) {
+		flags |= AVL_TREE_FLAT_COMBINING;
+	}
+
+	return flags;
+}
+
+struct avl_tree *bench_create_tree(uint32_t flags, int64_t num_values) {
+	struct avl_tree *tree = NULL;
+	if (avl_tree_create_flags(&tree, int64_t_cmp, flags) < 0) {
+		fprintf(stderr, "avl_tree_create_flags() failed\n");
+		exit(EXIT_FAILURE);
+	}
+
+	// Insert the even keys 0, 2, ... in random order so odd keys can be used for misses
+	int64_t *values = malloc(sizeof(*values) * num_values);
+	if (values == NULL) {
+		perror("malloc(sizeof(*values) * num_values)");
+		exit(EXIT_FAILURE);
+	}
+	for (int64_t i = 0; i < num_values; ++i) {
+		values[i] = 2 * i;
+	}
+	uint64_t state = 0x9E3779B97F4A7C15ULL;
+	bench_shuffle(values, num_values, &state);
+
+	for (int64_t i = 0; i < num_values; ++i) {
+		avl_tree_add(tree, (void *)values[i], (void *)(values[i] + 1));
+	}
+
+	free(values);
+	return tree;
+}
+
+int bench_free_node(struct avl_node const *node, void *arg __attribute__((unused))) {
+	free((struct avl_node *)node);
+	return 0;
+}
+
+void bench_free_tree(struct avl_tree *tree) {
+	// Pooled nodes go with the pool and must not be freed one by one
+	avl_tree_free(&tree, tree->flags & AVL_TREE_NODE_POOL ? NULL : bench_free_node, NULL);
+}
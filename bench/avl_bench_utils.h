@@ -0,0 +1,24 @@
+#ifndef AVL_C_BENCH_AVL_BENCH_UTILS_H
+#define AVL_C_BENCH_AVL_BENCH_UTILS_H
+
+#include <stdint.h>
+
+#include "avl.h"
+
+int int64_t_cmp(void const *new_value, void const *node_value);
+
+uint64_t bench_now_ns();
+
+uint64_t bench_rand(uint64_t *state);
+
+void bench_shuffle(int64_t *values, int64_t count, uint64_t *state);
+
+uint32_t bench_parse_flags(char const *names);
+
+struct avl_tree *bench_create_tree(uint32_t flags, int64_t num_values);
+
+int bench_free_node(struct avl_node const *node, void *arg);
+
+void bench_free_tree(struct avl_tree *tree);
+
+#endif  // AVL_C_BENCH_AVL_BENCH_UTILS_H
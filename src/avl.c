@@ -1,30 +1,126 @@
+// Needed for pthread_rwlockattr_setkind_np()
+#define _GNU_SOURCE
+
 #include "avl.h"
 
 #include <assert.h>
 #include <errno.h>
-#include <semaphore.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "avl_combiner.h"
+#include "avl_epoch.h"
+#include "avl_slab.h"
+#include "avl_workers.h"
+
 enum weight { LEFT = -1, BALANCED = 0, RIGHT = 1 };
 
-struct avl_node {
+// Number of unlocked descents avl_tree_get attempts before it waits for the lock instead
+#define OPTIMISTIC_ATTEMPTS 8
+// Pauses avl_tree_get spends in all waiting for writers to finish before it takes the lock instead
+#define OPTIMISTIC_SPINS 256
+
+// Lookups avl_tree_get_many keeps in flight; enough to cover a cache miss with useful work
+#define GET_MANY_LANES 8
+
+// Enough room for a root-to-leaf path plus the two siblings each level may rotate during a removal
+#define VERSION_CAPACITY (3 * AVL_MAX_HEIGHT + 1)
+
+struct avl_version {
+	// Published nodes that have been replaced by private copies
+	struct avl_node *replaced[VERSION_CAPACITY];
+	int replaced_count;
+	// Every node allocated for this version, released again if it cannot be completed
+	struct avl_node *created[VERSION_CAPACITY];
+	int created_count;
+};
+
+// An avl_tree_add, avl_tree_remove or avl_tree_get waiting for a combiner (AVL_TREE_FLAT_COMBINING)
+struct combined_op {
+	enum { COMBINED_ADD, COMBINED_REMOVE, COMBINED_GET } kind;
 	void const *value;
 	void const *data;
-	struct avl_node *left;
-	struct avl_node *right;
-	int32_t balance;
+	int result;
+	void const *node_value;
+	void const *node_data;
+};
+
+void _combine(void **ops, size_t count, void *tree);
+
+// A root-to-leaf path, kept from one operation of a batch (avl_tree_apply_batch) to the next
+struct avl_path {
+	// links[i] is where the node at depth i hangs, directions[i] the way we left it
+	struct avl_node **links[AVL_MAX_HEIGHT + 1];
+	int8_t directions[AVL_MAX_HEIGHT];
+	// Deepest slot still in place; the nodes above it are the ones the path went through
+	int depth;
 };
 
 int avl_tree_create(
     struct avl_tree **tree, int (*cmp_func)(void const *new_value, void const *node_value)) {
+	return avl_tree_create_flags(tree, cmp_func, 0);
+}
+
+int _lock_init(pthread_rwlock_t *lock, uint32_t flags) {
+	assert(lock != NULL);
+
+	pthread_rwlockattr_t attr;
+	int rc = pthread_rwlockattr_init(&attr);
+	if (rc != 0) {
+		return -rc;
+	}
+
+	if (flags & AVL_TREE_WRITER_PREFERENCE) {
+#ifdef __GLIBC__
+		// Without this, glibc lets new readers overtake a waiting writer indefinitely
+		rc = pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#else
+		rc = ENOTSUP;
+#endif
+		if (rc != 0) {
+			pthread_rwlockattr_destroy(&attr);
+			return -rc;
+		}
+	}
+
+	rc = pthread_rwlock_init(lock, &attr);
+	pthread_rwlockattr_destroy(&attr);
+
+	return -rc;
+}
+
+void _node_dealloc(struct avl_tree *tree, struct avl_node *node) {
+	if (tree->slab != NULL) {
+		avl_slab_release(tree->slab, node);
+	} else {
+		free(node);
+	}
+}
+
+void _node_free(void *node, void *tree) {
+	// Called by the epoch once a retired node can no longer be reached
+	_node_dealloc(tree, node);
+}
+
+int avl_tree_create_flags(
+    struct avl_tree **tree, int (*cmp_func)(void const *new_value, void const *node_value),
+    uint32_t flags) {
 	assert(tree != NULL);
 	assert(*tree == NULL);
 
 	int rc;
 
+	if (flags & AVL_TREE_INTRUSIVE &&
+	    flags & (AVL_TREE_OPTIMISTIC_READS | AVL_TREE_PERSISTENT | AVL_TREE_NODE_POOL)) {
+		// Each of these frees removed nodes (or copies of them) on its own
+		return -EINVAL;
+	}
+
 	*tree = malloc(sizeof(**tree));
 	if (*tree == NULL) {
 		perror("malloc(sizeof(**tree))");
@@ -34,17 +130,50 @@ int avl_tree_create(
 
 	(*tree)->root = NULL;
 	(*tree)->cmp_func = cmp_func;
+	(*tree)->flags = flags;
+	atomic_init(&(*tree)->sequence, 0);
+	(*tree)->epoch = NULL;
+	(*tree)->version = NULL;
+	(*tree)->slab = NULL;
+	(*tree)->combiner = NULL;
+	(*tree)->min.value = NULL;
+	(*tree)->min.data = NULL;
+	(*tree)->max.value = NULL;
+	(*tree)->max.data = NULL;
 	(*tree)->lock = malloc(sizeof(*(*tree)->lock));
 	if ((*tree)->lock == NULL) {
 		rc = -errno;
 		goto finish;
 	}
-	rc = sem_init((*tree)->lock, false, 1);
+	rc = _lock_init((*tree)->lock, flags);
 	if (rc < 0) {
-		rc = -errno;
+		// Keep avl_tree_free() from destroying a lock that was never initialized
+		free((*tree)->lock);
+		(*tree)->lock = NULL;
 		goto finish;
 	}
 
+	if (flags & AVL_TREE_NODE_POOL) {
+		rc = avl_slab_create(&(*tree)->slab, sizeof(struct avl_node));
+		if (rc < 0) {
+			goto finish;
+		}
+	}
+
+	if (flags & (AVL_TREE_OPTIMISTIC_READS | AVL_TREE_PERSISTENT)) {
+		rc = avl_epoch_create(&(*tree)->epoch, _node_free, *tree);
+		if (rc < 0) {
+			goto finish;
+		}
+	}
+
+	if (flags & AVL_TREE_FLAT_COMBINING) {
+		rc = avl_combiner_create(&(*tree)->combiner, _combine, *tree);
+		if (rc < 0) {
+			goto finish;
+		}
+	}
+
 finish:
 	if (rc < 0 && *tree != NULL) {
 		avl_tree_free(tree, NULL, NULL);
@@ -60,12 +189,29 @@ void avl_tree_free(
 	assert(*tree != NULL);
 
 	// Free each node of the tree
-	int rc = avl_tree_traverse(*tree, NULL, NULL, NULL, NULL, free_node_func, free_arg);
-	assert(rc == 0);
+	if ((*tree)->root != NULL && free_node_func != NULL) {
+		int rc = avl_tree_traverse(*tree, NULL, NULL, NULL, NULL, free_node_func, free_arg);
+		assert(rc == 0);
+		(void)rc;
+	}
+
+	// Release nodes whose reclamation was still deferred
+	if ((*tree)->epoch != NULL) {
+		avl_epoch_free(&(*tree)->epoch);
+	}
+
+	// Every pooled node goes back with its chunk
+	if ((*tree)->slab != NULL) {
+		avl_slab_free(&(*tree)->slab);
+	}
+
+	if ((*tree)->combiner != NULL) {
+		avl_combiner_free(&(*tree)->combiner);
+	}
 
-	// Destroy the semaphore lock and free the associated memory
+	// Destroy the reader-writer lock and free the associated memory
 	if ((*tree)->lock != NULL) {
-		sem_destroy((*tree)->lock);
+		pthread_rwlock_destroy((*tree)->lock);
 		free((*tree)->lock);
 	}
 
@@ -83,7 +229,177 @@ void const *avl_node_data(struct avl_node const *node) {
 	return node->data;
 }
 
-void _rotate_left(struct avl_node **root) {
+void _read_lock(struct avl_tree const *tree) {
+	int rc = pthread_rwlock_rdlock(tree->lock);
+	assert(rc == 0);
+	(void)rc;
+}
+
+void _read_unlock(struct avl_tree const *tree) {
+	pthread_rwlock_unlock(tree->lock);
+}
+
+void _write_lock(struct avl_tree *tree) {
+	int rc = pthread_rwlock_wrlock(tree->lock);
+	assert(rc == 0);
+	(void)rc;
+
+	if (tree->flags & AVL_TREE_OPTIMISTIC_READS) {
+		// An odd sequence tells optimistic readers that the tree is changing under them
+		uint64_t sequence = atomic_load_explicit(&tree->sequence, memory_order_relaxed);
+		atomic_store_explicit(&tree->sequence, sequence + 1, memory_order_relaxed);
+		atomic_thread_fence(memory_order_release);
+	}
+}
+
+void _write_unlock(struct avl_tree *tree) {
+	if (tree->flags & AVL_TREE_OPTIMISTIC_READS) {
+		uint64_t sequence = atomic_load_explicit(&tree->sequence, memory_order_relaxed);
+		atomic_store_explicit(&tree->sequence, sequence + 1, memory_order_release);
+	}
+
+	if (tree->epoch != NULL) {
+		avl_epoch_reclaim(tree->epoch);
+	}
+
+	pthread_rwlock_unlock(tree->lock);
+}
+
+struct avl_node *_node_alloc(struct avl_tree *tree) {
+	struct avl_node *node;
+	if (tree->slab != NULL) {
+		node = avl_slab_alloc(tree->slab);
+		if (node == NULL) {
+			return NULL;
+		}
+	} else {
+		node = malloc(sizeof(*node));
+		if (node == NULL) {
+			perror("malloc(sizeof(*node))");
+			return NULL;
+		}
+	}
+
+	if (tree->version != NULL) {
+		assert(tree->version->created_count < VERSION_CAPACITY);
+		tree->version->created[tree->version->created_count++] = node;
+	}
+
+	return node;
+}
+
+void _node_release(struct avl_tree *tree, struct avl_node *node) {
+	if (tree->version != NULL) {
+		// Unlinked from the new version, but older ones still reach it
+		assert(tree->version->replaced_count < VERSION_CAPACITY);
+		tree->version->replaced[tree->version->replaced_count++] = node;
+	} else if (tree->epoch != NULL) {
+		// An optimistic reader may still be standing on this node
+		avl_epoch_retire(tree->epoch, node);
+	} else {
+		_node_dealloc(tree, node);
+	}
+}
+
+int _node_copy(struct avl_tree *tree, struct avl_node **node) {
+	assert(node != NULL);
+	assert(*node != NULL);
+
+	if (tree->version == NULL) {
+		// Nodes are modified in place
+		return 0;
+	}
+
+	struct avl_node *copy = _node_alloc(tree);
+	if (copy == NULL) {
+		return -errno;
+	}
+	*copy = **node;
+
+	assert(tree->version->replaced_count < VERSION_CAPACITY);
+	tree->version->replaced[tree->version->replaced_count++] = *node;
+	*node = copy;
+
+	return 0;
+}
+
+int _retire_reserve(struct avl_tree *tree) {
+	if (tree->epoch == NULL) {
+		return 0;
+	}
+
+	// Whatever one change unlinks has room in limbo up front, so running out of memory turns the
+	// change down (with -ENOMEM) rather than having it wait out every reader with the lock held
+	return avl_epoch_reserve(tree->epoch, tree->version != NULL ? VERSION_CAPACITY : 1);
+}
+
+int _sibling_copy(struct avl_tree *tree, struct avl_node **node, enum weight side) {
+	// A removal rebalances using the sibling of the path it came up, which is still shared
+	struct avl_node **sibling = side == LEFT ? &(*node)->left : &(*node)->right;
+
+	int rc = _node_copy(tree, sibling);
+	if (rc < 0) {
+		return rc;
+	}
+
+	// A double rotation also rewires the sibling's inner child
+	if ((*sibling)->balance == -side) {
+		rc = _node_copy(tree, side == LEFT ? &(*sibling)->right : &(*sibling)->left);
+	}
+
+	return rc;
+}
+
+void _version_begin(struct avl_tree *tree, struct avl_version *version) {
+	version->replaced_count = 0;
+	version->created_count = 0;
+	tree->version = version;
+}
+
+void _version_publish(struct avl_tree *tree, struct avl_node *root) {
+	struct avl_version *version = tree->version;
+	tree->version = NULL;
+
+	// Readers that load the new root see fully built nodes
+	__atomic_store_n(&tree->root, root, __ATOMIC_RELEASE);
+
+	// Readers of older versions may still be using the nodes that were replaced
+	for (int i = 0; i < version->replaced_count; ++i) {
+		avl_epoch_retire(tree->epoch, version->replaced[i]);
+	}
+}
+
+void _version_abort(struct avl_tree *tree) {
+	struct avl_version *version = tree->version;
+	tree->version = NULL;
+
+	// The published tree was never touched, so only the private copies have to go
+	for (int i = 0; i < version->created_count; ++i) {
+		_node_dealloc(tree, version->created[i]);
+	}
+}
+
+void _free_subtree(struct avl_tree *tree, struct avl_node *root) {
+	// Only used on nodes that were never published
+	if (root == NULL) {
+		return;
+	}
+
+	_free_subtree(tree, root->left);
+	_free_subtree(tree, root->right);
+	_node_dealloc(tree, root);
+}
+
+size_t _size(struct avl_node const *node) {
+	return node == NULL ? 0 : node->size;
+}
+
+void _size_update(struct avl_node *node) {
+	// Children are always settled first, so this is all a rotation has to do
+	node->size = 1 + _size(node->left) + _size(node->right);
+}
+
+void _rotate_left(struct avl_tree const *tree, struct avl_node **root) {
 	assert(root != NULL);
 	assert(*root != NULL);
 	assert((*root)->right != NULL);
@@ -99,9 +415,14 @@ void _rotate_left(struct avl_node **root) {
 
 	// prior_right is the new root
 	*root = prior_right;
+
+	if (tree->flags & AVL_TREE_ORDER_STATISTICS) {
+		_size_update(prior_right->left);
+		_size_update(prior_right);
+	}
 }
 
-void _rotate_right(struct avl_node **root) {
+void _rotate_right(struct avl_tree const *tree, struct avl_node **root) {
 	assert(root != NULL);
 	assert(*root != NULL);
 	assert((*root)->left != NULL);
@@ -117,9 +438,14 @@ void _rotate_right(struct avl_node **root) {
 
 	// prior_left is the new root
 	*root = prior_left;
+
+	if (tree->flags & AVL_TREE_ORDER_STATISTICS) {
+		_size_update(prior_left->right);
+		_size_update(prior_left);
+	}
 }
 
-void _balance_left(struct avl_node **node, bool *decrease) {
+void _balance_left(struct avl_tree const *tree, struct avl_node **node, bool *decrease) {
 	assert(node != NULL);
 	assert(*node != NULL);
 	// avl_node_print(*node);
@@ -157,7 +483,7 @@ void _balance_left(struct avl_node **node, bool *decrease) {
 
 			(*node)->left->right->balance = BALANCED;
 
-			_rotate_left(&(*node)->left);
+			_rotate_left(tree, &(*node)->left);
 			break;
 
 		case BALANCED:
@@ -169,10 +495,10 @@ void _balance_left(struct avl_node **node, bool *decrease) {
 			break;
 	}
 
-	_rotate_right(node);
+	_rotate_right(tree, node);
 }
 
-void _balance_right(struct avl_node **node, bool *decrease) {
+void _balance_right(struct avl_tree const *tree, struct avl_node **node, bool *decrease) {
 	assert(node != NULL);
 	assert(*node != NULL);
 	assert((*node)->right != NULL);
@@ -209,7 +535,7 @@ void _balance_right(struct avl_node **node, bool *decrease) {
 
 			(*node)->right->left->balance = BALANCED;
 
-			_rotate_right(&(*node)->right);
+			_rotate_right(tree, &(*node)->right);
 			break;
 
 		case BALANCED:
@@ -221,106 +547,7 @@ void _balance_right(struct avl_node **node, bool *decrease) {
 			break;
 	}
 
-	_rotate_left(node);
-}
-
-int _add_helper(
-    struct avl_node **root, void const *value, void const *data,
-    int (*cmp_func)(void const *new_value, void const *node_value), bool *increase) {
-	assert(root != NULL);
-	assert(cmp_func != NULL);
-	assert(increase != NULL);
-
-	if (*root == NULL) {
-		*root = malloc(sizeof(**root));
-		if (*root == NULL) {
-			perror("malloc(sizeof(**root))");
-			return -errno;
-		}
-
-		(*root)->value = value;
-		(*root)->data = data;
-		(*root)->left = NULL;
-		(*root)->right = NULL;
-		(*root)->balance = BALANCED;
-
-		// The tree got longer here and may now be unbalanced
-		*increase = true;
-
-		return true;
-	} else {
-		int direction = cmp_func(value, (*root)->value);
-
-		// printf("\tdirection: %d\n", direction);
-
-		int did_add;
-		if (direction <= LEFT) {
-			// Add on left
-			did_add = _add_helper(&(*root)->left, value, data, cmp_func, increase);
-			if (did_add < 0) {
-				fprintf(stderr, "_add_helper() error: %d\n", did_add);
-				return did_add;
-			}
-
-			if (*increase) {
-				// The left side got longer for this node
-				(*root)->balance += LEFT;
-
-				// The overall height of the tree did not increase (the addition balanced this node)
-				if ((*root)->balance == BALANCED) {
-					*increase = false;
-				}
-				// The overall height of the tree increased out of bounds on the left side
-				else if ((*root)->balance < LEFT) {
-					_balance_left(root, NULL);
-					*increase = false;
-				}
-			}
-
-			return did_add;
-		} else if (RIGHT <= direction) {
-			// Add on right
-			did_add = _add_helper(&(*root)->right, value, data, cmp_func, increase);
-			if (did_add < 0) {
-				fprintf(stderr, "_add_helper() error: %d\n", did_add);
-				return did_add;
-			}
-
-			if (*increase) {
-				// The right side got longer for this node
-				(*root)->balance += RIGHT;
-
-				// The overall height of the tree did not increase (the addition balanced this node)
-				if ((*root)->balance == BALANCED) {
-					*increase = false;
-				}
-				// The overall height of the tree increased out of bounds on the right side
-				else if (RIGHT < (*root)->balance) {
-					_balance_right(root, NULL);
-					*increase = false;
-				}
-			}
-
-			return did_add;
-		} else {
-			// There already exists a node with this value
-			return false;
-		}
-	}
-}
-
-int avl_tree_add(struct avl_tree *tree, void const *new_value, void const *new_data) {
-	assert(tree != NULL);
-
-	// We assume that new_value already exists in the tree
-	bool increase = false;
-
-	// Obtain exclusive lock over the tree while adding data
-	sem_wait(tree->lock);
-	int rc = _add_helper(&(tree->root), new_value, new_data, tree->cmp_func, &increase);
-	sem_post(tree->lock);
-
-	return rc;
+	_rotate_left(tree, node);
 }
 
 int _get_helper(
@@ -329,257 +556,2256 @@ int _get_helper(
 	assert(data != NULL);
 	assert(cmp_func != NULL);
 
-	if (node == NULL) {
-		// We didn't find the node
-		return false;
-	} else {
+	while (node != NULL) {
 		int direction = cmp_func(value, node->value);
 
 		if (direction < 0) {
 			// Search left
-			return _get_helper(node->left, value, data, cmp_func);
+			node = node->left;
 		} else if (0 < direction) {
 			// Search right
-			return _get_helper(node->right, value, data, cmp_func);
+			node = node->right;
 		} else {
 			// We've found it
 			*data = node->data;
 			return true;
 		}
 	}
-}
-
-int avl_tree_get(struct avl_tree const *tree, void const *search_value, void const **node_data) {
-	assert(tree != NULL);
-	assert(node_data != NULL);
-
-	// Obtain exclusive lock over the tree while getting data
-	sem_wait(tree->lock);
-	int rc = _get_helper((tree)->root, search_value, node_data, tree->cmp_func);
-	sem_post(tree->lock);
 
-	return rc;
+	// We didn't find the node
+	return false;
 }
 
-int _remove_helper(
-    struct avl_node **root, void const *search_value, void const **node_value,
-    void const **node_data, int (*cmp_func)(void const *new_value, void const *node_value),
-    bool *decrease) {
-	assert(root != NULL);
-	assert(node_value != NULL);
-	assert(node_data != NULL);
-	assert(cmp_func != NULL);
-	assert(decrease != NULL);
-
-	if (*root == NULL) {
-		// We didn't find the node
-		return false;
-	} else {
-		int direction = cmp_func(search_value, (*root)->value);
-
-		int did_remove;
-
-		if (direction <= LEFT) {
-			// Remove from left side
-			did_remove =
-			    _remove_helper(&(*root)->left, search_value, node_value, node_data, cmp_func, decrease);
-
-			if (*decrease) {
-				// printf("RIGHT for node:\t");
-				// avl_node_print(*root);
-				// Since a node was removed on the left, the right side is now longer
-				(*root)->balance += RIGHT;
-				// printf("new balance: %d\n", (*root)->balance);
-
-				// If the overall height of this node did not decrease
-				if ((*root)->balance == RIGHT) {
-					*decrease = false;
-				}
-				// If the overall height of this node decreased out of bounds on the right side
-				else if (RIGHT < (*root)->balance) {
-					_balance_right(root, decrease);
-				}
-			}
-
-			return did_remove;
-		} else if (RIGHT <= direction) {
-			// Remove from right side
-			did_remove =
-			    _remove_helper(&(*root)->right, search_value, node_value, node_data, cmp_func, decrease);
-
-			if (*decrease) {
-				// printf("LEFT for node:\t");
-				// avl_node_print(*root);
-				// Since a node was removed on the right, the left side is now longer
-				(*root)->balance += LEFT;
-				// printf("new balance: %d\n", (*root)->balance);
-
-				// If the overall height of this node did not decrease
-				if ((*root)->balance == LEFT) {
-					*decrease = false;
-				}
-				// If the overall height of this node decreased out of bounds on the left side
-				else if ((*root)->balance < LEFT) {
-					_balance_left(root, decrease);
-				}
-			}
+int _path_copy(
+    struct avl_tree *tree, struct avl_node **links[], int8_t const directions[], int depth) {
+	// Persistent trees only ever change private copies of the path, made top-down so that each
+	// copy's child link is the one the next level hangs off
+	for (int i = 0; i < depth; ++i) {
+		int rc = _node_copy(tree, links[i]);
+		if (rc < 0) {
+			return rc;
+		}
+		links[i + 1] = directions[i] == LEFT ? &(*links[i])->left : &(*links[i])->right;
+	}
 
-			return did_remove;
-		} else {
-			// This is the node to remove
+	return 0;
+}
 
-			struct avl_node *old_node = *root;
+int _add_path(
+    struct avl_tree *tree, struct avl_path *path, void const *value, void const *data,
+    struct avl_node *node) {
+	assert(tree != NULL);
+	assert(path != NULL);
 
-			// Save this node's value and data just in case it needs to be freed externally
-			*node_value = (*root)->value;
-			*node_data = (*root)->data;
+	struct avl_node ***links = path->links;
+	int8_t *directions = path->directions;
 
-			// If the root has no left child or no children
-			if ((*root)->left == NULL) {
-				// Put root's right node in root's position
-				*root = (*root)->right;
-				free(old_node);
-				*decrease = true;
-				return true;
-			}
-			// If the root has no right child
-			else if ((*root)->right == NULL) {
-				// Put root's left child in root's position
-				*root = (*root)->left;
-				free(old_node);
-				*decrease = true;
-				return true;
-			}
-			// If the root has two children
-			else {
-				// Find the inorder predecessor node (this will be a leaf node)
-				struct avl_node *predecessor;
-				for (predecessor = (*root)->left; predecessor->right != NULL;
-				     predecessor = predecessor->right) {}
-
-				void const *predecessor_value;
-				void const *predecessor_data;
-				// Now remove the inorder predecessor from the tree
-				did_remove = _remove_helper(
-				    &(*root)->left, predecessor->value, &predecessor_value, &predecessor_data, cmp_func,
-				    decrease);
-
-				// Copy the value and data previously in the inorder predecessor into root
-				(*root)->value = predecessor_value;
-				(*root)->data = predecessor_data;
-
-				// Because the predecessor node was on the left, the right side of the tree is possibly
-				// longer depending on whether prior rebalancings fixed things
-				if (*decrease) {
-					// Tree got taller on right side because a node was removed from the left side
-					(*root)->balance += RIGHT;
-
-					// If the overall height of this node did not increase
-					if ((*root)->balance == RIGHT) {
-						*decrease = false;
-					}
-					// If the overall height of the tree increased out of bounds on the right side
-					else if (RIGHT < (*root)->balance) {
-						_balance_right(root, decrease);
-					}
-					// else: this node is now balanced, which means that the opposite side of the parent node
-					// is now relatively taller. Don't change the decrease variable because the next node
-					// might need to be rebalanced.
-				}
+	// Only new versions replace nodes on the way in
+	if (tree->version != NULL && _retire_reserve(tree) < 0) {
+		return -ENOMEM;
+	}
 
-				return did_remove;
-			}
+	// Only nodes below the deepest unbalanced one on the path can change their balance; that one
+	// either becomes balanced or gets rotated, and everything above it stays as it was
+	int critical = 0;
+	for (int i = 0; i < path->depth; ++i) {
+		if ((*links[i])->balance != BALANCED) {
+			critical = i;
 		}
 	}
-}
 
-int avl_tree_remove(
-    struct avl_tree *tree, void const *search_value, void const **node_value,
-    void const **node_data) {
-	assert(tree != NULL);
-	assert(node_value != NULL);
-	assert(node_data != NULL);
+	int depth = path->depth;
+	while (*links[depth] != NULL) {
+		struct avl_node *parent = *links[depth];
+		int direction = tree->cmp_func(value, parent->value);
 
-	// We assume that the search_value does not appear in the tree
-	bool decrease = false;
+		if (direction == 0) {
+			// There already exists a node with this value
+			path->depth = depth;
+			return false;
+		}
 
-	// Obtain exclusive lock while removing data
-	sem_wait(tree->lock);
-	int rc =
-	    _remove_helper(&tree->root, search_value, node_value, node_data, tree->cmp_func, &decrease);
-	sem_post(tree->lock);
-	return rc;
-}
+		if (parent->balance != BALANCED) {
+			critical = depth;
+		}
 
-int _avl_subtree_traverse(
-    struct avl_node const *root, int (*preorder_func)(struct avl_node const *node, void *arg),
-    void *preorder_arg, int (*inorder_func)(struct avl_node const *node, void *arg),
-    void *inorder_arg, int (*postorder_func)(struct avl_node const *node, void *arg),
-    void *postorder_arg) {
-	if (root == NULL) {
-		return 0;
+		assert(depth < AVL_MAX_HEIGHT);
+		directions[depth] = direction < 0 ? LEFT : RIGHT;
+		links[depth + 1] = direction < 0 ? &parent->left : &parent->right;
+		++depth;
 	}
 
-	int rc;
+	// Nothing has changed yet
+	path->depth = depth;
 
-	// Apply pre-order function on node
-	if (preorder_func != NULL) {
-		rc = preorder_func(root, preorder_arg);
-		if (rc <= -1) {
+	if (tree->flags & AVL_TREE_ORDER_STATISTICS && _size(*links[0]) == UINT32_MAX) {
+		// One more would not fit in the root's size
+		return -EOVERFLOW;
+	}
+
+	if (tree->version != NULL) {
+		int rc = _path_copy(tree, links, directions, depth);
+		if (rc < 0) {
+			path->depth = 0;
 			return rc;
 		}
 	}
 
-	// Go down the left branch
-	rc = _avl_subtree_traverse(
-	    root->left, preorder_func, preorder_arg, inorder_func, inorder_arg, postorder_func,
-	    postorder_arg);
-	if (rc <= -1) {
-		return rc;
+	// Intrusive trees are handed the node; everyone else gets one from the tree
+	if (node == NULL) {
+		node = _node_alloc(tree);
+		if (node == NULL) {
+			return -errno;
+		}
 	}
 
-	// Apply in-order function on node
-	if (inorder_func != NULL) {
-		rc = inorder_func(root, inorder_arg);
-		if (rc <= -1) {
-			return rc;
+	node->value = value;
+	node->data = data;
+	node->left = NULL;
+	node->right = NULL;
+	node->balance = BALANCED;
+	node->size = 1;
+	*links[depth] = node;
+
+	// Before any rotation, which recomputes sizes from the children
+	if (tree->flags & AVL_TREE_ORDER_STATISTICS) {
+		for (int i = 0; i < depth; ++i) {
+			++(*links[i])->size;
 		}
 	}
 
-	// Go down the right branch
-	rc = _avl_subtree_traverse(
-	    root->right, preorder_func, preorder_arg, inorder_func, inorder_arg, postorder_func,
-	    postorder_arg);
-	if (rc <= -1) {
-		return rc;
+	// Everything between the critical node and the new leaf was balanced and now leans towards it
+	for (int i = critical + 1; i < depth; ++i) {
+		(*links[i])->balance = directions[i];
 	}
 
-	// Apply post-order function on node
-	if (postorder_func != NULL) {
-		rc = postorder_func(root, postorder_arg);
-		if (rc <= -1) {
-			return rc;
+	if (depth != 0) {
+		struct avl_node *top = *links[critical];
+		top->balance += directions[critical];
+
+		// The overall height of the tree increased out of bounds on one side, and the path below the
+		// critical node no longer leads anywhere
+		if (top->balance < LEFT) {
+			_balance_left(tree, links[critical], NULL);
+			path->depth = critical;
+		} else if (RIGHT < top->balance) {
+			_balance_right(tree, links[critical], NULL);
+			path->depth = critical;
 		}
 	}
 
-	return 0;
+	return true;
 }
 
-int avl_tree_traverse(
-    struct avl_tree const *tree, int (*preorder_func)(struct avl_node const *node, void *arg),
-    void *preorder_arg, int (*inorder_func)(struct avl_node const *node, void *arg),
-    void *inorder_arg, int (*postorder_func)(struct avl_node const *node, void *arg),
-    void *postorder_arg) {
-	assert(tree != NULL);
-
-	sem_wait(tree->lock);
+int _add_helper(
+    struct avl_tree *tree, struct avl_node **root, void const *value, void const *data,
+    struct avl_node *node) {
+	assert(root != NULL);
+
+	struct avl_path path;
+	path.links[0] = root;
+	path.depth = 0;
+
+	return _add_path(tree, &path, value, data, node);
+}
+
+void _extremes_refresh(struct avl_tree *tree) {
+	// Called by writers after a change that may have taken out the smallest or largest entry
+	struct avl_node const *node = tree->root;
+	if (node == NULL) {
+		return;
+	}
+
+	for (; node->left != NULL; node = node->left) {}
+	tree->min.value = node->value;
+	tree->min.data = node->data;
+
+	for (node = tree->root; node->right != NULL; node = node->right) {}
+	tree->max.value = node->value;
+	tree->max.data = node->data;
+}
+
+void _extremes_add(struct avl_tree *tree, void const *new_value, void const *new_data) {
+	// Either the new value is the only one or it can only push out the old extremes
+	bool only = tree->root->left == NULL && tree->root->right == NULL;
+	if (only || tree->cmp_func(new_value, tree->min.value) < 0) {
+		tree->min.value = new_value;
+		tree->min.data = new_data;
+	}
+	if (only || 0 < tree->cmp_func(new_value, tree->max.value)) {
+		tree->max.value = new_value;
+		tree->max.data = new_data;
+	}
+}
+
+int _add_locked(
+    struct avl_tree *tree, void const *new_value, void const *new_data, struct avl_node *node) {
+	int rc;
+	if (tree->flags & AVL_TREE_PERSISTENT) {
+		struct avl_version version;
+		struct avl_node *root = tree->root;
+
+		// Nothing is copied unless the value turns out to be new
+		_version_begin(tree, &version);
+		rc = _add_helper(tree, &root, new_value, new_data, node);
+		if (rc == true) {
+			_version_publish(tree, root);
+		} else {
+			_version_abort(tree);
+		}
+	} else {
+		rc = _add_helper(tree, &(tree->root), new_value, new_data, node);
+	}
+
+	if (rc == true) {
+		_extremes_add(tree, new_value, new_data);
+	}
+
+	return rc;
+}
+
+int avl_tree_add(struct avl_tree *tree, void const *new_value, void const *new_data) {
+	assert(tree != NULL);
+
+	if (tree->flags & AVL_TREE_INTRUSIVE) {
+		// The tree has no nodes of its own to put the value in
+		return -EINVAL;
+	}
+
+	if (tree->combiner != NULL) {
+		struct combined_op op = {.kind = COMBINED_ADD, .value = new_value, .data = new_data};
+		if (avl_combiner_apply(tree->combiner, &op) == 0) {
+			return op.result;
+		}
+		// Another thread holds our slot; take the lock like everyone else
+	}
+
+	// Obtain exclusive lock over the tree while adding data
+	_write_lock(tree);
+	int rc = _add_locked(tree, new_value, new_data, NULL);
+	_write_unlock(tree);
+
+	return rc;
+}
+
+int avl_tree_link(
+    struct avl_tree *tree, struct avl_node *node, void const *value, void const *data) {
+	assert(tree != NULL);
+	assert(node != NULL);
+
+	if (!(tree->flags & AVL_TREE_INTRUSIVE)) {
+		// The tree would free the caller's node once it is removed
+		return -EINVAL;
+	}
+
+	_write_lock(tree);
+	int rc = _add_locked(tree, value, data, node);
+	_write_unlock(tree);
+
+	return rc;
+}
+
+void _cpu_pause() {
+	// Tells the core we are spinning, which frees resources for its sibling thread
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
+int _get_optimistic(struct avl_tree const *tree, void const *value, void const **data) {
+	assert(tree != NULL);
+	assert(data != NULL);
+
+	int spins = 0;
+	for (int attempt = 0; attempt < OPTIMISTIC_ATTEMPTS;) {
+		uint64_t sequence = atomic_load_explicit(&tree->sequence, memory_order_acquire);
+		if (sequence & 1) {
+			// A writer is in the middle of a change; wait for it rather than give up an attempt
+			if (OPTIMISTIC_SPINS <= ++spins) {
+				break;
+			}
+			_cpu_pause();
+			continue;
+		}
+
+		// Every load may race with a writer, so none of them may tear; the depth bound stops us from
+		// following a cycle that only exists mid-rotation
+		struct avl_node *node = __atomic_load_n(&tree->root, __ATOMIC_RELAXED);
+		void const *found_data = NULL;
+		int found = false;
+		for (int depth = 0; node != NULL && depth < AVL_MAX_HEIGHT; ++depth) {
+			int direction = tree->cmp_func(value, __atomic_load_n(&node->value, __ATOMIC_RELAXED));
+
+			if (direction < 0) {
+				node = __atomic_load_n(&node->left, __ATOMIC_RELAXED);
+			} else if (0 < direction) {
+				node = __atomic_load_n(&node->right, __ATOMIC_RELAXED);
+			} else {
+				found_data = __atomic_load_n(&node->data, __ATOMIC_RELAXED);
+				found = true;
+				break;
+			}
+		}
+
+		// The descent only counts if no writer ran while it happened
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(&tree->sequence, memory_order_relaxed) == sequence) {
+			if (found) {
+				*data = found_data;
+			}
+			return found;
+		}
+
+		// Only descents a writer overtook count as attempts
+		++attempt;
+	}
+
+	return -EAGAIN;
+}
+
+struct avl_node *_build_helper(
+    struct avl_tree *tree, void const *const *values, void const *const *data, size_t count,
+    int32_t *height) {
+	if (count == 0) {
+		*height = 0;
+		return NULL;
+	}
+
+	// The lower middle goes to the root, so the right side is never the larger one
+	size_t middle = count / 2;
+
+	int32_t left_height;
+	struct avl_node *left = _build_helper(tree, values, data, middle, &left_height);
+	if (left == NULL && middle != 0) {
+		return NULL;
+	}
+
+	// Allocating in order keeps neighbouring keys next to each other in memory
+	struct avl_node *node = _node_alloc(tree);
+	if (node == NULL) {
+		_free_subtree(tree, left);
+		return NULL;
+	}
+
+	int32_t right_height;
+	struct avl_node *right = _build_helper(
+	    tree, values + middle + 1, data == NULL ? NULL : data + middle + 1, count - middle - 1,
+	    &right_height);
+	if (right == NULL && count - middle - 1 != 0) {
+		_free_subtree(tree, left);
+		_node_dealloc(tree, node);
+		return NULL;
+	}
+
+	node->value = values[middle];
+	node->data = data == NULL ? NULL : data[middle];
+	node->left = left;
+	node->right = right;
+	node->balance = right_height - left_height;
+	node->size = count;
+
+	*height = 1 + (left_height < right_height ? right_height : left_height);
+
+	return node;
+}
+
+int avl_tree_build_sorted(
+    struct avl_tree *tree, void const *const *values, void const *const *data, size_t count) {
+	assert(tree != NULL);
+	assert(values != NULL || count == 0);
+
+	if (tree->flags & AVL_TREE_ORDER_STATISTICS && count > UINT32_MAX) {
+		return -EOVERFLOW;
+	}
+
+#ifndef NDEBUG
+	// The values have to be strictly increasing; checking costs the comparisons we are avoiding
+	for (size_t i = 1; i < count; ++i) {
+		assert(tree->cmp_func(values[i - 1], values[i]) < 0);
+	}
+#endif
+
+	if (tree->flags & AVL_TREE_INTRUSIVE) {
+		return -EINVAL;
+	}
+
+	_write_lock(tree);
+
+	int rc = 0;
+	if (tree->root != NULL) {
+		// Only an empty tree can be built from scratch
+		rc = -EEXIST;
+		goto finish;
+	}
+
+	// Pooled trees get all of their nodes in one contiguous burst
+	if (tree->slab != NULL) {
+		rc = avl_slab_reserve(tree->slab, count);
+		if (rc < 0) {
+			goto finish;
+		}
+	}
+
+	int32_t height;
+	struct avl_node *root = _build_helper(tree, values, data, count, &height);
+	if (root == NULL && count != 0) {
+		rc = -ENOMEM;
+		goto finish;
+	}
+
+	// Nothing could see the new nodes until now, so publishing the root is all persistent trees need
+	__atomic_store_n(&tree->root, root, __ATOMIC_RELEASE);
+	_extremes_refresh(tree);
+
+finish:
+	_write_unlock(tree);
+
+	return rc;
+}
+
+int avl_tree_get(struct avl_tree const *tree, void const *search_value, void const **node_data) {
+	assert(tree != NULL);
+	assert(node_data != NULL);
+
+	int rc;
+
+	if (tree->flags & AVL_TREE_PERSISTENT) {
+		// Whatever version we land on is complete and immutable
+		struct avl_snapshot snapshot;
+		avl_tree_snapshot(tree, &snapshot);
+		rc = avl_snapshot_get(&snapshot, search_value, node_data);
+		avl_snapshot_release(&snapshot);
+
+		return rc;
+	}
+
+	if (tree->flags & AVL_TREE_OPTIMISTIC_READS) {
+		// Stay registered so that nothing we might be looking at is freed
+		uint64_t token = avl_epoch_enter(tree->epoch);
+		rc = _get_optimistic(tree, search_value, node_data);
+		avl_epoch_exit(tree->epoch, token);
+
+		if (rc != -EAGAIN) {
+			return rc;
+		}
+		// Writers kept getting in the way; fall back to waiting for them
+	}
+
+	if (tree->combiner != NULL) {
+		struct combined_op op = {.kind = COMBINED_GET, .value = search_value};
+		if (avl_combiner_apply(tree->combiner, &op) == 0) {
+			*node_data = op.node_data;
+			return op.result;
+		}
+	}
+
+	// Obtain shared lock over the tree while getting data; other readers may run alongside us
+	_read_lock(tree);
+	rc = _get_helper((tree)->root, search_value, node_data, tree->cmp_func);
+	_read_unlock(tree);
+
+	return rc;
+}
+
+int avl_tree_find(struct avl_tree const *tree, void const *search_value, struct avl_node **node) {
+	assert(tree != NULL);
+	assert(node != NULL);
+
+	if (!(tree->flags & AVL_TREE_INTRUSIVE)) {
+		// Other trees may free the node as soon as the lock is dropped
+		return -EINVAL;
+	}
+
+	_read_lock(tree);
+	struct avl_node *found = tree->root;
+	while (found != NULL) {
+		int direction = tree->cmp_func(search_value, found->value);
+		if (direction == 0) {
+			break;
+		}
+		found = direction < 0 ? found->left : found->right;
+	}
+	_read_unlock(tree);
+
+	if (found != NULL) {
+		*node = found;
+	}
+
+	return found != NULL;
+}
+
+int _get_many_helper(
+    struct avl_node const *root, int (*cmp_func)(void const *new_value, void const *node_value),
+    void const *const *search_values, size_t count, void const **node_data, int *found) {
+	struct {
+		struct avl_node const *node;
+		size_t index;
+	} lanes[GET_MANY_LANES];
+
+	size_t next = 0;
+	int active = 0;
+	for (; active < GET_MANY_LANES && next < count; ++active, ++next) {
+		lanes[active].node = root;
+		lanes[active].index = next;
+	}
+
+	int total = 0;
+	while (active > 0) {
+		// Advance every lookup by one level; by the time we come back to a lane, the child we
+		// prefetched for it has had a whole round of other lanes' work to arrive
+		for (int lane = 0; lane < active;) {
+			struct avl_node const *node = lanes[lane].node;
+			size_t index = lanes[lane].index;
+
+			int direction = 0;
+			if (node != NULL) {
+				direction = cmp_func(search_values[index], node->value);
+				if (direction != 0) {
+					node = direction < 0 ? node->left : node->right;
+					__builtin_prefetch(node);
+					lanes[lane].node = node;
+					++lane;
+					continue;
+				}
+			}
+
+			// This lookup is over, one way or the other
+			if (node != NULL) {
+				node_data[index] = node->data;
+				found[index] = true;
+				++total;
+			} else {
+				found[index] = false;
+			}
+
+			if (next < count) {
+				lanes[lane].node = root;
+				lanes[lane].index = next++;
+				++lane;
+			} else {
+				// Nothing left to start; close the gap with the last active lane
+				lanes[lane] = lanes[--active];
+			}
+		}
+	}
+
+	return total;
+}
+
+int avl_tree_get_many(
+    struct avl_tree const *tree, void const *const *search_values, size_t count,
+    void const **node_data, int *found) {
+	assert(tree != NULL);
+	assert(search_values != NULL || count == 0);
+	assert(node_data != NULL || count == 0);
+	assert(found != NULL || count == 0);
+
+	if (count > INT_MAX) {
+		// The number of hits has to fit in the return value
+		return -EOVERFLOW;
+	}
+
+	int rc;
+
+	if (tree->flags & AVL_TREE_PERSISTENT) {
+		struct avl_snapshot snapshot;
+		avl_tree_snapshot(tree, &snapshot);
+		rc = _get_many_helper(snapshot.root, tree->cmp_func, search_values, count, node_data, found);
+		avl_snapshot_release(&snapshot);
+
+		return rc;
+	}
+
+	// One shared lock for the whole group rather than one per lookup
+	_read_lock(tree);
+	rc = _get_many_helper(tree->root, tree->cmp_func, search_values, count, node_data, found);
+	_read_unlock(tree);
+
+	return rc;
+}
+
+int _remove_path(
+    struct avl_tree *tree, struct avl_path *path, void const *search_value,
+    void const **node_value, void const **node_data, struct avl_node **unlinked) {
+	assert(tree != NULL);
+	assert(path != NULL);
+	assert(node_value != NULL);
+	assert(node_data != NULL);
+
+	struct avl_node ***links = path->links;
+	int8_t *directions = path->directions;
+
+	if (_retire_reserve(tree) < 0) {
+		return -ENOMEM;
+	}
+
+	int depth = path->depth;
+	for (;;) {
+		struct avl_node *node = *links[depth];
+		if (node == NULL) {
+			// We didn't find the node
+			path->depth = depth;
+			return false;
+		}
+
+		int direction = tree->cmp_func(search_value, node->value);
+		if (direction == 0) {
+			break;
+		}
+
+		assert(depth < AVL_MAX_HEIGHT);
+		directions[depth] = direction < 0 ? LEFT : RIGHT;
+		links[depth + 1] = direction < 0 ? &node->left : &node->right;
+		++depth;
+	}
+
+	// This is the node to remove
+	int found = depth;
+
+	// Save this node's value and data just in case it needs to be freed externally
+	*node_value = (*links[found])->value;
+	*node_data = (*links[found])->data;
+
+	if ((*links[found])->left != NULL && (*links[found])->right != NULL) {
+		// With two children, the inorder predecessor (which has no right child) is unlinked
+		// instead, so keep walking the same path down to it
+		struct avl_node *node = *links[found];
+		directions[depth] = LEFT;
+		links[depth + 1] = &node->left;
+		++depth;
+		for (node = node->left; node->right != NULL; node = node->right) {
+			assert(depth < AVL_MAX_HEIGHT);
+			directions[depth] = RIGHT;
+			links[depth + 1] = &node->right;
+			++depth;
+		}
+	}
+
+	// Whatever ends up in the found node's place, the path above it stays
+	path->depth = found;
+
+	if (tree->version != NULL) {
+		int rc = _path_copy(tree, links, directions, depth);
+		if (rc < 0) {
+			path->depth = 0;
+			return rc;
+		}
+	}
+
+	// Put the node's only child (if any) in its position
+	struct avl_node *old_node = *links[depth];
+	*links[depth] = old_node->left != NULL ? old_node->left : old_node->right;
+
+	if (depth != found) {
+		if (tree->version != NULL) {
+			// The found node is a private copy, so it may as well take over the predecessor's contents
+			(*links[found])->value = old_node->value;
+			(*links[found])->data = old_node->data;
+		} else {
+			// Nodes may belong to the caller, so the predecessor itself takes the found node's place
+			struct avl_node *predecessor = old_node;
+			old_node = *links[found];
+
+			predecessor->left = old_node->left;
+			predecessor->right = old_node->right;
+			predecessor->balance = old_node->balance;
+			predecessor->size = old_node->size;
+			*links[found] = predecessor;
+			links[found + 1] = &predecessor->left;
+		}
+	}
+
+	if (unlinked != NULL) {
+		*unlinked = old_node;
+	} else {
+		_node_release(tree, old_node);
+	}
+
+	if (tree->flags & AVL_TREE_ORDER_STATISTICS) {
+		for (int i = 0; i < depth; ++i) {
+			--(*links[i])->size;
+		}
+	}
+
+	// Walk back up while the subtree we came from keeps getting shorter
+	for (int i = depth - 1; 0 <= i; --i) {
+		struct avl_node *node = *links[i];
+
+		// The side we removed from is now shorter, so the node leans the other way
+		node->balance -= directions[i];
+
+		if (node->balance == -directions[i]) {
+			// The node was balanced before, so its overall height did not decrease
+			break;
+		} else if (node->balance != BALANCED) {
+			// The overall height of this node decreased out of bounds on the other side
+			bool decrease = true;
+			int rc = _sibling_copy(tree, links[i], -directions[i]);
+			if (rc < 0) {
+				path->depth = 0;
+				return rc;
+			}
+			if (node->balance < LEFT) {
+				_balance_left(tree, links[i], &decrease);
+			} else {
+				_balance_right(tree, links[i], &decrease);
+			}
+			if (i < path->depth) {
+				path->depth = i;
+			}
+
+			if (!decrease) {
+				break;
+			}
+		}
+		// else: this node is now balanced and one shorter, so its parent may need rebalancing too
+	}
+
+	return true;
+}
+
+int _remove_helper(
+    struct avl_tree *tree, struct avl_node **root, void const *search_value,
+    void const **node_value, void const **node_data, struct avl_node **unlinked) {
+	assert(root != NULL);
+
+	struct avl_path path;
+	path.links[0] = root;
+	path.depth = 0;
+
+	return _remove_path(tree, &path, search_value, node_value, node_data, unlinked);
+}
+
+void _extremes_remove(struct avl_tree *tree, void const *node_value) {
+	if (tree->cmp_func(node_value, tree->min.value) == 0 ||
+	    tree->cmp_func(node_value, tree->max.value) == 0) {
+		_extremes_refresh(tree);
+	}
+}
+
+int _remove_locked(
+    struct avl_tree *tree, void const *search_value, void const **node_value,
+    void const **node_data, struct avl_node **unlinked) {
+	int rc;
+	if (tree->flags & AVL_TREE_PERSISTENT) {
+		struct avl_version version;
+		struct avl_node *root = tree->root;
+
+		// Nothing is copied unless the value is found
+		_version_begin(tree, &version);
+		rc = _remove_helper(tree, &root, search_value, node_value, node_data, unlinked);
+		if (rc == true) {
+			_version_publish(tree, root);
+		} else {
+			_version_abort(tree);
+		}
+	} else {
+		rc = _remove_helper(tree, &tree->root, search_value, node_value, node_data, unlinked);
+	}
+
+	if (rc == true) {
+		_extremes_remove(tree, *node_value);
+	}
+
+	return rc;
+}
+
+int avl_tree_remove(
+    struct avl_tree *tree, void const *search_value, void const **node_value,
+    void const **node_data) {
+	assert(tree != NULL);
+	assert(node_value != NULL);
+	assert(node_data != NULL);
+
+	if (tree->flags & AVL_TREE_INTRUSIVE) {
+		// Removing would leave the caller's node nowhere; that is what avl_tree_unlink is for
+		return -EINVAL;
+	}
+
+	if (tree->combiner != NULL) {
+		struct combined_op op = {.kind = COMBINED_REMOVE, .value = search_value};
+		if (avl_combiner_apply(tree->combiner, &op) == 0) {
+			*node_value = op.node_value;
+			*node_data = op.node_data;
+			return op.result;
+		}
+	}
+
+	// Obtain exclusive lock while removing data
+	_write_lock(tree);
+	int rc = _remove_locked(tree, search_value, node_value, node_data, NULL);
+	_write_unlock(tree);
+	return rc;
+}
+
+void _combine(void **ops, size_t count, void *arg) {
+	struct avl_tree *tree = arg;
+
+	// Everything published goes in under one exclusive lock, so plain readers and other writers
+	// still see each operation as atomic
+	_write_lock(tree);
+	for (size_t i = 0; i < count; ++i) {
+		struct combined_op *op = ops[i];
+		switch (op->kind) {
+			case COMBINED_ADD:
+				op->result = _add_locked(tree, op->value, op->data, NULL);
+				break;
+			case COMBINED_REMOVE:
+				op->result = _remove_locked(tree, op->value, &op->node_value, &op->node_data, NULL);
+				break;
+			case COMBINED_GET:
+				op->result = _get_helper(tree->root, op->value, &op->node_data, tree->cmp_func);
+				break;
+		}
+	}
+	_write_unlock(tree);
+}
+
+int avl_tree_unlink(struct avl_tree *tree, void const *search_value, struct avl_node **node) {
+	assert(tree != NULL);
+	assert(node != NULL);
+
+	if (!(tree->flags & AVL_TREE_INTRUSIVE)) {
+		return -EINVAL;
+	}
+
+	void const *node_value;
+	void const *node_data;
+
+	_write_lock(tree);
+	int rc = _remove_locked(tree, search_value, &node_value, &node_data, node);
+	_write_unlock(tree);
+
+	return rc;
+}
+
+int _batch_op_cmp(void const *a, void const *b, void *tree) {
+	struct avl_batch_op const *op_a = *(struct avl_batch_op const *const *)a;
+	struct avl_batch_op const *op_b = *(struct avl_batch_op const *const *)b;
+
+	int direction = ((struct avl_tree const *)tree)->cmp_func(op_a->value, op_b->value);
+	if (direction != 0) {
+		return direction;
+	}
+
+	// Operations on the same value keep the order they were submitted in
+	return op_a < op_b ? -1 : op_a > op_b;
+}
+
+void _path_resume(struct avl_tree const *tree, struct avl_path *path, void const *value) {
+	// Batches go in key order, so value is never below the subtrees the previous operation went
+	// through, and the deepest of them that still holds it is found among the nodes the path left to
+	// the left: value is below the ones near the root and at or past the ones near the bottom
+	int lefts[AVL_MAX_HEIGHT];
+	int count = 0;
+	for (int i = 0; i < path->depth; ++i) {
+		if (path->directions[i] == LEFT) {
+			lefts[count++] = i;
+		}
+	}
+
+	// Gallop up from the bottom, since neighbouring keys part ways late, then bisect. value is below
+	// lefts[below] and at or past lefts[past] and everything after it.
+	int below = -1;
+	int past = count;
+	int direction = 0;
+	for (int step = 1; 0 < past; step *= 2) {
+		int k = past < step ? 0 : past - step;
+		int rc = tree->cmp_func(value, (*path->links[lefts[k]])->value);
+		if (rc < 0) {
+			below = k;
+			break;
+		}
+		past = k;
+		direction = rc;
+	}
+	while (1 < past - below) {
+		int k = below + (past - below) / 2;
+		int rc = tree->cmp_func(value, (*path->links[lefts[k]])->value);
+		if (rc < 0) {
+			below = k;
+		} else {
+			past = k;
+			direction = rc;
+		}
+	}
+
+	if (past == count) {
+		// Still below every node the path left to the left, so its end still holds value
+		return;
+	}
+
+	int depth = lefts[past];
+	if (0 < direction) {
+		// Already compared: value goes right there
+		path->directions[depth] = RIGHT;
+		path->links[depth + 1] = &(*path->links[depth])->right;
+		++depth;
+	}
+	path->depth = depth;
+}
+
+int avl_tree_apply_batch(struct avl_tree *tree, struct avl_batch_op *ops, size_t count) {
+	assert(tree != NULL);
+	assert(ops != NULL || count == 0);
+
+	if (tree->flags & AVL_TREE_INTRUSIVE) {
+		// Batches add and remove like avl_tree_add and avl_tree_remove
+		return -EINVAL;
+	}
+
+	// Sort pointers rather than the caller's array so results stay where the caller put them
+	struct avl_batch_op **order = malloc(sizeof(*order) * count);
+	if (order == NULL && count != 0) {
+		perror("malloc(sizeof(*order) * count)");
+		return -errno;
+	}
+
+	bool sorted = true;
+	for (size_t i = 0; i < count; ++i) {
+		order[i] = &ops[i];
+		if (i != 0 && sorted && _batch_op_cmp(&order[i - 1], &order[i], tree) > 0) {
+			sorted = false;
+		}
+	}
+
+	// Operations on different values commute, so key order gives the same results as submission
+	// order while walking the tree from left to right
+	if (!sorted) {
+		qsort_r(order, count, sizeof(*order), _batch_op_cmp, tree);
+	}
+
+	int rc = 0;
+
+	// Each operation starts from where the previous one left the path rather than from the root, so
+	// neighbouring keys share the top of their descents. Persistent trees copy a fresh path for each
+	// version and go through the usual helpers instead.
+	bool shared = !(tree->flags & AVL_TREE_PERSISTENT);
+	struct avl_path path;
+	path.links[0] = &tree->root;
+	path.depth = 0;
+
+	// One lock acquisition (and one sequence bump for optimistic readers) for the whole batch
+	_write_lock(tree);
+	for (size_t i = 0; i < count; ++i) {
+		struct avl_batch_op *op = order[i];
+
+		op->node_value = NULL;
+		op->node_data = NULL;
+
+		switch (op->kind) {
+			case AVL_BATCH_ADD:
+				if (!shared) {
+					op->result = _add_locked(tree, op->value, op->data, NULL);
+					break;
+				}
+				_path_resume(tree, &path, op->value);
+				op->result = _add_path(tree, &path, op->value, op->data, NULL);
+				if (op->result == true) {
+					_extremes_add(tree, op->value, op->data);
+				}
+				break;
+
+			case AVL_BATCH_REMOVE:
+				if (!shared) {
+					op->result = _remove_locked(tree, op->value, &op->node_value, &op->node_data, NULL);
+					break;
+				}
+				_path_resume(tree, &path, op->value);
+				op->result = _remove_path(tree, &path, op->value, &op->node_value, &op->node_data, NULL);
+				if (op->result == true) {
+					_extremes_remove(tree, op->node_value);
+				}
+				break;
+
+			default:
+				op->result = -EINVAL;
+				break;
+		}
+
+		// Report the first failure, but keep going: every operation gets its own result
+		if (op->result < 0 && rc == 0) {
+			rc = op->result;
+		}
+	}
+	_write_unlock(tree);
+
+	free(order);
+
+	return rc;
+}
+
+// Split, join and the set operations relink nodes between trees, which none of these can follow:
+// pooled nodes belong to one tree's slab, and lock-free readers could be standing on a node another
+// tree then frees
+#define SPLICE_UNSUPPORTED (AVL_TREE_OPTIMISTIC_READS | AVL_TREE_PERSISTENT | AVL_TREE_NODE_POOL)
+
+// Set operations hand half of the work to another worker once both inputs are at least this tall
+#define PARALLEL_HEIGHT 12
+
+// A detached subtree together with its height, which nodes do not store but joins need
+struct subtree {
+	struct avl_node *root;
+	int32_t height;
+};
+
+int32_t _height(struct avl_node const *node) {
+	// Following the taller child (either one when balanced) reaches the deepest leaf in O(log n)
+	int32_t height = 0;
+	for (; node != NULL; node = node->balance == LEFT ? node->left : node->right) {
+		++height;
+	}
+
+	return height;
+}
+
+int32_t _child_height(struct avl_node const *node, int32_t height, enum weight side) {
+	return height - (node->balance == -side ? 2 : 1);
+}
+
+struct subtree _join(
+    struct avl_tree const *tree, struct subtree left, struct avl_node *middle,
+    struct subtree right) {
+	assert(middle != NULL);
+
+	// Walk down the taller tree along the spine facing the shorter one
+	enum weight side = right.height + 1 < left.height ? RIGHT : LEFT;
+	struct subtree taller = side == RIGHT ? left : right;
+	struct subtree other = side == RIGHT ? right : left;
+
+	// links[i] is where the node at depth i hangs, heights[i] the height of the subtree there
+	struct avl_node **links[AVL_MAX_HEIGHT + 1];
+	int32_t heights[AVL_MAX_HEIGHT + 1];
+
+	int depth = 0;
+	links[0] = &taller.root;
+	heights[0] = taller.height;
+	while (other.height + 1 < heights[depth]) {
+		struct avl_node *node = *links[depth];
+
+		assert(depth < AVL_MAX_HEIGHT);
+		links[depth + 1] = side == LEFT ? &node->left : &node->right;
+		heights[depth + 1] = _child_height(node, heights[depth], side);
+		++depth;
+	}
+
+	// The subtree found there is within one of the shorter tree's height, so the middle node can
+	// take both of them as children without rebalancing
+	struct avl_node *inner = *links[depth];
+	middle->left = side == RIGHT ? inner : other.root;
+	middle->right = side == RIGHT ? other.root : inner;
+	middle->balance = side * (other.height - heights[depth]);
+	if (tree->flags & AVL_TREE_ORDER_STATISTICS) {
+		_size_update(middle);
+	}
+	*links[depth] = middle;
+
+	int32_t child_height = 1 + (heights[depth] < other.height ? other.height : heights[depth]);
+
+	// Walk back up; each subtree on the way grew by at most one on the side we descended
+	for (int i = depth - 1; 0 <= i; --i) {
+		struct avl_node *node = *links[i];
+		int32_t sibling_height = _child_height(node, heights[i], -side);
+		int32_t balance = side * (child_height - sibling_height);
+
+		if (tree->flags & AVL_TREE_ORDER_STATISTICS) {
+			_size_update(node);
+		}
+
+		if (LEFT <= balance && balance <= RIGHT) {
+			node->balance = balance;
+			child_height = 1 + (child_height < sibling_height ? sibling_height : child_height);
+		} else {
+			// A rotation leaves the subtree one taller than the sibling, or two if the child was
+			// balanced (which the rebalancing functions report like an unchanged removal height)
+			bool decrease = true;
+			if (side == LEFT) {
+				_balance_left(tree, links[i], &decrease);
+			} else {
+				_balance_right(tree, links[i], &decrease);
+			}
+			child_height = sibling_height + (decrease ? 2 : 3);
+		}
+	}
+
+	taller.height = child_height;
+
+	return taller;
+}
+
+struct subtree _join_pair(struct avl_tree *tree, struct subtree left, struct subtree right) {
+	if (left.root == NULL) {
+		return right;
+	} else if (right.root == NULL) {
+		return left;
+	}
+
+	// Without a middle node, the smallest one on the right ties the two together
+	struct avl_node *middle = right.root;
+	for (; middle->left != NULL; middle = middle->left) {}
+
+	void const *node_value;
+	void const *node_data;
+	int rc = _remove_helper(tree, &right.root, middle->value, &node_value, &node_data, &middle);
+	assert(rc == true);
+	(void)rc;
+	right.height = _height(right.root);
+
+	return _join(tree, left, middle, right);
+}
+
+struct avl_node *_split(
+    struct avl_tree const *tree, struct subtree whole, void const *search_value,
+    struct subtree *lo, struct subtree *hi) {
+	// path[i] is the node at depth i, heights[i] the height of its subtree
+	struct avl_node *path[AVL_MAX_HEIGHT];
+	int32_t heights[AVL_MAX_HEIGHT];
+	int8_t directions[AVL_MAX_HEIGHT];
+
+	*lo = (struct subtree){.root = NULL, .height = 0};
+	*hi = (struct subtree){.root = NULL, .height = 0};
+
+	struct avl_node *found = NULL;
+
+	int depth = 0;
+	int32_t height = whole.height;
+	for (struct avl_node *node = whole.root; node != NULL; ++depth) {
+		int direction = tree->cmp_func(search_value, node->value);
+
+		if (direction == 0) {
+			// The node itself goes to neither side, and its subtrees are where the sides start
+			found = node;
+			*lo = (struct subtree){.root = node->left, .height = _child_height(node, height, LEFT)};
+			*hi = (struct subtree){.root = node->right, .height = _child_height(node, height, RIGHT)};
+			break;
+		}
+
+		assert(depth < AVL_MAX_HEIGHT);
+		path[depth] = node;
+		heights[depth] = height;
+		directions[depth] = direction < 0 ? LEFT : RIGHT;
+
+		height = _child_height(node, height, directions[depth]);
+		node = direction < 0 ? node->left : node->right;
+	}
+
+	// From the bottom up, each node on the path joins the side it belongs to together with its
+	// subtree facing away from search_value. Their heights only grow, so the joins telescope to
+	// O(log n) in total.
+	for (int i = depth - 1; 0 <= i; --i) {
+		struct avl_node *node = path[i];
+
+		if (directions[i] == LEFT) {
+			struct subtree outer = {
+			    .root = node->right, .height = _child_height(node, heights[i], RIGHT)};
+			*hi = _join(tree, *hi, node, outer);
+		} else {
+			struct subtree outer = {.root = node->left, .height = _child_height(node, heights[i], LEFT)};
+			*lo = _join(tree, outer, node, *lo);
+		}
+	}
+
+	return found;
+}
+
+int avl_tree_split(
+    struct avl_tree *tree, void const *search_value, struct avl_tree **left,
+    struct avl_tree **right) {
+	assert(tree != NULL);
+	assert(left != NULL);
+	assert(right != NULL);
+
+	if (tree->flags & SPLICE_UNSUPPORTED) {
+		return -EINVAL;
+	}
+
+	int rc = avl_tree_create_flags(left, tree->cmp_func, tree->flags);
+	if (rc < 0) {
+		return rc;
+	}
+	rc = avl_tree_create_flags(right, tree->cmp_func, tree->flags);
+	if (rc < 0) {
+		avl_tree_free(left, NULL, NULL);
+		return rc;
+	}
+
+	_write_lock(tree);
+
+	struct subtree whole = {.root = tree->root, .height = _height(tree->root)};
+	struct subtree lo;
+	struct subtree hi;
+	struct avl_node *found = _split(tree, whole, search_value, &lo, &hi);
+	if (found != NULL) {
+		// Nodes equal to search_value go to the right
+		hi = _join(tree, (struct subtree){.root = NULL, .height = 0}, found, hi);
+	}
+
+	tree->root = NULL;
+
+	_write_unlock(tree);
+
+	(*left)->root = lo.root;
+	_extremes_refresh(*left);
+	(*right)->root = hi.root;
+	_extremes_refresh(*right);
+
+	return 0;
+}
+
+int avl_tree_join(struct avl_tree *left, struct avl_tree *right) {
+	assert(left != NULL);
+	assert(right != NULL);
+
+	if (left == right || left->cmp_func != right->cmp_func || left->flags != right->flags ||
+	    left->flags & SPLICE_UNSUPPORTED) {
+		return -EINVAL;
+	}
+
+	// Always lock in the same order, so two threads joining the same trees cannot deadlock
+	struct avl_tree *first = left < right ? left : right;
+	struct avl_tree *second = left < right ? right : left;
+	_write_lock(first);
+	_write_lock(second);
+
+	int rc = 0;
+
+	if (right->root == NULL) {
+		goto finish;
+	}
+
+	if (left->root != NULL && 0 <= left->cmp_func(left->max.value, right->min.value)) {
+		// The trees overlap, so there is no single spine to join them along
+		rc = -EINVAL;
+		goto finish;
+	}
+
+	if (left->flags & AVL_TREE_ORDER_STATISTICS &&
+	    _size(left->root) + _size(right->root) > UINT32_MAX) {
+		rc = -EOVERFLOW;
+		goto finish;
+	}
+
+	if (left->root == NULL) {
+		left->min = right->min;
+	}
+	left->max = right->max;
+
+	struct subtree joined = _join_pair(
+	    right, (struct subtree){.root = left->root, .height = _height(left->root)},
+	    (struct subtree){.root = right->root, .height = _height(right->root)});
+	left->root = joined.root;
+	right->root = NULL;
+
+finish:
+	_write_unlock(second);
+	_write_unlock(first);
+
+	return rc;
+}
+
+enum set_kind { SET_UNION, SET_INTERSECTION, SET_DIFFERENCE };
+
+struct set_op {
+	// Only used for its cmp_func and flags, the inputs are detached subtrees
+	struct avl_tree *tree;
+	struct avl_workers *workers;
+	enum set_kind kind;
+};
+
+// Nodes that end up in neither tree, chained through their right links
+struct dropped {
+	struct avl_node *first;
+	struct avl_node *last;
+};
+
+struct set_result {
+	struct subtree subtree;
+	struct dropped dropped;
+};
+
+struct set_task {
+	struct avl_task task;
+	struct set_op const *op;
+	struct subtree a;
+	struct subtree b;
+	struct set_result result;
+};
+
+void _drop(struct dropped *dropped, struct avl_node *node) {
+	node->right = NULL;
+	if (dropped->first == NULL) {
+		dropped->first = node;
+	} else {
+		dropped->last->right = node;
+	}
+	dropped->last = node;
+}
+
+void _drop_subtree(struct dropped *dropped, struct avl_node *root) {
+	// Rotating left children up turns the subtree into a chain without needing a stack
+	while (root != NULL) {
+		if (root->left != NULL) {
+			struct avl_node *left = root->left;
+			root->left = left->right;
+			left->right = root;
+			root = left;
+		} else {
+			struct avl_node *next = root->right;
+			_drop(dropped, root);
+			root = next;
+		}
+	}
+}
+
+void _drop_all(struct dropped *dropped, struct dropped const *more) {
+	if (more->first == NULL) {
+		return;
+	}
+
+	if (dropped->first == NULL) {
+		dropped->first = more->first;
+	} else {
+		dropped->last->right = more->first;
+	}
+	dropped->last = more->last;
+}
+
+struct set_result _set_helper(struct set_op const *op, struct subtree a, struct subtree b);
+
+void _set_task_run(void *arg) {
+	struct set_task *task = arg;
+	task->result = _set_helper(task->op, task->a, task->b);
+}
+
+struct set_result _set_helper(struct set_op const *op, struct subtree a, struct subtree b) {
+	struct set_result result = {
+	    .subtree = {.root = NULL, .height = 0}, .dropped = {.first = NULL, .last = NULL}};
+
+	if (b.root == NULL) {
+		// Nothing left to add or to take away
+		if (op->kind == SET_INTERSECTION) {
+			_drop_subtree(&result.dropped, a.root);
+		} else {
+			result.subtree = a;
+		}
+		return result;
+	} else if (a.root == NULL) {
+		if (op->kind == SET_UNION) {
+			result.subtree = b;
+		}
+		return result;
+	}
+
+	// Split a around the root of b, then combine the halves on either side independently
+	struct avl_node *pivot = b.root;
+	struct subtree b_left = {.root = pivot->left, .height = _child_height(pivot, b.height, LEFT)};
+	struct subtree b_right = {.root = pivot->right, .height = _child_height(pivot, b.height, RIGHT)};
+	struct subtree a_left;
+	struct subtree a_right;
+	struct avl_node *found = _split(op->tree, a, pivot->value, &a_left, &a_right);
+
+	struct set_result left;
+	struct set_result right;
+	if (op->workers != NULL && PARALLEL_HEIGHT <= a.height && PARALLEL_HEIGHT <= b.height) {
+		struct set_task task = {
+		    .task = {.func = _set_task_run}, .op = op, .a = a_left, .b = b_left};
+		task.task.arg = &task;
+
+		avl_workers_fork(op->workers, &task.task);
+		right = _set_helper(op, a_right, b_right);
+		avl_workers_join(op->workers, &task.task);
+		left = task.result;
+	} else {
+		left = _set_helper(op, a_left, b_left);
+		right = _set_helper(op, a_right, b_right);
+	}
+
+	_drop_all(&result.dropped, &left.dropped);
+	_drop_all(&result.dropped, &right.dropped);
+
+	switch (op->kind) {
+		case SET_UNION:
+			// The tree's own entry wins over the other tree's
+			if (found != NULL) {
+				_drop(&result.dropped, pivot);
+			}
+			result.subtree =
+			    _join(op->tree, left.subtree, found != NULL ? found : pivot, right.subtree);
+			break;
+
+		case SET_INTERSECTION:
+			result.subtree = found != NULL ? _join(op->tree, left.subtree, found, right.subtree)
+			                               : _join_pair(op->tree, left.subtree, right.subtree);
+			break;
+
+		case SET_DIFFERENCE:
+			if (found != NULL) {
+				_drop(&result.dropped, found);
+			}
+			result.subtree = _join_pair(op->tree, left.subtree, right.subtree);
+			break;
+	}
+
+	return result;
+}
+
+int _set_operation(
+    struct avl_tree *tree, struct avl_tree const *other, enum set_kind kind,
+    struct avl_workers *workers, int (*drop_func)(struct avl_node const *node, void *arg),
+    void *drop_arg) {
+	assert(tree != NULL);
+	assert(other != NULL);
+
+	if (tree == other || tree->cmp_func != other->cmp_func || tree->flags != other->flags ||
+	    tree->flags & SPLICE_UNSUPPORTED) {
+		return -EINVAL;
+	}
+
+	// A union takes the other tree's nodes, the rest only read them; the lock order is fixed either
+	// way so that two threads combining the same trees cannot deadlock
+	bool other_first = (void const *)other < (void const *)tree;
+	if (!other_first) {
+		_write_lock(tree);
+	}
+	if (kind == SET_UNION) {
+		_write_lock((struct avl_tree *)other);
+	} else {
+		_read_lock(other);
+	}
+	if (other_first) {
+		_write_lock(tree);
+	}
+
+	// Duplicates are only found along the way, so a union is turned down whenever it might not fit
+	if (kind == SET_UNION && tree->flags & AVL_TREE_ORDER_STATISTICS &&
+	    _size(tree->root) + _size(other->root) > UINT32_MAX) {
+		_write_unlock((struct avl_tree *)other);
+		_write_unlock(tree);
+		return -EOVERFLOW;
+	}
+
+	struct set_op op = {.tree = tree, .workers = workers, .kind = kind};
+	struct set_result result = _set_helper(
+	    &op, (struct subtree){.root = tree->root, .height = _height(tree->root)},
+	    // Intersections and differences never modify the nodes of b
+	    (struct subtree){.root = (struct avl_node *)other->root, .height = _height(other->root)});
+
+	tree->root = result.subtree.root;
+	_extremes_refresh(tree);
+
+	if (kind == SET_UNION) {
+		((struct avl_tree *)other)->root = NULL;
+		_write_unlock((struct avl_tree *)other);
+	} else {
+		_read_unlock(other);
+	}
+	_write_unlock(tree);
+
+	// Both trees are available again before the caller gets to see what was dropped
+	for (struct avl_node *node = result.dropped.first, *next; node != NULL; node = next) {
+		next = node->right;
+		if (drop_func != NULL) {
+			drop_func(node, drop_arg);
+		}
+		if (!(tree->flags & AVL_TREE_INTRUSIVE)) {
+			_node_release(tree, node);
+		}
+	}
+
+	return 0;
+}
+
+int avl_tree_union(
+    struct avl_tree *tree, struct avl_tree *other, struct avl_workers *workers,
+    int (*drop_func)(struct avl_node const *node, void *arg), void *drop_arg) {
+	return _set_operation(tree, other, SET_UNION, workers, drop_func, drop_arg);
+}
+
+int avl_tree_intersect(
+    struct avl_tree *tree, struct avl_tree const *other, struct avl_workers *workers,
+    int (*drop_func)(struct avl_node const *node, void *arg), void *drop_arg) {
+	return _set_operation(tree, other, SET_INTERSECTION, workers, drop_func, drop_arg);
+}
+
+int avl_tree_difference(
+    struct avl_tree *tree, struct avl_tree const *other, struct avl_workers *workers,
+    int (*drop_func)(struct avl_node const *node, void *arg), void *drop_arg) {
+	return _set_operation(tree, other, SET_DIFFERENCE, workers, drop_func, drop_arg);
+}
+
+void avl_tree_synchronize(struct avl_tree *tree) {
+	assert(tree != NULL);
+
+	if (tree->epoch == NULL) {
+		// Nodes are freed as soon as they are removed
+		return;
+	}
+
+	// Readers are waited for with the lock released, so writers keep going meanwhile; the lock is
+	// only taken for each step that moves the epoch on
+	_write_lock(tree);
+	uint64_t target = avl_epoch_synchronize_begin(tree->epoch);
+	bool done = avl_epoch_synchronize_step(tree->epoch, target);
+	_write_unlock(tree);
+
+	for (unsigned attempt = 0; !done; ++attempt) {
+		avl_epoch_backoff(attempt);
+
+		_write_lock(tree);
+		done = avl_epoch_synchronize_step(tree->epoch, target);
+		_write_unlock(tree);
+	}
+}
+
+int _avl_subtree_traverse(
+    struct avl_node const *root, int (*preorder_func)(struct avl_node const *node, void *arg),
+    void *preorder_arg, int (*inorder_func)(struct avl_node const *node, void *arg),
+    void *inorder_arg, int (*postorder_func)(struct avl_node const *node, void *arg),
+    void *postorder_arg) {
+	// Nodes whose subtrees are still being walked, and whether that has reached the right branch
+	struct {
+		struct avl_node const *node;
+		bool right;
+	} stack[AVL_MAX_HEIGHT];
+	int depth = 0;
+
+	int rc;
+	struct avl_node const *node = root;
+	for (;;) {
+		if (node != NULL) {
+			// Apply pre-order function on node
+			if (preorder_func != NULL) {
+				rc = preorder_func(node, preorder_arg);
+				if (rc <= -1) {
+					return rc;
+				}
+			}
+
+			// Go down the left branch
+			assert(depth < AVL_MAX_HEIGHT);
+			stack[depth].node = node;
+			stack[depth].right = false;
+			++depth;
+			node = node->left;
+		} else if (depth == 0) {
+			return 0;
+		} else if (!stack[depth - 1].right) {
+			// Apply in-order function on node
+			node = stack[depth - 1].node;
+			if (inorder_func != NULL) {
+				rc = inorder_func(node, inorder_arg);
+				if (rc <= -1) {
+					return rc;
+				}
+			}
+
+			// Go down the right branch
+			stack[depth - 1].right = true;
+			node = node->right;
+		} else {
+			// Apply post-order function on node; it may free the node, so it is the last use
+			--depth;
+			if (postorder_func != NULL) {
+				rc = postorder_func(stack[depth].node, postorder_arg);
+				if (rc <= -1) {
+					return rc;
+				}
+			}
+		}
+	}
+}
+
+int avl_tree_traverse(
+    struct avl_tree const *tree, int (*preorder_func)(struct avl_node const *node, void *arg),
+    void *preorder_arg, int (*inorder_func)(struct avl_node const *node, void *arg),
+    void *inorder_arg, int (*postorder_func)(struct avl_node const *node, void *arg),
+    void *postorder_arg) {
+	assert(tree != NULL);
+
+	if (tree->flags & AVL_TREE_PERSISTENT) {
+		// Walk one version without blocking writers
+		struct avl_snapshot snapshot;
+		avl_tree_snapshot(tree, &snapshot);
+		int rc = avl_snapshot_traverse(
+		    &snapshot, preorder_func, preorder_arg, inorder_func, inorder_arg, postorder_func,
+		    postorder_arg);
+		avl_snapshot_release(&snapshot);
+
+		return rc;
+	}
+
+	// Traversal callbacks only see const nodes, so a shared lock is enough
+	_read_lock(tree);
 	int rc = _avl_subtree_traverse(
 	    tree->root, preorder_func, preorder_arg, inorder_func, inorder_arg, postorder_func,
 	    postorder_arg);
-	sem_post(tree->lock);
+	_read_unlock(tree);
+	return rc;
+}
+
+struct avl_node const *_read_begin(struct avl_tree const *tree, struct avl_snapshot *snapshot) {
+	if (tree->flags & AVL_TREE_PERSISTENT) {
+		// Walk one version without blocking writers
+		avl_tree_snapshot(tree, snapshot);
+		return snapshot->root;
+	}
+
+	// Keep the unused snapshot defined; the compiler can't tell that _read_end won't touch it
+	*snapshot = (struct avl_snapshot){.tree = tree};
+
+	_read_lock(tree);
+	return tree->root;
+}
+
+void _read_end(struct avl_tree const *tree, struct avl_snapshot *snapshot) {
+	if (tree->flags & AVL_TREE_PERSISTENT) {
+		avl_snapshot_release(snapshot);
+	} else {
+		_read_unlock(tree);
+	}
+}
+
+struct walk {
+	struct avl_workers *workers;
+	int (*func)(struct avl_node const *node, void *arg);
+	void *arg;
+	struct avl_reduce const *reduce;
+	// First error returned by func, after which every task stops
+	_Atomic int rc;
+};
+
+struct walk_task {
+	struct avl_task task;
+	struct walk *walk;
+	struct avl_node const *root;
+	int32_t height;
+	void *accumulator;
+};
+
+struct reduce_visit {
+	struct avl_reduce const *reduce;
+	void *accumulator;
+};
+
+int _reduce_visit(struct avl_node const *node, void *arg) {
+	struct reduce_visit *visit = arg;
+	visit->reduce->accumulate_func(visit->accumulator, node, visit->reduce->arg);
+	return 0;
+}
+
+void _walk_result(struct walk *walk, int rc) {
+	if (rc < 0) {
+		// Only the first error is kept
+		int expected = 0;
+		atomic_compare_exchange_strong(&walk->rc, &expected, rc);
+	}
+}
+
+void _walk(struct walk *walk, struct avl_node const *root, int32_t height, void *accumulator);
+
+void _walk_task_run(void *arg) {
+	struct walk_task *task = arg;
+	_walk(task->walk, task->root, task->height, task->accumulator);
+}
+
+void _walk(struct walk *walk, struct avl_node const *root, int32_t height, void *accumulator) {
+	if (root == NULL || atomic_load_explicit(&walk->rc, memory_order_relaxed) < 0) {
+		return;
+	}
+
+	// Reductions fold each node into the accumulator this part of the tree was given
+	struct avl_reduce const *reduce = walk->reduce;
+	struct reduce_visit visit = {.reduce = reduce, .accumulator = accumulator};
+	int (*func)(struct avl_node const *node, void *arg) = reduce != NULL ? _reduce_visit : walk->func;
+	void *arg = reduce != NULL ? (void *)&visit : walk->arg;
+
+	if (walk->workers == NULL || height < PARALLEL_HEIGHT) {
+		// Too small to be worth another thread
+		_walk_result(walk, _avl_subtree_traverse(root, NULL, NULL, func, arg, NULL, NULL));
+		return;
+	}
+
+	struct walk_task task = {
+	    .task = {.func = _walk_task_run},
+	    .walk = walk,
+	    .root = root->left,
+	    .height = _child_height(root, height, LEFT),
+	    .accumulator = NULL};
+	task.task.arg = &task;
+	struct avl_node const *right = root->right;
+	int32_t right_height = _child_height(root, height, RIGHT);
+
+	if (reduce != NULL) {
+		// The left subtree and the rest are folded separately and combined in order afterwards
+		task.accumulator = malloc(2 * reduce->size);
+		if (task.accumulator == NULL) {
+			perror("malloc(2 * reduce->size)");
+
+			// Carry on without another thread
+			_walk(walk, task.root, task.height, accumulator);
+			_reduce_visit(root, &visit);
+			_walk(walk, right, right_height, accumulator);
+			return;
+		}
+		visit.accumulator = (char *)task.accumulator + reduce->size;
+		reduce->init_func(task.accumulator, reduce->arg);
+		reduce->init_func(visit.accumulator, reduce->arg);
+	}
+
+	avl_workers_fork(walk->workers, &task.task);
+
+	_walk_result(walk, func(root, arg));
+	_walk(walk, right, right_height, visit.accumulator);
+
+	avl_workers_join(walk->workers, &task.task);
+
+	if (reduce != NULL) {
+		reduce->combine_func(accumulator, task.accumulator, reduce->arg);
+		reduce->combine_func(accumulator, visit.accumulator, reduce->arg);
+		free(task.accumulator);
+	}
+}
+
+int avl_tree_parallel_for_each(
+    struct avl_tree const *tree, struct avl_workers *workers,
+    int (*func)(struct avl_node const *node, void *arg), void *arg) {
+	assert(tree != NULL);
+	assert(func != NULL);
+
+	struct walk walk = {.workers = workers, .func = func, .arg = arg, .reduce = NULL};
+	atomic_init(&walk.rc, 0);
+
+	// Workers only ever read nodes, so the caller's shared lock (or snapshot) covers them too
+	struct avl_snapshot snapshot;
+	struct avl_node const *root = _read_begin(tree, &snapshot);
+	_walk(&walk, root, _height(root), NULL);
+	_read_end(tree, &snapshot);
+
+	return atomic_load_explicit(&walk.rc, memory_order_relaxed);
+}
+
+int avl_tree_parallel_reduce(
+    struct avl_tree const *tree, struct avl_workers *workers, struct avl_reduce const *reduce,
+    void *result) {
+	assert(tree != NULL);
+	assert(reduce != NULL);
+	assert(result != NULL);
+
+	struct walk walk = {.workers = workers, .func = NULL, .arg = NULL, .reduce = reduce};
+	atomic_init(&walk.rc, 0);
+
+	reduce->init_func(result, reduce->arg);
+
+	struct avl_snapshot snapshot;
+	struct avl_node const *root = _read_begin(tree, &snapshot);
+	_walk(&walk, root, _height(root), result);
+	_read_end(tree, &snapshot);
+
+	return 0;
+}
+
+struct range {
+	int (*cmp_func)(void const *new_value, void const *node_value);
+	void const *lo;
+	void const *hi;
+	uint32_t flags;
+	int (*func)(struct avl_node const *node, void *arg);
+	void *arg;
+};
+
+int _range_helper(struct range const *range, struct avl_node const *root, int reverse) {
+	if (root == NULL) {
+		return 0;
+	}
+
+	// Subtrees that lie entirely outside the bounds are never entered
+	int lo_direction =
+	    range->flags & AVL_RANGE_LO_UNBOUNDED ? 1 : range->cmp_func(root->value, range->lo);
+	int hi_direction =
+	    range->flags & AVL_RANGE_HI_UNBOUNDED ? -1 : range->cmp_func(root->value, range->hi);
+
+	int above_lo = 0 < lo_direction || (lo_direction == 0 && range->flags & AVL_RANGE_LO_INCLUSIVE);
+	int below_hi = hi_direction < 0 || (hi_direction == 0 && range->flags & AVL_RANGE_HI_INCLUSIVE);
+
+	struct avl_node const *first = reverse ? root->right : root->left;
+	struct avl_node const *second = reverse ? root->left : root->right;
+	int enter_first = reverse ? hi_direction < 0 : 0 < lo_direction;
+	int enter_second = reverse ? 0 < lo_direction : hi_direction < 0;
+
+	int rc;
+	if (enter_first) {
+		rc = _range_helper(range, first, reverse);
+		if (rc <= -1) {
+			return rc;
+		}
+	}
+
+	if (above_lo && below_hi) {
+		rc = range->func(root, range->arg);
+		if (rc <= -1) {
+			return rc;
+		}
+	}
+
+	if (enter_second) {
+		rc = _range_helper(range, second, reverse);
+		if (rc <= -1) {
+			return rc;
+		}
+	}
+
+	return 0;
+}
+
+int _range(
+    struct avl_tree const *tree, void const *lo, void const *hi, uint32_t flags,
+    int (*func)(struct avl_node const *node, void *arg), void *arg, int reverse) {
+	assert(tree != NULL);
+	assert(func != NULL);
+
+	struct range range = {
+	    .cmp_func = tree->cmp_func, .lo = lo, .hi = hi, .flags = flags, .func = func, .arg = arg};
+
+	struct avl_snapshot snapshot;
+	int rc = _range_helper(&range, _read_begin(tree, &snapshot), reverse);
+	_read_end(tree, &snapshot);
+
+	return rc;
+}
+
+int avl_tree_range(
+    struct avl_tree const *tree, void const *lo, void const *hi, uint32_t flags,
+    int (*func)(struct avl_node const *node, void *arg), void *arg) {
+	return _range(tree, lo, hi, flags, func, arg, false);
+}
+
+int avl_tree_range_reverse(
+    struct avl_tree const *tree, void const *lo, void const *hi, uint32_t flags,
+    int (*func)(struct avl_node const *node, void *arg), void *arg) {
+	return _range(tree, lo, hi, flags, func, arg, true);
+}
+
+struct avl_node const *_neighbor(
+    struct avl_node const *node, int (*cmp_func)(void const *new_value, void const *node_value),
+    void const *value, enum weight side, bool inclusive) {
+	// The closest node on the given side of value, remembered each time the descent turns away
+	// from it
+	struct avl_node const *closest = NULL;
+	while (node != NULL) {
+		int direction = cmp_func(value, node->value);
+		if (direction == 0 && inclusive) {
+			return node;
+		}
+
+		if (side == RIGHT ? direction < 0 : 0 < direction) {
+			closest = node;
+			node = side == RIGHT ? node->left : node->right;
+		} else {
+			node = side == RIGHT ? node->right : node->left;
+		}
+	}
+
+	return closest;
+}
+
+int _neighbor_query(
+    struct avl_tree const *tree, void const *search_value, enum weight side, bool inclusive,
+    void const **node_value, void const **node_data) {
+	assert(tree != NULL);
+	assert(node_value != NULL);
+	assert(node_data != NULL);
+
+	struct avl_snapshot snapshot;
+	struct avl_node const *node =
+	    _neighbor(_read_begin(tree, &snapshot), tree->cmp_func, search_value, side, inclusive);
+	if (node != NULL) {
+		*node_value = node->value;
+		*node_data = node->data;
+	}
+	_read_end(tree, &snapshot);
+
+	return node != NULL;
+}
+
+int avl_tree_floor(
+    struct avl_tree const *tree, void const *search_value, void const **node_value,
+    void const **node_data) {
+	return _neighbor_query(tree, search_value, LEFT, true, node_value, node_data);
+}
+
+int avl_tree_ceiling(
+    struct avl_tree const *tree, void const *search_value, void const **node_value,
+    void const **node_data) {
+	return _neighbor_query(tree, search_value, RIGHT, true, node_value, node_data);
+}
+
+int avl_tree_lower_bound(
+    struct avl_tree const *tree, void const *search_value, void const **node_value,
+    void const **node_data) {
+	return _neighbor_query(tree, search_value, RIGHT, true, node_value, node_data);
+}
+
+int avl_tree_upper_bound(
+    struct avl_tree const *tree, void const *search_value, void const **node_value,
+    void const **node_data) {
+	return _neighbor_query(tree, search_value, RIGHT, false, node_value, node_data);
+}
+
+int _extreme(
+    struct avl_tree const *tree, enum weight side, void const **node_value,
+    void const **node_data) {
+	assert(tree != NULL);
+	assert(node_value != NULL);
+	assert(node_data != NULL);
+
+	if (tree->flags & AVL_TREE_PERSISTENT) {
+		// The cached pair belongs to whatever the writer is doing; a snapshot has to look for itself
+		struct avl_snapshot snapshot;
+		avl_tree_snapshot(tree, &snapshot);
+
+		struct avl_node const *node = snapshot.root;
+		for (; node != NULL && (side == LEFT ? node->left : node->right) != NULL;
+		     node = side == LEFT ? node->left : node->right) {}
+		if (node != NULL) {
+			*node_value = node->value;
+			*node_data = node->data;
+		}
+		avl_snapshot_release(&snapshot);
+
+		return node != NULL;
+	}
+
+	_read_lock(tree);
+	int rc = tree->root != NULL;
+	if (rc) {
+		*node_value = side == LEFT ? tree->min.value : tree->max.value;
+		*node_data = side == LEFT ? tree->min.data : tree->max.data;
+	}
+	_read_unlock(tree);
+
+	return rc;
+}
+
+int avl_tree_min(struct avl_tree const *tree, void const **node_value, void const **node_data) {
+	return _extreme(tree, LEFT, node_value, node_data);
+}
+
+int avl_tree_max(struct avl_tree const *tree, void const **node_value, void const **node_data) {
+	return _extreme(tree, RIGHT, node_value, node_data);
+}
+
+size_t _count_below(
+    struct avl_node const *node, int (*cmp_func)(void const *new_value, void const *node_value),
+    void const *value, bool inclusive, bool *found) {
+	// Counts the nodes less than value (or equal to it, if inclusive) by adding up whole left
+	// subtrees on the way down
+	size_t count = 0;
+	*found = false;
+	while (node != NULL) {
+		int direction = cmp_func(value, node->value);
+		if (direction < 0) {
+			node = node->left;
+		} else if (0 < direction) {
+			count += _size(node->left) + 1;
+			node = node->right;
+		} else {
+			*found = true;
+			return count + _size(node->left) + inclusive;
+		}
+	}
+
+	return count;
+}
+
+int avl_tree_rank(struct avl_tree const *tree, void const *search_value, size_t *rank) {
+	assert(tree != NULL);
+	assert(rank != NULL);
+
+	if (!(tree->flags & AVL_TREE_ORDER_STATISTICS)) {
+		return -EINVAL;
+	}
+
+	bool found;
+	struct avl_snapshot snapshot;
+	*rank = _count_below(_read_begin(tree, &snapshot), tree->cmp_func, search_value, false, &found);
+	_read_end(tree, &snapshot);
+
+	return found;
+}
+
+int avl_tree_select(
+    struct avl_tree const *tree, size_t rank, void const **node_value, void const **node_data) {
+	assert(tree != NULL);
+	assert(node_value != NULL);
+	assert(node_data != NULL);
+
+	if (!(tree->flags & AVL_TREE_ORDER_STATISTICS)) {
+		return -EINVAL;
+	}
+
+	struct avl_snapshot snapshot;
+	struct avl_node const *node = _read_begin(tree, &snapshot);
+
+	int rc = false;
+	while (node != NULL) {
+		size_t left_size = _size(node->left);
+		if (rank < left_size) {
+			node = node->left;
+		} else if (left_size < rank) {
+			rank -= left_size + 1;
+			node = node->right;
+		} else {
+			*node_value = node->value;
+			*node_data = node->data;
+			rc = true;
+			break;
+		}
+	}
+
+	_read_end(tree, &snapshot);
+
 	return rc;
 }
 
+int avl_tree_count_range(
+    struct avl_tree const *tree, void const *lo, void const *hi, uint32_t flags, size_t *count) {
+	assert(tree != NULL);
+	assert(count != NULL);
+
+	if (!(tree->flags & AVL_TREE_ORDER_STATISTICS)) {
+		return -EINVAL;
+	}
+
+	struct avl_snapshot snapshot;
+	struct avl_node const *root = _read_begin(tree, &snapshot);
+
+	// Everything up to hi, minus everything before lo
+	bool found;
+	size_t below_hi = _size(root);
+	if (!(flags & AVL_RANGE_HI_UNBOUNDED)) {
+		below_hi = _count_below(root, tree->cmp_func, hi, flags & AVL_RANGE_HI_INCLUSIVE, &found);
+	}
+	size_t below_lo = 0;
+	if (!(flags & AVL_RANGE_LO_UNBOUNDED)) {
+		below_lo = _count_below(root, tree->cmp_func, lo, !(flags & AVL_RANGE_LO_INCLUSIVE), &found);
+	}
+
+	_read_end(tree, &snapshot);
+
+	// An empty or inverted range
+	*count = below_lo < below_hi ? below_hi - below_lo : 0;
+
+	return 0;
+}
+
+int avl_tree_snapshot(struct avl_tree const *tree, struct avl_snapshot *snapshot) {
+	assert(tree != NULL);
+	assert(snapshot != NULL);
+
+	if (!(tree->flags & AVL_TREE_PERSISTENT)) {
+		// Other trees change nodes in place, so there is no old version to hold on to
+		return -EINVAL;
+	}
+
+	snapshot->tree = tree;
+	// Register before loading the root so that no node of that version can be reclaimed
+	snapshot->token = avl_epoch_enter(tree->epoch);
+	snapshot->root = __atomic_load_n(&tree->root, __ATOMIC_ACQUIRE);
+
+	return 0;
+}
+
+void avl_snapshot_release(struct avl_snapshot *snapshot) {
+	assert(snapshot != NULL);
+	assert(snapshot->tree != NULL);
+
+	avl_epoch_exit(snapshot->tree->epoch, snapshot->token);
+	snapshot->tree = NULL;
+	snapshot->root = NULL;
+}
+
+int avl_snapshot_get(
+    struct avl_snapshot const *snapshot, void const *search_value, void const **node_data) {
+	assert(snapshot != NULL);
+	assert(snapshot->tree != NULL);
+	assert(node_data != NULL);
+
+	return _get_helper(
+	    (struct avl_node *)snapshot->root, search_value, node_data, snapshot->tree->cmp_func);
+}
+
+int avl_snapshot_traverse(
+    struct avl_snapshot const *snapshot,
+    int (*preorder_func)(struct avl_node const *node, void *arg), void *preorder_arg,
+    int (*inorder_func)(struct avl_node const *node, void *arg), void *inorder_arg,
+    int (*postorder_func)(struct avl_node const *node, void *arg), void *postorder_arg) {
+	assert(snapshot != NULL);
+	assert(snapshot->tree != NULL);
+
+	return _avl_subtree_traverse(
+	    snapshot->root, preorder_func, preorder_arg, inorder_func, inorder_arg, postorder_func,
+	    postorder_arg);
+}
+
+int avl_cursor_open(struct avl_cursor *cursor, struct avl_tree const *tree) {
+	assert(cursor != NULL);
+	assert(tree != NULL);
+
+	if ((tree->flags & (AVL_TREE_WRITER_PREFERENCE | AVL_TREE_PERSISTENT)) ==
+	    AVL_TREE_WRITER_PREFERENCE) {
+		// A writer-preferring lock cannot be read-locked again by the cursor's thread once a writer
+		// queues up, so every read it makes while the cursor is open could deadlock
+		return -EINVAL;
+	}
+
+	cursor->tree = tree;
+	cursor->depth = 0;
+
+	if (tree->flags & AVL_TREE_PERSISTENT) {
+		// Pin one version instead of holding writers off
+		int rc = avl_tree_snapshot(tree, &cursor->snapshot);
+		if (rc < 0) {
+			return rc;
+		}
+		cursor->root = cursor->snapshot.root;
+	} else {
+		_read_lock(tree);
+		cursor->root = tree->root;
+	}
+
+	return 0;
+}
+
+void avl_cursor_close(struct avl_cursor *cursor) {
+	assert(cursor != NULL);
+	assert(cursor->tree != NULL);
+
+	if (cursor->tree->flags & AVL_TREE_PERSISTENT) {
+		avl_snapshot_release(&cursor->snapshot);
+	} else {
+		_read_unlock(cursor->tree);
+	}
+
+	cursor->tree = NULL;
+	cursor->root = NULL;
+	cursor->depth = 0;
+}
+
+void _cursor_descend(struct avl_cursor *cursor, struct avl_node const *node, enum weight side) {
+	// Push node and then its leftmost (or rightmost) descendants
+	while (node != NULL) {
+		assert(cursor->depth < AVL_MAX_HEIGHT);
+		cursor->path[cursor->depth++] = node;
+		node = side == LEFT ? node->left : node->right;
+	}
+}
+
+int avl_cursor_first(struct avl_cursor *cursor) {
+	assert(cursor != NULL);
+
+	cursor->depth = 0;
+	_cursor_descend(cursor, cursor->root, LEFT);
+
+	return cursor->depth != 0;
+}
+
+int avl_cursor_last(struct avl_cursor *cursor) {
+	assert(cursor != NULL);
+
+	cursor->depth = 0;
+	_cursor_descend(cursor, cursor->root, RIGHT);
+
+	return cursor->depth != 0;
+}
+
+int avl_cursor_seek(struct avl_cursor *cursor, void const *search_value) {
+	assert(cursor != NULL);
+
+	int (*cmp_func)(void const *new_value, void const *node_value) = cursor->tree->cmp_func;
+
+	// Lands on the first value that is not less than search_value
+	int candidate = 0;
+	cursor->depth = 0;
+	for (struct avl_node const *node = cursor->root; node != NULL;) {
+		assert(cursor->depth < AVL_MAX_HEIGHT);
+		cursor->path[cursor->depth++] = node;
+
+		int direction = cmp_func(search_value, node->value);
+		if (direction < 0) {
+			// This node is a candidate, but something smaller may still qualify
+			candidate = cursor->depth;
+			node = node->left;
+		} else if (0 < direction) {
+			node = node->right;
+		} else {
+			return true;
+		}
+	}
+
+	// Everything below the last candidate was smaller than search_value
+	cursor->depth = candidate;
+
+	return cursor->depth != 0;
+}
+
+int _cursor_step(struct avl_cursor *cursor, enum weight side) {
+	assert(cursor != NULL);
+
+	if (cursor->depth == 0) {
+		return false;
+	}
+
+	struct avl_node const *node = cursor->path[cursor->depth - 1];
+	struct avl_node const *child = side == RIGHT ? node->right : node->left;
+
+	if (child != NULL) {
+		// The neighbour is the nearest node on the far side of the subtree in that direction
+		_cursor_descend(cursor, child, -side);
+		return true;
+	}
+
+	// Otherwise climb until we come up from the near side of an ancestor
+	for (;;) {
+		--cursor->depth;
+		if (cursor->depth == 0) {
+			return false;
+		}
+
+		struct avl_node const *parent = cursor->path[cursor->depth - 1];
+		if ((side == RIGHT ? parent->left : parent->right) == node) {
+			return true;
+		}
+		node = parent;
+	}
+}
+
+int avl_cursor_next(struct avl_cursor *cursor) {
+	return _cursor_step(cursor, RIGHT);
+}
+
+int avl_cursor_prev(struct avl_cursor *cursor) {
+	return _cursor_step(cursor, LEFT);
+}
+
+int avl_cursor_valid(struct avl_cursor const *cursor) {
+	assert(cursor != NULL);
+	return cursor->depth != 0;
+}
+
+void const *avl_cursor_value(struct avl_cursor const *cursor) {
+	assert(cursor != NULL);
+	assert(cursor->depth != 0);
+	return cursor->path[cursor->depth - 1]->value;
+}
+
+void const *avl_cursor_data(struct avl_cursor const *cursor) {
+	assert(cursor != NULL);
+	assert(cursor->depth != 0);
+	return cursor->path[cursor->depth - 1]->data;
+}
+
 void avl_node_print(struct avl_node const *node) {
 	printf("(v: %p, d: %p, b: %d)\n", node->value, node->data, node->balance);
 }
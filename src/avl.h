@@ -1,20 +1,123 @@
 #ifndef AVL_C_SRC_AVL_H
 #define AVL_C_SRC_AVL_H
 
-#include <semaphore.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 
-struct avl_node;
+// Upper bound on the height of any AVL tree that fits in memory (about 1.44 * log2(n))
+#define AVL_MAX_HEIGHT 92
+
+struct avl_combiner;
+struct avl_epoch;
+struct avl_version;
+struct avl_slab;
+struct avl_workers;
+
+/**
+ * @brief Where a tree keeps one entry
+ *
+ * Allocated by the tree for avl_tree_add, or embedded by the caller in its own record for
+ * avl_tree_link (see AVL_TREE_INTRUSIVE and avl_container_of). The fields belong to the tree while
+ * the node is linked; use avl_node_value and avl_node_data to read them.
+ */
+struct avl_node {
+	void const *value;
+	void const *data;
+	struct avl_node *left;
+	struct avl_node *right;
+	int32_t balance;
+	// Number of nodes in this subtree, only maintained with AVL_TREE_ORDER_STATISTICS. It sits in
+	// what would otherwise be padding, which caps such trees at UINT32_MAX entries.
+	uint32_t size;
+};
+
+// The record of the given type whose member is the given node
+#define avl_container_of(node, type, member) \
+	((type *)((char *)(node) - offsetof(type, member)))
+
+/**
+ * @brief Options accepted by avl_tree_create_flags()
+ */
+enum avl_tree_flag {
+	// Queue new readers behind waiting writers so a steady stream of gets cannot starve adds and
+	// removes
+	AVL_TREE_WRITER_PREFERENCE = 1 << 0,
+	// Let avl_tree_get descend without touching the lock, validating the result against a sequence
+	// counter bumped by every writer. Removed nodes are reclaimed only once no lookup can reach them,
+	// so values handed to the tree must stay valid for cmp_func until the tree is freed or
+	// avl_tree_synchronize() returns.
+	AVL_TREE_OPTIMISTIC_READS = 1 << 1,
+	// Never modify a node that readers can see: avl_tree_add and avl_tree_remove copy the path they
+	// change and publish a new root. Lookups, traversals and snapshots then run without any lock
+	// while writers keep going. The same lifetime rule as for AVL_TREE_OPTIMISTIC_READS applies to
+	// removed values.
+	AVL_TREE_PERSISTENT = 1 << 2,
+	// Allocate nodes from a pool owned by the tree instead of one malloc per node. avl_tree_free
+	// then releases every node at once: its free_node_func may clean up values and data but must
+	// not free the node itself, and passing NULL makes teardown independent of the tree's size.
+	AVL_TREE_NODE_POOL = 1 << 3,
+	// Keep the size of every subtree up to date so that avl_tree_rank, avl_tree_select and
+	// avl_tree_count_range run in O(log n). Such trees hold at most UINT32_MAX entries: adds, builds,
+	// joins and unions that could take them past it fail with -EOVERFLOW.
+	AVL_TREE_ORDER_STATISTICS = 1 << 4,
+	// Nodes are owned by the caller, who embeds them in its own records and hands them over with
+	// avl_tree_link; the tree never allocates or frees one. avl_tree_add, avl_tree_remove and
+	// avl_tree_build_sorted are not available, and neither are the options that make the tree free
+	// nodes on its own (AVL_TREE_OPTIMISTIC_READS, AVL_TREE_PERSISTENT and AVL_TREE_NODE_POOL).
+	AVL_TREE_INTRUSIVE = 1 << 5,
+	// Have avl_tree_add, avl_tree_remove and avl_tree_get publish their operation for whichever
+	// thread holds the exclusive lock to apply, so that under contention one thread does many
+	// operations per lock handover. Gets are only combined when they would otherwise take the lock
+	// (without AVL_TREE_OPTIMISTIC_READS or AVL_TREE_PERSISTENT).
+	AVL_TREE_FLAT_COMBINING = 1 << 6,
+};
 
 struct avl_tree {
 	struct avl_node *root;
 	int (*cmp_func)(void const *new_value, void const *node_value);
-	sem_t *lock;
+	// Shared by avl_tree_get and avl_tree_traverse, exclusive for avl_tree_add and avl_tree_remove
+	pthread_rwlock_t *lock;
+	uint32_t flags;
+	// Odd while a writer is modifying the tree (AVL_TREE_OPTIMISTIC_READS only)
+	_Atomic uint64_t sequence;
+	// Deferred reclamation of removed nodes (AVL_TREE_OPTIMISTIC_READS and AVL_TREE_PERSISTENT)
+	struct avl_epoch *epoch;
+	// Version being built by the current writer (AVL_TREE_PERSISTENT only)
+	struct avl_version *version;
+	// Where nodes come from (AVL_TREE_NODE_POOL only)
+	struct avl_slab *slab;
+	// Where operations wait to be applied in batches (AVL_TREE_FLAT_COMBINING only)
+	struct avl_combiner *combiner;
+	// Smallest and largest entries, kept by writers so that avl_tree_min and avl_tree_max need no
+	// descent; meaningless while root is NULL
+	struct {
+		void const *value;
+		void const *data;
+	} min, max;
+};
+
+/**
+ * @brief A consistent, read-only view of an AVL_TREE_PERSISTENT tree
+ *
+ * Taking one costs O(1) and holds no lock. Nodes reachable from it are not reclaimed until it is
+ * released, so long scans should not keep one open forever.
+ */
+struct avl_snapshot {
+	struct avl_tree const *tree;
+	struct avl_node const *root;
+	uint64_t token;
 };
 
 int avl_tree_create(
     struct avl_tree **tree, int (*cmp_func)(void const *new_value, void const *node_value));
 
+int avl_tree_create_flags(
+    struct avl_tree **tree, int (*cmp_func)(void const *new_value, void const *node_value),
+    uint32_t flags);
+
 void avl_tree_free(
     struct avl_tree **tree, int (*free_node_func)(struct avl_node const *node, void *arg),
     void *free_arg);
@@ -24,18 +127,258 @@ void const *avl_node_data(struct avl_node const *node);
 
 int avl_tree_add(struct avl_tree *tree, void const *new_value, void const *new_data);
 
+int avl_tree_build_sorted(
+    struct avl_tree *tree, void const *const *values, void const *const *data, size_t count);
+
+int avl_tree_link(
+    struct avl_tree *tree, struct avl_node *node, void const *value, void const *data);
+
+int avl_tree_unlink(struct avl_tree *tree, void const *search_value, struct avl_node **node);
+
+int avl_tree_find(struct avl_tree const *tree, void const *search_value, struct avl_node **node);
+
 int avl_tree_get(struct avl_tree const *tree, void const *search_value, void const **node_data);
 
+// Looks up count values at once and returns how many were found, so count is at most INT_MAX;
+// larger groups get -EOVERFLOW
+int avl_tree_get_many(
+    struct avl_tree const *tree, void const *const *search_values, size_t count,
+    void const **node_data, int *found);
+
 int avl_tree_remove(
     struct avl_tree *tree, void const *search_value, void const **node_value,
     void const **node_data);
 
+// Returns once every node removed so far has been freed, which waits for all optimistic lookups,
+// snapshots and persistent cursors open at the time of the call. Writers are not held up meanwhile.
+// The calling thread must not hold a snapshot or persistent cursor itself, or it waits forever.
+void avl_tree_synchronize(struct avl_tree *tree);
+
+// Moves the entries less than search_value into a new tree *left and the rest into a new tree
+// *right, leaving tree empty. avl_tree_join moves every entry of right into left, all of which
+// have to be greater than the ones in left. Both relink nodes instead of copying them and run in
+// O(log n), but are not available for AVL_TREE_OPTIMISTIC_READS, AVL_TREE_PERSISTENT or
+// AVL_TREE_NODE_POOL trees, and join requires both trees to share cmp_func and flags.
+int avl_tree_split(
+    struct avl_tree *tree, void const *search_value, struct avl_tree **left,
+    struct avl_tree **right);
+
+int avl_tree_join(struct avl_tree *left, struct avl_tree *right);
+
+// Set operations on two trees with the same cmp_func and flags, and the same restrictions as
+// avl_tree_join. tree ends up with the entries in either tree, in both or only in tree, keeping its
+// own entry where both have one. avl_tree_union moves other's entries over and leaves it empty; the
+// others only read other. Entries that end up in neither tree are handed to drop_func (if any)
+// after both trees are unlocked, and then freed unless the trees are AVL_TREE_INTRUSIVE. Both
+// inputs are divided around each other's keys and joined back, which is O(m log(n / m + 1)) work
+// for sizes m <= n; if workers is not NULL, independent halves run on it in parallel.
+int avl_tree_union(
+    struct avl_tree *tree, struct avl_tree *other, struct avl_workers *workers,
+    int (*drop_func)(struct avl_node const *node, void *arg), void *drop_arg);
+
+int avl_tree_intersect(
+    struct avl_tree *tree, struct avl_tree const *other, struct avl_workers *workers,
+    int (*drop_func)(struct avl_node const *node, void *arg), void *drop_arg);
+
+int avl_tree_difference(
+    struct avl_tree *tree, struct avl_tree const *other, struct avl_workers *workers,
+    int (*drop_func)(struct avl_node const *node, void *arg), void *drop_arg);
+
+enum avl_batch_kind { AVL_BATCH_ADD, AVL_BATCH_REMOVE };
+
+/**
+ * @brief One change applied by avl_tree_apply_batch()
+ */
+struct avl_batch_op {
+	enum avl_batch_kind kind;
+	void const *value;
+	// Only used by AVL_BATCH_ADD
+	void const *data;
+	// What avl_tree_add or avl_tree_remove would have returned for this operation
+	int result;
+	// What an AVL_BATCH_REMOVE took out of the tree, NULL otherwise
+	void const *node_value;
+	void const *node_data;
+};
+
+// Applies ops in key order under one lock, each descent starting where the previous one parted
+// from its path, so batches of neighbouring keys take far fewer comparisons than single calls
+int avl_tree_apply_batch(struct avl_tree *tree, struct avl_batch_op *ops, size_t count);
+
 int avl_tree_traverse(
     struct avl_tree const *tree, int (*preorder_func)(struct avl_node const *node, void *arg),
     void *preorder_arg, int (*inorder_func)(struct avl_node const *node, void *arg),
     void *inorder_arg, int (*postorder_func)(struct avl_node const *node, void *arg),
     void *postorder_arg);
 
+/**
+ * @brief How avl_tree_parallel_reduce folds a tree into one result
+ *
+ * Each part of the tree handed to a worker is folded into an accumulator of its own, starting from
+ * init_func, and the accumulators are combined in key order. combine_func therefore has to be
+ * associative, but not commutative: concatenating values in order gives the same result as a
+ * sequential in-order traversal.
+ */
+struct avl_reduce {
+	// Bytes in an accumulator, which is also what the result is
+	size_t size;
+	void (*init_func)(void *accumulator, void *arg);
+	void (*accumulate_func)(void *accumulator, struct avl_node const *node, void *arg);
+	// Folds other, which covers entries after the ones already in accumulator, into accumulator
+	void (*combine_func)(void *accumulator, void const *other, void *arg);
+	void *arg;
+};
+
+// Visit every node with the tree read-locked (or pinned to one snapshot), spreading disjoint
+// subtrees over workers; with NULL workers everything runs on the calling thread.
+// avl_tree_parallel_for_each calls func from any thread and in no particular order, and a negative
+// return from it stops the walk and is returned.
+int avl_tree_parallel_for_each(
+    struct avl_tree const *tree, struct avl_workers *workers,
+    int (*func)(struct avl_node const *node, void *arg), void *arg);
+
+int avl_tree_parallel_reduce(
+    struct avl_tree const *tree, struct avl_workers *workers, struct avl_reduce const *reduce,
+    void *result);
+
+enum avl_range_flag {
+	AVL_RANGE_LO_INCLUSIVE = 1 << 0,
+	AVL_RANGE_HI_INCLUSIVE = 1 << 1,
+	// Ignore lo or hi, so the range is open on that end
+	AVL_RANGE_LO_UNBOUNDED = 1 << 2,
+	AVL_RANGE_HI_UNBOUNDED = 1 << 3,
+};
+
+// Calls func on every node between lo and hi in order (descending for avl_tree_range_reverse),
+// visiting O(log n + k) nodes. A negative return from func stops the scan and is returned.
+int avl_tree_range(
+    struct avl_tree const *tree, void const *lo, void const *hi, uint32_t flags,
+    int (*func)(struct avl_node const *node, void *arg), void *arg);
+
+int avl_tree_range_reverse(
+    struct avl_tree const *tree, void const *lo, void const *hi, uint32_t flags,
+    int (*func)(struct avl_node const *node, void *arg), void *arg);
+
+// Nearest entries around search_value: floor is the largest one not greater than it, ceiling and
+// lower_bound the smallest one not less than it, and upper_bound the smallest one greater than it.
+// They return true and fill in node_value and node_data if there is such an entry.
+int avl_tree_floor(
+    struct avl_tree const *tree, void const *search_value, void const **node_value,
+    void const **node_data);
+
+int avl_tree_ceiling(
+    struct avl_tree const *tree, void const *search_value, void const **node_value,
+    void const **node_data);
+
+int avl_tree_lower_bound(
+    struct avl_tree const *tree, void const *search_value, void const **node_value,
+    void const **node_data);
+
+int avl_tree_upper_bound(
+    struct avl_tree const *tree, void const *search_value, void const **node_value,
+    void const **node_data);
+
+int avl_tree_min(struct avl_tree const *tree, void const **node_value, void const **node_data);
+
+int avl_tree_max(struct avl_tree const *tree, void const **node_value, void const **node_data);
+
+int avl_tree_rank(struct avl_tree const *tree, void const *search_value, size_t *rank);
+
+int avl_tree_select(
+    struct avl_tree const *tree, size_t rank, void const **node_value, void const **node_data);
+
+int avl_tree_count_range(
+    struct avl_tree const *tree, void const *lo, void const *hi, uint32_t flags, size_t *count);
+
+/**
+ * @brief An in-order position in a tree that the caller steps through
+ *
+ * While a cursor is open the tree is read-locked (or, for AVL_TREE_PERSISTENT trees, pinned to one
+ * snapshot), so the thread that opened it must not modify the tree until it is closed. It may still
+ * read it, with more cursors, lookups or range scans, as in a merge of a tree with itself: the lock
+ * is taken again recursively, which AVL_TREE_WRITER_PREFERENCE locks do not allow once a writer
+ * waits, so avl_cursor_open() turns such trees down with -EINVAL unless they are also persistent.
+ * Each step costs amortized O(1); the cursor keeps the path from the root to its node.
+ */
+struct avl_cursor {
+	struct avl_tree const *tree;
+	struct avl_snapshot snapshot;
+	struct avl_node const *root;
+	struct avl_node const *path[AVL_MAX_HEIGHT];
+	// Length of path; 0 once the cursor has moved past either end
+	int depth;
+};
+
+int avl_tree_snapshot(struct avl_tree const *tree, struct avl_snapshot *snapshot);
+
+void avl_snapshot_release(struct avl_snapshot *snapshot);
+
+int avl_snapshot_get(
+    struct avl_snapshot const *snapshot, void const *search_value, void const **node_data);
+
+int avl_snapshot_traverse(
+    struct avl_snapshot const *snapshot,
+    int (*preorder_func)(struct avl_node const *node, void *arg), void *preorder_arg,
+    int (*inorder_func)(struct avl_node const *node, void *arg), void *inorder_arg,
+    int (*postorder_func)(struct avl_node const *node, void *arg), void *postorder_arg);
+
+int avl_cursor_open(struct avl_cursor *cursor, struct avl_tree const *tree);
+
+void avl_cursor_close(struct avl_cursor *cursor);
+
+int avl_cursor_first(struct avl_cursor *cursor);
+
+int avl_cursor_last(struct avl_cursor *cursor);
+
+int avl_cursor_seek(struct avl_cursor *cursor, void const *search_value);
+
+int avl_cursor_next(struct avl_cursor *cursor);
+
+int avl_cursor_prev(struct avl_cursor *cursor);
+
+int avl_cursor_valid(struct avl_cursor const *cursor);
+
+void const *avl_cursor_value(struct avl_cursor const *cursor);
+
+void const *avl_cursor_data(struct avl_cursor const *cursor);
+
+enum avl_save_flag {
+	// Values are integers cast to pointers that increase with cmp_func. Each is stored as a varint of
+	// its distance from the previous one, and the codec only sees data. The codec may then be NULL to
+	// save the values alone; they load back with NULL data.
+	AVL_SAVE_INTEGER_VALUES = 1 << 0,
+};
+
+/**
+ * @brief How avl_tree_save writes entries and avl_tree_load reads them back
+ */
+struct avl_codec {
+	// Encodes one entry (only its data with AVL_SAVE_INTEGER_VALUES) into buffer, which has room for
+	// *size bytes, and sets *size to the length used. If that is not enough, returns -ENOSPC with
+	// *size set to what it needs, and is called again with a buffer that large.
+	int (*encode_func)(
+	    void const *value, void const *data, uint8_t *buffer, size_t *size, void *arg);
+	// Rebuilds an entry from the size bytes encode_func wrote. With AVL_SAVE_INTEGER_VALUES, *value
+	// already holds the value.
+	int (*decode_func)(
+	    uint8_t const *buffer, size_t size, void const **value, void const **data, void *arg);
+	// Gives back what decode_func returned when loading fails before the tree takes it; may be NULL
+	void (*release_func)(void const *value, void const *data, void *arg);
+	void *arg;
+};
+
+// Streams the entries to file in order: a header, one length-prefixed record per entry, and a
+// trailer with the entry count and a CRC-32 of everything before it. The tree stays read-locked
+// (or pinned to one snapshot) throughout.
+int avl_tree_save(
+    struct avl_tree const *tree, FILE *file, uint32_t flags, struct avl_codec const *codec);
+
+// Reads a file written by avl_tree_save into an empty tree, checking order and checksum before
+// building it in O(n) with avl_tree_build_sorted. Corrupt or truncated files, and files
+// avl_tree_save did not write, fail with -EBADMSG; files with payloads need a codec that decodes
+// them, or fail with -EINVAL.
+int avl_tree_load(struct avl_tree *tree, FILE *file, struct avl_codec const *codec);
+
 // void avl_node_print(struct avl_node const *node);
 
 int avl_tree_print(struct avl_tree const *tree);
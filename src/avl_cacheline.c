@@ -0,0 +1,16 @@
+#include "avl_cacheline.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+void *avl_cacheline_alloc(size_t size) {
+	// aligned_alloc() takes whole cache lines only
+	size_t lines = size == 0 ? 1 : (size + AVL_CACHE_LINE - 1) / AVL_CACHE_LINE;
+
+	void *ptr = aligned_alloc(AVL_CACHE_LINE, lines * AVL_CACHE_LINE);
+	if (ptr == NULL) {
+		perror("aligned_alloc(AVL_CACHE_LINE, lines * AVL_CACHE_LINE)");
+	}
+
+	return ptr;
+}
@@ -0,0 +1,18 @@
+#ifndef AVL_C_SRC_AVL_CACHELINE_H
+#define AVL_C_SRC_AVL_CACHELINE_H
+
+#include <stddef.h>
+
+/*
+ * Memory that has to start on a cache line. Structures that keep what different threads write on
+ * separate lines (per-thread slots, per-shard guards, per-node replicas) are declared aligned to
+ * one, and so are layouts fetched a line at a time, but that only holds if the allocation starts on
+ * a line too, while malloc() merely aligns for max_align_t. Release with free().
+ */
+
+#define AVL_CACHE_LINE 64
+
+// Like malloc(), including errno, but cache-line aligned; reports failures with perror()
+void *avl_cacheline_alloc(size_t size);
+
+#endif  // AVL_C_SRC_AVL_CACHELINE_H
@@ -0,0 +1,146 @@
+#include "avl_combiner.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "avl_cacheline.h"
+
+// Slot states. Only the owner moves a slot out of EMPTY and back into it, only the combiner from
+// PENDING to DONE.
+enum { SLOT_EMPTY, SLOT_CLAIMED, SLOT_PENDING, SLOT_DONE };
+
+// Passes a combiner makes over the slots at most, picking up operations published meanwhile
+#define COMBINE_PASSES 4
+
+// Checks of its own slot a waiting thread makes before it yields
+#define SPIN_COUNT 100
+
+static atomic_uint _next_slot;
+static _Thread_local unsigned _thread_slot = AVL_COMBINER_SLOTS;
+
+unsigned _combiner_slot() {
+	if (_thread_slot == AVL_COMBINER_SLOTS) {
+		// Hand slots out round-robin, as avl_epoch does
+		unsigned slot = atomic_fetch_add_explicit(&_next_slot, 1, memory_order_relaxed);
+		_thread_slot = slot % AVL_COMBINER_SLOTS;
+	}
+
+	return _thread_slot;
+}
+
+int avl_combiner_create(
+    struct avl_combiner **combiner, void (*combine_func)(void **ops, size_t count, void *arg),
+    void *combine_arg) {
+	assert(combiner != NULL);
+	assert(*combiner == NULL);
+	assert(combine_func != NULL);
+
+	*combiner = avl_cacheline_alloc(sizeof(**combiner));
+	if (*combiner == NULL) {
+		return -errno;
+	}
+
+	memset(*combiner, 0, sizeof(**combiner));
+	int rc = pthread_mutex_init(&(*combiner)->lock, NULL);
+	if (rc != 0) {
+		free(*combiner);
+		*combiner = NULL;
+		return -rc;
+	}
+	(*combiner)->combine_func = combine_func;
+	(*combiner)->combine_arg = combine_arg;
+	atomic_init(&(*combiner)->used, 0);
+	for (int i = 0; i < AVL_COMBINER_SLOTS; ++i) {
+		atomic_init(&(*combiner)->slots[i].state, SLOT_EMPTY);
+	}
+
+	return 0;
+}
+
+void avl_combiner_free(struct avl_combiner **combiner) {
+	assert(combiner != NULL);
+	assert(*combiner != NULL);
+
+	pthread_mutex_destroy(&(*combiner)->lock);
+	free(*combiner);
+	*combiner = NULL;
+}
+
+void _combiner_pass(struct avl_combiner *combiner) {
+	void *ops[AVL_COMBINER_SLOTS];
+	struct avl_combiner_slot *slots[AVL_COMBINER_SLOTS];
+
+	for (int pass = 0; pass < COMBINE_PASSES; ++pass) {
+		unsigned used = atomic_load_explicit(&combiner->used, memory_order_acquire);
+		size_t count = 0;
+		for (unsigned i = 0; i < used; ++i) {
+			struct avl_combiner_slot *slot = &combiner->slots[i];
+			if (atomic_load_explicit(&slot->state, memory_order_acquire) == SLOT_PENDING) {
+				ops[count] = slot->op;
+				slots[count] = slot;
+				++count;
+			}
+		}
+
+		if (count == 0) {
+			return;
+		}
+
+		combiner->combine_func(ops, count, combiner->combine_arg);
+
+		// The owners read their results as soon as they see this
+		for (size_t i = 0; i < count; ++i) {
+			atomic_store_explicit(&slots[i]->state, SLOT_DONE, memory_order_release);
+		}
+	}
+}
+
+int avl_combiner_apply(struct avl_combiner *combiner, void *op) {
+	assert(combiner != NULL);
+
+	unsigned index = _combiner_slot();
+	struct avl_combiner_slot *slot = &combiner->slots[index];
+
+	int expected = SLOT_EMPTY;
+	if (!atomic_compare_exchange_strong_explicit(
+	        &slot->state, &expected, SLOT_CLAIMED, memory_order_acquire, memory_order_relaxed)) {
+		// Another thread sharing the slot is in the middle of an operation
+		return -EBUSY;
+	}
+
+	// Make sure the next pass looks this far
+	unsigned used = atomic_load_explicit(&combiner->used, memory_order_relaxed);
+	while (used <= index && !atomic_compare_exchange_weak_explicit(
+	                            &combiner->used, &used, index + 1, memory_order_release,
+	                            memory_order_relaxed)) {
+	}
+
+	slot->op = op;
+	atomic_store_explicit(&slot->state, SLOT_PENDING, memory_order_release);
+
+	while (atomic_load_explicit(&slot->state, memory_order_acquire) != SLOT_DONE) {
+		if (pthread_mutex_trylock(&combiner->lock) == 0) {
+			_combiner_pass(combiner);
+			pthread_mutex_unlock(&combiner->lock);
+			continue;
+		}
+
+		// Somebody else is combining and may well take our operation along; wait on our own cache
+		// line rather than hammering the lock's
+		for (int i = 0; i < SPIN_COUNT; ++i) {
+			if (atomic_load_explicit(&slot->state, memory_order_acquire) == SLOT_DONE) {
+				break;
+			}
+		}
+		if (atomic_load_explicit(&slot->state, memory_order_acquire) != SLOT_DONE) {
+			sched_yield();
+		}
+	}
+
+	atomic_store_explicit(&slot->state, SLOT_EMPTY, memory_order_release);
+	return 0;
+}
@@ -0,0 +1,51 @@
+#ifndef AVL_C_SRC_AVL_COMBINER_H
+#define AVL_C_SRC_AVL_COMBINER_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+/*
+ * Flat combining, after Hendler, Incze, Shavit and Tzafrir, "Flat Combining and the
+ * Synchronization-Parallelism Tradeoff" (SPAA 2010).
+ *
+ * Instead of queueing on a lock one operation at a time, threads publish their operation in a slot
+ * of their own, and whichever thread gets hold of the combiner lock hands everything published so
+ * far to combine_func in one call. The data structure stays in that thread's cache for the whole
+ * batch, and the lock changes hands once per batch rather than once per operation.
+ *
+ * Slots are cache-line-sized and picked per thread as in avl_epoch. Threads beyond
+ * AVL_COMBINER_SLOTS share slots; one that finds its slot busy is told so and must apply its
+ * operation some other way.
+ */
+
+#define AVL_COMBINER_SLOTS 64
+
+struct avl_combiner_slot {
+	// See the states in avl_combiner.c
+	_Atomic int state;
+	// Owned by the publishing thread, which waits on the stack until it is done
+	void *op;
+} __attribute__((aligned(64)));
+
+struct avl_combiner {
+	// Held by the thread combining
+	pthread_mutex_t lock;
+	void (*combine_func)(void **ops, size_t count, void *arg);
+	void *combine_arg;
+	// One past the highest slot ever published to, so passes skip slots no thread uses
+	atomic_uint used;
+	struct avl_combiner_slot slots[AVL_COMBINER_SLOTS];
+};
+
+int avl_combiner_create(
+    struct avl_combiner **combiner, void (*combine_func)(void **ops, size_t count, void *arg),
+    void *combine_arg);
+
+void avl_combiner_free(struct avl_combiner **combiner);
+
+// Returns once combine_func has seen op, or -EBUSY without publishing if this thread's slot is
+// taken by another thread
+int avl_combiner_apply(struct avl_combiner *combiner, void *op);
+
+#endif  // AVL_C_SRC_AVL_COMBINER_H
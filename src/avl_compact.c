@@ -0,0 +1,484 @@
+#include "avl_compact.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "avl.h"
+#include "avl_compact_internal.h"
+
+enum compact_weight { LEFT = -1, BALANCED = 0, RIGHT = 1 };
+
+// The first allocation is small so that tiny trees stay tiny
+#define MIN_CAPACITY 64
+
+size_t _compact_node_size(uint32_t flags) {
+	return sizeof(struct avl_compact_node) + (flags & AVL_COMPACT_SET ? 0 : sizeof(void const *));
+}
+
+struct avl_compact_node *_compact_node(struct avl_compact_tree const *tree, uint32_t index) {
+	return (struct avl_compact_node *)(tree->nodes + (size_t)index * tree->node_size);
+}
+
+void const **_compact_data(struct avl_compact_node *node) {
+	// Only valid outside set mode
+	return (void const **)(node + 1);
+}
+
+uint32_t _compact_child(uint32_t const *link) {
+	return *link >> 1;
+}
+
+void _compact_child_set(uint32_t *link, uint32_t index) {
+	// The low bit belongs to the balance of the node that owns the link
+	*link = index << 1 | (*link & 1);
+}
+
+int _compact_balance(struct avl_compact_node const *node) {
+	return (int)(node->right & 1) - (int)(node->left & 1);
+}
+
+void _compact_balance_set(struct avl_compact_node *node, int balance) {
+	node->left = (node->left & ~UINT32_C(1)) | (balance < 0);
+	node->right = (node->right & ~UINT32_C(1)) | (0 < balance);
+}
+
+uint32_t *_compact_link(
+    struct avl_compact_tree *tree, uint32_t const path[], int8_t const directions[], int depth) {
+	// Where the node at this depth of the path hangs. Computed from indices rather than kept as
+	// pointers, because growing the array moves every node.
+	if (depth == 0) {
+		return &tree->root;
+	}
+
+	struct avl_compact_node *parent = _compact_node(tree, path[depth - 1]);
+	return directions[depth - 1] == LEFT ? &parent->left : &parent->right;
+}
+
+int _compact_grow(struct avl_compact_tree *tree, size_t capacity) {
+	if (capacity <= tree->capacity) {
+		return 0;
+	}
+	if (AVL_COMPACT_MAX_NODES + 1 < capacity) {
+		// Indices would not fit in their 31 bits
+		return -ENOSPC;
+	}
+
+	char *nodes = realloc(tree->nodes, capacity * tree->node_size);
+	if (nodes == NULL) {
+		perror("realloc(tree->nodes, capacity * tree->node_size)");
+		return -errno;
+	}
+
+	tree->nodes = nodes;
+	tree->capacity = capacity;
+
+	return 0;
+}
+
+int64_t _compact_alloc(struct avl_compact_tree *tree) {
+	if (tree->free_list != 0) {
+		uint32_t index = tree->free_list;
+		tree->free_list = _compact_child(&_compact_node(tree, index)->left);
+		return index;
+	}
+
+	// Slot 0 counts as used before the array even exists
+	if (tree->capacity <= tree->used) {
+		size_t capacity = tree->capacity < MIN_CAPACITY ? MIN_CAPACITY : 2 * (size_t)tree->capacity;
+		if (AVL_COMPACT_MAX_NODES + 1 < capacity) {
+			capacity = AVL_COMPACT_MAX_NODES + 1;
+		}
+
+		int rc = _compact_grow(tree, capacity);
+		if (rc < 0) {
+			return rc;
+		}
+		if (tree->capacity <= tree->used) {
+			return -ENOSPC;
+		}
+	}
+
+	return tree->used++;
+}
+
+void _compact_release(struct avl_compact_tree *tree, uint32_t index) {
+	_compact_node(tree, index)->left = tree->free_list << 1;
+	tree->free_list = index;
+}
+
+int avl_compact_create(
+    struct avl_compact_tree **tree, int (*cmp_func)(void const *new_value, void const *node_value),
+    uint32_t flags) {
+	assert(tree != NULL);
+	assert(*tree == NULL);
+	assert(cmp_func != NULL);
+
+	*tree = malloc(sizeof(**tree));
+	if (*tree == NULL) {
+		perror("malloc(sizeof(**tree))");
+		return -errno;
+	}
+
+	(*tree)->nodes = NULL;
+	(*tree)->node_size = _compact_node_size(flags);
+	(*tree)->capacity = 0;
+	// Slot 0 stands for "no child" and is never handed out
+	(*tree)->used = 1;
+	(*tree)->free_list = 0;
+	(*tree)->root = 0;
+	(*tree)->count = 0;
+	(*tree)->cmp_func = cmp_func;
+	(*tree)->flags = flags;
+
+	int rc = pthread_rwlock_init(&(*tree)->lock, NULL);
+	if (rc != 0) {
+		free(*tree);
+		*tree = NULL;
+		return -rc;
+	}
+
+	return 0;
+}
+
+void avl_compact_free(
+    struct avl_compact_tree **tree,
+    int (*free_func)(void const *value, void const *data, void *arg), void *free_arg) {
+	assert(tree != NULL);
+	assert(*tree != NULL);
+
+	// Nodes go with the array; only what they point to needs the caller
+	if (free_func != NULL) {
+		avl_compact_traverse(*tree, free_func, free_arg);
+	}
+
+	pthread_rwlock_destroy(&(*tree)->lock);
+	free((*tree)->nodes);
+	free(*tree);
+	*tree = NULL;
+}
+
+int avl_compact_reserve(struct avl_compact_tree *tree, size_t count) {
+	assert(tree != NULL);
+
+	// Growing to the final size in one step also avoids copying the array at every doubling
+	pthread_rwlock_wrlock(&tree->lock);
+	int rc = _compact_grow(tree, (size_t)tree->used + count);
+	pthread_rwlock_unlock(&tree->lock);
+
+	return rc;
+}
+
+void _compact_rotate_left(struct avl_compact_tree *tree, uint32_t *link) {
+	uint32_t index = _compact_child(link);
+	struct avl_compact_node *node = _compact_node(tree, index);
+	uint32_t prior_right = _compact_child(&node->right);
+
+	// Everything to the left of prior_right is attached to the node's right
+	_compact_child_set(&node->right, _compact_child(&_compact_node(tree, prior_right)->left));
+	_compact_child_set(&_compact_node(tree, prior_right)->left, index);
+	_compact_child_set(link, prior_right);
+}
+
+void _compact_rotate_right(struct avl_compact_tree *tree, uint32_t *link) {
+	uint32_t index = _compact_child(link);
+	struct avl_compact_node *node = _compact_node(tree, index);
+	uint32_t prior_left = _compact_child(&node->left);
+
+	// Everything to the right of prior_left is attached to the node's left
+	_compact_child_set(&node->left, _compact_child(&_compact_node(tree, prior_left)->right));
+	_compact_child_set(&_compact_node(tree, prior_left)->right, index);
+	_compact_child_set(link, prior_left);
+}
+
+void _compact_rebalance(struct avl_compact_tree *tree, uint32_t *link, int side, bool *decrease) {
+	// The subtree on side is two levels taller than the other, which the node's bits cannot even
+	// record; these are the cases of _balance_left and _balance_right in avl.c
+	struct avl_compact_node *node = _compact_node(tree, _compact_child(link));
+	struct avl_compact_node *child =
+	    _compact_node(tree, _compact_child(side == LEFT ? &node->left : &node->right));
+	int child_balance = _compact_balance(child);
+
+	if (child_balance == side) {
+		// left-left or right-right tree
+		_compact_balance_set(node, BALANCED);
+		_compact_balance_set(child, BALANCED);
+	} else if (child_balance == -side) {
+		// left-right or right-left tree
+		struct avl_compact_node *grandchild =
+		    _compact_node(tree, _compact_child(side == LEFT ? &child->right : &child->left));
+		int grandchild_balance = _compact_balance(grandchild);
+		_compact_balance_set(node, grandchild_balance == side ? -side : BALANCED);
+		_compact_balance_set(child, grandchild_balance == -side ? side : BALANCED);
+		_compact_balance_set(grandchild, BALANCED);
+
+		if (side == LEFT) {
+			_compact_rotate_left(tree, &node->left);
+		} else {
+			_compact_rotate_right(tree, &node->right);
+		}
+	} else {
+		// The height of the subtree will remain the same after rotating. Occurs only during removals.
+		_compact_balance_set(node, side);
+		_compact_balance_set(child, -side);
+		*decrease = false;
+	}
+
+	if (side == LEFT) {
+		_compact_rotate_right(tree, link);
+	} else {
+		_compact_rotate_left(tree, link);
+	}
+}
+
+int _compact_add_locked(struct avl_compact_tree *tree, void const *value, void const *data) {
+	uint32_t path[AVL_MAX_HEIGHT];
+	int8_t directions[AVL_MAX_HEIGHT];
+	// Only nodes below the deepest unbalanced one on the path can change their balance
+	int critical = 0;
+	int depth = 0;
+
+	for (uint32_t index = _compact_child(&tree->root); index != 0;) {
+		struct avl_compact_node *node = _compact_node(tree, index);
+		int direction = tree->cmp_func(value, node->value);
+
+		if (direction == 0) {
+			// There already exists a node with this value
+			return false;
+		}
+
+		if (_compact_balance(node) != BALANCED) {
+			critical = depth;
+		}
+
+		assert(depth < AVL_MAX_HEIGHT);
+		path[depth] = index;
+		directions[depth] = direction < 0 ? LEFT : RIGHT;
+		++depth;
+		index = _compact_child(direction < 0 ? &node->left : &node->right);
+	}
+
+	int64_t index = _compact_alloc(tree);
+	if (index < 0) {
+		return index;
+	}
+
+	struct avl_compact_node *node = _compact_node(tree, index);
+	node->value = value;
+	node->left = 0;
+	node->right = 0;
+	if (!(tree->flags & AVL_COMPACT_SET)) {
+		*_compact_data(node) = data;
+	}
+	_compact_child_set(_compact_link(tree, path, directions, depth), index);
+	++tree->count;
+
+	// Everything between the critical node and the new leaf was balanced and now leans towards it
+	for (int i = critical + 1; i < depth; ++i) {
+		_compact_balance_set(_compact_node(tree, path[i]), directions[i]);
+	}
+
+	if (depth != 0) {
+		struct avl_compact_node *top = _compact_node(tree, path[critical]);
+		int balance = _compact_balance(top) + directions[critical];
+
+		if (LEFT <= balance && balance <= RIGHT) {
+			_compact_balance_set(top, balance);
+		} else {
+			bool decrease = true;
+			_compact_rebalance(
+			    tree, _compact_link(tree, path, directions, critical), directions[critical], &decrease);
+		}
+	}
+
+	return true;
+}
+
+int avl_compact_add(struct avl_compact_tree *tree, void const *value, void const *data) {
+	assert(tree != NULL);
+
+	pthread_rwlock_wrlock(&tree->lock);
+	int rc = _compact_add_locked(tree, value, data);
+	pthread_rwlock_unlock(&tree->lock);
+
+	return rc;
+}
+
+int _compact_get_locked(
+    struct avl_compact_tree const *tree, void const *search_value, void const **node_data) {
+	for (uint32_t index = _compact_child(&tree->root); index != 0;) {
+		struct avl_compact_node *node = _compact_node(tree, index);
+		int direction = tree->cmp_func(search_value, node->value);
+
+		if (direction == 0) {
+			if (node_data != NULL) {
+				*node_data = tree->flags & AVL_COMPACT_SET ? NULL : *_compact_data(node);
+			}
+			return true;
+		}
+
+		index = _compact_child(direction < 0 ? &node->left : &node->right);
+	}
+
+	return false;
+}
+
+int avl_compact_get(
+    struct avl_compact_tree *tree, void const *search_value, void const **node_data) {
+	assert(tree != NULL);
+
+	pthread_rwlock_rdlock(&tree->lock);
+	int rc = _compact_get_locked(tree, search_value, node_data);
+	pthread_rwlock_unlock(&tree->lock);
+
+	return rc;
+}
+
+int _compact_remove_locked(
+    struct avl_compact_tree *tree, void const *search_value, void const **node_value,
+    void const **node_data) {
+	uint32_t path[AVL_MAX_HEIGHT];
+	int8_t directions[AVL_MAX_HEIGHT];
+	int depth = 0;
+
+	uint32_t index = _compact_child(&tree->root);
+	for (;;) {
+		if (index == 0) {
+			// We didn't find the node
+			return false;
+		}
+
+		struct avl_compact_node *node = _compact_node(tree, index);
+		int direction = tree->cmp_func(search_value, node->value);
+		if (direction == 0) {
+			break;
+		}
+
+		assert(depth < AVL_MAX_HEIGHT);
+		path[depth] = index;
+		directions[depth] = direction < 0 ? LEFT : RIGHT;
+		++depth;
+		index = _compact_child(direction < 0 ? &node->left : &node->right);
+	}
+
+	struct avl_compact_node *found_node = _compact_node(tree, index);
+
+	// Save this node's value and data just in case it needs to be freed externally
+	*node_value = found_node->value;
+	*node_data = tree->flags & AVL_COMPACT_SET ? NULL : *_compact_data(found_node);
+
+	if (_compact_child(&found_node->left) != 0 && _compact_child(&found_node->right) != 0) {
+		// With two children, the inorder predecessor (which has no right child) is unlinked instead
+		path[depth] = index;
+		directions[depth] = LEFT;
+		++depth;
+		for (index = _compact_child(&found_node->left);
+		     _compact_child(&_compact_node(tree, index)->right) != 0;
+		     index = _compact_child(&_compact_node(tree, index)->right)) {
+			assert(depth < AVL_MAX_HEIGHT);
+			path[depth] = index;
+			directions[depth] = RIGHT;
+			++depth;
+		}
+
+		// Nodes have no identity here, so the predecessor's contents simply move up
+		struct avl_compact_node *predecessor = _compact_node(tree, index);
+		found_node->value = predecessor->value;
+		if (!(tree->flags & AVL_COMPACT_SET)) {
+			*_compact_data(found_node) = *_compact_data(predecessor);
+		}
+	}
+
+	// Put the node's only child (if any) in its position
+	struct avl_compact_node *old_node = _compact_node(tree, index);
+	uint32_t child = _compact_child(&old_node->left);
+	if (child == 0) {
+		child = _compact_child(&old_node->right);
+	}
+	_compact_child_set(_compact_link(tree, path, directions, depth), child);
+	_compact_release(tree, index);
+	--tree->count;
+
+	// Walk back up while the subtree we came from keeps getting shorter
+	for (int i = depth - 1; 0 <= i; --i) {
+		struct avl_compact_node *node = _compact_node(tree, path[i]);
+
+		// The side we removed from is now shorter, so the node leans the other way
+		int balance = _compact_balance(node) - directions[i];
+
+		if (balance == -directions[i]) {
+			// The node was balanced before, so its overall height did not decrease
+			_compact_balance_set(node, balance);
+			break;
+		} else if (balance == BALANCED) {
+			// One shorter, so the parent may need rebalancing too
+			_compact_balance_set(node, balance);
+		} else {
+			bool decrease = true;
+			_compact_rebalance(tree, _compact_link(tree, path, directions, i), -directions[i], &decrease);
+			if (!decrease) {
+				break;
+			}
+		}
+	}
+
+	return true;
+}
+
+int avl_compact_remove(
+    struct avl_compact_tree *tree, void const *search_value, void const **node_value,
+    void const **node_data) {
+	assert(tree != NULL);
+	assert(node_value != NULL);
+	assert(node_data != NULL);
+
+	pthread_rwlock_wrlock(&tree->lock);
+	int rc = _compact_remove_locked(tree, search_value, node_value, node_data);
+	pthread_rwlock_unlock(&tree->lock);
+
+	return rc;
+}
+
+int _compact_traverse_locked(
+    struct avl_compact_tree const *tree,
+    int (*inorder_func)(void const *value, void const *data, void *arg), void *arg) {
+	uint32_t stack[AVL_MAX_HEIGHT];
+	int depth = 0;
+	int rc = 0;
+
+	uint32_t index = _compact_child(&tree->root);
+	while (index != 0 || depth != 0) {
+		// Go down the left branch
+		for (; index != 0; index = _compact_child(&_compact_node(tree, index)->left)) {
+			assert(depth < AVL_MAX_HEIGHT);
+			stack[depth++] = index;
+		}
+
+		struct avl_compact_node *node = _compact_node(tree, stack[--depth]);
+		rc = inorder_func(
+		    node->value, tree->flags & AVL_COMPACT_SET ? NULL : *_compact_data(node), arg);
+		if (rc <= -1) {
+			break;
+		}
+
+		// Then the right one
+		index = _compact_child(&node->right);
+	}
+
+	return rc <= -1 ? rc : 0;
+}
+
+int avl_compact_traverse(
+    struct avl_compact_tree *tree,
+    int (*inorder_func)(void const *value, void const *data, void *arg), void *arg) {
+	assert(tree != NULL);
+	assert(inorder_func != NULL);
+
+	pthread_rwlock_rdlock(&tree->lock);
+	int rc = _compact_traverse_locked(tree, inorder_func, arg);
+	pthread_rwlock_unlock(&tree->lock);
+
+	return rc;
+}
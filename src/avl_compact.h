@@ -0,0 +1,78 @@
+#ifndef AVL_C_SRC_AVL_COMPACT_H
+#define AVL_C_SRC_AVL_COMPACT_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * AVL tree with its nodes packed into one growable array.
+ *
+ * Children are 31-bit indices into the array, and the balance factor takes the low bit of each of
+ * the two links. A node costs 16 bytes in set mode (AVL_COMPACT_SET: value and links only) and 24
+ * bytes with data. A struct avl_node costs 40 bytes, plus 8 to 16 bytes of malloc overhead unless
+ * the tree uses AVL_TREE_NODE_POOL. The array doubles as it grows, so up to half of it may sit
+ * unused unless avl_compact_reserve() sized it up front. Removed nodes are reused by later adds.
+ *
+ * add, get, remove and traverse behave like their avl_tree counterparts, with the same
+ * reader-writer locking. None of the avl_tree_flag options are available.
+ */
+
+// Index 0 means "no child", and indices have to fit in 31 bits
+#define AVL_COMPACT_MAX_NODES ((UINT32_C(1) << 31) - 2)
+
+enum avl_compact_flag {
+	// Store values only; data arguments are ignored and data results are always NULL
+	AVL_COMPACT_SET = 1 << 0,
+};
+
+struct avl_compact_node {
+	void const *value;
+	// Child index << 1; the low bits are set on the left for LEFT and on the right for RIGHT balance
+	uint32_t left;
+	uint32_t right;
+	// Followed by void const *data unless the tree is in set mode
+};
+
+struct avl_compact_tree {
+	// Node i starts at nodes + i * node_size; slot 0 is never used
+	char *nodes;
+	size_t node_size;
+	uint32_t capacity;
+	// Slots handed out so far, counting slot 0
+	uint32_t used;
+	// Removed nodes waiting to be reused, linked through their left link
+	uint32_t free_list;
+	// Index of the root << 1, like a child link
+	uint32_t root;
+	size_t count;
+	int (*cmp_func)(void const *new_value, void const *node_value);
+	uint32_t flags;
+	// Shared by get and traverse, exclusive for everything that changes the tree
+	pthread_rwlock_t lock;
+};
+
+int avl_compact_create(
+    struct avl_compact_tree **tree, int (*cmp_func)(void const *new_value, void const *node_value),
+    uint32_t flags);
+
+void avl_compact_free(
+    struct avl_compact_tree **tree,
+    int (*free_func)(void const *value, void const *data, void *arg), void *free_arg);
+
+int avl_compact_reserve(struct avl_compact_tree *tree, size_t count);
+
+int avl_compact_add(struct avl_compact_tree *tree, void const *value, void const *data);
+
+int avl_compact_get(
+    struct avl_compact_tree *tree, void const *search_value, void const **node_data);
+
+int avl_compact_remove(
+    struct avl_compact_tree *tree, void const *search_value, void const **node_value,
+    void const **node_data);
+
+int avl_compact_traverse(
+    struct avl_compact_tree *tree,
+    int (*inorder_func)(void const *value, void const *data, void *arg), void *arg);
+
+#endif  // AVL_C_SRC_AVL_COMPACT_H
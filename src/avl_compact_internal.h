@@ -0,0 +1,28 @@
+#ifndef AVL_C_SRC_AVL_COMPACT_INTERNAL_H
+#define AVL_C_SRC_AVL_COMPACT_INTERNAL_H
+
+#include "avl_compact.h"
+
+/*
+ * The avl_compact operations without taking tree->lock, shared with avl_shm, whose lock and nodes
+ * live in a shared mapping. Not part of the public interface.
+ */
+
+// Bytes per node for a tree with these flags: the data pointer follows unless AVL_COMPACT_SET
+size_t _compact_node_size(uint32_t flags);
+
+// _compact_add_locked grows the array when it is full, so callers with a fixed one check first.
+int _compact_add_locked(struct avl_compact_tree *tree, void const *value, void const *data);
+
+int _compact_get_locked(
+    struct avl_compact_tree const *tree, void const *search_value, void const **node_data);
+
+int _compact_remove_locked(
+    struct avl_compact_tree *tree, void const *search_value, void const **node_value,
+    void const **node_data);
+
+int _compact_traverse_locked(
+    struct avl_compact_tree const *tree,
+    int (*inorder_func)(void const *value, void const *data, void *arg), void *arg);
+
+#endif  // AVL_C_SRC_AVL_COMPACT_INTERNAL_H
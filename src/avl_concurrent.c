@@ -0,0 +1,884 @@
+#include "avl_concurrent.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+char const avl_concurrent_absent[1];
+
+enum concurrent_direction { LEFT = -1, RIGHT = 1 };
+
+// A changing node is being rotated down, so a search passing through it right now may miss nodes
+// that moved up; an unlinked node has left the tree for good. Every finished change adds a step.
+#define VERSION_UNLINKED UINT64_C(1)
+#define VERSION_CHANGING UINT64_C(2)
+#define VERSION_STEP UINT64_C(4)
+
+// An attempt was overtaken by a rotation and has to be repeated from its parent; never returned
+#define RETRY (-EAGAIN)
+
+// What _concurrent_condition() reports besides a new height
+#define UNLINK_REQUIRED (-1)
+#define REBALANCE_REQUIRED (-2)
+#define NOTHING_REQUIRED (-3)
+
+// Reads of a changing node spin this long before blocking on the lock of the rotating thread
+#define SPIN_COUNT 100
+
+struct update {
+	struct avl_concurrent_tree *tree;
+	void const *value;
+	// The data to add, or AVL_CONCURRENT_ABSENT to remove
+	void const *data;
+	// Allocated right before it is needed, and kept across retries
+	struct avl_concurrent_node *leaf;
+	// The data of the removed entry
+	void const *found;
+	// Set when an add filled in a routing node instead of using the leaf
+	bool revived;
+	// Nodes unlinked so far, retired once the update is out of the epoch
+	struct avl_concurrent_node *retired;
+};
+
+struct avl_concurrent_node *_concurrent_child(struct avl_concurrent_node *node, int direction) {
+	return __atomic_load_n(direction == LEFT ? &node->left : &node->right, __ATOMIC_ACQUIRE);
+}
+
+struct avl_concurrent_node *_concurrent_parent(struct avl_concurrent_node *node) {
+	return __atomic_load_n(&node->parent, __ATOMIC_ACQUIRE);
+}
+
+void _concurrent_link(
+    struct avl_concurrent_node *parent, int direction, struct avl_concurrent_node *child) {
+	// Called with the locks of the parent and of the child's old parent held
+	__atomic_store_n(direction == LEFT ? &parent->left : &parent->right, child, __ATOMIC_RELEASE);
+	if (child != NULL) {
+		__atomic_store_n(&child->parent, parent, __ATOMIC_RELEASE);
+	}
+}
+
+int _concurrent_direction(struct avl_concurrent_node *parent, struct avl_concurrent_node *child) {
+	return _concurrent_child(parent, LEFT) == child ? LEFT : RIGHT;
+}
+
+void const *_concurrent_data(struct avl_concurrent_node *node) {
+	return __atomic_load_n(&node->data, __ATOMIC_ACQUIRE);
+}
+
+int32_t _concurrent_height(struct avl_concurrent_node *node) {
+	// Only a hint outside the node's lock; whoever acts on it checks again under the lock
+	return node == NULL ? 0 : __atomic_load_n(&node->height, __ATOMIC_RELAXED);
+}
+
+void _concurrent_height_set(struct avl_concurrent_node *node, int32_t height) {
+	__atomic_store_n(&node->height, height, __ATOMIC_RELAXED);
+}
+
+uint64_t _concurrent_version(struct avl_concurrent_node *node) {
+	return __atomic_load_n(&node->version, __ATOMIC_ACQUIRE);
+}
+
+bool _concurrent_changed(struct avl_concurrent_node *node, uint64_t version) {
+	return _concurrent_version(node) != version;
+}
+
+void _concurrent_begin_change(struct avl_concurrent_node *node) {
+	uint64_t version = __atomic_load_n(&node->version, __ATOMIC_RELAXED);
+	__atomic_store_n(&node->version, version | VERSION_CHANGING, __ATOMIC_RELAXED);
+
+	// Whoever sees a link moved by this change also sees that it started
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void _concurrent_end_change(struct avl_concurrent_node *node) {
+	uint64_t version = __atomic_load_n(&node->version, __ATOMIC_RELAXED);
+	__atomic_store_n(
+	    &node->version, (version & ~VERSION_CHANGING) + VERSION_STEP, __ATOMIC_RELEASE);
+}
+
+void _concurrent_wait(struct avl_concurrent_node *node, uint64_t version) {
+	if (!(version & VERSION_CHANGING)) {
+		return;
+	}
+
+	for (int i = 0; i < SPIN_COUNT; ++i) {
+		if (_concurrent_changed(node, version)) {
+			return;
+		}
+	}
+
+	// Rotations hold the lock of the node they move down from start to finish
+	pthread_mutex_lock(&node->lock);
+	pthread_mutex_unlock(&node->lock);
+}
+
+int _concurrent_cmp(struct avl_concurrent_tree *tree, void const *value, void const *node_value) {
+	int direction = tree->cmp_func(value, node_value);
+	return direction < 0 ? LEFT : (0 < direction ? RIGHT : 0);
+}
+
+struct avl_concurrent_node *_concurrent_node_create(void const *value, void const *data) {
+	struct avl_concurrent_node *node = malloc(sizeof(*node));
+	if (node == NULL) {
+		perror("malloc(sizeof(*node))");
+		return NULL;
+	}
+
+	node->value = value;
+	node->data = data;
+	node->parent = NULL;
+	node->left = NULL;
+	node->right = NULL;
+	node->height = 1;
+	node->version = 0;
+	pthread_mutex_init(&node->lock, NULL);
+	node->retired = NULL;
+
+	return node;
+}
+
+void _concurrent_node_release(struct avl_concurrent_tree *tree, struct avl_concurrent_node *node) {
+	if (tree->release_func != NULL) {
+		tree->release_func(node->value, tree->release_arg);
+	}
+
+	pthread_mutex_destroy(&node->lock);
+	free(node);
+}
+
+void _concurrent_reclaim(void *ptr, void *arg) {
+	_concurrent_node_release(arg, ptr);
+}
+
+void _concurrent_retire(struct avl_concurrent_tree *tree, struct avl_concurrent_node *retired) {
+	if (retired == NULL) {
+		return;
+	}
+
+	// Outside the epoch, so that a retire which has to wait for readers never waits for itself
+	pthread_mutex_lock(&tree->retire_lock);
+	while (retired != NULL) {
+		struct avl_concurrent_node *next = retired->retired;
+		avl_epoch_retire(tree->epoch, retired);
+		retired = next;
+	}
+	avl_epoch_reclaim(tree->epoch);
+	pthread_mutex_unlock(&tree->retire_lock);
+}
+
+int avl_concurrent_create(
+    struct avl_concurrent_tree **tree,
+    int (*cmp_func)(void const *new_value, void const *node_value),
+    void (*release_func)(void const *value, void *arg), void *release_arg) {
+	assert(tree != NULL);
+	assert(*tree == NULL);
+	assert(cmp_func != NULL);
+
+	*tree = malloc(sizeof(**tree));
+	if (*tree == NULL) {
+		perror("malloc(sizeof(**tree))");
+		return -errno;
+	}
+
+	struct avl_concurrent_node *holder = &(*tree)->holder;
+	holder->value = NULL;
+	holder->data = AVL_CONCURRENT_ABSENT;
+	holder->parent = NULL;
+	holder->left = NULL;
+	holder->right = NULL;
+	holder->height = 0;
+	// Never changes: the holder is never rotated, so searches can always restart from it
+	holder->version = 0;
+	pthread_mutex_init(&holder->lock, NULL);
+	holder->retired = NULL;
+
+	(*tree)->cmp_func = cmp_func;
+	(*tree)->release_func = release_func;
+	(*tree)->release_arg = release_arg;
+	pthread_mutex_init(&(*tree)->retire_lock, NULL);
+
+	(*tree)->epoch = NULL;
+	int rc = avl_epoch_create(&(*tree)->epoch, _concurrent_reclaim, *tree);
+	if (rc < 0) {
+		pthread_mutex_destroy(&(*tree)->retire_lock);
+		pthread_mutex_destroy(&holder->lock);
+		free(*tree);
+		*tree = NULL;
+	}
+
+	return rc;
+}
+
+void avl_concurrent_free(
+    struct avl_concurrent_tree **tree,
+    int (*free_func)(void const *value, void const *data, void *arg), void *free_arg) {
+	assert(tree != NULL);
+	assert(*tree != NULL);
+
+	// Unlinked nodes first; they are no longer reachable from the root
+	avl_epoch_free(&(*tree)->epoch);
+
+	// Without recursion: pending nodes are stacked through their retired links
+	struct avl_concurrent_node *pending = (*tree)->holder.right;
+	if (pending != NULL) {
+		pending->retired = NULL;
+	}
+	while (pending != NULL) {
+		struct avl_concurrent_node *node = pending;
+		pending = node->retired;
+
+		struct avl_concurrent_node *children[2] = {node->left, node->right};
+		for (int i = 0; i < 2; ++i) {
+			if (children[i] != NULL) {
+				children[i]->retired = pending;
+				pending = children[i];
+			}
+		}
+
+		if (free_func != NULL && node->data != AVL_CONCURRENT_ABSENT) {
+			free_func(node->value, node->data, free_arg);
+		}
+		_concurrent_node_release(*tree, node);
+	}
+
+	pthread_mutex_destroy(&(*tree)->retire_lock);
+	pthread_mutex_destroy(&(*tree)->holder.lock);
+	free(*tree);
+	*tree = NULL;
+}
+
+int _concurrent_get(
+    struct avl_concurrent_tree *tree, void const *search_value, struct avl_concurrent_node *node,
+    int direction, uint64_t version, void const **node_data) {
+	// Searches the subtree in the given direction of node, as long as node keeps the version
+	for (;;) {
+		struct avl_concurrent_node *child = _concurrent_child(node, direction);
+		if (child == NULL) {
+			return _concurrent_changed(node, version) ? RETRY : false;
+		}
+
+		int child_direction = _concurrent_cmp(tree, search_value, child->value);
+		if (child_direction == 0) {
+			// Unlinking empties a node before it leaves, so this is right as of now either way
+			void const *data = _concurrent_data(child);
+			if (data == AVL_CONCURRENT_ABSENT) {
+				return false;
+			}
+
+			*node_data = data;
+			return true;
+		}
+
+		uint64_t child_version = _concurrent_version(child);
+		if (child_version & (VERSION_CHANGING | VERSION_UNLINKED)) {
+			_concurrent_wait(child, child_version);
+		} else if (child == _concurrent_child(node, direction)) {
+			// The child was node's as of the version, so the search may go down
+			if (_concurrent_changed(node, version)) {
+				return RETRY;
+			}
+
+			int rc = _concurrent_get(
+			    tree, search_value, child, child_direction, child_version, node_data);
+			if (rc != RETRY) {
+				return rc;
+			}
+		}
+
+		if (_concurrent_changed(node, version)) {
+			return RETRY;
+		}
+	}
+}
+
+int avl_concurrent_get(
+    struct avl_concurrent_tree *tree, void const *search_value, void const **node_data) {
+	assert(tree != NULL);
+	assert(node_data != NULL);
+
+	uint64_t token = avl_epoch_enter(tree->epoch);
+
+	// The holder never changes, so nothing is ever retried past it
+	int rc = _concurrent_get(tree, search_value, &tree->holder, RIGHT, 0, node_data);
+	assert(rc != RETRY);
+
+	avl_epoch_exit(tree->epoch, token);
+
+	return rc;
+}
+
+int _concurrent_condition(struct avl_concurrent_node *node) {
+	struct avl_concurrent_node *left = _concurrent_child(node, LEFT);
+	struct avl_concurrent_node *right = _concurrent_child(node, RIGHT);
+
+	// Routing nodes are only kept while they have two children to route between
+	if ((left == NULL || right == NULL) && _concurrent_data(node) == AVL_CONCURRENT_ABSENT) {
+		return UNLINK_REQUIRED;
+	}
+
+	int32_t left_height = _concurrent_height(left);
+	int32_t right_height = _concurrent_height(right);
+	int32_t balance = left_height - right_height;
+	if (balance < -1 || 1 < balance) {
+		return REBALANCE_REQUIRED;
+	}
+
+	int32_t height = 1 + (left_height < right_height ? right_height : left_height);
+	return height != _concurrent_height(node) ? height : NOTHING_REQUIRED;
+}
+
+struct avl_concurrent_node *_concurrent_fix_height(struct avl_concurrent_node *node) {
+	// Called with the node's lock held. Returns the next node that may need fixing, if any.
+	int condition = _concurrent_condition(node);
+	switch (condition) {
+		case UNLINK_REQUIRED:
+		case REBALANCE_REQUIRED:
+			// Needs the parent's lock too
+			return node;
+		case NOTHING_REQUIRED:
+			return NULL;
+		default:
+			_concurrent_height_set(node, condition);
+			return _concurrent_parent(node);
+	}
+}
+
+bool _concurrent_unlink(
+    struct update *update, struct avl_concurrent_node *parent, struct avl_concurrent_node *node) {
+	// Called with the locks of parent and node held
+	int direction;
+	if (_concurrent_child(parent, LEFT) == node) {
+		direction = LEFT;
+	} else if (_concurrent_child(parent, RIGHT) == node) {
+		direction = RIGHT;
+	} else {
+		return false;
+	}
+
+	struct avl_concurrent_node *left = _concurrent_child(node, LEFT);
+	struct avl_concurrent_node *right = _concurrent_child(node, RIGHT);
+	if (left != NULL && right != NULL) {
+		return false;
+	}
+
+	// Searches inside node may go on through its old links, and are sent back by the version
+	_concurrent_link(parent, direction, left != NULL ? left : right);
+	__atomic_store_n(&node->version, VERSION_UNLINKED, __ATOMIC_RELEASE);
+	__atomic_store_n(&node->data, AVL_CONCURRENT_ABSENT, __ATOMIC_RELEASE);
+
+	node->retired = update->retired;
+	update->retired = node;
+
+	return true;
+}
+
+struct avl_concurrent_node *_concurrent_rotate(
+    struct avl_concurrent_node *parent, struct avl_concurrent_node *node,
+    struct avl_concurrent_node *heavy, int32_t short_height, int32_t outer_height,
+    struct avl_concurrent_node *inner, int32_t inner_height, int direction) {
+	// Moves node down in the given direction and its heavy child up, with parent, node and heavy
+	// locked. Returns the next node that may need fixing, if any.
+	int parent_direction = _concurrent_direction(parent, node);
+
+	// Node is the only one to lose descendants
+	_concurrent_begin_change(node);
+
+	_concurrent_link(node, -direction, inner);
+	_concurrent_link(heavy, direction, node);
+	_concurrent_link(parent, parent_direction, heavy);
+
+	int32_t node_height = 1 + (inner_height < short_height ? short_height : inner_height);
+	_concurrent_height_set(node, node_height);
+	_concurrent_height_set(heavy, 1 + (outer_height < node_height ? node_height : outer_height));
+
+	_concurrent_end_change(node);
+
+	// The rotation may have left work for the nodes it moved, before their ancestors
+	int32_t node_balance = inner_height - short_height;
+	if (node_balance < -1 || 1 < node_balance) {
+		return node;
+	}
+	if ((inner == NULL || short_height == 0) && _concurrent_data(node) == AVL_CONCURRENT_ABSENT) {
+		return node;
+	}
+
+	int32_t heavy_balance = outer_height - node_height;
+	if (heavy_balance < -1 || 1 < heavy_balance) {
+		return heavy;
+	}
+	if (outer_height == 0 && _concurrent_data(heavy) == AVL_CONCURRENT_ABSENT) {
+		return heavy;
+	}
+
+	return _concurrent_fix_height(parent);
+}
+
+struct avl_concurrent_node *_concurrent_rotate_double(
+    struct avl_concurrent_node *parent, struct avl_concurrent_node *node,
+    struct avl_concurrent_node *heavy, int32_t short_height, int32_t outer_height,
+    struct avl_concurrent_node *inner, int32_t inner_near_height, int direction) {
+	// Moves node down in the given direction and heavy down the other way, bringing up inner, the
+	// heavy child's child on the near side. All four are locked.
+	int parent_direction = _concurrent_direction(parent, node);
+	struct avl_concurrent_node *inner_near = _concurrent_child(inner, -direction);
+	struct avl_concurrent_node *inner_far = _concurrent_child(inner, direction);
+	int32_t inner_far_height = _concurrent_height(inner_far);
+
+	_concurrent_begin_change(node);
+	_concurrent_begin_change(heavy);
+
+	_concurrent_link(node, -direction, inner_far);
+	_concurrent_link(heavy, direction, inner_near);
+	_concurrent_link(inner, -direction, heavy);
+	_concurrent_link(inner, direction, node);
+	_concurrent_link(parent, parent_direction, inner);
+
+	int32_t node_height = 1 + (inner_far_height < short_height ? short_height : inner_far_height);
+	int32_t heavy_height =
+	    1 + (inner_near_height < outer_height ? outer_height : inner_near_height);
+	_concurrent_height_set(node, node_height);
+	_concurrent_height_set(heavy, heavy_height);
+	_concurrent_height_set(inner, 1 + (heavy_height < node_height ? node_height : heavy_height));
+
+	_concurrent_end_change(node);
+	_concurrent_end_change(heavy);
+
+	// Heavy was checked beforehand, so only node and inner can be left unbalanced
+	int32_t node_balance = inner_far_height - short_height;
+	if (node_balance < -1 || 1 < node_balance) {
+		return node;
+	}
+	if ((inner_far == NULL || short_height == 0) &&
+	    _concurrent_data(node) == AVL_CONCURRENT_ABSENT) {
+		return node;
+	}
+	if ((inner_near == NULL || outer_height == 0) &&
+	    _concurrent_data(heavy) == AVL_CONCURRENT_ABSENT) {
+		return heavy;
+	}
+
+	int32_t inner_balance = heavy_height - node_height;
+	if (inner_balance < -1 || 1 < inner_balance) {
+		return inner;
+	}
+
+	return _concurrent_fix_height(parent);
+}
+
+struct avl_concurrent_node *_concurrent_rebalance_to(
+    struct avl_concurrent_node *parent, struct avl_concurrent_node *node,
+    struct avl_concurrent_node *heavy, int32_t short_height, int direction) {
+	// Rotates node in the given direction, with parent and node locked
+	pthread_mutex_lock(&heavy->lock);
+
+	struct avl_concurrent_node *next;
+
+	int32_t heavy_height = _concurrent_height(heavy);
+	if (heavy_height - short_height <= 1) {
+		// Someone else got here first; check node again
+		next = node;
+		goto finish;
+	}
+
+	struct avl_concurrent_node *inner = _concurrent_child(heavy, direction);
+	int32_t outer_height = _concurrent_height(_concurrent_child(heavy, -direction));
+	int32_t inner_height = _concurrent_height(inner);
+	if (inner_height <= outer_height) {
+		next = _concurrent_rotate(
+		    parent, node, heavy, short_height, outer_height, inner, inner_height, direction);
+		goto finish;
+	}
+
+	pthread_mutex_lock(&inner->lock);
+
+	// The height read before the lock may have been stale
+	inner_height = _concurrent_height(inner);
+	if (inner_height <= outer_height) {
+		next = _concurrent_rotate(
+		    parent, node, heavy, short_height, outer_height, inner, inner_height, direction);
+		pthread_mutex_unlock(&inner->lock);
+		goto finish;
+	}
+
+	// A double rotation only helps if it leaves heavy balanced. Heavy may end up a routing node with
+	// one child, which is unlinked right after; skipping the rotation instead would get nowhere.
+	int32_t inner_near_height = _concurrent_height(_concurrent_child(inner, -direction));
+	int32_t heavy_balance = outer_height - inner_near_height;
+	if (-1 <= heavy_balance && heavy_balance <= 1) {
+		next = _concurrent_rotate_double(
+		    parent, node, heavy, short_height, outer_height, inner, inner_near_height, direction);
+		pthread_mutex_unlock(&inner->lock);
+		goto finish;
+	}
+	pthread_mutex_unlock(&inner->lock);
+
+	// Otherwise fix heavy first, by rotating it the other way
+	next = _concurrent_rebalance_to(node, heavy, inner, outer_height, -direction);
+
+finish:
+	pthread_mutex_unlock(&heavy->lock);
+
+	return next;
+}
+
+struct avl_concurrent_node *_concurrent_rebalance_node(
+    struct update *update, struct avl_concurrent_node *parent, struct avl_concurrent_node *node) {
+	// Called with the locks of parent and node held
+	struct avl_concurrent_node *left = _concurrent_child(node, LEFT);
+	struct avl_concurrent_node *right = _concurrent_child(node, RIGHT);
+
+	if ((left == NULL || right == NULL) && _concurrent_data(node) == AVL_CONCURRENT_ABSENT) {
+		return _concurrent_unlink(update, parent, node) ? _concurrent_fix_height(parent) : node;
+	}
+
+	int32_t left_height = _concurrent_height(left);
+	int32_t right_height = _concurrent_height(right);
+	int32_t balance = left_height - right_height;
+	if (1 < balance) {
+		return _concurrent_rebalance_to(parent, node, left, right_height, RIGHT);
+	}
+	if (balance < -1) {
+		return _concurrent_rebalance_to(parent, node, right, left_height, LEFT);
+	}
+
+	int32_t height = 1 + (left_height < right_height ? right_height : left_height);
+	if (height != _concurrent_height(node)) {
+		_concurrent_height_set(node, height);
+		return _concurrent_fix_height(parent);
+	}
+
+	return NULL;
+}
+
+void _concurrent_rebalance(struct update *update, struct avl_concurrent_node *node) {
+	// Walks up from a node whose subtree changed, until heights stop changing. A rotation that hands
+	// back one of the nodes it moved down has not fixed its parent yet, so from then on the walk
+	// goes all the way up to the holder, the only node without a parent.
+	bool climb = false;
+	while (node != NULL) {
+		struct avl_concurrent_node *parent = _concurrent_parent(node);
+		if (parent == NULL) {
+			return;
+		}
+
+		struct avl_concurrent_node *next;
+		int condition = _concurrent_condition(node);
+		if (condition == NOTHING_REQUIRED || _concurrent_version(node) == VERSION_UNLINKED) {
+			next = NULL;
+		} else if (condition != UNLINK_REQUIRED && condition != REBALANCE_REQUIRED) {
+			pthread_mutex_lock(&node->lock);
+			next = _concurrent_fix_height(node);
+			pthread_mutex_unlock(&node->lock);
+		} else {
+			// Unlinking and rotating change the parent's links; lock it first, as everywhere else
+			next = node;
+			pthread_mutex_lock(&parent->lock);
+			if (_concurrent_version(parent) != VERSION_UNLINKED && _concurrent_parent(node) == parent) {
+				pthread_mutex_lock(&node->lock);
+				if (_concurrent_version(node) != VERSION_UNLINKED) {
+					next = _concurrent_rebalance_node(update, parent, node);
+				}
+				pthread_mutex_unlock(&node->lock);
+			}
+			pthread_mutex_unlock(&parent->lock);
+
+			climb = climb || (next != NULL && next != parent && next != _concurrent_parent(parent));
+		}
+
+		node = next == NULL && climb ? parent : next;
+	}
+}
+
+int _concurrent_update(
+    struct update *update, struct avl_concurrent_node *parent, struct avl_concurrent_node *node,
+    uint64_t version);
+
+int _concurrent_update_child(
+    struct update *update, struct avl_concurrent_node *node, uint64_t version, int direction) {
+	// Updates the subtree in the given direction of node, as long as node keeps the version
+	for (;;) {
+		struct avl_concurrent_node *child = _concurrent_child(node, direction);
+		if (_concurrent_changed(node, version)) {
+			return RETRY;
+		}
+
+		if (child == NULL) {
+			if (update->data == AVL_CONCURRENT_ABSENT) {
+				return false;
+			}
+
+			// Never under a lock, and only once however often the update is retried
+			if (update->leaf == NULL) {
+				update->leaf = _concurrent_node_create(update->value, update->data);
+				if (update->leaf == NULL) {
+					return -ENOMEM;
+				}
+			}
+
+			pthread_mutex_lock(&node->lock);
+			if (_concurrent_changed(node, version)) {
+				pthread_mutex_unlock(&node->lock);
+				return RETRY;
+			}
+
+			// Another add may have taken the spot in the meantime
+			struct avl_concurrent_node *damaged = NULL;
+			bool added = _concurrent_child(node, direction) == NULL;
+			if (added) {
+				_concurrent_link(node, direction, update->leaf);
+				update->leaf = NULL;
+				damaged = _concurrent_fix_height(node);
+			}
+			pthread_mutex_unlock(&node->lock);
+
+			if (added) {
+				_concurrent_rebalance(update, damaged);
+				return true;
+			}
+			continue;
+		}
+
+		uint64_t child_version = _concurrent_version(child);
+		if (child_version & (VERSION_CHANGING | VERSION_UNLINKED)) {
+			_concurrent_wait(child, child_version);
+		} else if (child == _concurrent_child(node, direction)) {
+			if (_concurrent_changed(node, version)) {
+				return RETRY;
+			}
+
+			int rc = _concurrent_update(update, node, child, child_version);
+			if (rc != RETRY) {
+				return rc;
+			}
+		}
+	}
+}
+
+int _concurrent_update_node(
+    struct update *update, struct avl_concurrent_node *parent, struct avl_concurrent_node *node) {
+	// The node holds the value; only its data changes, unless a remove can unlink it right away
+	void const *data = _concurrent_data(node);
+
+	if (update->data != AVL_CONCURRENT_ABSENT) {
+		if (data != AVL_CONCURRENT_ABSENT) {
+			return false;
+		}
+
+		pthread_mutex_lock(&node->lock);
+		int rc = RETRY;
+		if (_concurrent_version(node) != VERSION_UNLINKED) {
+			rc = _concurrent_data(node) == AVL_CONCURRENT_ABSENT;
+			if (rc) {
+				__atomic_store_n(&node->data, update->data, __ATOMIC_RELEASE);
+				update->revived = true;
+			}
+		}
+		pthread_mutex_unlock(&node->lock);
+
+		return rc;
+	}
+
+	if (data == AVL_CONCURRENT_ABSENT) {
+		return false;
+	}
+
+	if (_concurrent_child(node, LEFT) == NULL || _concurrent_child(node, RIGHT) == NULL) {
+		// Unlinking changes the parent's links, so its lock comes first
+		pthread_mutex_lock(&parent->lock);
+		if (_concurrent_version(parent) == VERSION_UNLINKED || _concurrent_parent(node) != parent) {
+			pthread_mutex_unlock(&parent->lock);
+			return RETRY;
+		}
+
+		pthread_mutex_lock(&node->lock);
+		data = _concurrent_data(node);
+		int rc = data != AVL_CONCURRENT_ABSENT;
+		if (rc && !_concurrent_unlink(update, parent, node)) {
+			// A child was added, or node moved; try again from the parent
+			rc = RETRY;
+		}
+		pthread_mutex_unlock(&node->lock);
+
+		struct avl_concurrent_node *damaged = rc == true ? _concurrent_fix_height(parent) : NULL;
+		pthread_mutex_unlock(&parent->lock);
+
+		if (rc == true) {
+			update->found = data;
+			_concurrent_rebalance(update, damaged);
+		}
+		return rc;
+	}
+
+	pthread_mutex_lock(&node->lock);
+	int rc = RETRY;
+	if (_concurrent_version(node) != VERSION_UNLINKED) {
+		data = _concurrent_data(node);
+		rc = data != AVL_CONCURRENT_ABSENT;
+		if (rc && (_concurrent_child(node, LEFT) == NULL || _concurrent_child(node, RIGHT) == NULL)) {
+			// Lost a child in the meantime, so it has to be unlinked after all
+			rc = RETRY;
+		} else if (rc) {
+			// Left behind to route searches between its two children
+			__atomic_store_n(&node->data, AVL_CONCURRENT_ABSENT, __ATOMIC_RELEASE);
+			update->found = data;
+		}
+	}
+	pthread_mutex_unlock(&node->lock);
+
+	return rc;
+}
+
+int _concurrent_update(
+    struct update *update, struct avl_concurrent_node *parent, struct avl_concurrent_node *node,
+    uint64_t version) {
+	int direction = _concurrent_cmp(update->tree, update->value, node->value);
+	if (direction == 0) {
+		return _concurrent_update_node(update, parent, node);
+	}
+
+	return _concurrent_update_child(update, node, version, direction);
+}
+
+int _concurrent_apply(struct update *update) {
+	struct avl_concurrent_tree *tree = update->tree;
+
+	uint64_t token = avl_epoch_enter(tree->epoch);
+
+	// The holder never changes, so nothing is ever retried past it
+	int rc = _concurrent_update_child(update, &tree->holder, 0, RIGHT);
+	assert(rc != RETRY);
+
+	avl_epoch_exit(tree->epoch, token);
+
+	_concurrent_retire(tree, update->retired);
+
+	return rc;
+}
+
+int avl_concurrent_add(struct avl_concurrent_tree *tree, void const *value, void const *data) {
+	assert(tree != NULL);
+	assert(data != AVL_CONCURRENT_ABSENT);
+
+	struct update update = {
+	    .tree = tree,
+	    .value = value,
+	    .data = data,
+	    .leaf = NULL,
+	    .revived = false,
+	    .retired = NULL,
+	};
+	int rc = _concurrent_apply(&update);
+
+	// Never published, so nobody else can have seen it
+	if (update.leaf != NULL) {
+		pthread_mutex_destroy(&update.leaf->lock);
+		free(update.leaf);
+	}
+
+	// The node that was filled in keeps its own, equal value
+	if (update.revived && tree->release_func != NULL) {
+		tree->release_func(value, tree->release_arg);
+	}
+
+	return rc;
+}
+
+int avl_concurrent_remove(
+    struct avl_concurrent_tree *tree, void const *search_value, void const **node_data) {
+	assert(tree != NULL);
+	assert(node_data != NULL);
+
+	struct update update = {
+	    .tree = tree,
+	    .value = search_value,
+	    .data = AVL_CONCURRENT_ABSENT,
+	    .leaf = NULL,
+	    .revived = false,
+	    .retired = NULL,
+	};
+	int rc = _concurrent_apply(&update);
+	if (rc == true) {
+		*node_data = update.found;
+	}
+
+	return rc;
+}
+
+int _concurrent_next(
+    struct avl_concurrent_tree *tree, void const *const *after, struct avl_concurrent_node *node,
+    int direction, uint64_t version, struct avl_concurrent_node **next) {
+	// Finds the first node after *after (or the first node at all if after is NULL) in the subtree
+	// in the given direction of node, as long as node keeps the version
+	for (;;) {
+		struct avl_concurrent_node *child = _concurrent_child(node, direction);
+		if (child == NULL) {
+			*next = NULL;
+			return _concurrent_changed(node, version) ? RETRY : 0;
+		}
+
+		int child_direction =
+		    after == NULL || _concurrent_cmp(tree, *after, child->value) < 0 ? LEFT : RIGHT;
+
+		uint64_t child_version = _concurrent_version(child);
+		if (child_version & (VERSION_CHANGING | VERSION_UNLINKED)) {
+			_concurrent_wait(child, child_version);
+		} else if (child == _concurrent_child(node, direction)) {
+			if (_concurrent_changed(node, version)) {
+				return RETRY;
+			}
+
+			int rc = _concurrent_next(tree, after, child, child_direction, child_version, next);
+			if (rc != RETRY) {
+				// Nothing after it on its left, so the child itself comes next
+				if (*next == NULL && child_direction == LEFT) {
+					*next = child;
+				}
+				return rc;
+			}
+		}
+
+		if (_concurrent_changed(node, version)) {
+			return RETRY;
+		}
+	}
+}
+
+int avl_concurrent_traverse(
+    struct avl_concurrent_tree *tree,
+    int (*inorder_func)(void const *value, void const *data, void *arg), void *arg) {
+	assert(tree != NULL);
+	assert(inorder_func != NULL);
+
+	// One epoch for the whole walk: the last value seen has to stay valid for the next search
+	uint64_t token = avl_epoch_enter(tree->epoch);
+
+	int rc = 0;
+	void const *last = NULL;
+	void const *const *after = NULL;
+	for (;;) {
+		struct avl_concurrent_node *next;
+		rc = _concurrent_next(tree, after, &tree->holder, RIGHT, 0, &next);
+		assert(rc != RETRY);
+		if (next == NULL) {
+			break;
+		}
+
+		// Routing nodes are stepped over
+		void const *data = _concurrent_data(next);
+		if (data != AVL_CONCURRENT_ABSENT) {
+			rc = inorder_func(next->value, data, arg);
+			if (rc < 0) {
+				break;
+			}
+		}
+
+		last = next->value;
+		after = &last;
+	}
+
+	avl_epoch_exit(tree->epoch, token);
+
+	return rc < 0 ? rc : 0;
+}
@@ -0,0 +1,88 @@
+#ifndef AVL_C_SRC_AVL_CONCURRENT_H
+#define AVL_C_SRC_AVL_CONCURRENT_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "avl_epoch.h"
+
+/*
+ * AVL tree that takes adds and removes from many threads at once, after Bronson, Casper, Chafi and
+ * Olukotun, "A Practical Concurrent Binary Search Tree" (PPoPP 2010).
+ *
+ * Every node has its own lock and a version that changes whenever a rotation moves nodes out of its
+ * subtree. Lookups take no locks at all: each step of a descent is validated against the version of
+ * the node it came from, and only that step is retried if it was overtaken by a rotation. Writers
+ * lock just the nodes they change, and the thread that unbalanced a subtree fixes heights and
+ * rotates on the way back up, locking a parent, a node and at most two children at a time. Balance
+ * is relaxed while writers race, and strict again once they are done.
+ *
+ * Removing an entry whose node has two children leaves the node behind, empty, to route searches
+ * until rebalancing can unlink it; adding the value again fills it back in. So the tree may keep
+ * comparing against a value after its entry is gone, and values are handed to release_func (if
+ * any) only once no thread can still be looking at them. Unlinked nodes are reclaimed the same way,
+ * through an avl_epoch.
+ *
+ * add, get and remove mirror avl_tree's, except that remove gives back only the data, since the
+ * value may still be in use.
+ */
+
+struct avl_concurrent_node {
+	// Fixed for the life of the node
+	void const *value;
+	// AVL_CONCURRENT_ABSENT while the node only routes searches
+	void const *data;
+	struct avl_concurrent_node *parent;
+	struct avl_concurrent_node *left;
+	struct avl_concurrent_node *right;
+	// Height of the subtree as of the last fix, 1 for leaves
+	int32_t height;
+	// Bumped by every rotation that moves this node down; see the flags in avl_concurrent.c
+	uint64_t version;
+	// Links, height and data only change with this held, and the parent's for parent links
+	pthread_mutex_t lock;
+	// Chains nodes unlinked by one operation until they are retired
+	struct avl_concurrent_node *retired;
+};
+
+struct avl_concurrent_tree {
+	// Never holds a value: its right child is the root, so the root is relinked like any other node
+	struct avl_concurrent_node holder;
+	int (*cmp_func)(void const *new_value, void const *node_value);
+	void (*release_func)(void const *value, void *arg);
+	void *release_arg;
+	struct avl_epoch *epoch;
+	// avl_epoch serves one retiring thread at a time
+	pthread_mutex_t retire_lock;
+};
+
+// Marks nodes without an entry. Never a valid data pointer.
+extern char const avl_concurrent_absent[1];
+#define AVL_CONCURRENT_ABSENT ((void const *)avl_concurrent_absent)
+
+int avl_concurrent_create(
+    struct avl_concurrent_tree **tree,
+    int (*cmp_func)(void const *new_value, void const *node_value),
+    void (*release_func)(void const *value, void *arg), void *release_arg);
+
+// Not safe against other calls; free_func sees every remaining entry, release_func every value
+void avl_concurrent_free(
+    struct avl_concurrent_tree **tree,
+    int (*free_func)(void const *value, void const *data, void *arg), void *free_arg);
+
+int avl_concurrent_add(struct avl_concurrent_tree *tree, void const *value, void const *data);
+
+int avl_concurrent_get(
+    struct avl_concurrent_tree *tree, void const *search_value, void const **node_data);
+
+int avl_concurrent_remove(
+    struct avl_concurrent_tree *tree, void const *search_value, void const **node_data);
+
+// In order, without locks. Entries present for the whole walk are seen exactly once; others may or
+// may not be. O(log n) per entry, and reclamation waits until the walk is over.
+int avl_concurrent_traverse(
+    struct avl_concurrent_tree *tree,
+    int (*inorder_func)(void const *value, void const *data, void *arg), void *arg);
+
+#endif  // AVL_C_SRC_AVL_CONCURRENT_H
@@ -0,0 +1,215 @@
+#include "avl_epoch.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "avl_cacheline.h"
+
+// Retired items are only reclaimed in batches of this size to keep the slot scan off the fast path
+#define RECLAIM_BATCH 128
+// Waits between synchronization steps yield this many times before they start to sleep
+#define BACKOFF_YIELDS 16
+// Longest sleep between synchronization steps
+#define BACKOFF_MAX_NS 1000000
+
+static atomic_uint _next_slot;
+static _Thread_local unsigned _thread_slot = AVL_EPOCH_SLOTS;
+
+unsigned _epoch_slot() {
+	if (_thread_slot == AVL_EPOCH_SLOTS) {
+		// Hand slots out round-robin; threads beyond AVL_EPOCH_SLOTS share, which is still correct
+		unsigned slot = atomic_fetch_add_explicit(&_next_slot, 1, memory_order_relaxed);
+		_thread_slot = slot % AVL_EPOCH_SLOTS;
+	}
+
+	return _thread_slot;
+}
+
+int avl_epoch_create(
+    struct avl_epoch **epoch, void (*free_func)(void *ptr, void *arg), void *free_arg) {
+	assert(epoch != NULL);
+	assert(*epoch == NULL);
+	assert(free_func != NULL);
+
+	*epoch = avl_cacheline_alloc(sizeof(**epoch));
+	if (*epoch == NULL) {
+		return -errno;
+	}
+
+	memset(*epoch, 0, sizeof(**epoch));
+	atomic_init(&(*epoch)->epoch, 0);
+	(*epoch)->free_func = free_func;
+	(*epoch)->free_arg = free_arg;
+
+	return 0;
+}
+
+void _limbo_drain(struct avl_epoch *epoch, struct avl_epoch_limbo *limbo) {
+	for (size_t i = 0; i < limbo->count; ++i) {
+		epoch->free_func(limbo->items[i], epoch->free_arg);
+	}
+	limbo->count = 0;
+}
+
+void avl_epoch_free(struct avl_epoch **epoch) {
+	assert(epoch != NULL);
+	assert(*epoch != NULL);
+
+	// No readers may remain at this point, so everything still in limbo can go
+	for (int i = 0; i < 3; ++i) {
+		_limbo_drain(*epoch, &(*epoch)->limbo[i]);
+		free((*epoch)->limbo[i].items);
+	}
+
+	free(*epoch);
+	*epoch = NULL;
+}
+
+uint64_t avl_epoch_enter(struct avl_epoch *epoch) {
+	assert(epoch != NULL);
+
+	struct avl_epoch_slot *slot = &epoch->slots[_epoch_slot()];
+
+	for (;;) {
+		uint64_t current = atomic_load_explicit(&epoch->epoch, memory_order_relaxed);
+		atomic_fetch_add_explicit(&slot->readers[current & 1], 1, memory_order_seq_cst);
+
+		// If the epoch moved on while we registered, the reclaimer may not have seen us
+		if (atomic_load_explicit(&epoch->epoch, memory_order_seq_cst) == current) {
+			return ((uint64_t)(slot - epoch->slots) << 1) | (current & 1);
+		}
+
+		atomic_fetch_sub_explicit(&slot->readers[current & 1], 1, memory_order_release);
+	}
+}
+
+void avl_epoch_exit(struct avl_epoch *epoch, uint64_t token) {
+	assert(epoch != NULL);
+	assert((token >> 1) < AVL_EPOCH_SLOTS);
+
+	atomic_fetch_sub_explicit(&epoch->slots[token >> 1].readers[token & 1], 1, memory_order_release);
+}
+
+bool _try_advance(struct avl_epoch *epoch) {
+	uint64_t current = atomic_load_explicit(&epoch->epoch, memory_order_relaxed);
+
+	// Readers of the previous epoch share a parity with the next one; they must all be gone
+	unsigned previous = (current + 1) & 1;
+	for (int i = 0; i < AVL_EPOCH_SLOTS; ++i) {
+		if (atomic_load_explicit(&epoch->slots[i].readers[previous], memory_order_seq_cst) != 0) {
+			return false;
+		}
+	}
+
+	// Everything retired during the previous epoch is now unreachable for every reader
+	_limbo_drain(epoch, &epoch->limbo[(current + 2) % 3]);
+	atomic_store_explicit(&epoch->epoch, current + 1, memory_order_seq_cst);
+
+	return true;
+}
+
+int _limbo_grow(struct avl_epoch_limbo *limbo, size_t count) {
+	size_t capacity = limbo->capacity == 0 ? RECLAIM_BATCH : limbo->capacity;
+	while (capacity - limbo->count < count) {
+		capacity *= 2;
+	}
+	if (capacity == limbo->capacity) {
+		return 0;
+	}
+
+	void **items = realloc(limbo->items, sizeof(*items) * capacity);
+	if (items == NULL) {
+		perror("realloc(limbo->items, sizeof(*items) * capacity)");
+		return -errno;
+	}
+
+	limbo->items = items;
+	limbo->capacity = capacity;
+
+	return 0;
+}
+
+int avl_epoch_reserve(struct avl_epoch *epoch, size_t count) {
+	assert(epoch != NULL);
+
+	// Only advances switch limbo lists, and they are serialized with the retires that follow
+	uint64_t current = atomic_load_explicit(&epoch->epoch, memory_order_relaxed);
+	return _limbo_grow(&epoch->limbo[current % 3], count);
+}
+
+int avl_epoch_retire(struct avl_epoch *epoch, void *ptr) {
+	assert(epoch != NULL);
+
+	uint64_t current = atomic_load_explicit(&epoch->epoch, memory_order_relaxed);
+	struct avl_epoch_limbo *limbo = &epoch->limbo[current % 3];
+
+	if (_limbo_grow(limbo, 1) < 0) {
+		// Nowhere to defer it: wait out every reader and free it right away instead
+		avl_epoch_synchronize(epoch);
+		epoch->free_func(ptr, epoch->free_arg);
+		return 0;
+	}
+
+	limbo->items[limbo->count++] = ptr;
+
+	return 0;
+}
+
+void avl_epoch_reclaim(struct avl_epoch *epoch) {
+	assert(epoch != NULL);
+
+	uint64_t current = atomic_load_explicit(&epoch->epoch, memory_order_relaxed);
+	if (epoch->limbo[current % 3].count < RECLAIM_BATCH) {
+		return;
+	}
+
+	_try_advance(epoch);
+}
+
+uint64_t avl_epoch_synchronize_begin(struct avl_epoch *epoch) {
+	assert(epoch != NULL);
+
+	// Two advances guarantee that every reader which entered before this call has left, and drain
+	// the limbo lists of the epochs before them. Advances made by anyone else count as well.
+	return atomic_load_explicit(&epoch->epoch, memory_order_relaxed) + 2;
+}
+
+bool avl_epoch_synchronize_step(struct avl_epoch *epoch, uint64_t target) {
+	assert(epoch != NULL);
+
+	while (atomic_load_explicit(&epoch->epoch, memory_order_relaxed) < target) {
+		if (!_try_advance(epoch)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void avl_epoch_backoff(unsigned attempt) {
+	if (attempt < BACKOFF_YIELDS) {
+		sched_yield();
+		return;
+	}
+
+	// Readers that hold on for long (snapshots, scans) are waited for without burning a core
+	unsigned shift = attempt - BACKOFF_YIELDS;
+	long ns = shift < 10 ? 1000L << shift : BACKOFF_MAX_NS;
+	struct timespec pause = {.tv_sec = 0, .tv_nsec = ns < BACKOFF_MAX_NS ? ns : BACKOFF_MAX_NS};
+	nanosleep(&pause, NULL);
+}
+
+void avl_epoch_synchronize(struct avl_epoch *epoch) {
+	assert(epoch != NULL);
+
+	uint64_t target = avl_epoch_synchronize_begin(epoch);
+	for (unsigned attempt = 0; !avl_epoch_synchronize_step(epoch, target); ++attempt) {
+		avl_epoch_backoff(attempt);
+	}
+}
@@ -0,0 +1,76 @@
+#ifndef AVL_C_SRC_AVL_EPOCH_H
+#define AVL_C_SRC_AVL_EPOCH_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Epoch-based reclamation for memory that lock-free readers may still be looking at.
+ *
+ * Readers bracket their accesses with avl_epoch_enter()/avl_epoch_exit(). A single writer at a time
+ * (the caller serializes writers, normally with the tree's exclusive lock) hands unlinked memory to
+ * avl_epoch_retire(), and it is released once every reader that could have seen it has left.
+ *
+ * Nothing here waits for readers while the caller's lock is held: writers that must not wait
+ * reserve room with avl_epoch_reserve() before unlinking anything, and avl_epoch_synchronize_step()
+ * only advances as far as readers allow, so the caller can drop its lock between steps.
+ *
+ * Readers register in one of AVL_EPOCH_SLOTS cache-line-sized slots picked per thread, so they
+ * never write to a line shared with every other reader.
+ */
+
+#define AVL_EPOCH_SLOTS 64
+
+struct avl_epoch_slot {
+	// Number of readers inside an even (0) or odd (1) epoch
+	_Atomic uint64_t readers[2];
+} __attribute__((aligned(64)));
+
+struct avl_epoch_limbo {
+	void **items;
+	size_t count;
+	size_t capacity;
+};
+
+struct avl_epoch {
+	_Atomic uint64_t epoch;
+	void (*free_func)(void *ptr, void *arg);
+	void *free_arg;
+	// Memory retired during epochs e, e - 1 and e - 2, indexed by epoch % 3
+	struct avl_epoch_limbo limbo[3];
+	struct avl_epoch_slot slots[AVL_EPOCH_SLOTS];
+};
+
+int avl_epoch_create(
+    struct avl_epoch **epoch, void (*free_func)(void *ptr, void *arg), void *free_arg);
+
+void avl_epoch_free(struct avl_epoch **epoch);
+
+uint64_t avl_epoch_enter(struct avl_epoch *epoch);
+
+void avl_epoch_exit(struct avl_epoch *epoch, uint64_t token);
+
+// Makes sure the next count avl_epoch_retire() calls need no memory; -ENOMEM if they would
+int avl_epoch_reserve(struct avl_epoch *epoch, size_t count);
+
+// Defers ptr until readers are done with it. Without a reservation, running out of memory makes it
+// wait for every reader and free ptr right away.
+int avl_epoch_retire(struct avl_epoch *epoch, void *ptr);
+
+void avl_epoch_reclaim(struct avl_epoch *epoch);
+
+// The epoch after which everything retired so far has been freed
+uint64_t avl_epoch_synchronize_begin(struct avl_epoch *epoch);
+
+// Advances towards target as far as readers allow; true once it has been reached
+bool avl_epoch_synchronize_step(struct avl_epoch *epoch, uint64_t target);
+
+// Pauses between steps, yielding at first and then sleeping for longer and longer
+void avl_epoch_backoff(unsigned attempt);
+
+// Waits until everything retired so far has been freed, with the caller's lock held throughout
+void avl_epoch_synchronize(struct avl_epoch *epoch);
+
+#endif  // AVL_C_SRC_AVL_EPOCH_H
@@ -0,0 +1,540 @@
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "avl.h"
+
+/*
+ * avl_tree_save() and avl_tree_load(). A file is laid out as
+ *
+ *   "avlt" | version (1 byte) | flags (1 byte) | first value (8 bytes, integer values only)
+ *   records, each [value distance] [length] payload, in order
+ *   0 | entry count | CRC-32 of everything before it (4 bytes)
+ *
+ * with every number a little-endian base-128 varint. The first number of a record is never 0, so a
+ * 0 ends them: it is either the distance from the previous value, at least 1 since values only
+ * increase and the first one counts from one below itself, or the payload length plus one when
+ * values are left to the codec. A record has no length or payload when the tree was saved without
+ * a codec.
+ */
+
+#define FILE_MAGIC "avlt"
+#define FILE_VERSION 1
+// Set in the file's flags when there is no payload to go with the values
+#define FILE_NO_DATA (1 << 7)
+// Longest varint encoding of a uint64_t
+#define VARINT_MAX 10
+// Scratch space records start out with; grown on demand
+#define RECORD_CAPACITY 256
+// Records are gathered into blocks this large before they are checksummed and written
+#define WRITE_BUFFER (1 << 16)
+
+static uint32_t _crc_table[8][256];
+static pthread_once_t _crc_once = PTHREAD_ONCE_INIT;
+
+void _crc_init() {
+	// Reflected IEEE polynomial, as in zlib; the extra tables let us consume 8 bytes per step
+	for (uint32_t i = 0; i < 256; ++i) {
+		uint32_t crc = i;
+		for (int bit = 0; bit < 8; ++bit) {
+			crc = crc & 1 ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+		}
+		_crc_table[0][i] = crc;
+	}
+	for (uint32_t i = 0; i < 256; ++i) {
+		for (int k = 1; k < 8; ++k) {
+			uint32_t previous = _crc_table[k - 1][i];
+			_crc_table[k][i] = (previous >> 8) ^ _crc_table[0][previous & 0xFF];
+		}
+	}
+}
+
+uint32_t _crc32(uint32_t crc, uint8_t const *bytes, size_t size) {
+	crc = ~crc;
+
+	for (; size >= 8; bytes += 8, size -= 8) {
+		uint32_t lo = crc ^ ((uint32_t)bytes[0] | (uint32_t)bytes[1] << 8 | (uint32_t)bytes[2] << 16 |
+		                     (uint32_t)bytes[3] << 24);
+		crc = _crc_table[7][lo & 0xFF] ^ _crc_table[6][(lo >> 8) & 0xFF] ^
+		      _crc_table[5][(lo >> 16) & 0xFF] ^ _crc_table[4][lo >> 24] ^ _crc_table[3][bytes[4]] ^
+		      _crc_table[2][bytes[5]] ^ _crc_table[1][bytes[6]] ^ _crc_table[0][bytes[7]];
+	}
+	for (; size > 0; ++bytes, --size) {
+		crc = (crc >> 8) ^ _crc_table[0][(crc ^ *bytes) & 0xFF];
+	}
+
+	return ~crc;
+}
+
+size_t _varint_size(uint64_t value) {
+	size_t size = 1;
+	for (; value >= 0x80; value >>= 7) {
+		++size;
+	}
+	return size;
+}
+
+size_t _varint_encode(uint64_t value, uint8_t *bytes) {
+	size_t size = 0;
+	for (; value >= 0x80; value >>= 7) {
+		bytes[size++] = (uint8_t)(value | 0x80);
+	}
+	bytes[size++] = (uint8_t)value;
+	return size;
+}
+
+struct file_writer {
+	FILE *file;
+	uint32_t flags;
+	struct avl_codec const *codec;
+	uint32_t crc;
+	// Distances are taken from here; meaningful once started
+	uint64_t previous;
+	bool started;
+	uint64_t count;
+	// One record at a time: room for its two varints, then the payload
+	uint8_t *record;
+	size_t capacity;
+	// Pending output, WRITE_BUFFER bytes; one fwrite per record costs more than encoding it
+	uint8_t *buffer;
+	size_t used;
+};
+
+int _writer_flush(struct file_writer *writer) {
+	writer->crc = _crc32(writer->crc, writer->buffer, writer->used);
+	size_t size = writer->used;
+	writer->used = 0;
+
+	return fwrite(writer->buffer, 1, size, writer->file) == size ? 0 : -EIO;
+}
+
+int _writer_put(struct file_writer *writer, uint8_t const *bytes, size_t size) {
+	if (WRITE_BUFFER - writer->used < size) {
+		int rc = _writer_flush(writer);
+		if (rc < 0) {
+			return rc;
+		}
+	}
+	if (WRITE_BUFFER <= size) {
+		writer->crc = _crc32(writer->crc, bytes, size);
+		return fwrite(bytes, 1, size, writer->file) == size ? 0 : -EIO;
+	}
+
+	memcpy(writer->buffer + writer->used, bytes, size);
+	writer->used += size;
+
+	return 0;
+}
+
+int _writer_start(struct file_writer *writer, uint64_t first) {
+	// The first value is only known once we have it, and nothing before it has been written
+	uint8_t header[sizeof(FILE_MAGIC) - 1 + 2 + 8];
+	size_t size = 0;
+
+	memcpy(header, FILE_MAGIC, sizeof(FILE_MAGIC) - 1);
+	size += sizeof(FILE_MAGIC) - 1;
+	header[size++] = FILE_VERSION;
+	header[size++] = (uint8_t)(writer->flags | (writer->codec == NULL ? FILE_NO_DATA : 0));
+	if (writer->flags & AVL_SAVE_INTEGER_VALUES) {
+		for (int i = 0; i < 8; ++i) {
+			header[size++] = (uint8_t)(first >> (8 * i));
+		}
+	}
+
+	writer->previous = first - 1;
+	writer->started = true;
+
+	return _writer_put(writer, header, size);
+}
+
+int _writer_entry(struct avl_node const *node, void *arg) {
+	struct file_writer *writer = arg;
+	bool integer = writer->flags & AVL_SAVE_INTEGER_VALUES;
+	uint64_t value = (uint64_t)(uintptr_t)avl_node_value(node);
+
+	int rc;
+	if (!writer->started) {
+		rc = _writer_start(writer, value);
+		if (rc < 0) {
+			return rc;
+		}
+	}
+
+	// Encode the payload after the space its prefix could take, growing the buffer until it fits
+	size_t payload = 0;
+	if (writer->codec != NULL) {
+		for (;;) {
+			payload = writer->capacity - 2 * VARINT_MAX;
+			rc = writer->codec->encode_func(
+			    avl_node_value(node), avl_node_data(node), writer->record + 2 * VARINT_MAX, &payload,
+			    writer->codec->arg);
+			if (rc != -ENOSPC) {
+				break;
+			}
+
+			size_t capacity = 2 * VARINT_MAX + payload;
+			uint8_t *record = realloc(writer->record, capacity);
+			if (record == NULL) {
+				perror("realloc(writer->record, capacity)");
+				return -errno;
+			}
+			writer->record = record;
+			writer->capacity = capacity;
+		}
+		if (rc < 0) {
+			return rc;
+		}
+	}
+
+	// Then fill in the prefix right in front of it, so the record goes out in one piece
+	uint8_t prefix[2 * VARINT_MAX];
+	size_t prefix_size = 0;
+	if (integer) {
+		prefix_size += _varint_encode(value - writer->previous, prefix);
+		writer->previous = value;
+		if (writer->codec != NULL) {
+			prefix_size += _varint_encode(payload, prefix + prefix_size);
+		}
+	} else {
+		prefix_size += _varint_encode(payload + 1, prefix);
+	}
+
+	uint8_t *start = writer->record + 2 * VARINT_MAX - prefix_size;
+	memcpy(start, prefix, prefix_size);
+	++writer->count;
+
+	return _writer_put(writer, start, prefix_size + payload);
+}
+
+int avl_tree_save(
+    struct avl_tree const *tree, FILE *file, uint32_t flags, struct avl_codec const *codec) {
+	assert(tree != NULL);
+	assert(file != NULL);
+	assert(codec != NULL || flags & AVL_SAVE_INTEGER_VALUES);
+
+	pthread_once(&_crc_once, _crc_init);
+
+	struct file_writer writer = {
+	    .file = file,
+	    .flags = flags,
+	    .codec = codec,
+	    .crc = 0,
+	    .started = false,
+	    .count = 0,
+	    .record = malloc(RECORD_CAPACITY),
+	    .capacity = RECORD_CAPACITY,
+	    .buffer = malloc(WRITE_BUFFER),
+	    .used = 0,
+	};
+	int rc = 0;
+	if (writer.record == NULL || writer.buffer == NULL) {
+		perror("malloc()");
+		free(writer.record);
+		free(writer.buffer);
+		return -ENOMEM;
+	}
+
+	// Holding the stream's lock once saves taking it for every record
+	flockfile(file);
+
+	rc = avl_tree_traverse(tree, NULL, NULL, _writer_entry, &writer, NULL, NULL);
+	if (rc < 0) {
+		goto finish;
+	}
+	if (!writer.started) {
+		rc = _writer_start(&writer, 0);
+		if (rc < 0) {
+			goto finish;
+		}
+	}
+
+	uint8_t trailer[1 + VARINT_MAX + 4];
+	size_t size = 0;
+	trailer[size++] = 0;
+	size += _varint_encode(writer.count, trailer + size);
+	rc = _writer_put(&writer, trailer, size);
+	if (rc == 0) {
+		rc = _writer_flush(&writer);
+	}
+	if (rc < 0) {
+		goto finish;
+	}
+
+	// Everything up to here is covered; the checksum itself is not
+	uint8_t crc[4];
+	for (int i = 0; i < 4; ++i) {
+		crc[i] = (uint8_t)(writer.crc >> (8 * i));
+	}
+	rc = fwrite(crc, 1, sizeof(crc), file) == sizeof(crc) && fflush(file) == 0 ? 0 : -EIO;
+
+finish:
+	funlockfile(file);
+	free(writer.record);
+	free(writer.buffer);
+
+	return rc;
+}
+
+struct file_reader {
+	FILE *file;
+	uint32_t crc;
+};
+
+int _reader_get(struct file_reader *reader, uint8_t *bytes, size_t size) {
+	if (fread(bytes, 1, size, reader->file) != size) {
+		// Running out of file means it was cut short
+		return ferror(reader->file) ? -EIO : -EBADMSG;
+	}
+
+	reader->crc = _crc32(reader->crc, bytes, size);
+	return 0;
+}
+
+int _reader_varint(struct file_reader *reader, uint64_t *value) {
+	// Byte by byte through the stream's buffer, so that nothing past the snapshot is consumed
+	uint8_t bytes[VARINT_MAX];
+	size_t size = 0;
+	*value = 0;
+
+	for (;;) {
+		int c = getc_unlocked(reader->file);
+		if (c == EOF) {
+			return ferror(reader->file) ? -EIO : -EBADMSG;
+		}
+		if (size == VARINT_MAX) {
+			return -EBADMSG;
+		}
+
+		bytes[size] = (uint8_t)c;
+		*value |= (uint64_t)(c & 0x7F) << (7 * size);
+		++size;
+		if (!(c & 0x80)) {
+			break;
+		}
+	}
+
+	reader->crc = _crc32(reader->crc, bytes, size);
+	return 0;
+}
+
+int _reader_payload(struct file_reader *reader, uint8_t **record, size_t *capacity, uint64_t size) {
+	// A corrupt length could ask for anything, so the buffer only grows as far as the file goes
+	for (uint64_t read = 0; read < size;) {
+		if (*capacity <= read) {
+			size_t grown_capacity = 2 * *capacity;
+			uint8_t *grown = realloc(*record, grown_capacity);
+			if (grown == NULL) {
+				perror("realloc(*record, grown_capacity)");
+				return -errno;
+			}
+			*record = grown;
+			*capacity = grown_capacity;
+		}
+
+		size_t chunk = *capacity - read < size - read ? *capacity - read : size - read;
+		int rc = _reader_get(reader, *record + read, chunk);
+		if (rc < 0) {
+			return rc;
+		}
+		read += chunk;
+	}
+
+	return 0;
+}
+
+struct loaded {
+	void const **values;
+	void const **data;
+	size_t count;
+	size_t capacity;
+};
+
+int _loaded_append(struct loaded *loaded, void const *value, void const *data) {
+	if (loaded->count == loaded->capacity) {
+		size_t capacity = loaded->capacity == 0 ? 1024 : 2 * loaded->capacity;
+
+		void const **values = realloc(loaded->values, sizeof(*values) * capacity);
+		if (values == NULL) {
+			perror("realloc(loaded->values, sizeof(*values) * capacity)");
+			return -errno;
+		}
+		loaded->values = values;
+
+		void const **data = realloc(loaded->data, sizeof(*data) * capacity);
+		if (data == NULL) {
+			perror("realloc(loaded->data, sizeof(*data) * capacity)");
+			return -errno;
+		}
+		loaded->data = data;
+		loaded->capacity = capacity;
+	}
+
+	loaded->values[loaded->count] = value;
+	loaded->data[loaded->count] = data;
+	++loaded->count;
+
+	return 0;
+}
+
+int _reader_entries(
+    struct file_reader *reader, struct avl_codec const *codec, uint32_t flags,
+    struct loaded *loaded) {
+	bool integer = flags & AVL_SAVE_INTEGER_VALUES;
+	uint64_t previous = 0;
+	int rc;
+
+	if (integer) {
+		uint8_t first[8];
+		rc = _reader_get(reader, first, sizeof(first));
+		if (rc < 0) {
+			return rc;
+		}
+		for (int i = 0; i < 8; ++i) {
+			previous |= (uint64_t)first[i] << (8 * i);
+		}
+		--previous;
+	}
+
+	// Never NULL, so that codecs can copy out of it even for empty payloads
+	uint8_t *record = malloc(RECORD_CAPACITY);
+	size_t capacity = RECORD_CAPACITY;
+
+	if (record == NULL) {
+		perror("malloc(RECORD_CAPACITY)");
+		return -errno;
+	}
+
+	for (;;) {
+		uint64_t lead;
+		rc = _reader_varint(reader, &lead);
+		if (rc < 0 || lead == 0) {
+			break;
+		}
+
+		void const *value = NULL;
+		void const *data = NULL;
+		uint64_t size = lead - 1;
+		if (integer) {
+			previous += lead;
+			value = (void const *)(uintptr_t)previous;
+			size = 0;
+			if (!(flags & FILE_NO_DATA)) {
+				rc = _reader_varint(reader, &size);
+				if (rc < 0) {
+					break;
+				}
+			}
+		}
+
+		if (!(flags & FILE_NO_DATA)) {
+			rc = _reader_payload(reader, &record, &capacity, size);
+			if (rc < 0) {
+				break;
+			}
+			rc = codec->decode_func(record, size, &value, &data, codec->arg);
+			if (rc < 0) {
+				break;
+			}
+		}
+
+		rc = _loaded_append(loaded, value, data);
+		if (rc < 0) {
+			if (!(flags & FILE_NO_DATA) && codec->release_func != NULL) {
+				codec->release_func(value, data, codec->arg);
+			}
+			break;
+		}
+	}
+
+	free(record);
+	return rc;
+}
+
+int avl_tree_load(struct avl_tree *tree, FILE *file, struct avl_codec const *codec) {
+	assert(tree != NULL);
+	assert(file != NULL);
+
+	pthread_once(&_crc_once, _crc_init);
+
+	struct file_reader reader = {.file = file, .crc = 0};
+	struct loaded loaded = {.values = NULL, .data = NULL, .count = 0, .capacity = 0};
+	// Whether the loaded entries came from codec->decode_func, and so go back to release_func
+	bool decoded = false;
+	int rc;
+
+	flockfile(file);
+
+	uint8_t header[sizeof(FILE_MAGIC) - 1 + 2];
+	rc = _reader_get(&reader, header, sizeof(header));
+	if (rc < 0) {
+		goto finish;
+	}
+	// Only the flags avl_tree_save writes: records without a payload always carry integer values
+	uint32_t flags = header[sizeof(FILE_MAGIC)];
+	if (memcmp(header, FILE_MAGIC, sizeof(FILE_MAGIC) - 1) != 0 ||
+	    header[sizeof(FILE_MAGIC) - 1] != FILE_VERSION ||
+	    (flags != 0 && flags != AVL_SAVE_INTEGER_VALUES &&
+	     flags != (AVL_SAVE_INTEGER_VALUES | FILE_NO_DATA))) {
+		rc = -EBADMSG;
+		goto finish;
+	}
+	if (!(flags & FILE_NO_DATA) && (codec == NULL || codec->decode_func == NULL)) {
+		// Payloads we would not know what to do with
+		rc = -EINVAL;
+		goto finish;
+	}
+	decoded = !(flags & FILE_NO_DATA);
+
+	rc = _reader_entries(&reader, codec, flags, &loaded);
+	if (rc < 0) {
+		goto finish;
+	}
+
+	uint64_t count;
+	rc = _reader_varint(&reader, &count);
+	if (rc < 0) {
+		goto finish;
+	}
+
+	uint32_t expected = reader.crc;
+	uint8_t crc[4];
+	rc = _reader_get(&reader, crc, sizeof(crc));
+	if (rc < 0) {
+		goto finish;
+	}
+	if (((uint32_t)crc[0] | (uint32_t)crc[1] << 8 | (uint32_t)crc[2] << 16 |
+	     (uint32_t)crc[3] << 24) != expected ||
+	    count != loaded.count) {
+		rc = -EBADMSG;
+		goto finish;
+	}
+
+	// The tree can only be built from strictly increasing values. Checked only now, since cmp_func
+	// may not cope with values decoded from a file that turns out to be corrupt.
+	for (size_t i = 1; i < loaded.count; ++i) {
+		if (tree->cmp_func(loaded.values[i - 1], loaded.values[i]) >= 0) {
+			rc = -EBADMSG;
+			goto finish;
+		}
+	}
+
+	rc = avl_tree_build_sorted(tree, loaded.values, loaded.data, loaded.count);
+
+finish:
+	funlockfile(file);
+
+	// Entries only belong to the tree once it has been built from them
+	if (rc < 0 && decoded && codec->release_func != NULL) {
+		for (size_t i = 0; i < loaded.count; ++i) {
+			codec->release_func(loaded.values[i], loaded.data[i], codec->arg);
+		}
+	}
+	free(loaded.values);
+	free(loaded.data);
+
+	return rc;
+}
@@ -0,0 +1,581 @@
+#include "avl_frozen.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "avl_cacheline.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define FROZEN_AVX2 1
+#endif
+
+// Van Emde Boas blocks: one cache line of keys, holding a subtree of up to 3 levels
+#define BLOCK_SLOTS 8
+#define BLOCK_HEIGHT 3
+// Slot that stands for "no key found yet"
+#define NO_SLOT UINT64_MAX
+
+uint64_t _frozen_align(uint64_t offset) {
+	return (offset + 63) & ~(uint64_t)63;
+}
+
+uint32_t _veb_height(uint64_t count) {
+	// Levels of the smallest perfect binary tree with room for count keys
+	uint32_t height = 0;
+	while (height < AVL_FROZEN_MAX_HEIGHT && (UINT64_C(1) << height) - 1 < count) {
+		++height;
+	}
+	return height;
+}
+
+uint32_t _veb_bottom(uint32_t height) {
+	// Bottom trees get half the levels, rounded so that every block below the root is full
+	return BLOCK_HEIGHT * ((height + 2 * BLOCK_HEIGHT - 1) / (2 * BLOCK_HEIGHT));
+}
+
+uint64_t _veb_blocks(uint32_t height) {
+	if (height <= BLOCK_HEIGHT) {
+		return height > 0;
+	}
+
+	uint32_t bottom = _veb_bottom(height);
+	uint32_t top = height - bottom;
+	return _veb_blocks(top) + (UINT64_C(1) << top) * _veb_blocks(bottom);
+}
+
+void _veb_split(struct avl_frozen *frozen, uint32_t depth, uint32_t height) {
+	if (height <= BLOCK_HEIGHT) {
+		frozen->block_height[depth] = height;
+		return;
+	}
+
+	uint32_t bottom = _veb_bottom(height);
+	uint32_t top = height - bottom;
+	frozen->top_depth[depth + top] = depth;
+	frozen->top_blocks[depth + top] = _veb_blocks(top);
+	frozen->bottom_blocks[depth + top] = _veb_blocks(bottom);
+
+	_veb_split(frozen, depth, top);
+	_veb_split(frozen, depth + top, bottom);
+}
+
+static inline uint64_t _veb_position(
+    struct avl_frozen const *frozen, uint64_t const *positions, uint32_t depth, uint64_t index) {
+	// Block of the node at depth with breadth-first index, given the blocks of its ancestors: past
+	// the top tree it hangs off, then past the bottom trees to its left
+	uint32_t top = frozen->top_depth[depth];
+	uint64_t bottom = index & ((UINT64_C(1) << (depth - top)) - 1);
+	return positions[top] + frozen->top_blocks[depth] + bottom * frozen->bottom_blocks[depth];
+}
+
+static inline uint64_t _veb_prefetch_children(
+    struct avl_frozen const *frozen, uint64_t const *positions, uint32_t depth, uint32_t height,
+    uint64_t index) {
+	// Where the children of the block at depth start, once there are any. Their bottom trees lie
+	// side by side, so all of them can be fetched before this block's keys arrive and say which one
+	// is next; that overlaps one level's miss with the next.
+	uint32_t child_depth = depth + height;
+	if (child_depth >= frozen->header->height) {
+		return 0;
+	}
+
+	uint64_t first = _veb_position(frozen, positions, child_depth, index << height);
+	for (uint64_t c = 0; c < UINT64_C(1) << height; ++c) {
+		__builtin_prefetch(
+		    frozen->keys + (first + c * frozen->bottom_blocks[child_depth]) * BLOCK_SLOTS);
+	}
+	return first;
+}
+
+static inline bool _frozen_less(
+    struct avl_frozen const *frozen, void const *key, void const *search_value, bool integer) {
+	if (integer) {
+		return (int64_t)(intptr_t)key < (int64_t)(intptr_t)search_value;
+	}
+	return frozen->cmp_func(search_value, key) > 0;
+}
+
+static inline uint64_t _eytzinger_search(
+    struct avl_frozen const *frozen, void const *search_value, bool integer) {
+	uint64_t count = frozen->header->count;
+	void const *const *keys = frozen->keys;
+
+	uint64_t k = 1;
+	while (k <= count) {
+		// Slots 8k to 8k + 7, three levels down, share a cache line; it may well be past the end,
+		// which prefetching does not mind
+		__builtin_prefetch((void const *)((uintptr_t)keys + 8 * k * sizeof(*keys)));
+		k = 2 * k + _frozen_less(frozen, keys[k], search_value, integer);
+	}
+
+	// Undo the right turns after the last left one, which was at the answer
+	k >>= __builtin_ffsll((long long)~k);
+	return k == 0 ? count : frozen->ranks[k];
+}
+
+static inline uint64_t _veb_search(
+    struct avl_frozen const *frozen, void const *search_value, bool integer) {
+	struct avl_frozen_header const *header = frozen->header;
+	uint64_t positions[AVL_FROZEN_MAX_HEIGHT + 1];
+	uint64_t index = 0;
+	uint64_t found = NO_SLOT;
+
+	positions[0] = 0;
+	for (uint32_t depth = 0; depth < header->height;) {
+		uint32_t height = frozen->block_height[depth];
+		uint64_t base = positions[depth] * BLOCK_SLOTS;
+		void const *const *block = frozen->keys + base;
+		uint64_t first = _veb_prefetch_children(frozen, positions, depth, height, index);
+
+		// Keys in the block less than search_value, by branchless binary search
+		uint32_t rank = 0;
+		for (uint32_t step = 1u << (height - 1); step > 0; step >>= 1) {
+			rank += _frozen_less(frozen, block[rank + step - 1], search_value, integer) ? step : 0;
+		}
+
+		// Deeper blocks can only offer smaller keys not less than search_value
+		found = rank < (1u << height) - 1 ? base + rank : found;
+		index = (index << height) + rank;
+		depth += height;
+		positions[depth] = first + rank * frozen->bottom_blocks[depth];
+	}
+
+	return found == NO_SLOT ? header->count : frozen->ranks[found];
+}
+
+uint64_t _eytzinger_search_generic(struct avl_frozen const *frozen, void const *search_value) {
+	return _eytzinger_search(frozen, search_value, false);
+}
+
+uint64_t _eytzinger_search_integer(struct avl_frozen const *frozen, void const *search_value) {
+	return _eytzinger_search(frozen, search_value, true);
+}
+
+uint64_t _veb_search_generic(struct avl_frozen const *frozen, void const *search_value) {
+	return _veb_search(frozen, search_value, false);
+}
+
+uint64_t _veb_search_integer(struct avl_frozen const *frozen, void const *search_value) {
+	return _veb_search(frozen, search_value, true);
+}
+
+#ifdef FROZEN_AVX2
+__attribute__((target("avx2,popcnt"))) uint64_t _veb_search_avx2(
+    struct avl_frozen const *frozen, void const *search_value) {
+	struct avl_frozen_header const *header = frozen->header;
+	uint64_t positions[AVL_FROZEN_MAX_HEIGHT + 1];
+	uint64_t index = 0;
+	uint64_t found = NO_SLOT;
+	__m256i needle = _mm256_set1_epi64x((int64_t)(intptr_t)search_value);
+
+	positions[0] = 0;
+	for (uint32_t depth = 0; depth < header->height;) {
+		uint32_t height = frozen->block_height[depth];
+		uint64_t base = positions[depth] * BLOCK_SLOTS;
+		__m256i const *block = (__m256i const *)(frozen->keys + base);
+		uint64_t first = _veb_prefetch_children(frozen, positions, depth, height, index);
+
+		// Compare against all 8 lanes at once and count the block's keys among the smaller ones;
+		// they are sorted, so that count is where search_value would go
+		__m256i lo = _mm256_cmpgt_epi64(needle, _mm256_load_si256(block));
+		__m256i hi = _mm256_cmpgt_epi64(needle, _mm256_load_si256(block + 1));
+		uint32_t less = (uint32_t)_mm256_movemask_pd(_mm256_castsi256_pd(lo)) |
+		                (uint32_t)_mm256_movemask_pd(_mm256_castsi256_pd(hi)) << 4;
+		uint32_t keys = (1u << height) - 1;
+		uint32_t rank = (uint32_t)__builtin_popcount(less & ((1u << keys) - 1));
+
+		found = rank < keys ? base + rank : found;
+		index = (index << height) + rank;
+		depth += height;
+		positions[depth] = first + rank * frozen->bottom_blocks[depth];
+	}
+
+	return found == NO_SLOT ? header->count : frozen->ranks[found];
+}
+#endif
+
+void _frozen_setup(struct avl_frozen *frozen, struct avl_frozen_header const *header) {
+	char const *region = (char const *)header;
+
+	frozen->header = header;
+	frozen->keys = (void const *const *)(region + header->keys_offset);
+	frozen->ranks = (uint64_t const *)(region + header->ranks_offset);
+	frozen->values = (void const *const *)(region + header->values_offset);
+	frozen->data = (void const *const *)(region + header->data_offset);
+
+	bool integer = header->flags & AVL_FROZEN_INTEGER_VALUES;
+	if (header->layout == AVL_FROZEN_EYTZINGER) {
+		frozen->search_func = integer ? _eytzinger_search_integer : _eytzinger_search_generic;
+		return;
+	}
+
+	// Depths where no block or bottom tree starts are only read past the last level
+	memset(frozen->block_height, 0, sizeof(frozen->block_height));
+	memset(frozen->top_depth, 0, sizeof(frozen->top_depth));
+	memset(frozen->top_blocks, 0, sizeof(frozen->top_blocks));
+	memset(frozen->bottom_blocks, 0, sizeof(frozen->bottom_blocks));
+
+	frozen->search_func = integer ? _veb_search_integer : _veb_search_generic;
+#ifdef FROZEN_AVX2
+	if (integer && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+		frozen->search_func = _veb_search_avx2;
+	}
+#endif
+	if (header->height > 0) {
+		_veb_split(frozen, 0, header->height);
+	}
+}
+
+void _frozen_layout(struct avl_frozen_header *header) {
+	// Everything but the magic follows from layout and count
+	if (header->layout == AVL_FROZEN_EYTZINGER) {
+		header->height = 0;
+		header->slots = header->count + 1;
+	} else {
+		header->height = _veb_height(header->count);
+		header->slots = _veb_blocks(header->height) * BLOCK_SLOTS;
+	}
+
+	header->keys_offset = _frozen_align(sizeof(*header));
+	header->ranks_offset = _frozen_align(header->keys_offset + header->slots * sizeof(void *));
+	header->values_offset = _frozen_align(header->ranks_offset + header->slots * sizeof(uint64_t));
+	header->data_offset = _frozen_align(header->values_offset + header->count * sizeof(void *));
+	header->size = _frozen_align(header->data_offset + header->count * sizeof(void *));
+}
+
+struct frozen_fill {
+	void const **keys;
+	uint64_t *ranks;
+	void const *const *values;
+	uint64_t count;
+	// Rank of the next key to place; slots past the last one repeat it
+	uint64_t next;
+	uint64_t positions[AVL_FROZEN_MAX_HEIGHT + 1];
+};
+
+void _fill_slot(struct frozen_fill *fill, uint64_t slot) {
+	// A repeat of the largest key is as good an answer as the key itself
+	uint64_t rank = fill->next < fill->count ? fill->next : fill->count - 1;
+	fill->keys[slot] = fill->values[rank];
+	fill->ranks[slot] = rank;
+	++fill->next;
+}
+
+void _eytzinger_fill(struct frozen_fill *fill, uint64_t k) {
+	if (k > fill->count) {
+		return;
+	}
+
+	_eytzinger_fill(fill, 2 * k);
+	_fill_slot(fill, k);
+	_eytzinger_fill(fill, 2 * k + 1);
+}
+
+void _veb_fill(
+    struct avl_frozen const *frozen, struct frozen_fill *fill, uint32_t depth, uint64_t index) {
+	uint32_t height = frozen->block_height[depth];
+	uint32_t keys = (1u << height) - 1;
+	uint64_t base = fill->positions[depth] * BLOCK_SLOTS;
+	uint32_t child_depth = depth + height;
+
+	// In order: each key of the block comes after the subtree to its left
+	for (uint32_t c = 0; c <= keys; ++c) {
+		if (child_depth < frozen->header->height) {
+			uint64_t child = (index << height) + c;
+			fill->positions[child_depth] = _veb_position(frozen, fill->positions, child_depth, child);
+			_veb_fill(frozen, fill, child_depth, child);
+		}
+		if (c < keys) {
+			_fill_slot(fill, base + c);
+		}
+	}
+
+	// Lanes past a short block's keys are never counted, but are loaded all the same
+	for (uint32_t c = keys; c < BLOCK_SLOTS; ++c) {
+		fill->keys[base + c] = fill->values[fill->count - 1];
+		fill->ranks[base + c] = fill->count - 1;
+	}
+}
+
+int _frozen_build(
+    struct avl_frozen **frozen, int (*cmp_func)(void const *new_value, void const *node_value),
+    void const *const *values, void const *const *data, uint64_t count,
+    enum avl_frozen_layout layout, uint32_t flags) {
+	struct avl_frozen_header shape = {
+	    .magic = AVL_FROZEN_MAGIC,
+	    .layout = layout,
+	    .flags = flags,
+	    .count = count,
+	};
+	_frozen_layout(&shape);
+
+	*frozen = malloc(sizeof(**frozen));
+	if (*frozen == NULL) {
+		perror("malloc(sizeof(**frozen))");
+		return -errno;
+	}
+
+	struct avl_frozen_header *header = avl_cacheline_alloc(shape.size);
+	if (header == NULL) {
+		free(*frozen);
+		*frozen = NULL;
+		return -ENOMEM;
+	}
+	// Padding included, so that written files do not depend on what malloc left behind
+	memset(header, 0, shape.size);
+	*header = shape;
+
+	char *region = (char *)header;
+	if (count > 0) {
+		memcpy(region + header->values_offset, values, count * sizeof(*values));
+		memcpy(region + header->data_offset, data, count * sizeof(*data));
+	}
+
+	(*frozen)->cmp_func = cmp_func;
+	(*frozen)->mapped = false;
+	_frozen_setup(*frozen, header);
+
+	struct frozen_fill fill = {
+	    .keys = (void const **)(region + header->keys_offset),
+	    .ranks = (uint64_t *)(region + header->ranks_offset),
+	    .values = values,
+	    .count = count,
+	    .next = 0,
+	};
+	if (layout == AVL_FROZEN_EYTZINGER) {
+		_eytzinger_fill(&fill, 1);
+	} else if (header->height > 0) {
+		fill.positions[0] = 0;
+		_veb_fill(*frozen, &fill, 0, 0);
+	}
+
+	return 0;
+}
+
+struct frozen_collect {
+	void const **values;
+	void const **data;
+	uint64_t count;
+	uint64_t capacity;
+};
+
+int _frozen_collect(struct avl_node const *node, void *arg) {
+	struct frozen_collect *collect = arg;
+
+	if (collect->count == collect->capacity) {
+		uint64_t capacity = collect->capacity == 0 ? 1024 : 2 * collect->capacity;
+
+		void const **values = realloc(collect->values, sizeof(*values) * capacity);
+		if (values == NULL) {
+			perror("realloc(collect->values, sizeof(*values) * capacity)");
+			return -errno;
+		}
+		collect->values = values;
+
+		void const **data = realloc(collect->data, sizeof(*data) * capacity);
+		if (data == NULL) {
+			perror("realloc(collect->data, sizeof(*data) * capacity)");
+			return -errno;
+		}
+		collect->data = data;
+		collect->capacity = capacity;
+	}
+
+	collect->values[collect->count] = avl_node_value(node);
+	collect->data[collect->count] = avl_node_data(node);
+	++collect->count;
+
+	return 0;
+}
+
+int avl_tree_freeze(
+    struct avl_tree const *tree, struct avl_frozen **frozen, enum avl_frozen_layout layout,
+    uint32_t flags) {
+	assert(tree != NULL);
+	assert(frozen != NULL);
+	assert(*frozen == NULL);
+	assert(layout == AVL_FROZEN_EYTZINGER || layout == AVL_FROZEN_VEB);
+
+	struct frozen_collect collect = {.values = NULL, .data = NULL, .count = 0, .capacity = 0};
+
+	int rc = avl_tree_traverse(tree, NULL, NULL, _frozen_collect, &collect, NULL, NULL);
+	if (rc == 0) {
+		rc = _frozen_build(
+		    frozen, tree->cmp_func, collect.values, collect.data, collect.count, layout, flags);
+	}
+
+	free(collect.values);
+	free(collect.data);
+
+	return rc;
+}
+
+int avl_frozen_write(struct avl_frozen const *frozen, FILE *file) {
+	assert(frozen != NULL);
+	assert(file != NULL);
+
+	size_t size = frozen->header->size;
+	return fwrite(frozen->header, 1, size, file) == size && fflush(file) == 0 ? 0 : -EIO;
+}
+
+bool _frozen_valid(struct avl_frozen_header const *header, size_t size) {
+	// The arrays themselves are trusted, but nothing the header says may point outside the file
+	if (size < sizeof(*header) || header->magic != AVL_FROZEN_MAGIC || header->size != size ||
+	    (header->layout != AVL_FROZEN_EYTZINGER && header->layout != AVL_FROZEN_VEB) ||
+	    header->flags & ~(uint32_t)AVL_FROZEN_INTEGER_VALUES ||
+	    header->count > size / (2 * sizeof(void *))) {
+		return false;
+	}
+
+	struct avl_frozen_header expected = {
+	    .layout = header->layout,
+	    .count = header->count,
+	};
+	_frozen_layout(&expected);
+	return expected.size == header->size && expected.height == header->height &&
+	       expected.slots == header->slots && expected.keys_offset == header->keys_offset &&
+	       expected.ranks_offset == header->ranks_offset &&
+	       expected.values_offset == header->values_offset &&
+	       expected.data_offset == header->data_offset;
+}
+
+int avl_frozen_map(
+    struct avl_frozen **frozen, char const *path,
+    int (*cmp_func)(void const *new_value, void const *node_value)) {
+	assert(frozen != NULL);
+	assert(*frozen == NULL);
+	assert(path != NULL);
+	assert(cmp_func != NULL);
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return -errno;
+	}
+
+	int rc = 0;
+	void *region = MAP_FAILED;
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		rc = -errno;
+		goto finish;
+	}
+	if ((size_t)st.st_size < sizeof(struct avl_frozen_header)) {
+		rc = -EINVAL;
+		goto finish;
+	}
+
+	region = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (region == MAP_FAILED) {
+		rc = -errno;
+		perror("mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)");
+		goto finish;
+	}
+	if (!_frozen_valid(region, st.st_size)) {
+		rc = -EINVAL;
+		goto finish;
+	}
+
+	*frozen = malloc(sizeof(**frozen));
+	if (*frozen == NULL) {
+		perror("malloc(sizeof(**frozen))");
+		rc = -errno;
+		goto finish;
+	}
+	(*frozen)->cmp_func = cmp_func;
+	(*frozen)->mapped = true;
+	_frozen_setup(*frozen, region);
+
+finish:
+	close(fd);
+	if (rc < 0 && region != MAP_FAILED) {
+		munmap(region, st.st_size);
+	}
+
+	return rc;
+}
+
+void avl_frozen_free(struct avl_frozen **frozen) {
+	assert(frozen != NULL);
+	assert(*frozen != NULL);
+
+	if ((*frozen)->mapped) {
+		munmap((void *)(*frozen)->header, (*frozen)->header->size);
+	} else {
+		free((void *)(*frozen)->header);
+	}
+	free(*frozen);
+	*frozen = NULL;
+}
+
+uint64_t _frozen_bound(struct avl_frozen const *frozen, void const *value, bool after) {
+	// Rank of the first entry not less than value, or with after, greater than it
+	uint64_t rank = frozen->search_func(frozen, value);
+	if (after && rank < frozen->header->count &&
+	    frozen->cmp_func(value, frozen->values[rank]) == 0) {
+		++rank;
+	}
+	return rank;
+}
+
+int avl_frozen_get(
+    struct avl_frozen const *frozen, void const *search_value, void const **node_data) {
+	assert(frozen != NULL);
+
+	uint64_t rank = frozen->search_func(frozen, search_value);
+	if (rank == frozen->header->count || frozen->cmp_func(search_value, frozen->values[rank]) != 0) {
+		return false;
+	}
+
+	if (node_data != NULL) {
+		*node_data = frozen->data[rank];
+	}
+	return true;
+}
+
+int avl_frozen_lower_bound(
+    struct avl_frozen const *frozen, void const *search_value, void const **node_value,
+    void const **node_data) {
+	assert(frozen != NULL);
+	assert(node_value != NULL);
+	assert(node_data != NULL);
+
+	uint64_t rank = frozen->search_func(frozen, search_value);
+	if (rank == frozen->header->count) {
+		return false;
+	}
+
+	*node_value = frozen->values[rank];
+	*node_data = frozen->data[rank];
+	return true;
+}
+
+int avl_frozen_range(
+    struct avl_frozen const *frozen, void const *lo, void const *hi, uint32_t flags,
+    int (*func)(void const *value, void const *data, void *arg), void *arg) {
+	assert(frozen != NULL);
+	assert(func != NULL);
+
+	// Both ends are found by search, so the scan itself compares nothing
+	uint64_t begin = flags & AVL_RANGE_LO_UNBOUNDED
+	                     ? 0
+	                     : _frozen_bound(frozen, lo, !(flags & AVL_RANGE_LO_INCLUSIVE));
+	uint64_t end = flags & AVL_RANGE_HI_UNBOUNDED
+	                   ? frozen->header->count
+	                   : _frozen_bound(frozen, hi, flags & AVL_RANGE_HI_INCLUSIVE);
+
+	for (uint64_t rank = begin; rank < end; ++rank) {
+		int rc = func(frozen->values[rank], frozen->data[rank], arg);
+		if (rc < 0) {
+			return rc;
+		}
+	}
+
+	return 0;
+}
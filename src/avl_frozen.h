@@ -0,0 +1,115 @@
+#ifndef AVL_C_SRC_AVL_FROZEN_H
+#define AVL_C_SRC_AVL_FROZEN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "avl.h"
+
+/*
+ * Read-only copy of a tree, laid out in one array so that lookups touch few cache lines and never
+ * chase pointers.
+ *
+ * The keys sit in the order of an implicit search tree, either
+ *
+ *   AVL_FROZEN_EYTZINGER: breadth-first, as in a binary heap. The children of slot k are 2k and
+ *   2k + 1, so a lookup is a short loop with no branches on the comparisons, and the 8 slots three
+ *   levels down share a cache line that is fetched while the levels above it are searched.
+ *
+ *   AVL_FROZEN_VEB: van Emde Boas order, which splits the tree by height into a top tree and the
+ *   bottom trees hanging off it and lays out each of them the same way in turn. Subtrees at every
+ *   scale then sit in one stretch of memory, so a lookup touches few cache lines and pages
+ *   whatever their size. The recursion stops at subtrees of 3 levels, whose 7 keys fill one
+ *   64-byte block in sorted order, and a block's children are fetched along with it. With
+ *   AVL_FROZEN_INTEGER_VALUES, a block is searched with two AVX2 comparisons where the CPU has
+ *   them.
+ *
+ * Next to the keys are the slots' ranks and, in sorted order, the values and data, so that lookups
+ * end with one more access and ranges are plain array scans.
+ *
+ * A frozen tree is one contiguous region with no pointers into itself. avl_frozen_write() stores
+ * it as is and avl_frozen_map() maps such a file straight back, which only makes sense when values
+ * and data are integers (or offsets) rather than pointers.
+ */
+
+#define AVL_FROZEN_MAGIC UINT64_C(0x61766c5f66727a31)
+// Deepest implicit tree, enough for any count that fits in memory
+#define AVL_FROZEN_MAX_HEIGHT 64
+
+enum avl_frozen_layout { AVL_FROZEN_EYTZINGER, AVL_FROZEN_VEB };
+
+enum avl_frozen_flag {
+	// Values are int64_t cast to pointers, ordered as such by cmp_func, which lookups then skip
+	AVL_FROZEN_INTEGER_VALUES = 1 << 0,
+};
+
+// Start of the region; the arrays follow at the offsets it gives, each 64-byte aligned
+struct avl_frozen_header {
+	uint64_t magic;
+	// Bytes in the region, header included
+	uint64_t size;
+	uint32_t layout;
+	uint32_t flags;
+	// Levels of the implicit binary tree (AVL_FROZEN_VEB only)
+	uint32_t height;
+	uint64_t count;
+	// Entries in the keys and ranks arrays, padding included
+	uint64_t slots;
+	uint64_t keys_offset;
+	uint64_t ranks_offset;
+	uint64_t values_offset;
+	uint64_t data_offset;
+} __attribute__((aligned(64)));
+
+struct avl_frozen {
+	struct avl_frozen_header const *header;
+	// In layout order. Eytzinger slot 0 is unused; van Emde Boas blocks have 8 slots each.
+	void const *const *keys;
+	// Position in values and data of each slot's key
+	uint64_t const *ranks;
+	void const *const *values;
+	void const *const *data;
+	int (*cmp_func)(void const *new_value, void const *node_value);
+	// Rank of the first entry not less than search_value, chosen for the layout, flags and CPU
+	uint64_t (*search_func)(struct avl_frozen const *frozen, void const *search_value);
+	// Whether header comes from avl_frozen_map() rather than malloc()
+	bool mapped;
+	// Van Emde Boas navigation, by depth in the binary tree: the height of the block starting
+	// there, and for depths where bottom trees start, the depth of their top tree's root, blocks in
+	// that top tree and blocks in each bottom tree
+	uint8_t block_height[AVL_FROZEN_MAX_HEIGHT + 1];
+	uint8_t top_depth[AVL_FROZEN_MAX_HEIGHT + 1];
+	uint64_t top_blocks[AVL_FROZEN_MAX_HEIGHT + 1];
+	uint64_t bottom_blocks[AVL_FROZEN_MAX_HEIGHT + 1];
+};
+
+// Copies the entries of tree, read-locked (or pinned to one snapshot) while they are collected
+int avl_tree_freeze(
+    struct avl_tree const *tree, struct avl_frozen **frozen, enum avl_frozen_layout layout,
+    uint32_t flags);
+
+int avl_frozen_write(struct avl_frozen const *frozen, FILE *file);
+
+// Maps a file written by avl_frozen_write() read-only; -EINVAL if it is not one
+int avl_frozen_map(
+    struct avl_frozen **frozen, char const *path,
+    int (*cmp_func)(void const *new_value, void const *node_value));
+
+void avl_frozen_free(struct avl_frozen **frozen);
+
+int avl_frozen_get(
+    struct avl_frozen const *frozen, void const *search_value, void const **node_data);
+
+int avl_frozen_lower_bound(
+    struct avl_frozen const *frozen, void const *search_value, void const **node_value,
+    void const **node_data);
+
+// Calls func on every entry between lo and hi (see avl_range_flag) in order; a negative return
+// from func stops the scan and is returned
+int avl_frozen_range(
+    struct avl_frozen const *frozen, void const *lo, void const *hi, uint32_t flags,
+    int (*func)(void const *value, void const *data, void *arg), void *arg);
+
+#endif  // AVL_C_SRC_AVL_FROZEN_H
@@ -0,0 +1,444 @@
+// Needed for sched_getcpu()
+#define _GNU_SOURCE
+
+#include "avl_replicated.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "avl_cacheline.h"
+#include "avl_slab.h"
+
+// Highest NUMA node id looked for in sysfs, plus one
+#define MAX_NODES 1024
+
+static _Thread_local int _thread_node = -1;
+
+void avl_replicated_set_node(int node) {
+	_thread_node = node;
+}
+
+int _topology_read_list(char const *path, bool *members, size_t capacity) {
+	// sysfs lists look like "0-3,8-11"
+	FILE *file = fopen(path, "r");
+	if (file == NULL) {
+		return -errno;
+	}
+
+	size_t lo;
+	size_t hi;
+	while (fscanf(file, "%zu", &lo) == 1) {
+		int c = fgetc(file);
+		hi = lo;
+		if (c == '-') {
+			if (fscanf(file, "%zu", &hi) != 1) {
+				break;
+			}
+			c = fgetc(file);
+		}
+		for (size_t i = lo; i <= hi && i < capacity; ++i) {
+			members[i] = true;
+		}
+		if (c != ',') {
+			break;
+		}
+	}
+
+	fclose(file);
+	return 0;
+}
+
+size_t _topology_read(size_t *cpu_nodes, size_t cpu_count, int *node_ids) {
+	// Numbers the online nodes densely and returns how many there are, 0 if sysfs is unavailable.
+	// node_ids has room for MAX_NODES and maps the dense numbers back to the kernel's.
+	bool *nodes = calloc(MAX_NODES, sizeof(*nodes));
+	bool *cpus = calloc(cpu_count, sizeof(*cpus));
+	size_t count = 0;
+
+	if (nodes == NULL || cpus == NULL ||
+	    _topology_read_list("/sys/devices/system/node/online", nodes, MAX_NODES) < 0) {
+		goto finish;
+	}
+
+	for (size_t node = 0; node < MAX_NODES; ++node) {
+		if (!nodes[node]) {
+			continue;
+		}
+
+		char path[64];
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%zu/cpulist", node);
+		memset(cpus, 0, sizeof(*cpus) * cpu_count);
+		if (_topology_read_list(path, cpus, cpu_count) < 0) {
+			continue;
+		}
+		for (size_t cpu = 0; cpu < cpu_count; ++cpu) {
+			if (cpus[cpu]) {
+				cpu_nodes[cpu] = count;
+			}
+		}
+		node_ids[count++] = (int)node;
+	}
+
+finish:
+	free(cpus);
+	free(nodes);
+
+	return count;
+}
+
+int avl_replicated_create(
+    struct avl_replicated_tree **tree,
+    int (*cmp_func)(void const *new_value, void const *node_value), uint32_t flags, size_t count) {
+	assert(tree != NULL);
+	assert(*tree == NULL);
+
+	if (flags & AVL_TREE_INTRUSIVE) {
+		// Every replica needs nodes of its own
+		return -EINVAL;
+	}
+
+	int rc = 0;
+	int *node_ids = NULL;
+
+	*tree = malloc(sizeof(**tree));
+	if (*tree == NULL) {
+		perror("malloc(sizeof(**tree))");
+		return -errno;
+	}
+
+	(*tree)->cmp_func = cmp_func;
+	(*tree)->count = 0;
+	(*tree)->replicas = NULL;
+	atomic_init(&(*tree)->tail, 0);
+	rc = -pthread_mutex_init(&(*tree)->log_lock, NULL);
+	if (rc < 0) {
+		free(*tree);
+		*tree = NULL;
+		return rc;
+	}
+
+	long cpu_count = sysconf(_SC_NPROCESSORS_CONF);
+	(*tree)->cpu_count = cpu_count < 1 ? 1 : (size_t)cpu_count;
+	(*tree)->cpu_replicas = malloc(sizeof(*(*tree)->cpu_replicas) * (*tree)->cpu_count);
+	if ((*tree)->cpu_replicas == NULL) {
+		perror("malloc(sizeof(*(*tree)->cpu_replicas) * (*tree)->cpu_count)");
+		rc = -errno;
+		goto finish;
+	}
+
+	node_ids = malloc(sizeof(*node_ids) * MAX_NODES);
+	if (node_ids == NULL) {
+		perror("malloc(sizeof(*node_ids) * MAX_NODES)");
+		rc = -errno;
+		goto finish;
+	}
+
+	for (size_t cpu = 0; cpu < (*tree)->cpu_count; ++cpu) {
+		(*tree)->cpu_replicas[cpu] = cpu;
+	}
+	size_t nodes = _topology_read((*tree)->cpu_replicas, (*tree)->cpu_count, node_ids);
+	if (count == 0) {
+		count = nodes == 0 ? 1 : nodes;
+	}
+	for (size_t cpu = 0; cpu < (*tree)->cpu_count; ++cpu) {
+		// Fewer real nodes than replicas: simulate a topology by spreading CPUs instead
+		size_t replica = nodes < count ? cpu : (*tree)->cpu_replicas[cpu];
+		(*tree)->cpu_replicas[cpu] = replica % count;
+	}
+
+	(*tree)->replicas = avl_cacheline_alloc(sizeof(*(*tree)->replicas) * count);
+	if ((*tree)->replicas == NULL) {
+		rc = -errno;
+		goto finish;
+	}
+
+	for (; (*tree)->count < count; ++(*tree)->count) {
+		struct avl_replica *replica = &(*tree)->replicas[(*tree)->count];
+
+		replica->tree = NULL;
+		atomic_init(&replica->applied, 0);
+		replica->ops = malloc(sizeof(*replica->ops) * AVL_REPLICATED_LOG);
+		if (replica->ops == NULL) {
+			perror("malloc(sizeof(*replica->ops) * AVL_REPLICATED_LOG)");
+			rc = -errno;
+			goto finish;
+		}
+
+		// Pooled, so that the nodes can be placed on the replica's own NUMA node: whichever thread
+		// applies the log to a replica, its nodes stay local to the threads reading it
+		rc = avl_tree_create_flags(&replica->tree, cmp_func, flags | AVL_TREE_NODE_POOL);
+		if (rc < 0) {
+			free(replica->ops);
+			goto finish;
+		}
+		if (count <= nodes) {
+			avl_slab_bind(replica->tree->slab, node_ids[(*tree)->count]);
+		}
+
+		rc = -pthread_rwlock_init(&replica->lock, NULL);
+		if (rc < 0) {
+			avl_tree_free(&replica->tree, NULL, NULL);
+			free(replica->ops);
+			goto finish;
+		}
+	}
+
+finish:
+	free(node_ids);
+	if (rc < 0) {
+		avl_replicated_free(tree, NULL, NULL);
+	}
+
+	return rc;
+}
+
+struct avl_replica *_replica_local(struct avl_replicated_tree *tree) {
+	size_t index;
+	if (_thread_node >= 0) {
+		index = (size_t)_thread_node % tree->count;
+	} else {
+		int cpu = sched_getcpu();
+		size_t known = cpu < 0 ? 0 : (size_t)cpu;
+		index = known < tree->cpu_count ? tree->cpu_replicas[known] : known % tree->count;
+	}
+
+	return &tree->replicas[index];
+}
+
+int _replica_catch_up(
+    struct avl_replicated_tree *tree, struct avl_replica *replica, uint64_t upto) {
+	// Called with replica->lock held for writing. Applies log entries up to upto.
+	uint64_t from = atomic_load_explicit(&replica->applied, memory_order_relaxed);
+	if (upto <= from) {
+		return 0;
+	}
+
+	size_t count = upto - from;
+	for (size_t i = 0; i < count; ++i) {
+		struct avl_replicated_entry const *entry = &tree->log[(from + i) % AVL_REPLICATED_LOG];
+		replica->ops[i] = (struct avl_batch_op){
+		    .kind = entry->kind,
+		    .value = entry->value,
+		    .data = entry->data,
+		};
+	}
+
+	// Entries for the same value stay in log order, the others commute
+	int rc = avl_tree_apply_batch(replica->tree, replica->ops, count);
+	if (rc < 0) {
+		// Applying the same entries again ends in the same state, so the next catch-up starts over
+		return rc;
+	}
+
+	// Writers may reuse these entries once every replica is past them
+	atomic_store_explicit(&replica->applied, upto, memory_order_release);
+
+	return 0;
+}
+
+int _replica_sync(struct avl_replicated_tree *tree, struct avl_replica *replica) {
+	// Everything appended before we got here has to be visible to us
+	uint64_t tail = atomic_load_explicit(&tree->tail, memory_order_acquire);
+	if (tail <= atomic_load_explicit(&replica->applied, memory_order_acquire)) {
+		return 0;
+	}
+
+	pthread_rwlock_wrlock(&replica->lock);
+	int rc = _replica_catch_up(tree, replica, tail);
+	pthread_rwlock_unlock(&replica->lock);
+
+	return rc;
+}
+
+int _replica_read_lock(struct avl_replicated_tree *tree, struct avl_replica *replica) {
+	// Everything appended before we got here has to be visible to us. On success, returns with
+	// replica->lock held for reading.
+	uint64_t tail = atomic_load_explicit(&tree->tail, memory_order_acquire);
+	pthread_rwlock_rdlock(&replica->lock);
+	while (atomic_load_explicit(&replica->applied, memory_order_acquire) < tail) {
+		pthread_rwlock_unlock(&replica->lock);
+		int rc = _replica_sync(tree, replica);
+		if (rc < 0) {
+			return rc;
+		}
+		pthread_rwlock_rdlock(&replica->lock);
+	}
+
+	return 0;
+}
+
+void avl_replicated_free(
+    struct avl_replicated_tree **tree,
+    int (*free_node_func)(struct avl_node const *node, void *arg), void *free_arg) {
+	assert(tree != NULL);
+	assert(*tree != NULL);
+
+	// Only replicas that were completely set up are counted
+	for (size_t i = 0; i < (*tree)->count; ++i) {
+		struct avl_replica *replica = &(*tree)->replicas[i];
+
+		if (i == 0) {
+			// free_node_func has to see what the log says is in the tree
+			int rc = _replica_catch_up(*tree, replica, atomic_load(&(*tree)->tail));
+			assert(rc >= 0);
+			(void)rc;
+			avl_tree_free(&replica->tree, free_node_func, free_arg);
+		} else {
+			// The nodes go with the pool
+			avl_tree_free(&replica->tree, NULL, NULL);
+		}
+		pthread_rwlock_destroy(&replica->lock);
+		free(replica->ops);
+	}
+
+	free((*tree)->replicas);
+	free((*tree)->cpu_replicas);
+	pthread_mutex_destroy(&(*tree)->log_lock);
+	free(*tree);
+	*tree = NULL;
+}
+
+uint64_t _replicated_oldest(struct avl_replicated_tree *tree) {
+	uint64_t oldest = UINT64_MAX;
+	for (size_t i = 0; i < tree->count; ++i) {
+		uint64_t applied = atomic_load_explicit(&tree->replicas[i].applied, memory_order_acquire);
+		oldest = applied < oldest ? applied : oldest;
+	}
+
+	return oldest;
+}
+
+int _replicated_update(struct avl_replicated_tree *tree, struct avl_batch_op *op) {
+	struct avl_replica *replica = _replica_local(tree);
+
+	// Held throughout, so that nobody reads our entry here before it is in the log
+	pthread_rwlock_wrlock(&replica->lock);
+
+	// Most of the catching up happens before other writers have to wait for us
+	uint64_t tail = atomic_load_explicit(&tree->tail, memory_order_acquire);
+	int rc = _replica_catch_up(tree, replica, tail);
+	if (rc < 0) {
+		goto finish;
+	}
+
+	pthread_mutex_lock(&tree->log_lock);
+	tail = atomic_load_explicit(&tree->tail, memory_order_relaxed);
+	while (AVL_REPLICATED_LOG <= tail - _replicated_oldest(tree)) {
+		pthread_mutex_unlock(&tree->log_lock);
+
+		// The log is full. Replicas nobody is using right now would never catch up on their own; those
+		// that are locked belong to threads that are catching up already. Their nodes still come from
+		// their own NUMA node's pool, and they retry whatever fails here on their next catch-up.
+		rc = _replica_catch_up(tree, replica, tail);
+		if (rc < 0) {
+			goto finish;
+		}
+		for (size_t i = 0; i < tree->count; ++i) {
+			struct avl_replica *other = &tree->replicas[i];
+			if (other != replica && pthread_rwlock_trywrlock(&other->lock) == 0) {
+				_replica_catch_up(tree, other, tail);
+				pthread_rwlock_unlock(&other->lock);
+			}
+		}
+		sched_yield();
+
+		pthread_mutex_lock(&tree->log_lock);
+		tail = atomic_load_explicit(&tree->tail, memory_order_relaxed);
+	}
+
+	// Our entry has to come right after everything appended before it. It is applied here first, and
+	// only logged if that worked, so a failed operation never reaches the other replicas.
+	rc = _replica_catch_up(tree, replica, tail);
+	if (rc == 0) {
+		rc = avl_tree_apply_batch(replica->tree, op, 1);
+	}
+	if (rc == 0) {
+		tree->log[tail % AVL_REPLICATED_LOG] = (struct avl_replicated_entry){
+		    .kind = op->kind,
+		    .value = op->value,
+		    .data = op->data,
+		};
+		atomic_store_explicit(&replica->applied, tail + 1, memory_order_release);
+		atomic_store_explicit(&tree->tail, tail + 1, memory_order_release);
+		rc = op->result;
+	}
+	pthread_mutex_unlock(&tree->log_lock);
+
+finish:
+	pthread_rwlock_unlock(&replica->lock);
+
+	return rc;
+}
+
+int avl_replicated_add(struct avl_replicated_tree *tree, void const *value, void const *data) {
+	assert(tree != NULL);
+
+	struct avl_batch_op op = {.kind = AVL_BATCH_ADD, .value = value, .data = data};
+	return _replicated_update(tree, &op);
+}
+
+int avl_replicated_get(
+    struct avl_replicated_tree *tree, void const *search_value, void const **node_data) {
+	assert(tree != NULL);
+	assert(node_data != NULL);
+
+	struct avl_replica *replica = _replica_local(tree);
+	int rc = _replica_read_lock(tree, replica);
+	if (rc < 0) {
+		return rc;
+	}
+
+	rc = avl_tree_get(replica->tree, search_value, node_data);
+	pthread_rwlock_unlock(&replica->lock);
+
+	return rc;
+}
+
+int avl_replicated_remove(
+    struct avl_replicated_tree *tree, void const *search_value, void const **node_value,
+    void const **node_data) {
+	assert(tree != NULL);
+	assert(node_value != NULL);
+	assert(node_data != NULL);
+
+	struct avl_batch_op op = {.kind = AVL_BATCH_REMOVE, .value = search_value};
+	int rc = _replicated_update(tree, &op);
+	*node_value = op.node_value;
+	*node_data = op.node_data;
+
+	return rc;
+}
+
+int avl_replicated_traverse(
+    struct avl_replicated_tree *tree, int (*inorder_func)(struct avl_node const *node, void *arg),
+    void *arg) {
+	assert(tree != NULL);
+
+	struct avl_replica *replica = _replica_local(tree);
+	int rc = _replica_read_lock(tree, replica);
+	if (rc < 0) {
+		return rc;
+	}
+
+	rc = avl_tree_traverse(replica->tree, NULL, NULL, inorder_func, arg, NULL, NULL);
+	pthread_rwlock_unlock(&replica->lock);
+
+	return rc;
+}
+
+int avl_replicated_synchronize(struct avl_replicated_tree *tree) {
+	assert(tree != NULL);
+
+	int rc = 0;
+	for (size_t i = 0; i < tree->count && rc >= 0; ++i) {
+		rc = _replica_sync(tree, &tree->replicas[i]);
+	}
+
+	return rc;
+}
@@ -0,0 +1,101 @@
+#ifndef AVL_C_SRC_AVL_REPLICATED_H
+#define AVL_C_SRC_AVL_REPLICATED_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "avl.h"
+
+/*
+ * One avl_tree per NUMA node, after Calciu, Sen, Balakrishnan and Aguilera, "Black-box Concurrent
+ * Data Structures for NUMA Architectures" (ASPLOS 2017).
+ *
+ * Adds and removes are appended to a shared operation log. Every replica applies the log in order,
+ * lazily: a thread brings its own replica up to date (as one avl_tree_apply_batch) before it reads
+ * from it or makes an update. An update is applied to the writer's replica first and only appended
+ * if it succeeded there, so every replica sees the same successful operations and an error (such as
+ * -ENOMEM) leaves the tree unchanged. So lookups only touch nodes of their own node's replica, and
+ * the interconnect carries the log rather than every step of every descent.
+ * Replicas always keep their nodes in a pool (AVL_TREE_NODE_POOL) bound to their NUMA node, so a
+ * replica stays local to its own threads even when another thread applies the log to it.
+ *
+ * Threads use the replica of the NUMA node they run on, as read from sysfs when the tree is
+ * created. With more replicas than the machine has nodes (for instance on a single-node test
+ * machine), CPUs are spread over replicas round-robin instead, and avl_replicated_set_node() lets a
+ * thread pick one outright.
+ *
+ * Only nodes are replicated: every replica points at the same values and data. A removed value may
+ * still be compared against by replicas that have yet to apply the removal, so it must stay valid
+ * for cmp_func until avl_replicated_synchronize() returns or the tree is freed.
+ */
+
+// Entries the log holds; a writer that would lap the slowest replica catches it up first
+#define AVL_REPLICATED_LOG 4096
+
+struct avl_replicated_entry {
+	enum avl_batch_kind kind;
+	void const *value;
+	void const *data;
+};
+
+struct avl_replica {
+	struct avl_tree *tree;
+	// Held for writing while log entries are applied to tree, and for reading while it is read
+	pthread_rwlock_t lock;
+	// Number of log entries tree reflects
+	_Atomic uint64_t applied;
+	// Room for one catch-up, as large as the log
+	struct avl_batch_op *ops;
+} __attribute__((aligned(64)));
+
+struct avl_replicated_tree {
+	int (*cmp_func)(void const *new_value, void const *node_value);
+	struct avl_replica *replicas;
+	size_t count;
+	// Replica for each CPU the topology was read for
+	size_t *cpu_replicas;
+	size_t cpu_count;
+	// Serializes appends
+	pthread_mutex_t log_lock;
+	// Number of entries ever appended; entry i lives in log[i % AVL_REPLICATED_LOG]
+	_Atomic uint64_t tail;
+	struct avl_replicated_entry log[AVL_REPLICATED_LOG];
+};
+
+// count 0 makes one replica per NUMA node; flags are those of each replica's avl_tree, which always
+// adds AVL_TREE_NODE_POOL, and may not include AVL_TREE_INTRUSIVE
+int avl_replicated_create(
+    struct avl_replicated_tree **tree,
+    int (*cmp_func)(void const *new_value, void const *node_value), uint32_t flags, size_t count);
+
+// Not safe against other calls. free_node_func sees every entry once, as for avl_tree_free on a
+// pooled tree: it may release values and data, but the nodes go with the pools.
+void avl_replicated_free(
+    struct avl_replicated_tree **tree,
+    int (*free_node_func)(struct avl_node const *node, void *arg), void *free_arg);
+
+// Make the calling thread use replica node % count of every replicated tree; -1 goes back to
+// following the CPU it runs on
+void avl_replicated_set_node(int node);
+
+int avl_replicated_add(struct avl_replicated_tree *tree, void const *value, void const *data);
+
+int avl_replicated_get(
+    struct avl_replicated_tree *tree, void const *search_value, void const **node_data);
+
+int avl_replicated_remove(
+    struct avl_replicated_tree *tree, void const *search_value, void const **node_value,
+    void const **node_data);
+
+// Walks the calling thread's replica, brought up to date first. inorder_func must not add to or
+// remove from the tree, which waits for the walk.
+int avl_replicated_traverse(
+    struct avl_replicated_tree *tree, int (*inorder_func)(struct avl_node const *node, void *arg),
+    void *arg);
+
+// Brings every replica up to date, after which values removed before the call are no longer used
+int avl_replicated_synchronize(struct avl_replicated_tree *tree);
+
+#endif  // AVL_C_SRC_AVL_REPLICATED_H
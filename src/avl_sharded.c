@@ -0,0 +1,461 @@
+#include "avl_sharded.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "avl_cacheline.h"
+
+// Rebalancing relinks nodes, which trees with these flags cannot do
+#define REBALANCE_UNSUPPORTED \
+	(AVL_TREE_OPTIMISTIC_READS | AVL_TREE_PERSISTENT | AVL_TREE_NODE_POOL)
+
+void _sharded_release(void *value, void *tree) {
+	// Called by the epoch once no routing thread can still be comparing against a boundary
+	struct avl_sharded_tree *sharded = tree;
+	sharded->release_func(value, sharded->bound_arg);
+}
+
+int avl_sharded_create(
+    struct avl_sharded_tree **tree,
+    int (*cmp_func)(void const *new_value, void const *node_value), uint32_t flags,
+    void const *const *bounds, size_t count,
+    void const *(*clone_func)(void const *value, void *arg),
+    void (*release_func)(void const *value, void *arg), void *bound_arg) {
+	assert(tree != NULL);
+	assert(*tree == NULL);
+	assert(0 < count);
+	assert(bounds != NULL || count == 1);
+	assert((clone_func == NULL) == (release_func == NULL));
+
+#ifndef NDEBUG
+	for (size_t i = 1; i + 1 < count; ++i) {
+		assert(cmp_func(bounds[i - 1], bounds[i]) <= 0);
+	}
+#endif
+
+	int rc = 0;
+
+	*tree = malloc(sizeof(**tree));
+	if (*tree == NULL) {
+		perror("malloc(sizeof(**tree))");
+		return -errno;
+	}
+
+	(*tree)->count = 0;
+	(*tree)->cmp_func = cmp_func;
+	(*tree)->flags = flags;
+	(*tree)->clone_func = clone_func;
+	(*tree)->release_func = release_func;
+	(*tree)->bound_arg = bound_arg;
+	(*tree)->owned = NULL;
+	(*tree)->owned_count = 0;
+	(*tree)->epoch = NULL;
+	(*tree)->shards = NULL;
+	(*tree)->bounds = malloc(sizeof(*(*tree)->bounds) * (count - 1 == 0 ? 1 : count - 1));
+	if ((*tree)->bounds == NULL) {
+		perror("malloc(bounds)");
+		rc = -errno;
+		goto finish;
+	}
+	(*tree)->shards = avl_cacheline_alloc(sizeof(*(*tree)->shards) * count);
+	if ((*tree)->shards == NULL) {
+		rc = -errno;
+		goto finish;
+	}
+	if (count > 1) {
+		memcpy((*tree)->bounds, bounds, sizeof(*bounds) * (count - 1));
+	}
+
+	if (clone_func != NULL) {
+		(*tree)->owned = malloc(sizeof(*(*tree)->owned) * (count - 1 == 0 ? 1 : count - 1));
+		if ((*tree)->owned == NULL) {
+			perror("malloc(owned)");
+			rc = -errno;
+			goto finish;
+		}
+		for (; (*tree)->owned_count + 1 < count; ++(*tree)->owned_count) {
+			void const *copy = clone_func(bounds[(*tree)->owned_count], bound_arg);
+			if (copy == NULL) {
+				rc = -ENOMEM;
+				goto finish;
+			}
+			(*tree)->owned[(*tree)->owned_count] = copy;
+			(*tree)->bounds[(*tree)->owned_count] = copy;
+		}
+
+		rc = avl_epoch_create(&(*tree)->epoch, _sharded_release, *tree);
+		if (rc < 0) {
+			goto finish;
+		}
+	}
+
+	for (; (*tree)->count < count; ++(*tree)->count) {
+		struct avl_sharded_shard *shard = &(*tree)->shards[(*tree)->count];
+
+		// Every shard counts its entries so that rebalancing can find where to cut in O(log n)
+		shard->tree = NULL;
+		rc = avl_tree_create_flags(&shard->tree, cmp_func, flags | AVL_TREE_ORDER_STATISTICS);
+		if (rc < 0) {
+			goto finish;
+		}
+
+		rc = -pthread_rwlock_init(&shard->guard, NULL);
+		if (rc < 0) {
+			avl_tree_free(&shard->tree, NULL, NULL);
+			goto finish;
+		}
+	}
+
+finish:
+	if (rc < 0) {
+		avl_sharded_free(tree, NULL, NULL);
+	}
+
+	return rc;
+}
+
+void avl_sharded_free(
+    struct avl_sharded_tree **tree, int (*free_node_func)(struct avl_node const *node, void *arg),
+    void *free_arg) {
+	assert(tree != NULL);
+	assert(*tree != NULL);
+
+	// Only shards that were completely set up are counted
+	for (size_t i = 0; i < (*tree)->count; ++i) {
+		avl_tree_free(&(*tree)->shards[i].tree, free_node_func, free_arg);
+		pthread_rwlock_destroy(&(*tree)->shards[i].guard);
+	}
+
+	// Nothing routes any more, so the boundaries can go right away along with those still deferred
+	for (size_t i = 0; i < (*tree)->owned_count; ++i) {
+		(*tree)->release_func((*tree)->owned[i], (*tree)->bound_arg);
+	}
+	free((*tree)->owned);
+	if ((*tree)->epoch != NULL) {
+		avl_epoch_free(&(*tree)->epoch);
+	}
+
+	free((*tree)->shards);
+	free((*tree)->bounds);
+	free(*tree);
+	*tree = NULL;
+}
+
+size_t _sharded_route(struct avl_sharded_tree const *tree, void const *value) {
+	// The number of boundaries not greater than value; they may be moving unless a guard is held
+	size_t lo = 0;
+	size_t hi = tree->count - 1;
+	while (lo < hi) {
+		size_t middle = lo + (hi - lo) / 2;
+		void const *bound = __atomic_load_n(&tree->bounds[middle], __ATOMIC_ACQUIRE);
+		if (tree->cmp_func(value, bound) < 0) {
+			hi = middle;
+		} else {
+			lo = middle + 1;
+		}
+	}
+
+	return lo;
+}
+
+uint64_t _sharded_epoch_enter(struct avl_sharded_tree *tree) {
+	// Copied boundaries stay valid for as long as a thread is inside the epoch
+	return tree->epoch != NULL ? avl_epoch_enter(tree->epoch) : 0;
+}
+
+void _sharded_epoch_exit(struct avl_sharded_tree *tree, uint64_t token) {
+	if (tree->epoch != NULL) {
+		avl_epoch_exit(tree->epoch, token);
+	}
+}
+
+struct avl_sharded_shard *_sharded_enter(struct avl_sharded_tree *tree, void const *value) {
+	uint64_t token = _sharded_epoch_enter(tree);
+
+	for (;;) {
+		size_t i = _sharded_route(tree, value);
+		pthread_rwlock_rdlock(&tree->shards[i].guard);
+
+		// Boundaries only move while every guard is held, so the answer is now final
+		if (_sharded_route(tree, value) == i) {
+			_sharded_epoch_exit(tree, token);
+			return &tree->shards[i];
+		}
+
+		pthread_rwlock_unlock(&tree->shards[i].guard);
+	}
+}
+
+void _sharded_exit(struct avl_sharded_shard *shard) {
+	pthread_rwlock_unlock(&shard->guard);
+}
+
+int avl_sharded_add(struct avl_sharded_tree *tree, void const *new_value, void const *new_data) {
+	assert(tree != NULL);
+
+	struct avl_sharded_shard *shard = _sharded_enter(tree, new_value);
+	int rc = avl_tree_add(shard->tree, new_value, new_data);
+	_sharded_exit(shard);
+
+	return rc;
+}
+
+int avl_sharded_get(
+    struct avl_sharded_tree *tree, void const *search_value, void const **node_data) {
+	assert(tree != NULL);
+
+	struct avl_sharded_shard *shard = _sharded_enter(tree, search_value);
+	int rc = avl_tree_get(shard->tree, search_value, node_data);
+	_sharded_exit(shard);
+
+	return rc;
+}
+
+int avl_sharded_remove(
+    struct avl_sharded_tree *tree, void const *search_value, void const **node_value,
+    void const **node_data) {
+	assert(tree != NULL);
+
+	struct avl_sharded_shard *shard = _sharded_enter(tree, search_value);
+	int rc = avl_tree_remove(shard->tree, search_value, node_value, node_data);
+	_sharded_exit(shard);
+
+	return rc;
+}
+
+int avl_sharded_range(
+    struct avl_sharded_tree *tree, void const *lo, void const *hi, uint32_t flags,
+    int (*func)(struct avl_node const *node, void *arg), void *arg) {
+	assert(tree != NULL);
+	assert(func != NULL);
+
+	uint32_t hi_flags = flags & (AVL_RANGE_HI_INCLUSIVE | AVL_RANGE_HI_UNBOUNDED);
+	uint32_t lo_flags = flags & (AVL_RANGE_LO_INCLUSIVE | AVL_RANGE_LO_UNBOUNDED);
+
+	// One epoch for the whole walk: each boundary is still used after its shard's guard is let go
+	uint64_t token = _sharded_epoch_enter(tree);
+	int rc;
+
+	for (;;) {
+		// The first shard always covers an unbounded start
+		struct avl_sharded_shard *shard = &tree->shards[0];
+		if (lo_flags & AVL_RANGE_LO_UNBOUNDED) {
+			pthread_rwlock_rdlock(&shard->guard);
+		} else {
+			shard = _sharded_enter(tree, lo);
+		}
+
+		size_t i = shard - tree->shards;
+		rc = avl_tree_range(shard->tree, lo, hi, lo_flags | hi_flags, func, arg);
+		bool last = i + 1 == tree->count;
+		void const *bound = last ? NULL : tree->bounds[i];
+
+		_sharded_exit(shard);
+
+		if (rc < 0 || last) {
+			break;
+		}
+
+		// Stop once the next shard starts past hi
+		if (!(flags & AVL_RANGE_HI_UNBOUNDED)) {
+			int direction = tree->cmp_func(hi, bound);
+			if (direction < 0 || (direction == 0 && !(flags & AVL_RANGE_HI_INCLUSIVE))) {
+				break;
+			}
+		}
+
+		// Everything before the boundary has been seen, wherever rebalancing moves it next
+		lo = bound;
+		lo_flags = AVL_RANGE_LO_INCLUSIVE;
+	}
+
+	_sharded_epoch_exit(tree, token);
+
+	return rc;
+}
+
+int avl_sharded_traverse(
+    struct avl_sharded_tree *tree, int (*inorder_func)(struct avl_node const *node, void *arg),
+    void *arg) {
+	return avl_sharded_range(
+	    tree, NULL, NULL, AVL_RANGE_LO_UNBOUNDED | AVL_RANGE_HI_UNBOUNDED, inorder_func, arg);
+}
+
+size_t _sharded_size(struct avl_sharded_shard const *shard) {
+	size_t size;
+	int rc = avl_tree_count_range(
+	    shard->tree, NULL, NULL, AVL_RANGE_LO_UNBOUNDED | AVL_RANGE_HI_UNBOUNDED, &size);
+	assert(rc == 0);
+	(void)rc;
+
+	return size;
+}
+
+int avl_sharded_sizes(struct avl_sharded_tree *tree, size_t *sizes) {
+	assert(tree != NULL);
+	assert(sizes != NULL);
+
+	for (size_t i = 0; i < tree->count; ++i) {
+		pthread_rwlock_rdlock(&tree->shards[i].guard);
+		sizes[i] = _sharded_size(&tree->shards[i]);
+		pthread_rwlock_unlock(&tree->shards[i].guard);
+	}
+
+	return 0;
+}
+
+int _sharded_cut(struct avl_sharded_tree *tree, size_t total, void const **cuts) {
+	// Called with every guard held. cuts[0] is the smallest value and cuts[i] the first of shard i's
+	// share, copied if the tree keeps copies of its boundaries.
+	size_t shard = 0;
+	size_t before = 0;
+	size_t size = _sharded_size(&tree->shards[0]);
+	for (size_t i = 0; i < tree->count; ++i) {
+		size_t rank = i * total / tree->count;
+		while (before + size <= rank) {
+			before += size;
+			size = _sharded_size(&tree->shards[++shard]);
+		}
+
+		void const *data;
+		int rc = avl_tree_select(tree->shards[shard].tree, rank - before, &cuts[i], &data);
+		assert(rc == true);
+		(void)rc;
+
+		if (tree->clone_func != NULL) {
+			cuts[i] = tree->clone_func(cuts[i], tree->bound_arg);
+			if (cuts[i] == NULL) {
+				// Nothing has moved yet, and nobody has seen these copies
+				for (size_t j = 0; j < i; ++j) {
+					tree->release_func(cuts[j], tree->bound_arg);
+				}
+				return -ENOMEM;
+			}
+		}
+	}
+
+	return 0;
+}
+
+int avl_sharded_rebalance(struct avl_sharded_tree *tree) {
+	assert(tree != NULL);
+
+	if (tree->flags & REBALANCE_UNSUPPORTED) {
+		return -EINVAL;
+	}
+
+	// Always in the same order, so two rebalancing threads cannot deadlock
+	for (size_t i = 0; i < tree->count; ++i) {
+		pthread_rwlock_wrlock(&tree->shards[i].guard);
+	}
+
+	int rc = 0;
+	void const **cuts = NULL;
+
+	size_t total = 0;
+	for (size_t i = 0; i < tree->count; ++i) {
+		total += _sharded_size(&tree->shards[i]);
+	}
+	if (total < tree->count) {
+		// Some shards stay empty whatever the boundaries are
+		goto finish;
+	}
+
+	cuts = malloc(sizeof(*cuts) * tree->count);
+	if (cuts == NULL) {
+		perror("malloc(sizeof(*cuts) * tree->count)");
+		rc = -errno;
+		goto finish;
+	}
+
+	// Routing threads may be inside the epoch and waiting for our guards, so retiring the old
+	// boundaries must never have to wait for them
+	if (tree->epoch != NULL) {
+		rc = avl_epoch_reserve(tree->epoch, tree->owned_count);
+		if (rc < 0) {
+			goto finish;
+		}
+	}
+
+	// Every boundary is picked (and copied) before anything moves, so a failure changes nothing
+	rc = _sharded_cut(tree, total, cuts);
+	if (rc < 0) {
+		goto finish;
+	}
+
+	// Gather everything in the first shard; the others stay around, empty, until they are refilled
+	struct avl_sharded_shard *shards = tree->shards;
+	for (size_t i = 1; i < tree->count; ++i) {
+		rc = avl_tree_join(shards[0].tree, shards[i].tree);
+		assert(rc == 0);
+	}
+
+	// Cut off one shard's share at a time, each with an O(log n) split
+	struct avl_tree *rest = shards[0].tree;
+	size_t i = 0;
+	for (; i + 1 < tree->count; ++i) {
+		struct avl_tree *lo = NULL;
+		struct avl_tree *hi = NULL;
+		rc = avl_tree_split(rest, cuts[i + 1], &lo, &hi);
+		if (rc < 0) {
+			break;
+		}
+
+		// Both the old tree of this shard and rest (the first time, the same tree) are empty now
+		struct avl_tree *old = shards[i].tree;
+		shards[i].tree = lo;
+		if (old != rest) {
+			avl_tree_free(&old, NULL, NULL);
+		}
+		avl_tree_free(&rest, NULL, NULL);
+		rest = hi;
+
+		__atomic_store_n(&tree->bounds[i], cuts[i + 1], __ATOMIC_RELEASE);
+	}
+
+	if (rc < 0) {
+		// Out of memory halfway: the rest, which starts at cuts[i], goes to the last shard, and the
+		// boundaries between make the shards in between empty
+		for (size_t j = i; j + 1 < tree->count; ++j) {
+			__atomic_store_n(&tree->bounds[j], cuts[i], __ATOMIC_RELEASE);
+		}
+	}
+
+	// The last shard takes whatever is left
+	struct avl_tree *empty = shards[tree->count - 1].tree;
+	if (empty != rest) {
+		shards[tree->count - 1].tree = rest;
+		if (rc < 0 && i == 0) {
+			// rest was the first shard's tree, which needs a replacement
+			shards[0].tree = empty;
+		} else {
+			avl_tree_free(&empty, NULL, NULL);
+		}
+	}
+
+	if (tree->clone_func != NULL) {
+		// Threads that read the old boundaries without a guard may still be comparing against them
+		for (size_t j = 0; j < tree->owned_count; ++j) {
+			avl_epoch_retire(tree->epoch, (void *)tree->owned[j]);
+		}
+		avl_epoch_reclaim(tree->epoch);
+
+		free(tree->owned);
+		tree->owned = cuts;
+		tree->owned_count = tree->count;
+		cuts = NULL;
+	}
+
+finish:
+	for (size_t i = tree->count; 0 < i; --i) {
+		pthread_rwlock_unlock(&tree->shards[i - 1].guard);
+	}
+
+	free(cuts);
+
+	return rc < 0 ? rc : 0;
+}
@@ -0,0 +1,90 @@
+#ifndef AVL_C_SRC_AVL_SHARDED_H
+#define AVL_C_SRC_AVL_SHARDED_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "avl.h"
+#include "avl_epoch.h"
+
+/*
+ * A set of avl_trees that split the key space into consecutive ranges, so that writers working on
+ * different ranges never wait for each other.
+ *
+ * Shard i holds the values from bounds[i - 1] (inclusive) up to bounds[i] (exclusive), with the
+ * first and last shards open-ended. Every operation takes its shard's guard shared on top of the
+ * shard's own lock; avl_sharded_rebalance() takes every guard exclusively while it moves the
+ * boundaries so that each shard holds about the same number of entries.
+ *
+ * Boundaries are made from values the caller passed in or that were in the tree at the time, and
+ * threads route by them without holding any guard. With a clone_func, the tree keeps copies of its
+ * own and hands each to release_func once no thread can still be comparing against it, so removed
+ * values can be freed right away. Without one, boundaries borrow the values themselves, which must
+ * then stay valid for cmp_func until the tree is freed; that suits values that need no freeing.
+ *
+ * Shards always keep AVL_TREE_ORDER_STATISTICS on top of the flags the tree was created with.
+ * Rebalancing relinks nodes with avl_tree_split and avl_tree_join, so it is not available with the
+ * flags those reject.
+ */
+
+struct avl_sharded_shard {
+	// Shared by every operation on the shard, exclusive while boundaries move
+	pthread_rwlock_t guard;
+	struct avl_tree *tree;
+} __attribute__((aligned(64)));
+
+struct avl_sharded_tree {
+	struct avl_sharded_shard *shards;
+	size_t count;
+	// count - 1 non-decreasing boundaries; equal neighbours leave the shard between them empty
+	void const **bounds;
+	int (*cmp_func)(void const *new_value, void const *node_value);
+	uint32_t flags;
+	void const *(*clone_func)(void const *value, void *arg);
+	void (*release_func)(void const *value, void *arg);
+	void *bound_arg;
+	// The copies bounds points into, only kept with a clone_func; each is released exactly once
+	void const **owned;
+	size_t owned_count;
+	// Defers releasing copies that routing threads may still be looking at
+	struct avl_epoch *epoch;
+};
+
+// count shards, split by the count - 1 values in bounds. clone_func returns a copy of a value, or
+// NULL if it cannot, and release_func disposes of one; either both are given or neither.
+int avl_sharded_create(
+    struct avl_sharded_tree **tree,
+    int (*cmp_func)(void const *new_value, void const *node_value), uint32_t flags,
+    void const *const *bounds, size_t count,
+    void const *(*clone_func)(void const *value, void *arg),
+    void (*release_func)(void const *value, void *arg), void *bound_arg);
+
+void avl_sharded_free(
+    struct avl_sharded_tree **tree, int (*free_node_func)(struct avl_node const *node, void *arg),
+    void *free_arg);
+
+int avl_sharded_add(struct avl_sharded_tree *tree, void const *new_value, void const *new_data);
+
+int avl_sharded_get(
+    struct avl_sharded_tree *tree, void const *search_value, void const **node_data);
+
+int avl_sharded_remove(
+    struct avl_sharded_tree *tree, void const *search_value, void const **node_value,
+    void const **node_data);
+
+// In order across every shard. Each shard is consistent on its own, and moving boundaries never
+// make a walk visit an entry twice or skip one that stayed in the tree.
+int avl_sharded_range(
+    struct avl_sharded_tree *tree, void const *lo, void const *hi, uint32_t flags,
+    int (*func)(struct avl_node const *node, void *arg), void *arg);
+
+int avl_sharded_traverse(
+    struct avl_sharded_tree *tree, int (*inorder_func)(struct avl_node const *node, void *arg),
+    void *arg);
+
+int avl_sharded_sizes(struct avl_sharded_tree *tree, size_t *sizes);
+
+int avl_sharded_rebalance(struct avl_sharded_tree *tree);
+
+#endif  // AVL_C_SRC_AVL_SHARDED_H
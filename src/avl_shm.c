@@ -0,0 +1,264 @@
+#include "avl_shm.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "avl_compact_internal.h"
+
+int _shm_map(
+    struct avl_shm_tree **tree, int fd, size_t size,
+    int (*cmp_func)(void const *new_value, void const *node_value)) {
+	*tree = malloc(sizeof(**tree));
+	if (*tree == NULL) {
+		perror("malloc(sizeof(**tree))");
+		return -errno;
+	}
+
+	void *region = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (region == MAP_FAILED) {
+		int rc = -errno;
+		perror("mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)");
+		free(*tree);
+		*tree = NULL;
+		return rc;
+	}
+
+	(*tree)->header = region;
+	(*tree)->nodes = (char *)region + sizeof(struct avl_shm_header);
+	(*tree)->cmp_func = cmp_func;
+
+	return 0;
+}
+
+int avl_shm_create(
+    struct avl_shm_tree **tree, char const *name,
+    int (*cmp_func)(void const *new_value, void const *node_value), uint32_t flags,
+    size_t capacity) {
+	assert(tree != NULL);
+	assert(*tree == NULL);
+	assert(name != NULL);
+	assert(cmp_func != NULL);
+
+	if (AVL_COMPACT_MAX_NODES < capacity) {
+		return -EINVAL;
+	}
+
+	// Never take over a region somebody else is using
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd < 0) {
+		return -errno;
+	}
+
+	int rc = 0;
+	size_t size = sizeof(struct avl_shm_header) + (capacity + 1) * _compact_node_size(flags);
+	if (ftruncate(fd, size) < 0) {
+		rc = -errno;
+		perror("ftruncate(fd, size)");
+		goto finish;
+	}
+
+	rc = _shm_map(tree, fd, size, cmp_func);
+	if (rc < 0) {
+		goto finish;
+	}
+
+	struct avl_shm_header *header = (*tree)->header;
+	header->size = size;
+	header->flags = flags;
+	header->capacity = capacity + 1;
+	// Slot 0 stands for "no child" and is never handed out
+	header->used = 1;
+	header->free_list = 0;
+	header->root = 0;
+	header->count = 0;
+
+	pthread_rwlockattr_t attr;
+	rc = -pthread_rwlockattr_init(&attr);
+	if (rc == 0) {
+		rc = -pthread_rwlockattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+		if (rc == 0) {
+			rc = -pthread_rwlock_init(&header->lock, &attr);
+		}
+		pthread_rwlockattr_destroy(&attr);
+	}
+	if (rc < 0) {
+		avl_shm_close(tree);
+		goto finish;
+	}
+
+	// Only now may other processes open it
+	atomic_store_explicit(&header->magic, AVL_SHM_MAGIC, memory_order_release);
+
+finish:
+	close(fd);
+	if (rc < 0) {
+		shm_unlink(name);
+	}
+
+	return rc;
+}
+
+int avl_shm_open(
+    struct avl_shm_tree **tree, char const *name,
+    int (*cmp_func)(void const *new_value, void const *node_value)) {
+	assert(tree != NULL);
+	assert(*tree == NULL);
+	assert(name != NULL);
+	assert(cmp_func != NULL);
+
+	int fd = shm_open(name, O_RDWR, 0);
+	if (fd < 0) {
+		return -errno;
+	}
+
+	int rc = 0;
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		rc = -errno;
+		goto finish;
+	}
+	if ((size_t)st.st_size < sizeof(struct avl_shm_header)) {
+		// Not even truncated to size yet
+		rc = -EAGAIN;
+		goto finish;
+	}
+
+	rc = _shm_map(tree, fd, st.st_size, cmp_func);
+	if (rc < 0) {
+		goto finish;
+	}
+
+	struct avl_shm_header *header = (*tree)->header;
+	if (atomic_load_explicit(&header->magic, memory_order_acquire) != AVL_SHM_MAGIC) {
+		rc = -EAGAIN;
+	} else if (header->size != (uint64_t)st.st_size) {
+		rc = -EINVAL;
+	}
+	if (rc < 0) {
+		munmap(header, st.st_size);
+		free(*tree);
+		*tree = NULL;
+	}
+
+finish:
+	close(fd);
+
+	return rc;
+}
+
+void avl_shm_close(struct avl_shm_tree **tree) {
+	assert(tree != NULL);
+	assert(*tree != NULL);
+
+	munmap((*tree)->header, (*tree)->header->size);
+	free(*tree);
+	*tree = NULL;
+}
+
+int avl_shm_unlink(char const *name) {
+	assert(name != NULL);
+
+	return shm_unlink(name) < 0 ? -errno : 0;
+}
+
+void _shm_view(struct avl_shm_tree const *tree, struct avl_compact_tree *view) {
+	// Called with the lock held. The compact tree code runs on a copy of the shared state that
+	// points at this process's mapping of the nodes.
+	struct avl_shm_header const *header = tree->header;
+
+	view->nodes = tree->nodes;
+	view->node_size = _compact_node_size(header->flags);
+	view->capacity = header->capacity;
+	view->used = header->used;
+	view->free_list = header->free_list;
+	view->root = header->root;
+	view->count = header->count;
+	view->cmp_func = tree->cmp_func;
+	view->flags = header->flags;
+}
+
+void _shm_publish(struct avl_shm_tree *tree, struct avl_compact_tree const *view) {
+	// Called with the exclusive lock held, once the view has been changed
+	struct avl_shm_header *header = tree->header;
+
+	header->used = view->used;
+	header->free_list = view->free_list;
+	header->root = view->root;
+	header->count = view->count;
+}
+
+int avl_shm_add(struct avl_shm_tree *tree, void const *value, void const *data) {
+	assert(tree != NULL);
+
+	struct avl_compact_tree view;
+	int rc;
+
+	pthread_rwlock_wrlock(&tree->header->lock);
+	_shm_view(tree, &view);
+
+	if (view.free_list == 0 && view.capacity <= view.used) {
+		// The compact tree would grow its array, which here is not its to reallocate
+		rc = _compact_get_locked(&view, value, NULL) ? false : -ENOSPC;
+	} else {
+		rc = _compact_add_locked(&view, value, data);
+		_shm_publish(tree, &view);
+	}
+
+	pthread_rwlock_unlock(&tree->header->lock);
+
+	return rc;
+}
+
+int avl_shm_get(struct avl_shm_tree *tree, void const *search_value, void const **node_data) {
+	assert(tree != NULL);
+
+	struct avl_compact_tree view;
+
+	pthread_rwlock_rdlock(&tree->header->lock);
+	_shm_view(tree, &view);
+	int rc = _compact_get_locked(&view, search_value, node_data);
+	pthread_rwlock_unlock(&tree->header->lock);
+
+	return rc;
+}
+
+int avl_shm_remove(
+    struct avl_shm_tree *tree, void const *search_value, void const **node_value,
+    void const **node_data) {
+	assert(tree != NULL);
+	assert(node_value != NULL);
+	assert(node_data != NULL);
+
+	struct avl_compact_tree view;
+
+	pthread_rwlock_wrlock(&tree->header->lock);
+	_shm_view(tree, &view);
+	int rc = _compact_remove_locked(&view, search_value, node_value, node_data);
+	_shm_publish(tree, &view);
+	pthread_rwlock_unlock(&tree->header->lock);
+
+	return rc;
+}
+
+int avl_shm_traverse(
+    struct avl_shm_tree *tree, int (*inorder_func)(void const *value, void const *data, void *arg),
+    void *arg) {
+	assert(tree != NULL);
+	assert(inorder_func != NULL);
+
+	struct avl_compact_tree view;
+
+	pthread_rwlock_rdlock(&tree->header->lock);
+	_shm_view(tree, &view);
+	int rc = _compact_traverse_locked(&view, inorder_func, arg);
+	pthread_rwlock_unlock(&tree->header->lock);
+
+	return rc;
+}
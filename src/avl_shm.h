@@ -0,0 +1,83 @@
+#ifndef AVL_C_SRC_AVL_SHM_H
+#define AVL_C_SRC_AVL_SHM_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "avl_compact.h"
+
+/*
+ * AVL tree that several processes map and use at once, kept in a POSIX shared memory object.
+ *
+ * The region holds a header with a process-shared reader-writer lock, followed by a fixed arena of
+ * avl_compact nodes. Those are linked by index rather than by pointer, so every process can walk
+ * them wherever the region lands in its address space. Each process supplies its own cmp_func when
+ * it maps the region, and lookups run straight against the shared nodes: no copies, no messages.
+ *
+ * Values and data are stored as they are given, so they must mean the same thing in every process:
+ * integers, or offsets into memory all of them share, rather than pointers. The arena does not
+ * grow; avl_shm_add() fails with -ENOSPC once capacity entries are in the tree.
+ *
+ * The lock is not robust: a process that dies in the middle of an add or remove leaves the others
+ * waiting.
+ */
+
+// Set in avl_shm_header.magic once the region is ready to be opened
+#define AVL_SHM_MAGIC UINT64_C(0x61766c5f73686d31)
+
+struct avl_shm_header {
+	_Atomic uint64_t magic;
+	// Bytes in the region, header included
+	uint64_t size;
+	// avl_compact_flag options
+	uint32_t flags;
+	// Where the avl_compact_tree fields of the same names live while no process has the lock
+	uint32_t capacity;
+	uint32_t used;
+	uint32_t free_list;
+	uint32_t root;
+	uint64_t count;
+	// Process-shared; shared by get and traverse, exclusive for add and remove
+	pthread_rwlock_t lock;
+	// Followed by the nodes, slot 0 included
+} __attribute__((aligned(64)));
+
+// One process's view of the region
+struct avl_shm_tree {
+	struct avl_shm_header *header;
+	char *nodes;
+	int (*cmp_func)(void const *new_value, void const *node_value);
+};
+
+// Creates the shared memory object name, which must not exist yet, with room for capacity entries
+int avl_shm_create(
+    struct avl_shm_tree **tree, char const *name,
+    int (*cmp_func)(void const *new_value, void const *node_value), uint32_t flags,
+    size_t capacity);
+
+// Maps a region made by avl_shm_create(); -EAGAIN while its creator is still setting it up
+int avl_shm_open(
+    struct avl_shm_tree **tree, char const *name,
+    int (*cmp_func)(void const *new_value, void const *node_value));
+
+// Unmaps the region; the tree lives on for the other processes
+void avl_shm_close(struct avl_shm_tree **tree);
+
+// Removes the name; the region goes away once every process has closed it
+int avl_shm_unlink(char const *name);
+
+int avl_shm_add(struct avl_shm_tree *tree, void const *value, void const *data);
+
+int avl_shm_get(struct avl_shm_tree *tree, void const *search_value, void const **node_data);
+
+int avl_shm_remove(
+    struct avl_shm_tree *tree, void const *search_value, void const **node_value,
+    void const **node_data);
+
+int avl_shm_traverse(
+    struct avl_shm_tree *tree, int (*inorder_func)(void const *value, void const *data, void *arg),
+    void *arg);
+
+#endif  // AVL_C_SRC_AVL_SHM_H
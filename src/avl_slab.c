@@ -0,0 +1,183 @@
+// Needed for syscall()
+#define _GNU_SOURCE
+
+#include "avl_slab.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <linux/mempolicy.h>
+#include <stdalign.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// The first chunk is small so that tiny trees stay tiny; later ones double up to the maximum
+#define MIN_CHUNK_OBJECTS 64
+#define MAX_CHUNK_OBJECTS (1 << 16)
+
+// Highest NUMA node a pool can be bound to, plus one
+#define MAX_NODES 1024
+
+struct avl_slab_chunk {
+	struct avl_slab_chunk *next;
+	// Length of the mapping for chunks of a bound pool, 0 for those from malloc()
+	size_t mapped;
+	// Keeps the objects that follow the header aligned for any type
+	alignas(max_align_t) char objects[];
+};
+
+int avl_slab_create(struct avl_slab **slab, size_t object_size) {
+	assert(slab != NULL);
+	assert(*slab == NULL);
+
+	*slab = malloc(sizeof(**slab));
+	if (*slab == NULL) {
+		perror("malloc(sizeof(**slab))");
+		return -errno;
+	}
+
+	// Released objects have to be able to hold the free list link
+	if (object_size < sizeof(void *)) {
+		object_size = sizeof(void *);
+	}
+	// Round up so that every object stays suitably aligned
+	object_size = (object_size + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1);
+
+	(*slab)->object_size = object_size;
+	(*slab)->chunk_objects = MIN_CHUNK_OBJECTS;
+	(*slab)->chunks = NULL;
+	(*slab)->free_list = NULL;
+	(*slab)->next = NULL;
+	(*slab)->end = NULL;
+	(*slab)->node = -1;
+
+	return 0;
+}
+
+void avl_slab_free(struct avl_slab **slab) {
+	assert(slab != NULL);
+	assert(*slab != NULL);
+
+	// Live objects go with their chunk; there is no need to visit them one by one
+	struct avl_slab_chunk *chunk = (*slab)->chunks;
+	while (chunk != NULL) {
+		struct avl_slab_chunk *next = chunk->next;
+		if (chunk->mapped != 0) {
+			munmap(chunk, chunk->mapped);
+		} else {
+			free(chunk);
+		}
+		chunk = next;
+	}
+
+	free(*slab);
+	*slab = NULL;
+}
+
+void avl_slab_bind(struct avl_slab *slab, int node) {
+	assert(slab != NULL);
+	assert(node < MAX_NODES);
+
+	slab->node = node;
+}
+
+struct avl_slab_chunk *_slab_map(struct avl_slab *slab, size_t size) {
+	// Fresh pages that nobody has touched yet, so the policy decides where they go
+	struct avl_slab_chunk *chunk =
+	    mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (chunk == MAP_FAILED) {
+		perror("mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)");
+		return NULL;
+	}
+
+	unsigned long mask[MAX_NODES / (8 * sizeof(unsigned long))] = {0};
+	mask[slab->node / (8 * sizeof(*mask))] |= 1UL << (slab->node % (8 * sizeof(*mask)));
+
+	// Preferred rather than bound, so a full node spills over instead of failing. Without NUMA
+	// support the call fails and first touch is all there is, which is fine on such a machine.
+	syscall(SYS_mbind, chunk, size, MPOL_PREFERRED, mask, MAX_NODES + 1, 0);
+
+	chunk->mapped = size;
+	return chunk;
+}
+
+int _slab_grow(struct avl_slab *slab, size_t objects) {
+	size_t size = sizeof(struct avl_slab_chunk) + objects * slab->object_size;
+
+	struct avl_slab_chunk *chunk;
+	if (slab->node >= 0) {
+		chunk = _slab_map(slab, size);
+	} else {
+		chunk = malloc(size);
+		if (chunk == NULL) {
+			perror("malloc(size)");
+		} else {
+			chunk->mapped = 0;
+		}
+	}
+	if (chunk == NULL) {
+		return -errno;
+	}
+
+	// Whatever was left of the previous chunk is handed to the free list rather than wasted
+	while (slab->next != NULL && slab->next < slab->end) {
+		avl_slab_release(slab, slab->next);
+		slab->next += slab->object_size;
+	}
+
+	chunk->next = slab->chunks;
+	slab->chunks = chunk;
+	slab->next = chunk->objects;
+	slab->end = chunk->objects + objects * slab->object_size;
+
+	return 0;
+}
+
+int avl_slab_reserve(struct avl_slab *slab, size_t count) {
+	assert(slab != NULL);
+
+	size_t available = (size_t)(slab->end - slab->next) / slab->object_size;
+	if (count <= available) {
+		return 0;
+	}
+
+	// One chunk large enough for the whole burst, so it is laid out contiguously
+	return _slab_grow(slab, count);
+}
+
+void *avl_slab_alloc(struct avl_slab *slab) {
+	assert(slab != NULL);
+
+	if (slab->free_list != NULL) {
+		void *object = slab->free_list;
+		slab->free_list = *(void **)object;
+		return object;
+	}
+
+	if (slab->next == slab->end) {
+		int rc = _slab_grow(slab, slab->chunk_objects);
+		if (rc < 0) {
+			errno = -rc;
+			return NULL;
+		}
+
+		if (slab->chunk_objects < MAX_CHUNK_OBJECTS) {
+			slab->chunk_objects *= 2;
+		}
+	}
+
+	void *object = slab->next;
+	slab->next += slab->object_size;
+
+	return object;
+}
+
+void avl_slab_release(struct avl_slab *slab, void *object) {
+	assert(slab != NULL);
+	assert(object != NULL);
+
+	*(void **)object = slab->free_list;
+	slab->free_list = object;
+}
@@ -0,0 +1,46 @@
+#ifndef AVL_C_SRC_AVL_SLAB_H
+#define AVL_C_SRC_AVL_SLAB_H
+
+#include <stddef.h>
+
+/*
+ * Fixed-size object allocator backing the nodes of an AVL_TREE_NODE_POOL tree.
+ *
+ * Objects are carved out of chunks that double in size as the pool grows, and released objects go
+ * onto a free list for reuse. The pool is not thread-safe by itself: every allocation and release
+ * happens under the owning tree's exclusive lock. Freeing the pool returns all chunks at once.
+ *
+ * A pool bound to a NUMA node maps its chunks itself and asks the kernel to place them there, so
+ * its objects end up on that node whichever thread first touches them.
+ */
+
+struct avl_slab_chunk;
+
+struct avl_slab {
+	size_t object_size;
+	// Objects the next chunk will hold
+	size_t chunk_objects;
+	struct avl_slab_chunk *chunks;
+	// Released objects, linked through their first word
+	void *free_list;
+	// Untouched tail of the newest chunk
+	char *next;
+	char *end;
+	// NUMA node chunks are placed on, -1 to leave them where first touch puts them
+	int node;
+};
+
+int avl_slab_create(struct avl_slab **slab, size_t object_size);
+
+void avl_slab_free(struct avl_slab **slab);
+
+// Places chunks allocated from now on on the given NUMA node
+void avl_slab_bind(struct avl_slab *slab, int node);
+
+int avl_slab_reserve(struct avl_slab *slab, size_t count);
+
+void *avl_slab_alloc(struct avl_slab *slab);
+
+void avl_slab_release(struct avl_slab *slab, void *object);
+
+#endif  // AVL_C_SRC_AVL_SLAB_H
@@ -0,0 +1,429 @@
+/*
+ * Type-specialized AVL trees.
+ *
+ * Define the parameters below and include this header to generate a tree whose nodes hold the key
+ * and data inline and whose comparisons the compiler can inline, instead of going through void
+ * pointers and cmp_func. It can be included again with other parameters for more tree types:
+ *
+ *   #define AVL_TYPED_NAME int64_tree
+ *   #define AVL_TYPED_KEY int64_t
+ *   #define AVL_TYPED_DATA void const *
+ *   #include "avl_typed.h"
+ *
+ * AVL_TYPED_NAME  prefix for the generated types and functions (required)
+ * AVL_TYPED_KEY   key type, stored in the node (required)
+ * AVL_TYPED_DATA  data type, stored in the node (default: void const *)
+ * AVL_TYPED_CMP   cmp(a, b) on two AVL_TYPED_KEY const * (default: compares with < and >)
+ *
+ * add, get, remove and traverse behave like avl_tree_add, avl_tree_get, avl_tree_remove and
+ * avl_tree_traverse, with the same reader-writer locking, but the tree owns its nodes: remove and
+ * free release them, and free_node_func only has to clean up what the key and data refer to.
+ * None of the avl_tree_flag options are available.
+ */
+
+#ifndef AVL_C_SRC_AVL_TYPED_H
+#define AVL_C_SRC_AVL_TYPED_H
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "avl.h"
+
+#define AVL_TYPED_CONCAT_(a, b) a##b
+#define AVL_TYPED_CONCAT(a, b) AVL_TYPED_CONCAT_(a, b)
+
+#endif  // AVL_C_SRC_AVL_TYPED_H
+
+#ifndef AVL_TYPED_NAME
+#error "AVL_TYPED_NAME must be defined before including avl_typed.h"
+#endif
+
+#ifndef AVL_TYPED_KEY
+#error "AVL_TYPED_KEY must be defined before including avl_typed.h"
+#endif
+
+#ifndef AVL_TYPED_DATA
+#define AVL_TYPED_DATA void const *
+#endif
+
+#ifndef AVL_TYPED_CMP
+#define AVL_TYPED_CMP(a, b) ((*(b) < *(a)) - (*(a) < *(b)))
+#endif
+
+#define AVL_TYPED_FN(suffix) AVL_TYPED_CONCAT(AVL_TYPED_NAME, suffix)
+#define AVL_TYPED_INTERNAL(suffix) AVL_TYPED_CONCAT(_, AVL_TYPED_FN(suffix))
+#define AVL_TYPED_TREE struct AVL_TYPED_NAME
+#define AVL_TYPED_NODE struct AVL_TYPED_FN(_node)
+
+AVL_TYPED_NODE {
+	AVL_TYPED_KEY key;
+	AVL_TYPED_DATA data;
+	AVL_TYPED_NODE *left;
+	AVL_TYPED_NODE *right;
+	int32_t balance;
+};
+
+AVL_TYPED_TREE {
+	AVL_TYPED_NODE *root;
+	// Shared by get and traverse, exclusive for add and remove
+	pthread_rwlock_t lock;
+};
+
+static inline int AVL_TYPED_FN(_create)(AVL_TYPED_TREE **tree) {
+	assert(tree != NULL);
+	assert(*tree == NULL);
+
+	*tree = malloc(sizeof(**tree));
+	if (*tree == NULL) {
+		perror("malloc(sizeof(**tree))");
+		return -errno;
+	}
+
+	(*tree)->root = NULL;
+	int rc = pthread_rwlock_init(&(*tree)->lock, NULL);
+	if (rc != 0) {
+		free(*tree);
+		*tree = NULL;
+		return -rc;
+	}
+
+	return 0;
+}
+
+static inline int AVL_TYPED_FN(_traverse)(
+    AVL_TYPED_TREE *tree, int (*preorder_func)(AVL_TYPED_NODE const *node, void *arg),
+    void *preorder_arg, int (*inorder_func)(AVL_TYPED_NODE const *node, void *arg),
+    void *inorder_arg, int (*postorder_func)(AVL_TYPED_NODE const *node, void *arg),
+    void *postorder_arg);
+
+struct AVL_TYPED_FN(_free_arg) {
+	int (*free_node_func)(AVL_TYPED_NODE const *node, void *arg);
+	void *free_arg;
+};
+
+static inline int AVL_TYPED_INTERNAL(_free_node)(AVL_TYPED_NODE const *node, void *arg) {
+	struct AVL_TYPED_FN(_free_arg) *free_arg = arg;
+
+	// Let the caller clean up the contents; the node itself belongs to the tree
+	if (free_arg->free_node_func != NULL) {
+		free_arg->free_node_func(node, free_arg->free_arg);
+	}
+	free((AVL_TYPED_NODE *)node);
+
+	return 0;
+}
+
+static inline void AVL_TYPED_FN(_free)(
+    AVL_TYPED_TREE **tree, int (*free_node_func)(AVL_TYPED_NODE const *node, void *arg),
+    void *free_arg) {
+	assert(tree != NULL);
+	assert(*tree != NULL);
+
+	struct AVL_TYPED_FN(_free_arg) arg = {.free_node_func = free_node_func, .free_arg = free_arg};
+	AVL_TYPED_FN(_traverse)(*tree, NULL, NULL, NULL, NULL, AVL_TYPED_INTERNAL(_free_node), &arg);
+
+	pthread_rwlock_destroy(&(*tree)->lock);
+	free(*tree);
+	*tree = NULL;
+}
+
+static inline void AVL_TYPED_INTERNAL(_rotate_left)(AVL_TYPED_NODE **root) {
+	AVL_TYPED_NODE *prior_right = (*root)->right;
+	(*root)->right = prior_right->left;
+	prior_right->left = *root;
+	*root = prior_right;
+}
+
+static inline void AVL_TYPED_INTERNAL(_rotate_right)(AVL_TYPED_NODE **root) {
+	AVL_TYPED_NODE *prior_left = (*root)->left;
+	(*root)->left = prior_left->right;
+	prior_left->right = *root;
+	*root = prior_left;
+}
+
+// Same cases as _balance_left and _balance_right in avl.c, folded into one with side = LEFT when
+// the node leans too far left
+static inline void AVL_TYPED_INTERNAL(_balance)(AVL_TYPED_NODE **node, int side, bool *decrease) {
+	AVL_TYPED_NODE *child = side < 0 ? (*node)->left : (*node)->right;
+
+	if (child->balance == side) {
+		// left-left or right-right tree
+		(*node)->balance = 0;
+		child->balance = 0;
+	} else if (child->balance == -side) {
+		// left-right or right-left tree
+		AVL_TYPED_NODE *grandchild = side < 0 ? child->right : child->left;
+		(*node)->balance = grandchild->balance == side ? -side : 0;
+		child->balance = grandchild->balance == -side ? side : 0;
+		grandchild->balance = 0;
+
+		if (side < 0) {
+			AVL_TYPED_INTERNAL(_rotate_left)(&(*node)->left);
+		} else {
+			AVL_TYPED_INTERNAL(_rotate_right)(&(*node)->right);
+		}
+	} else {
+		// The height of the subtree will remain the same after rotating. Occurs only during removals.
+		(*node)->balance = side;
+		child->balance = -side;
+		*decrease = false;
+	}
+
+	if (side < 0) {
+		AVL_TYPED_INTERNAL(_rotate_right)(node);
+	} else {
+		AVL_TYPED_INTERNAL(_rotate_left)(node);
+	}
+}
+
+static inline int AVL_TYPED_FN(_add)(AVL_TYPED_TREE *tree, AVL_TYPED_KEY key, AVL_TYPED_DATA data) {
+	assert(tree != NULL);
+
+	// links[i] is where the node at depth i hangs, directions[i] the way we left it
+	AVL_TYPED_NODE **links[AVL_MAX_HEIGHT + 1];
+	int8_t directions[AVL_MAX_HEIGHT];
+	int critical = 0;
+	int depth = 0;
+	int rc = true;
+
+	pthread_rwlock_wrlock(&tree->lock);
+
+	links[0] = &tree->root;
+	while (*links[depth] != NULL) {
+		AVL_TYPED_NODE *node = *links[depth];
+		int direction = AVL_TYPED_CMP(&key, &node->key);
+
+		if (direction == 0) {
+			// There already exists a node with this key
+			rc = false;
+			goto finish;
+		}
+
+		// Only nodes below the deepest unbalanced one can change their balance
+		if (node->balance != 0) {
+			critical = depth;
+		}
+
+		assert(depth < AVL_MAX_HEIGHT);
+		directions[depth] = direction < 0 ? -1 : 1;
+		links[depth + 1] = direction < 0 ? &node->left : &node->right;
+		++depth;
+	}
+
+	AVL_TYPED_NODE *node = malloc(sizeof(*node));
+	if (node == NULL) {
+		perror("malloc(sizeof(*node))");
+		rc = -errno;
+		goto finish;
+	}
+
+	node->key = key;
+	node->data = data;
+	node->left = NULL;
+	node->right = NULL;
+	node->balance = 0;
+	*links[depth] = node;
+
+	for (int i = critical + 1; i < depth; ++i) {
+		(*links[i])->balance = directions[i];
+	}
+
+	if (depth != 0) {
+		AVL_TYPED_NODE *top = *links[critical];
+		top->balance += directions[critical];
+
+		if (top->balance < -1 || 1 < top->balance) {
+			bool decrease = true;
+			AVL_TYPED_INTERNAL(_balance)(links[critical], directions[critical], &decrease);
+		}
+	}
+
+finish:
+	pthread_rwlock_unlock(&tree->lock);
+
+	return rc;
+}
+
+static inline int AVL_TYPED_FN(_get)(
+    AVL_TYPED_TREE *tree, AVL_TYPED_KEY key, AVL_TYPED_DATA *data) {
+	assert(tree != NULL);
+	assert(data != NULL);
+
+	int rc = false;
+
+	pthread_rwlock_rdlock(&tree->lock);
+	for (AVL_TYPED_NODE *node = tree->root; node != NULL;) {
+		int direction = AVL_TYPED_CMP(&key, &node->key);
+
+		if (direction < 0) {
+			node = node->left;
+		} else if (0 < direction) {
+			node = node->right;
+		} else {
+			*data = node->data;
+			rc = true;
+			break;
+		}
+	}
+	pthread_rwlock_unlock(&tree->lock);
+
+	return rc;
+}
+
+static inline int AVL_TYPED_FN(_remove)(
+    AVL_TYPED_TREE *tree, AVL_TYPED_KEY key, AVL_TYPED_KEY *node_key, AVL_TYPED_DATA *node_data) {
+	assert(tree != NULL);
+	assert(node_key != NULL);
+	assert(node_data != NULL);
+
+	// links[i] is where the node at depth i hangs, directions[i] the way we left it
+	AVL_TYPED_NODE **links[AVL_MAX_HEIGHT + 1];
+	int8_t directions[AVL_MAX_HEIGHT];
+	int depth = 0;
+	int rc = true;
+
+	pthread_rwlock_wrlock(&tree->lock);
+
+	links[0] = &tree->root;
+	for (;;) {
+		AVL_TYPED_NODE *node = *links[depth];
+		if (node == NULL) {
+			rc = false;
+			goto finish;
+		}
+
+		int direction = AVL_TYPED_CMP(&key, &node->key);
+		if (direction == 0) {
+			break;
+		}
+
+		assert(depth < AVL_MAX_HEIGHT);
+		directions[depth] = direction < 0 ? -1 : 1;
+		links[depth + 1] = direction < 0 ? &node->left : &node->right;
+		++depth;
+	}
+
+	int found = depth;
+	*node_key = (*links[found])->key;
+	*node_data = (*links[found])->data;
+
+	if ((*links[found])->left != NULL && (*links[found])->right != NULL) {
+		// Unlink the inorder predecessor instead and move its contents up
+		AVL_TYPED_NODE *node = *links[found];
+		directions[depth] = -1;
+		links[depth + 1] = &node->left;
+		++depth;
+		for (node = node->left; node->right != NULL; node = node->right) {
+			assert(depth < AVL_MAX_HEIGHT);
+			directions[depth] = 1;
+			links[depth + 1] = &node->right;
+			++depth;
+		}
+	}
+
+	AVL_TYPED_NODE *old_node = *links[depth];
+	if (depth != found) {
+		(*links[found])->key = old_node->key;
+		(*links[found])->data = old_node->data;
+	}
+	*links[depth] = old_node->left != NULL ? old_node->left : old_node->right;
+	free(old_node);
+
+	// Walk back up while the subtree we came from keeps getting shorter
+	for (int i = depth - 1; 0 <= i; --i) {
+		AVL_TYPED_NODE *node = *links[i];
+		node->balance -= directions[i];
+
+		if (node->balance == -directions[i]) {
+			break;
+		} else if (node->balance != 0) {
+			bool decrease = true;
+			AVL_TYPED_INTERNAL(_balance)(links[i], -directions[i], &decrease);
+			if (!decrease) {
+				break;
+			}
+		}
+	}
+
+finish:
+	pthread_rwlock_unlock(&tree->lock);
+
+	return rc;
+}
+
+static inline int AVL_TYPED_FN(_traverse)(
+    AVL_TYPED_TREE *tree, int (*preorder_func)(AVL_TYPED_NODE const *node, void *arg),
+    void *preorder_arg, int (*inorder_func)(AVL_TYPED_NODE const *node, void *arg),
+    void *inorder_arg, int (*postorder_func)(AVL_TYPED_NODE const *node, void *arg),
+    void *postorder_arg) {
+	assert(tree != NULL);
+
+	// The same walk as _avl_subtree_traverse in avl.c
+	struct {
+		AVL_TYPED_NODE const *node;
+		bool right;
+	} stack[AVL_MAX_HEIGHT];
+	int depth = 0;
+	int rc = 0;
+
+	pthread_rwlock_rdlock(&tree->lock);
+
+	AVL_TYPED_NODE const *node = tree->root;
+	for (;;) {
+		if (node != NULL) {
+			if (preorder_func != NULL) {
+				rc = preorder_func(node, preorder_arg);
+				if (rc <= -1) {
+					break;
+				}
+			}
+
+			assert(depth < AVL_MAX_HEIGHT);
+			stack[depth].node = node;
+			stack[depth].right = false;
+			++depth;
+			node = node->left;
+		} else if (depth == 0) {
+			rc = 0;
+			break;
+		} else if (!stack[depth - 1].right) {
+			node = stack[depth - 1].node;
+			if (inorder_func != NULL) {
+				rc = inorder_func(node, inorder_arg);
+				if (rc <= -1) {
+					break;
+				}
+			}
+
+			stack[depth - 1].right = true;
+			node = node->right;
+		} else {
+			// The post-order function may free the node, so it is the last use
+			--depth;
+			if (postorder_func != NULL) {
+				rc = postorder_func(stack[depth].node, postorder_arg);
+				if (rc <= -1) {
+					break;
+				}
+			}
+		}
+	}
+
+	pthread_rwlock_unlock(&tree->lock);
+
+	return rc;
+}
+
+#undef AVL_TYPED_NODE
+#undef AVL_TYPED_TREE
+#undef AVL_TYPED_INTERNAL
+#undef AVL_TYPED_FN
+#undef AVL_TYPED_CMP
+#undef AVL_TYPED_DATA
+#undef AVL_TYPED_KEY
+#undef AVL_TYPED_NAME
@@ -0,0 +1,289 @@
+#include "avl_workers.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "avl_cacheline.h"
+
+enum task_state { TASK_QUEUED, TASK_RUNNING, TASK_DONE };
+
+// The pool the current thread works for, and the index of its queue there
+static _Thread_local struct avl_workers *_thread_workers;
+static _Thread_local int _thread_queue;
+
+struct avl_workers_queue *_workers_own_queue(struct avl_workers *workers) {
+	return &workers->queues[_thread_workers == workers ? _thread_queue : workers->count];
+}
+
+void _workers_unlink(struct avl_workers_queue *queue, struct avl_task *task) {
+	// Called with the queue's mutex held
+	if (task->prev != NULL) {
+		task->prev->next = task->next;
+	} else {
+		queue->front = task->next;
+	}
+	if (task->next != NULL) {
+		task->next->prev = task->prev;
+	} else {
+		queue->back = task->prev;
+	}
+}
+
+struct avl_task *_workers_take(
+    struct avl_workers *workers, struct avl_workers_queue *queue, bool back) {
+	pthread_mutex_lock(&queue->mutex);
+	struct avl_task *task = back ? queue->back : queue->front;
+	if (task != NULL) {
+		_workers_unlink(queue, task);
+		atomic_store_explicit(&task->state, TASK_RUNNING, memory_order_relaxed);
+		atomic_fetch_sub_explicit(&workers->queued, 1, memory_order_relaxed);
+	}
+	pthread_mutex_unlock(&queue->mutex);
+
+	return task;
+}
+
+struct avl_task *_workers_find(struct avl_workers *workers) {
+	if (atomic_load_explicit(&workers->queued, memory_order_relaxed) == 0) {
+		return NULL;
+	}
+
+	struct avl_workers_queue *own = _workers_own_queue(workers);
+	struct avl_task *task = _workers_take(workers, own, true);
+
+	// Steal from the others, starting at our neighbour so that thieves spread out
+	int queues = workers->count + 1;
+	int first = (int)(own - workers->queues);
+	for (int i = 1; task == NULL && i < queues; ++i) {
+		task = _workers_take(workers, &workers->queues[(first + i) % queues], false);
+	}
+
+	return task;
+}
+
+void _workers_wake(struct avl_workers *workers, bool all) {
+	// Pairs with the check sleepers make after announcing themselves in _workers_sleep
+	if (atomic_load_explicit(&workers->sleepers, memory_order_seq_cst) == 0) {
+		return;
+	}
+
+	pthread_mutex_lock(&workers->mutex);
+	if (all) {
+		pthread_cond_broadcast(&workers->changed);
+	} else {
+		pthread_cond_signal(&workers->changed);
+	}
+	pthread_mutex_unlock(&workers->mutex);
+}
+
+void _workers_sleep(struct avl_workers *workers, struct avl_task const *awaited) {
+	pthread_mutex_lock(&workers->mutex);
+	atomic_fetch_add_explicit(&workers->sleepers, 1, memory_order_seq_cst);
+
+	// Anything that changed before we were counted as sleeping has to be noticed here
+	if (atomic_load_explicit(&workers->queued, memory_order_seq_cst) == 0 &&
+	    !atomic_load_explicit(&workers->stopping, memory_order_seq_cst) &&
+	    (awaited == NULL ||
+	     atomic_load_explicit(&awaited->state, memory_order_seq_cst) != TASK_DONE)) {
+		pthread_cond_wait(&workers->changed, &workers->mutex);
+	}
+
+	atomic_fetch_sub_explicit(&workers->sleepers, 1, memory_order_relaxed);
+	pthread_mutex_unlock(&workers->mutex);
+}
+
+void _workers_run(struct avl_workers *workers, struct avl_task *task) {
+	task->func(task->arg);
+
+	atomic_store_explicit(&task->state, TASK_DONE, memory_order_seq_cst);
+
+	// Whoever forked it may be asleep waiting for it
+	_workers_wake(workers, true);
+}
+
+struct workers_start {
+	struct avl_workers *workers;
+	int queue;
+};
+
+void *_workers_main(void *arg) {
+	struct avl_workers *workers = ((struct workers_start *)arg)->workers;
+	_thread_workers = workers;
+	_thread_queue = ((struct workers_start *)arg)->queue;
+	free(arg);
+
+	for (;;) {
+		struct avl_task *task = _workers_find(workers);
+		if (task != NULL) {
+			_workers_run(workers, task);
+		} else if (atomic_load_explicit(&workers->stopping, memory_order_relaxed)) {
+			break;
+		} else {
+			_workers_sleep(workers, NULL);
+		}
+	}
+
+	return NULL;
+}
+
+void _workers_stop(struct avl_workers **workers, int started) {
+	// Workers finish whatever is still queued before they leave
+	atomic_store_explicit(&(*workers)->stopping, true, memory_order_seq_cst);
+	pthread_mutex_lock(&(*workers)->mutex);
+	pthread_cond_broadcast(&(*workers)->changed);
+	pthread_mutex_unlock(&(*workers)->mutex);
+
+	for (int i = 0; i < started; ++i) {
+		pthread_join((*workers)->threads[i], NULL);
+	}
+
+	for (int i = 0; i <= (*workers)->count; ++i) {
+		pthread_mutex_destroy(&(*workers)->queues[i].mutex);
+	}
+
+	pthread_cond_destroy(&(*workers)->changed);
+	pthread_mutex_destroy(&(*workers)->mutex);
+	free((*workers)->queues);
+	free((*workers)->threads);
+	free(*workers);
+	*workers = NULL;
+}
+
+int avl_workers_create(struct avl_workers **workers, int count) {
+	assert(workers != NULL);
+	assert(*workers == NULL);
+
+	if (count < 0) {
+		// One thread per processor, with the caller (who helps while it joins) taking the last one
+		long processors = sysconf(_SC_NPROCESSORS_ONLN);
+		count = processors > 1 ? processors - 1 : 0;
+	}
+
+	*workers = malloc(sizeof(**workers));
+	if (*workers == NULL) {
+		perror("malloc(sizeof(**workers))");
+		return -errno;
+	}
+
+	// Settled before any thread starts, since they all pick queues by it
+	(*workers)->count = count;
+	atomic_init(&(*workers)->queued, 0);
+	atomic_init(&(*workers)->sleepers, 0);
+	atomic_init(&(*workers)->stopping, false);
+	pthread_mutex_init(&(*workers)->mutex, NULL);
+	pthread_cond_init(&(*workers)->changed, NULL);
+
+	(*workers)->queues = avl_cacheline_alloc(sizeof(*(*workers)->queues) * (count + 1));
+	(*workers)->threads = malloc(sizeof(*(*workers)->threads) * (count == 0 ? 1 : count));
+	if ((*workers)->queues == NULL || (*workers)->threads == NULL) {
+		if ((*workers)->threads == NULL) {
+			perror("malloc(threads)");
+		}
+		int rc = -errno;
+		free((*workers)->queues);
+		free((*workers)->threads);
+		free(*workers);
+		*workers = NULL;
+		return rc;
+	}
+
+	for (int i = 0; i <= count; ++i) {
+		pthread_mutex_init(&(*workers)->queues[i].mutex, NULL);
+		(*workers)->queues[i].front = NULL;
+		(*workers)->queues[i].back = NULL;
+	}
+
+	int rc = 0;
+
+	int started = 0;
+	for (; started < count; ++started) {
+		struct workers_start *start = malloc(sizeof(*start));
+		if (start == NULL) {
+			perror("malloc(sizeof(*start))");
+			rc = -errno;
+			goto finish;
+		}
+		start->workers = *workers;
+		start->queue = started;
+
+		rc = -pthread_create(&(*workers)->threads[started], NULL, _workers_main, start);
+		if (rc < 0) {
+			free(start);
+			goto finish;
+		}
+	}
+
+finish:
+	if (rc < 0) {
+		_workers_stop(workers, started);
+	}
+
+	return rc;
+}
+
+void avl_workers_free(struct avl_workers **workers) {
+	assert(workers != NULL);
+	assert(*workers != NULL);
+
+	_workers_stop(workers, (*workers)->count);
+}
+
+void avl_workers_fork(struct avl_workers *workers, struct avl_task *task) {
+	assert(workers != NULL);
+	assert(task != NULL);
+	assert(task->func != NULL);
+
+	struct avl_workers_queue *queue = _workers_own_queue(workers);
+
+	atomic_init(&task->state, TASK_QUEUED);
+	task->queue = queue;
+	task->next = NULL;
+
+	pthread_mutex_lock(&queue->mutex);
+	task->prev = queue->back;
+	if (queue->back != NULL) {
+		queue->back->next = task;
+	} else {
+		queue->front = task;
+	}
+	queue->back = task;
+	atomic_fetch_add_explicit(&workers->queued, 1, memory_order_seq_cst);
+	pthread_mutex_unlock(&queue->mutex);
+
+	_workers_wake(workers, false);
+}
+
+void avl_workers_join(struct avl_workers *workers, struct avl_task *task) {
+	assert(workers != NULL);
+	assert(task != NULL);
+
+	struct avl_workers_queue *queue = task->queue;
+
+	// Nobody took it, so it costs no more than a plain call
+	pthread_mutex_lock(&queue->mutex);
+	bool queued = atomic_load_explicit(&task->state, memory_order_relaxed) == TASK_QUEUED;
+	if (queued) {
+		_workers_unlink(queue, task);
+		atomic_fetch_sub_explicit(&workers->queued, 1, memory_order_relaxed);
+	}
+	pthread_mutex_unlock(&queue->mutex);
+
+	if (queued) {
+		task->func(task->arg);
+		atomic_store_explicit(&task->state, TASK_DONE, memory_order_relaxed);
+		return;
+	}
+
+	// Rather than sleep while another thread finishes it, work on whatever else is queued
+	while (atomic_load_explicit(&task->state, memory_order_acquire) != TASK_DONE) {
+		struct avl_task *other = _workers_find(workers);
+		if (other != NULL) {
+			_workers_run(workers, other);
+		} else {
+			_workers_sleep(workers, task);
+		}
+	}
+}
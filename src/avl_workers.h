@@ -0,0 +1,62 @@
+#ifndef AVL_C_SRC_AVL_WORKERS_H
+#define AVL_C_SRC_AVL_WORKERS_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * A fixed set of threads running fork-join tasks with work stealing.
+ *
+ * avl_workers_fork() puts a task at the back of the calling thread's own queue (threads outside the
+ * pool share one), and the same thread later waits for it with avl_workers_join(). Each thread
+ * takes its own newest tasks first, which keeps recursive work on data it just touched, and idle
+ * threads steal the oldest task of another queue, which for divide-and-conquer work is the largest.
+ * A task nobody has taken yet is simply run by the joining thread, and a thread waiting for one
+ * that is already running works on other tasks meanwhile, so tasks may fork and join their own
+ * subtasks to any depth without tying up the workers.
+ */
+
+struct avl_workers_queue;
+
+struct avl_task {
+	void (*func)(void *arg);
+	void *arg;
+	// Owned by the workers while the task is forked
+	struct avl_workers_queue *queue;
+	struct avl_task *prev;
+	struct avl_task *next;
+	_Atomic int state;
+};
+
+struct avl_workers_queue {
+	pthread_mutex_t mutex;
+	// Oldest first; the owner pushes and pops at the back, thieves take from the front
+	struct avl_task *front;
+	struct avl_task *back;
+} __attribute__((aligned(64)));
+
+struct avl_workers {
+	pthread_t *threads;
+	int count;
+	// One per worker, then the one shared by threads outside the pool
+	struct avl_workers_queue *queues;
+	// Tasks waiting in any queue, so that idle threads know whether looking is worth it
+	_Atomic size_t queued;
+	// Idle threads sleep until a task is queued or finishes
+	pthread_mutex_t mutex;
+	pthread_cond_t changed;
+	_Atomic int sleepers;
+	_Atomic bool stopping;
+};
+
+int avl_workers_create(struct avl_workers **workers, int count);
+
+void avl_workers_free(struct avl_workers **workers);
+
+void avl_workers_fork(struct avl_workers *workers, struct avl_task *task);
+
+void avl_workers_join(struct avl_workers *workers, struct avl_task *task);
+
+#endif  // AVL_C_SRC_AVL_WORKERS_H
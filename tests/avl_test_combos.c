@@ -530,6 +530,44 @@ START_TEST(test_add_remove_all) {
 
 END_TEST
 
+START_TEST(test_add_remove_pool) {
+	printf("test add remove pool\n");
+
+	for (int iteration = 0; iteration < 10; ++iteration) {
+		struct avl_tree *tree = NULL;
+		ck_assert(avl_tree_create_flags(&tree, int64_t_cmp, AVL_TREE_NODE_POOL) == 0);
+		ck_assert(tree->slab != NULL);
+
+		for (int64_t num_node = 0; num_node < NUM_VALUES; ++num_node) {
+			int64_t v = (int64_t)rand() % NUM_VALUES;
+			avl_tree_add(tree, (void *)v, (void *)(v + 1));
+		}
+
+		check_tree(tree);
+
+		// Removed nodes are recycled by the following additions
+		void const *value;
+		void const *data;
+		for (int64_t num_node = 0; num_node < NUM_VALUES; ++num_node) {
+			int64_t v = (int64_t)rand() % NUM_VALUES;
+			if (avl_tree_remove(tree, (void *)v, &value, &data)) {
+				ck_assert(value == (void *)v);
+				ck_assert(data == (void *)(v + 1));
+			}
+			v = (int64_t)rand() % NUM_VALUES;
+			avl_tree_add(tree, (void *)v, (void *)(v + 1));
+		}
+
+		check_tree(tree);
+
+		// The pool takes every node with it
+		avl_tree_free(&tree, NULL, NULL);
+		ck_assert(tree == NULL);
+	}
+}
+
+END_TEST
+
 START_TEST(test_balance_random) {
 	printf("test balance random\n");
 
@@ -581,6 +619,7 @@ Suite *test_suite() {
 	tcase_add_test(tcase, test_balance_left_left_left);
 
 	tcase_add_test(tcase, test_add_remove_all);
+	tcase_add_test(tcase, test_add_remove_pool);
 
 	tcase_add_test(tcase, test_balance_random);
 
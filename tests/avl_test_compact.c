@@ -0,0 +1,161 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "avl_compact.h"
+#include "avl_test_utils.h"
+
+#define NUM_VALUES 1000
+
+int64_t _check_compact(struct avl_compact_tree *tree, uint32_t index, int64_t *previous) {
+	if (index == 0) {
+		return 0;
+	}
+
+	struct avl_compact_node *node =
+	    (struct avl_compact_node *)(tree->nodes + (size_t)index * tree->node_size);
+
+	// Never both balance bits at once
+	ck_assert(!((node->left & 1) && (node->right & 1)));
+
+	int64_t left_height = _check_compact(tree, node->left >> 1, previous);
+	ck_assert(*previous < (int64_t)node->value);
+	*previous = (int64_t)node->value;
+	int64_t right_height = _check_compact(tree, node->right >> 1, previous);
+
+	int balance = (int)(node->right & 1) - (int)(node->left & 1);
+	ck_assert(balance == right_height - left_height);
+
+	return 1 + (left_height < right_height ? right_height : left_height);
+}
+
+struct visit {
+	int64_t previous;
+	size_t count;
+	bool set;
+};
+
+int _visit(void const *value, void const *data, void *arg) {
+	struct visit *visit = arg;
+
+	ck_assert(visit->previous < (int64_t)value);
+	ck_assert((int64_t)data == (visit->set ? 0 : (int64_t)value + 1));
+	visit->previous = (int64_t)value;
+	++visit->count;
+
+	return 0;
+}
+
+void _check_random(uint32_t flags) {
+	struct avl_compact_tree *tree = NULL;
+	ck_assert(avl_compact_create(&tree, int64_t_cmp, flags) == 0);
+
+	bool set = flags & AVL_COMPACT_SET;
+	bool present[NUM_VALUES] = {false};
+	size_t count = 0;
+
+	for (int i = 0; i < 50 * NUM_VALUES; ++i) {
+		int64_t v = rand() % NUM_VALUES;
+		void const *value;
+		void const *data;
+
+		switch (rand() % 3) {
+			case 0:
+				ck_assert(avl_compact_add(tree, (void *)v, (void *)(v + 1)) == !present[v]);
+				count += !present[v];
+				present[v] = true;
+				break;
+
+			case 1:
+				ck_assert(avl_compact_remove(tree, (void *)v, &value, &data) == present[v]);
+				if (present[v]) {
+					ck_assert((int64_t)value == v);
+					ck_assert((int64_t)data == (set ? 0 : v + 1));
+					--count;
+				}
+				present[v] = false;
+				break;
+
+			default:
+				ck_assert(avl_compact_get(tree, (void *)v, &data) == present[v]);
+				if (present[v]) {
+					ck_assert((int64_t)data == (set ? 0 : v + 1));
+				}
+				break;
+		}
+
+		if (i % NUM_VALUES == 0) {
+			int64_t previous = -1;
+			_check_compact(tree, tree->root >> 1, &previous);
+			ck_assert(tree->count == count);
+		}
+	}
+
+	struct visit visit = {.previous = -1, .count = 0, .set = set};
+	ck_assert(avl_compact_traverse(tree, _visit, &visit) == 0);
+	ck_assert(visit.count == count);
+
+	// Removed slots are reused rather than growing the array
+	ck_assert(tree->used <= NUM_VALUES + 1);
+
+	avl_compact_free(&tree, NULL, NULL);
+	ck_assert(tree == NULL);
+}
+
+START_TEST(test_compact) {
+	_check_random(0);
+}
+
+END_TEST
+
+START_TEST(test_compact_set) {
+	_check_random(AVL_COMPACT_SET);
+}
+
+END_TEST
+
+START_TEST(test_compact_layout) {
+	struct avl_compact_tree *tree = NULL;
+	ck_assert(avl_compact_create(&tree, int64_t_cmp, AVL_COMPACT_SET) == 0);
+	ck_assert(tree->node_size == 16);
+	avl_compact_free(&tree, NULL, NULL);
+
+	ck_assert(avl_compact_create(&tree, int64_t_cmp, 0) == 0);
+	ck_assert(tree->node_size == 24);
+
+	// Reserving makes room for all of them at once
+	ck_assert(avl_compact_reserve(tree, NUM_VALUES) == 0);
+	uint32_t capacity = tree->capacity;
+	ck_assert(NUM_VALUES < capacity);
+	for (int64_t v = 0; v < NUM_VALUES; ++v) {
+		ck_assert(avl_compact_add(tree, (void *)v, NULL) == true);
+	}
+	ck_assert(tree->capacity == capacity);
+
+	ck_assert(avl_compact_reserve(tree, (size_t)AVL_COMPACT_MAX_NODES + 1) == -ENOSPC);
+
+	int64_t previous = -1;
+	_check_compact(tree, tree->root >> 1, &previous);
+
+	avl_compact_free(&tree, NULL, NULL);
+}
+
+END_TEST
+
+Suite *test_suite() {
+	Suite *suite = suite_create("test_suite");
+
+	TCase *tcase = tcase_create("case");
+
+	tcase_add_test(tcase, test_compact);
+	tcase_add_test(tcase, test_compact_set);
+	tcase_add_test(tcase, test_compact_layout);
+
+	suite_add_tcase(suite, tcase);
+
+	return suite;
+}
+
+int main() {
+	return run(test_suite());
+}
@@ -0,0 +1,481 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "avl_test_utils.h"
+
+#define NUM_VALUES 10000
+#define NUM_READERS 3
+#define NUM_ROUNDS 20
+#define NUM_WRITERS 8
+
+struct shared {
+	struct avl_tree *tree;
+	atomic_bool done;
+	atomic_bool reader_finished;
+};
+
+int _wait_for_reader(struct avl_node const *node __attribute__((unused)), void *arg) {
+	struct shared *shared = arg;
+
+	// Only returns once another reader got in while this traversal holds the lock
+	while (!atomic_load(&shared->reader_finished)) {}
+
+	return -1;
+}
+
+void *_get_once(void *arg) {
+	struct shared *shared = arg;
+
+	void const *node_data;
+	ck_assert(avl_tree_get(shared->tree, (void *)0, &node_data) == true);
+	atomic_store(&shared->reader_finished, true);
+
+	return NULL;
+}
+
+START_TEST(test_parallel_readers) {
+	struct avl_tree *tree = create_tree();
+	ck_assert(avl_tree_add(tree, (void *)0, (void *)1) == true);
+
+	struct shared shared = {.tree = tree};
+	atomic_init(&shared.done, false);
+	atomic_init(&shared.reader_finished, false);
+
+	pthread_t reader;
+	pthread_create(&reader, NULL, _get_once, &shared);
+
+	// The traversal holds the lock shared until the other thread's get has completed
+	int rc = avl_tree_traverse(tree, _wait_for_reader, &shared, NULL, NULL, NULL, NULL);
+	ck_assert(rc == -1);
+
+	pthread_join(reader, NULL);
+	free_tree(tree);
+}
+
+END_TEST
+
+START_TEST(test_optimistic) {
+	struct avl_tree *tree = NULL;
+	ck_assert(avl_tree_create_flags(&tree, int64_t_cmp, AVL_TREE_OPTIMISTIC_READS) == 0);
+	ck_assert(tree->epoch != NULL);
+
+	for (int64_t v = 0; v < NUM_VALUES; ++v) {
+		ck_assert(avl_tree_add(tree, (void *)v, (void *)(v + 1)) == true);
+	}
+
+	void const *node_data = NULL;
+	for (int64_t v = 0; v < NUM_VALUES; ++v) {
+		ck_assert(avl_tree_get(tree, (void *)v, &node_data) == true);
+		ck_assert(node_data == (void *)(v + 1));
+	}
+
+	// Removals defer freeing their nodes
+	void const *node_value;
+	for (int64_t v = 0; v < NUM_VALUES; v += 2) {
+		ck_assert(avl_tree_remove(tree, (void *)v, &node_value, &node_data) == true);
+	}
+	avl_tree_synchronize(tree);
+
+	node_data = NULL;
+	ck_assert(avl_tree_get(tree, (void *)0, &node_data) == false);
+	ck_assert(node_data == NULL);
+	ck_assert(avl_tree_get(tree, (void *)1, &node_data) == true);
+	ck_assert(node_data == (void *)2);
+
+	check_tree(tree);
+	free_tree(tree);
+}
+
+END_TEST
+
+void *_read_while_writing(void *arg) {
+	struct shared *shared = arg;
+
+	while (!atomic_load(&shared->done)) {
+		for (int64_t v = 0; v < NUM_VALUES; ++v) {
+			void const *node_data = NULL;
+			int rc = avl_tree_get(shared->tree, (void *)v, &node_data);
+
+			if (v % 2 == 0) {
+				// Even values are never removed
+				ck_assert(rc == true);
+			}
+			if (rc == true) {
+				ck_assert(node_data == (void *)(v + 1));
+			}
+		}
+	}
+
+	return NULL;
+}
+
+START_TEST(test_optimistic_readers) {
+	struct avl_tree *tree = NULL;
+	ck_assert(avl_tree_create_flags(&tree, int64_t_cmp, AVL_TREE_OPTIMISTIC_READS) == 0);
+
+	for (int64_t v = 0; v < NUM_VALUES; ++v) {
+		avl_tree_add(tree, (void *)v, (void *)(v + 1));
+	}
+
+	struct shared shared = {.tree = tree};
+	atomic_init(&shared.done, false);
+
+	pthread_t readers[NUM_READERS];
+	for (int r = 0; r < NUM_READERS; ++r) {
+		pthread_create(&readers[r], NULL, _read_while_writing, &shared);
+	}
+
+	// Keep rotating the tree underneath the readers by taking out and putting back the odd values
+	void const *node_value;
+	void const *node_data;
+	for (int round = 0; round < NUM_ROUNDS; ++round) {
+		for (int64_t v = 1; v < NUM_VALUES; v += 2) {
+			ck_assert(avl_tree_remove(tree, (void *)v, &node_value, &node_data) == true);
+		}
+		for (int64_t v = 1; v < NUM_VALUES; v += 2) {
+			ck_assert(avl_tree_add(tree, (void *)v, (void *)(v + 1)) == true);
+		}
+	}
+
+	atomic_store(&shared.done, true);
+	for (int r = 0; r < NUM_READERS; ++r) {
+		pthread_join(readers[r], NULL);
+	}
+
+	check_tree(tree);
+	free_tree(tree);
+}
+
+END_TEST
+
+int _count_node(struct avl_node const *node __attribute__((unused)), void *count) {
+	++*(int64_t *)count;
+	return 0;
+}
+
+START_TEST(test_persistent_snapshot) {
+	struct avl_tree *tree = NULL;
+	ck_assert(avl_tree_create_flags(&tree, int64_t_cmp, AVL_TREE_PERSISTENT) == 0);
+
+	for (int64_t v = 0; v < NUM_VALUES; ++v) {
+		ck_assert(avl_tree_add(tree, (void *)v, (void *)(v + 1)) == true);
+	}
+	ck_assert(avl_tree_add(tree, (void *)0, (void *)2) == false);
+
+	struct avl_snapshot snapshot;
+	ck_assert(avl_tree_snapshot(tree, &snapshot) == 0);
+
+	// Change the tree after the snapshot was taken
+	void const *node_value;
+	void const *node_data;
+	for (int64_t v = 0; v < NUM_VALUES; v += 2) {
+		ck_assert(avl_tree_remove(tree, (void *)v, &node_value, &node_data) == true);
+		ck_assert(node_value == (void *)v);
+		ck_assert(node_data == (void *)(v + 1));
+	}
+	ck_assert(avl_tree_add(tree, (void *)NUM_VALUES, (void *)(NUM_VALUES + 1)) == true);
+
+	// The snapshot still sees the old version
+	for (int64_t v = 0; v < NUM_VALUES; ++v) {
+		ck_assert(avl_snapshot_get(&snapshot, (void *)v, &node_data) == true);
+		ck_assert(node_data == (void *)(v + 1));
+	}
+	ck_assert(avl_snapshot_get(&snapshot, (void *)NUM_VALUES, &node_data) == false);
+
+	int64_t count = 0;
+	ck_assert(avl_snapshot_traverse(&snapshot, NULL, NULL, _count_node, &count, NULL, NULL) == 0);
+	ck_assert(count == NUM_VALUES);
+	avl_snapshot_release(&snapshot);
+
+	// While the tree itself moved on
+	ck_assert(avl_tree_get(tree, (void *)0, &node_data) == false);
+	ck_assert(avl_tree_get(tree, (void *)1, &node_data) == true);
+	ck_assert(avl_tree_get(tree, (void *)NUM_VALUES, &node_data) == true);
+
+	count = 0;
+	ck_assert(avl_tree_traverse(tree, NULL, NULL, _count_node, &count, NULL, NULL) == 0);
+	ck_assert(count == NUM_VALUES / 2 + 1);
+
+	check_tree(tree);
+	free_tree(tree);
+}
+
+END_TEST
+
+int _record_node(struct avl_node const *node, void *arg) {
+	struct avl_node const ***cursor = arg;
+	*(*cursor)++ = node;
+	return 0;
+}
+
+START_TEST(test_persistent_matches) {
+	// Path copying must leave exactly the same shape as updating in place
+	struct avl_tree *plain = create_tree();
+	struct avl_tree *persistent = NULL;
+	ck_assert(avl_tree_create_flags(&persistent, int64_t_cmp, AVL_TREE_PERSISTENT) == 0);
+
+	void const *node_value;
+	void const *node_data;
+	for (int64_t i = 0; i < 4 * NUM_VALUES; ++i) {
+		int64_t v = rand() % NUM_VALUES;
+		if (rand() % 3 == 0) {
+			ck_assert(
+			    avl_tree_remove(plain, (void *)v, &node_value, &node_data) ==
+			    avl_tree_remove(persistent, (void *)v, &node_value, &node_data));
+		} else {
+			ck_assert(
+			    avl_tree_add(plain, (void *)v, (void *)(v + 1)) ==
+			    avl_tree_add(persistent, (void *)v, (void *)(v + 1)));
+		}
+	}
+
+	struct avl_node const **expected = calloc(NUM_VALUES, sizeof(*expected));
+	struct avl_node const **actual = calloc(NUM_VALUES, sizeof(*actual));
+	struct avl_node const **cursor = expected;
+	avl_tree_traverse(plain, _record_node, &cursor, NULL, NULL, NULL, NULL);
+	int64_t count = cursor - expected;
+	cursor = actual;
+	avl_tree_traverse(persistent, _record_node, &cursor, NULL, NULL, NULL, NULL);
+	ck_assert(cursor - actual == count);
+
+	for (int64_t i = 0; i < count; ++i) {
+		ck_assert(expected[i]->value == actual[i]->value);
+		ck_assert(expected[i]->balance == actual[i]->balance);
+	}
+
+	free(expected);
+	free(actual);
+	free_tree(plain);
+	free_tree(persistent);
+}
+
+END_TEST
+
+void *_synchronize_once(void *arg) {
+	struct shared *shared = arg;
+
+	avl_tree_synchronize(shared->tree);
+	atomic_store(&shared->done, true);
+
+	return NULL;
+}
+
+START_TEST(test_synchronize_writers) {
+	struct shared shared = {.tree = NULL};
+	atomic_init(&shared.done, false);
+	ck_assert(avl_tree_create_flags(&shared.tree, int64_t_cmp, AVL_TREE_PERSISTENT) == 0);
+
+	for (int64_t v = 0; v < NUM_VALUES; ++v) {
+		ck_assert(avl_tree_add(shared.tree, (void *)v, (void *)(v + 1)) == true);
+	}
+
+	struct avl_snapshot snapshot;
+	ck_assert(avl_tree_snapshot(shared.tree, &snapshot) == 0);
+
+	pthread_t thread;
+	ck_assert(pthread_create(&thread, NULL, _synchronize_once, &shared) == 0);
+	usleep(50000);
+
+	// The snapshot holds up avl_tree_synchronize, but not the writers that come along meanwhile
+	void const *node_value;
+	void const *node_data;
+	for (int64_t v = 0; v < NUM_VALUES; v += 2) {
+		ck_assert(avl_tree_remove(shared.tree, (void *)v, &node_value, &node_data) == true);
+	}
+	ck_assert(avl_tree_add(shared.tree, (void *)0, (void *)1) == true);
+	ck_assert(!atomic_load(&shared.done));
+
+	avl_snapshot_release(&snapshot);
+	pthread_join(thread, NULL);
+	ck_assert(atomic_load(&shared.done));
+
+	check_tree(shared.tree);
+	free_tree(shared.tree);
+}
+
+END_TEST
+
+START_TEST(test_snapshot_not_persistent) {
+	struct avl_tree *tree = create_tree();
+
+	struct avl_snapshot snapshot;
+	ck_assert(avl_tree_snapshot(tree, &snapshot) == -EINVAL);
+
+	free_tree(tree);
+}
+
+END_TEST
+
+int _check_even(struct avl_node const *node, void *arg) {
+	int64_t *state = arg;
+	int64_t value = (int64_t)avl_node_value(node);
+
+	// In order, and every even value is present in every version
+	ck_assert(state[0] < value);
+	state[0] = value;
+	if (value % 2 == 0) {
+		++state[1];
+	}
+
+	return 0;
+}
+
+void *_scan_while_writing(void *arg) {
+	struct shared *shared = arg;
+
+	while (!atomic_load(&shared->done)) {
+		struct avl_snapshot snapshot;
+		ck_assert(avl_tree_snapshot(shared->tree, &snapshot) == 0);
+
+		int64_t state[2] = {-1, 0};
+		ck_assert(avl_snapshot_traverse(&snapshot, NULL, NULL, _check_even, state, NULL, NULL) == 0);
+		ck_assert(state[1] == NUM_VALUES / 2);
+
+		avl_snapshot_release(&snapshot);
+	}
+
+	return NULL;
+}
+
+START_TEST(test_persistent_readers) {
+	struct avl_tree *tree = NULL;
+	ck_assert(avl_tree_create_flags(&tree, int64_t_cmp, AVL_TREE_PERSISTENT) == 0);
+
+	for (int64_t v = 0; v < NUM_VALUES; ++v) {
+		avl_tree_add(tree, (void *)v, (void *)(v + 1));
+	}
+
+	struct shared shared = {.tree = tree};
+	atomic_init(&shared.done, false);
+
+	pthread_t readers[2 * NUM_READERS];
+	for (int r = 0; r < NUM_READERS; ++r) {
+		pthread_create(&readers[r], NULL, _scan_while_writing, &shared);
+		pthread_create(&readers[NUM_READERS + r], NULL, _read_while_writing, &shared);
+	}
+
+	void const *node_value;
+	void const *node_data;
+	for (int round = 0; round < NUM_ROUNDS; ++round) {
+		for (int64_t v = 1; v < NUM_VALUES; v += 2) {
+			ck_assert(avl_tree_remove(tree, (void *)v, &node_value, &node_data) == true);
+		}
+		for (int64_t v = 1; v < NUM_VALUES; v += 2) {
+			ck_assert(avl_tree_add(tree, (void *)v, (void *)(v + 1)) == true);
+		}
+	}
+
+	atomic_store(&shared.done, true);
+	for (int r = 0; r < 2 * NUM_READERS; ++r) {
+		pthread_join(readers[r], NULL);
+	}
+
+	check_tree(tree);
+	free_tree(tree);
+}
+
+END_TEST
+
+struct combining_writer {
+	struct avl_tree *tree;
+	int64_t first;
+};
+
+void *_write_combined(void *arg) {
+	struct combining_writer *writer = arg;
+
+	// Each writer owns the values congruent to its first one, so every result is predictable
+	void const *node_value;
+	void const *node_data;
+	for (int round = 0; round < NUM_ROUNDS; ++round) {
+		for (int64_t v = writer->first; v < NUM_VALUES; v += NUM_WRITERS) {
+			ck_assert(avl_tree_add(writer->tree, (void *)v, (void *)(v + 1)) == true);
+			ck_assert(avl_tree_add(writer->tree, (void *)v, (void *)(v + 1)) == false);
+		}
+		for (int64_t v = writer->first; v < NUM_VALUES; v += NUM_WRITERS) {
+			ck_assert(avl_tree_get(writer->tree, (void *)v, &node_data) == true);
+			ck_assert((int64_t)node_data == v + 1);
+		}
+		for (int64_t v = writer->first; v < NUM_VALUES; v += 2 * NUM_WRITERS) {
+			ck_assert(avl_tree_remove(writer->tree, (void *)v, &node_value, &node_data) == true);
+			ck_assert((int64_t)node_value == v && (int64_t)node_data == v + 1);
+			ck_assert(avl_tree_get(writer->tree, (void *)v, &node_data) == false);
+		}
+		for (int64_t v = writer->first; v < NUM_VALUES; v += NUM_WRITERS) {
+			bool kept = (v - writer->first) % (2 * NUM_WRITERS) != 0;
+			ck_assert(avl_tree_remove(writer->tree, (void *)v, &node_value, &node_data) == kept);
+		}
+	}
+
+	return NULL;
+}
+
+START_TEST(test_flat_combining) {
+	uint32_t const flags[] = {
+	    AVL_TREE_FLAT_COMBINING,
+	    AVL_TREE_FLAT_COMBINING | AVL_TREE_OPTIMISTIC_READS,
+	    AVL_TREE_FLAT_COMBINING | AVL_TREE_PERSISTENT | AVL_TREE_ORDER_STATISTICS,
+	};
+
+	for (size_t f = 0; f < sizeof(flags) / sizeof(flags[0]); ++f) {
+		struct avl_tree *tree = NULL;
+		ck_assert(avl_tree_create_flags(&tree, int64_t_cmp, flags[f]) == 0);
+
+		// A population the writers leave alone, in between their values
+		for (int64_t v = -NUM_VALUES; v < 0; ++v) {
+			ck_assert(avl_tree_add(tree, (void *)v, (void *)(v + 1)) == true);
+		}
+
+		pthread_t threads[NUM_WRITERS];
+		struct combining_writer writers[NUM_WRITERS];
+		for (int i = 0; i < NUM_WRITERS; ++i) {
+			writers[i] = (struct combining_writer){.tree = tree, .first = i};
+			ck_assert(pthread_create(&threads[i], NULL, _write_combined, &writers[i]) == 0);
+		}
+		for (int i = 0; i < NUM_WRITERS; ++i) {
+			pthread_join(threads[i], NULL);
+		}
+
+		check_tree(tree);
+		for (int64_t v = -NUM_VALUES; v < NUM_VALUES; ++v) {
+			void const *node_data;
+			ck_assert(avl_tree_get(tree, (void *)v, &node_data) == (v < 0));
+		}
+
+		free_tree(tree);
+	}
+}
+
+END_TEST
+
+Suite *test_suite() {
+	Suite *suite = suite_create("test_suite");
+
+	TCase *tcase = tcase_create("case");
+	tcase_set_timeout(tcase, 60);
+
+	tcase_add_test(tcase, test_parallel_readers);
+
+	tcase_add_test(tcase, test_optimistic);
+	tcase_add_test(tcase, test_optimistic_readers);
+
+	tcase_add_test(tcase, test_persistent_snapshot);
+	tcase_add_test(tcase, test_persistent_matches);
+	tcase_add_test(tcase, test_snapshot_not_persistent);
+	tcase_add_test(tcase, test_synchronize_writers);
+	tcase_add_test(tcase, test_persistent_readers);
+
+	tcase_add_test(tcase, test_flat_combining);
+
+	suite_add_tcase(suite, tcase);
+
+	return suite;
+}
+
+int main() {
+	return run(test_suite());
+}
@@ -0,0 +1,239 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "avl_concurrent.h"
+#include "avl_test_utils.h"
+
+#define NUM_VALUES 10000
+#define NUM_THREADS 8
+#define NUM_OPS 100000
+
+// Every value the tree lets go of is counted here
+static atomic_long _released;
+
+void _release(void const *value __attribute__((unused)), void *arg __attribute__((unused))) {
+	atomic_fetch_add(&_released, 1);
+}
+
+int32_t _check_concurrent_node(
+    struct avl_concurrent_node *node, struct avl_concurrent_node *parent, int64_t lo, int64_t hi) {
+	// Only valid once every writer is done, when balance has to be strict again
+	if (node == NULL) {
+		return 0;
+	}
+
+	int64_t value = (int64_t)node->value;
+	ck_assert(lo < value && value < hi);
+	ck_assert(node->parent == parent);
+	ck_assert(node->version == 0 || !(node->version & 3));
+	ck_assert(node->data != AVL_CONCURRENT_ABSENT || (node->left != NULL && node->right != NULL));
+
+	int32_t left_height = _check_concurrent_node(node->left, node, lo, value);
+	int32_t right_height = _check_concurrent_node(node->right, node, value, hi);
+	ck_assert(-1 <= left_height - right_height && left_height - right_height <= 1);
+	ck_assert(node->height == 1 + (left_height < right_height ? right_height : left_height));
+
+	return node->height;
+}
+
+struct collected {
+	int64_t values[NUM_VALUES];
+	int count;
+};
+
+int _collect(void const *value, void const *data, void *arg) {
+	struct collected *collected = arg;
+
+	ck_assert((int64_t)data == (int64_t)value + 1);
+	ck_assert(collected->count < NUM_VALUES);
+	collected->values[collected->count++] = (int64_t)value;
+
+	return 0;
+}
+
+void _check_contents(struct avl_concurrent_tree *tree, bool const *present) {
+	_check_concurrent_node(tree->holder.right, &tree->holder, -1, NUM_VALUES);
+
+	static struct collected collected;
+	collected.count = 0;
+	ck_assert(avl_concurrent_traverse(tree, _collect, &collected) == 0);
+
+	int count = 0;
+	for (int64_t v = 0; v < NUM_VALUES; ++v) {
+		void const *data;
+		ck_assert(avl_concurrent_get(tree, (void *)v, &data) == present[v]);
+		if (present[v]) {
+			ck_assert((int64_t)data == v + 1);
+			ck_assert(collected.values[count++] == v);
+		}
+	}
+	ck_assert(collected.count == count);
+}
+
+START_TEST(test_concurrent_sequential) {
+	atomic_store(&_released, 0);
+
+	struct avl_concurrent_tree *tree = NULL;
+	ck_assert(avl_concurrent_create(&tree, int64_t_cmp, _release, NULL) == 0);
+
+	bool present[NUM_VALUES] = {false};
+	long added = 0;
+
+	for (int round = 0; round < 10; ++round) {
+		for (int i = 0; i < NUM_VALUES; ++i) {
+			int64_t v = rand() % NUM_VALUES;
+			if (rand() % 3) {
+				int rc = avl_concurrent_add(tree, (void *)v, (void *)(v + 1));
+				ck_assert(rc == !present[v]);
+				added += rc;
+				present[v] = true;
+			} else {
+				void const *data;
+				ck_assert(avl_concurrent_remove(tree, (void *)v, &data) == present[v]);
+				ck_assert(!present[v] || (int64_t)data == v + 1);
+				present[v] = false;
+			}
+		}
+
+		_check_contents(tree, present);
+	}
+
+	// Every value added was either kept by a node, or handed back when a routing node took its place
+	avl_concurrent_free(&tree, NULL, NULL);
+	ck_assert(tree == NULL);
+	ck_assert(atomic_load(&_released) == added);
+}
+
+END_TEST
+
+struct worker {
+	pthread_t thread;
+	struct avl_concurrent_tree *tree;
+	int index;
+	unsigned seed;
+	// Values congruent to index are this worker's alone; the rest are shared by every worker
+	bool present[NUM_VALUES];
+	long added;
+	long removed;
+};
+
+bool _owned(int64_t v, int index) {
+	return v % (2 * NUM_THREADS) == index;
+}
+
+void *_work(void *arg) {
+	struct worker *worker = arg;
+
+	for (int i = 0; i < NUM_OPS; ++i) {
+		int64_t v = rand_r(&worker->seed) % NUM_VALUES;
+		if (v % (2 * NUM_THREADS) < NUM_THREADS && !_owned(v, worker->index)) {
+			// Somebody else's; shift into the shared range instead
+			v = v - v % (2 * NUM_THREADS) + NUM_THREADS + worker->index;
+			if (NUM_VALUES <= v) {
+				continue;
+			}
+		}
+
+		bool owned = _owned(v, worker->index);
+		if (rand_r(&worker->seed) % 2) {
+			int rc = avl_concurrent_add(worker->tree, (void *)v, (void *)(v + 1));
+			ck_assert(rc == true || rc == false);
+			ck_assert(!owned || rc == !worker->present[v]);
+			worker->added += rc;
+			worker->present[v] = worker->present[v] || owned;
+		} else {
+			void const *data;
+			int rc = avl_concurrent_remove(worker->tree, (void *)v, &data);
+			ck_assert(rc == true || rc == false);
+			ck_assert(!owned || rc == worker->present[v]);
+			ck_assert(rc == false || (int64_t)data == v + 1);
+			worker->removed += rc;
+			worker->present[v] = worker->present[v] && !owned;
+		}
+
+		// Lookups of owned values cannot be fooled by rotations going on elsewhere
+		int64_t lookup = rand_r(&worker->seed) % (NUM_VALUES / (2 * NUM_THREADS));
+		lookup = lookup * 2 * NUM_THREADS + worker->index;
+		void const *data;
+		ck_assert(avl_concurrent_get(worker->tree, (void *)lookup, &data) == worker->present[lookup]);
+	}
+
+	return NULL;
+}
+
+START_TEST(test_concurrent_stress) {
+	atomic_store(&_released, 0);
+
+	struct avl_concurrent_tree *tree = NULL;
+	ck_assert(avl_concurrent_create(&tree, int64_t_cmp, _release, NULL) == 0);
+
+	static struct worker workers[NUM_THREADS];
+	for (int i = 0; i < NUM_THREADS; ++i) {
+		workers[i] = (struct worker){.tree = tree, .index = i, .seed = i + 1};
+		ck_assert(pthread_create(&workers[i].thread, NULL, _work, &workers[i]) == 0);
+	}
+
+	// Meanwhile, walks only ever go forward
+	for (int i = 0; i < 20; ++i) {
+		static struct collected collected;
+		collected.count = 0;
+		ck_assert(avl_concurrent_traverse(tree, _collect, &collected) == 0);
+		for (int j = 1; j < collected.count; ++j) {
+			ck_assert(collected.values[j - 1] < collected.values[j]);
+		}
+	}
+
+	long added = 0;
+	long removed = 0;
+	for (int i = 0; i < NUM_THREADS; ++i) {
+		pthread_join(workers[i].thread, NULL);
+		added += workers[i].added;
+		removed += workers[i].removed;
+	}
+
+	// Owned values are as their worker left them; for shared ones, every add was matched by a remove
+	// or is still there
+	bool present[NUM_VALUES] = {false};
+	long shared = 0;
+	for (int64_t v = 0; v < NUM_VALUES; ++v) {
+		if (v % (2 * NUM_THREADS) < NUM_THREADS) {
+			present[v] = workers[v % (2 * NUM_THREADS)].present[v];
+		} else {
+			void const *data;
+			present[v] = avl_concurrent_get(tree, (void *)v, &data);
+			shared += present[v];
+		}
+	}
+	long owned = 0;
+	for (int64_t v = 0; v < NUM_VALUES; ++v) {
+		owned += present[v] && v % (2 * NUM_THREADS) < NUM_THREADS;
+	}
+	ck_assert(added - removed == owned + shared);
+
+	_check_contents(tree, present);
+
+	avl_concurrent_free(&tree, NULL, NULL);
+	ck_assert(atomic_load(&_released) == added);
+}
+
+END_TEST
+
+Suite *test_suite() {
+	Suite *suite = suite_create("test_suite");
+
+	TCase *tcase = tcase_create("case");
+	tcase_set_timeout(tcase, 120);
+
+	tcase_add_test(tcase, test_concurrent_sequential);
+	tcase_add_test(tcase, test_concurrent_stress);
+
+	suite_add_tcase(suite, tcase);
+
+	return suite;
+}
+
+int main() {
+	return run(test_suite());
+}
@@ -0,0 +1,367 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "avl_test_utils.h"
+
+#define NUM_VALUES 10000
+
+int _encode_data(void const *value, void const *data, uint8_t *buffer, size_t *size, void *arg) {
+	(void)value;
+	(void)arg;
+
+	if (*size < sizeof(data)) {
+		*size = sizeof(data);
+		return -ENOSPC;
+	}
+	memcpy(buffer, &data, sizeof(data));
+	*size = sizeof(data);
+
+	return 0;
+}
+
+int _decode_data(
+    uint8_t const *buffer, size_t size, void const **value, void const **data, void *arg) {
+	(void)value;
+	(void)arg;
+
+	if (size != sizeof(*data)) {
+		return -EBADMSG;
+	}
+	memcpy(data, buffer, sizeof(*data));
+
+	return 0;
+}
+
+int _encode_entry(void const *value, void const *data, uint8_t *buffer, size_t *size, void *arg) {
+	(void)arg;
+
+	if (*size < 2 * sizeof(value)) {
+		*size = 2 * sizeof(value);
+		return -ENOSPC;
+	}
+	memcpy(buffer, &value, sizeof(value));
+	memcpy(buffer + sizeof(value), &data, sizeof(data));
+	*size = 2 * sizeof(value);
+
+	return 0;
+}
+
+int _decode_entry(
+    uint8_t const *buffer, size_t size, void const **value, void const **data, void *arg) {
+	(void)arg;
+
+	if (size != 2 * sizeof(*value)) {
+		return -EBADMSG;
+	}
+	memcpy(value, buffer, sizeof(*value));
+	memcpy(data, buffer + sizeof(*value), sizeof(*data));
+
+	return 0;
+}
+
+// Strings of the value's length, long enough for some to outgrow the first encode buffer
+int _encode_string(void const *value, void const *data, uint8_t *buffer, size_t *size, void *arg) {
+	(void)value;
+	(void)arg;
+
+	size_t length = strlen(data);
+	if (*size < length) {
+		*size = length;
+		return -ENOSPC;
+	}
+	memcpy(buffer, data, length);
+	*size = length;
+
+	return 0;
+}
+
+int _decode_string(
+    uint8_t const *buffer, size_t size, void const **value, void const **data, void *arg) {
+	int *live = arg;
+
+	char *string = malloc(size + 1);
+	ck_assert(string != NULL);
+	memcpy(string, buffer, size);
+	string[size] = '\0';
+	*data = string;
+	++*live;
+
+	(void)value;
+	return 0;
+}
+
+void _release_string(void const *value, void const *data, void *arg) {
+	int *live = arg;
+
+	free((void *)data);
+	--*live;
+
+	(void)value;
+}
+
+int _free_string_node(struct avl_node const *node, void *arg) {
+	_release_string(avl_node_value(node), avl_node_data(node), arg);
+	free((struct avl_node *)node);
+	return 0;
+}
+
+// Values that are strings themselves, ordered by strcmp, which cannot take anything else
+int _string_cmp(void const *new_value, void const *node_value) {
+	return strcmp(new_value, node_value);
+}
+
+int _encode_key(void const *value, void const *data, uint8_t *buffer, size_t *size, void *arg) {
+	(void)data;
+	return _encode_string(NULL, value, buffer, size, arg);
+}
+
+int _decode_key(
+    uint8_t const *buffer, size_t size, void const **value, void const **data, void *arg) {
+	*data = NULL;
+	return _decode_string(buffer, size, NULL, value, arg);
+}
+
+void _release_key(void const *value, void const *data, void *arg) {
+	(void)data;
+	_release_string(NULL, value, arg);
+}
+
+char *_string(int64_t v) {
+	size_t length = (size_t)(v % 700);
+	char *string = malloc(length + 1);
+	ck_assert(string != NULL);
+	memset(string, 'a' + v % 26, length);
+	string[length] = '\0';
+	return string;
+}
+
+void _check_loaded(struct avl_tree *tree, bool const *present, bool with_data) {
+	check_tree(tree);
+	for (int64_t v = 0; v < NUM_VALUES; ++v) {
+		void const *node_data;
+		ck_assert(avl_tree_get(tree, (void *)(v - NUM_VALUES / 2), &node_data) == present[v]);
+		ck_assert(!present[v] || (int64_t)node_data == (with_data ? v - NUM_VALUES / 2 + 1 : 0));
+	}
+}
+
+START_TEST(test_file) {
+	struct avl_tree *tree = create_tree();
+	bool present[NUM_VALUES] = {false};
+
+	// Negative values too, which integer values have to count up to across zero
+	for (int i = 0; i < NUM_VALUES; ++i) {
+		int64_t v = rand() % NUM_VALUES;
+		int64_t value = v - NUM_VALUES / 2;
+		avl_tree_add(tree, (void *)value, (void *)(value + 1));
+		present[v] = true;
+	}
+
+	struct avl_codec data_codec = {.encode_func = _encode_data, .decode_func = _decode_data};
+	struct avl_codec entry_codec = {.encode_func = _encode_entry, .decode_func = _decode_entry};
+	struct {
+		uint32_t flags;
+		struct avl_codec const *codec;
+	} const formats[] = {
+	    {AVL_SAVE_INTEGER_VALUES, &data_codec},
+	    {AVL_SAVE_INTEGER_VALUES, NULL},
+	    {0, &entry_codec},
+	};
+
+	for (size_t i = 0; i < sizeof(formats) / sizeof(*formats); ++i) {
+		FILE *file = tmpfile();
+		ck_assert(file != NULL);
+		ck_assert(avl_tree_save(tree, file, formats[i].flags, formats[i].codec) == 0);
+		long size = ftell(file);
+
+		// The snapshot ends where it says, whatever follows it
+		fputs("trailing", file);
+		rewind(file);
+
+		struct avl_tree *loaded = create_tree();
+		ck_assert(avl_tree_load(loaded, file, formats[i].codec) == 0);
+		ck_assert(ftell(file) == size);
+		_check_loaded(loaded, present, formats[i].codec != NULL);
+
+		// Only into an empty tree
+		rewind(file);
+		ck_assert(avl_tree_load(loaded, file, formats[i].codec) == -EEXIST);
+
+		free_tree(loaded);
+		fclose(file);
+	}
+
+	free_tree(tree);
+
+	// An empty tree saves and loads as one
+	tree = create_tree();
+	FILE *file = tmpfile();
+	ck_assert(avl_tree_save(tree, file, AVL_SAVE_INTEGER_VALUES, &data_codec) == 0);
+	rewind(file);
+	ck_assert(avl_tree_load(tree, file, &data_codec) == 0);
+	ck_assert(tree->root == NULL);
+
+	// Files saved with data need a codec to read it back
+	rewind(file);
+	ck_assert(avl_tree_save(tree, file, 0, &entry_codec) == 0);
+	rewind(file);
+	ck_assert(avl_tree_load(tree, file, NULL) == -EINVAL);
+
+	fclose(file);
+	free_tree(tree);
+}
+
+END_TEST
+
+START_TEST(test_file_corrupt) {
+	int live = 0;
+	struct avl_tree *tree = create_tree();
+	for (int64_t v = 0; v < NUM_VALUES; ++v) {
+		avl_tree_add(tree, (void *)(3 * v), _string(v));
+		++live;
+	}
+
+	struct avl_codec codec = {
+	    .encode_func = _encode_string,
+	    .decode_func = _decode_string,
+	    .release_func = _release_string,
+	    .arg = &live,
+	};
+	FILE *file = tmpfile();
+	ck_assert(avl_tree_save(tree, file, AVL_SAVE_INTEGER_VALUES, &codec) == 0);
+	long size = ftell(file);
+
+	rewind(file);
+	struct avl_tree *loaded = create_tree();
+	ck_assert(avl_tree_load(loaded, file, &codec) == 0);
+	ck_assert(live == 2 * NUM_VALUES);
+	for (int64_t v = 0; v < NUM_VALUES; ++v) {
+		void const *node_data;
+		ck_assert(avl_tree_get(loaded, (void *)(3 * v), &node_data) == true);
+		ck_assert(strlen(node_data) == (size_t)(v % 700));
+	}
+	avl_tree_free(&loaded, _free_string_node, &live);
+	avl_tree_free(&tree, _free_string_node, &live);
+	ck_assert(live == 0);
+
+	char *bytes = malloc(size);
+	ck_assert(bytes != NULL);
+	rewind(file);
+	ck_assert(fread(bytes, 1, size, file) == (size_t)size);
+	fclose(file);
+
+	// Flipped bits anywhere past the header, and cuts anywhere at all, are caught; whatever was
+	// decoded along the way is released
+	for (int i = 0; i < 200; ++i) {
+		long offset = 6 + rand() % (size - 6);
+		char flip = (char)(1 << (rand() % 8));
+		bytes[offset] ^= flip;
+
+		file = tmpfile();
+		ck_assert(fwrite(bytes, 1, size, file) == (size_t)size);
+		rewind(file);
+		loaded = create_tree();
+		ck_assert(avl_tree_load(loaded, file, &codec) == -EBADMSG);
+		ck_assert(loaded->root == NULL);
+		ck_assert(live == 0);
+		free_tree(loaded);
+		fclose(file);
+
+		bytes[offset] ^= flip;
+	}
+
+	for (int i = 0; i < 200; ++i) {
+		long cut = rand() % size;
+
+		file = tmpfile();
+		ck_assert(fwrite(bytes, 1, cut, file) == (size_t)cut);
+		rewind(file);
+		loaded = create_tree();
+		ck_assert(avl_tree_load(loaded, file, &codec) == -EBADMSG);
+		ck_assert(live == 0);
+		free_tree(loaded);
+		fclose(file);
+	}
+
+	// Not one of ours
+	file = tmpfile();
+	fputs("avlx\1\1", file);
+	rewind(file);
+	loaded = create_tree();
+	ck_assert(avl_tree_load(loaded, file, &codec) == -EBADMSG);
+	free_tree(loaded);
+	fclose(file);
+
+	free(bytes);
+}
+
+END_TEST
+
+START_TEST(test_file_corrupt_flags) {
+	int live = 0;
+	struct avl_tree *tree = NULL;
+	ck_assert(avl_tree_create(&tree, _string_cmp) == 0);
+	char const *keys[] = {"apple", "banana", "cherry"};
+	for (int i = 0; i < 3; ++i) {
+		ck_assert(avl_tree_add(tree, keys[i], NULL) == true);
+	}
+
+	struct avl_codec codec = {
+	    .encode_func = _encode_key,
+	    .decode_func = _decode_key,
+	    .release_func = _release_key,
+	    .arg = &live,
+	};
+	FILE *file = tmpfile();
+	ck_assert(avl_tree_save(tree, file, 0, &codec) == 0);
+	long size = ftell(file);
+	avl_tree_free(&tree, free_node, NULL);
+
+	char *bytes = malloc(size);
+	ck_assert(bytes != NULL);
+	rewind(file);
+	ck_assert(fread(bytes, 1, size, file) == (size_t)size);
+	fclose(file);
+
+	// Any other flags byte, including ones that would leave values to be decoded as integers and
+	// handed to strcmp, is caught before cmp_func sees a value
+	for (int flags = 1; flags < 256; ++flags) {
+		bytes[5] = (char)flags;
+
+		file = tmpfile();
+		ck_assert(fwrite(bytes, 1, size, file) == (size_t)size);
+		rewind(file);
+		struct avl_tree *loaded = NULL;
+		ck_assert(avl_tree_create(&loaded, _string_cmp) == 0);
+		ck_assert(avl_tree_load(loaded, file, &codec) == -EBADMSG);
+		ck_assert(loaded->root == NULL);
+		ck_assert(live == 0);
+		free_tree(loaded);
+		fclose(file);
+	}
+
+	free(bytes);
+}
+
+END_TEST
+
+Suite *test_suite() {
+	Suite *suite = suite_create("test_suite");
+
+	TCase *tcase = tcase_create("case");
+	tcase_set_timeout(tcase, 60);
+
+	tcase_add_test(tcase, test_file);
+	tcase_add_test(tcase, test_file_corrupt);
+	tcase_add_test(tcase, test_file_corrupt_flags);
+
+	suite_add_tcase(suite, tcase);
+
+	return suite;
+}
+
+int main() {
+	return run(test_suite());
+}
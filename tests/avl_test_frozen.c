@@ -0,0 +1,171 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "avl_frozen.h"
+#include "avl_test_utils.h"
+
+struct collected {
+	int64_t values[64];
+	int count;
+};
+
+int _collect(void const *value, void const *data, void *arg) {
+	struct collected *collected = arg;
+
+	ck_assert((int64_t)data == (int64_t)value + 1);
+	if (collected->count == 64) {
+		return -ECANCELED;
+	}
+	collected->values[collected->count++] = (int64_t)value;
+
+	return 0;
+}
+
+void _check_frozen(struct avl_frozen const *frozen, int64_t count) {
+	// The tree holds count even values, about half of them negative
+	int64_t first = -2 * (count / 2);
+	int64_t end = first + 2 * count;
+
+	for (int64_t v = first - 3; v <= end + 3; ++v) {
+		bool present = v % 2 == 0 && first <= v && v < end;
+		void const *node_data = NULL;
+		ck_assert(avl_frozen_get(frozen, (void *)v, &node_data) == present);
+		ck_assert(!present || (int64_t)node_data == v + 1);
+
+		int64_t ceiling = v < first ? first : v + (v % 2 != 0);
+		void const *node_value;
+		bool found = ceiling < end;
+		ck_assert(avl_frozen_lower_bound(frozen, (void *)v, &node_value, &node_data) == found);
+		ck_assert(!found || ((int64_t)node_value == ceiling && (int64_t)node_data == ceiling + 1));
+	}
+
+	for (int i = 0; i < 100; ++i) {
+		int64_t lo = first - 3 + rand() % (2 * count + 7);
+		int64_t hi = lo + rand() % 100;
+		uint32_t flags = rand() % 16;
+
+		struct collected collected = {.count = 0};
+		int rc = avl_frozen_range(frozen, (void *)lo, (void *)hi, flags, _collect, &collected);
+
+		int expected = 0;
+		for (int64_t v = first; v < end; v += 2) {
+			bool above = flags & AVL_RANGE_LO_UNBOUNDED ||
+			             (flags & AVL_RANGE_LO_INCLUSIVE ? lo <= v : lo < v);
+			bool below = flags & AVL_RANGE_HI_UNBOUNDED ||
+			             (flags & AVL_RANGE_HI_INCLUSIVE ? v <= hi : v < hi);
+			if (above && below) {
+				// Scans stop once the callback gives up
+				if (expected == 64) {
+					ck_assert(rc == -ECANCELED);
+					break;
+				}
+				ck_assert(collected.values[expected++] == v);
+			}
+		}
+		ck_assert(expected == collected.count);
+		ck_assert(expected == 64 || rc == 0);
+	}
+}
+
+START_TEST(test_frozen) {
+	int64_t const counts[] = {0, 1, 2, 3, 6, 7, 8, 9, 15, 63, 64, 65, 100, 511, 513, 4097, 30000};
+
+	for (size_t i = 0; i < sizeof(counts) / sizeof(*counts); ++i) {
+		int64_t count = counts[i];
+
+		// Negative values too, which integer lookups have to order as signed
+		struct avl_tree *tree = create_tree();
+		for (int64_t v = 2 * (count - count / 2) - 2; v >= -2 * (count / 2); v -= 2) {
+			ck_assert(avl_tree_add(tree, (void *)v, (void *)(v + 1)) == true);
+		}
+
+		for (int layout = AVL_FROZEN_EYTZINGER; layout <= AVL_FROZEN_VEB; ++layout) {
+			for (uint32_t flags = 0; flags <= AVL_FROZEN_INTEGER_VALUES; ++flags) {
+				struct avl_frozen *frozen = NULL;
+				ck_assert(avl_tree_freeze(tree, &frozen, layout, flags) == 0);
+				ck_assert(frozen->header->count == (uint64_t)count);
+				_check_frozen(frozen, count);
+
+				avl_frozen_free(&frozen);
+				ck_assert(frozen == NULL);
+			}
+		}
+
+		free_tree(tree);
+	}
+}
+
+END_TEST
+
+START_TEST(test_frozen_map) {
+	int64_t count = 5000;
+	struct avl_tree *tree = create_tree();
+	for (int64_t v = -count; v < count; v += 2) {
+		avl_tree_add(tree, (void *)v, (void *)(v + 1));
+	}
+
+	char path[] = "/tmp/avl_test_frozen_XXXXXX";
+	int fd = mkstemp(path);
+	ck_assert(fd >= 0);
+	close(fd);
+
+	for (int layout = AVL_FROZEN_EYTZINGER; layout <= AVL_FROZEN_VEB; ++layout) {
+		struct avl_frozen *frozen = NULL;
+		ck_assert(avl_tree_freeze(tree, &frozen, layout, AVL_FROZEN_INTEGER_VALUES) == 0);
+
+		FILE *file = fopen(path, "wb");
+		ck_assert(file != NULL);
+		ck_assert(avl_frozen_write(frozen, file) == 0);
+		fclose(file);
+		avl_frozen_free(&frozen);
+
+		// Straight from the file, without the tree
+		ck_assert(avl_frozen_map(&frozen, path, int64_t_cmp) == 0);
+		ck_assert(frozen->mapped);
+		_check_frozen(frozen, count);
+		size_t size = frozen->header->size;
+		avl_frozen_free(&frozen);
+
+		// Files cut short are turned away before anything is read past their end
+		ck_assert(truncate(path, size - 64) == 0);
+		ck_assert(avl_frozen_map(&frozen, path, int64_t_cmp) == -EINVAL);
+		ck_assert(frozen == NULL);
+	}
+
+	// And so are other files
+	FILE *file = fopen(path, "wb");
+	for (int i = 0; i < 1000; ++i) {
+		fputs("not a frozen tree", file);
+	}
+	fclose(file);
+	struct avl_frozen *frozen = NULL;
+	ck_assert(avl_frozen_map(&frozen, path, int64_t_cmp) == -EINVAL);
+
+	unlink(path);
+	ck_assert(avl_frozen_map(&frozen, path, int64_t_cmp) == -ENOENT);
+
+	free_tree(tree);
+}
+
+END_TEST
+
+Suite *test_suite() {
+	Suite *suite = suite_create("test_suite");
+
+	TCase *tcase = tcase_create("case");
+	tcase_set_timeout(tcase, 60);
+
+	tcase_add_test(tcase, test_frozen);
+	tcase_add_test(tcase, test_frozen_map);
+
+	suite_add_tcase(suite, tcase);
+
+	return suite;
+}
+
+int main() {
+	return run(test_suite());
+}
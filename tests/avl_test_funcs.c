@@ -1,3 +1,5 @@
+#include <errno.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdlib.h>
 
@@ -14,6 +16,27 @@ START_TEST(test_init) {
 
 END_TEST
 
+START_TEST(test_init_writer_preference) {
+	struct avl_tree *tree = NULL;
+	int rc = avl_tree_create_flags(&tree, int64_t_cmp, AVL_TREE_WRITER_PREFERENCE);
+	ck_assert(rc == 0);
+
+	ck_assert(tree->root == NULL);
+	ck_assert(tree->flags == AVL_TREE_WRITER_PREFERENCE);
+
+	rc = avl_tree_add(tree, (void *)0, (void *)1);
+	ck_assert(rc == true);
+
+	void const *node_data;
+	rc = avl_tree_get(tree, (void *)0, &node_data);
+	ck_assert(rc == true);
+	ck_assert(node_data == (void *)1);
+
+	free_tree(tree);
+}
+
+END_TEST
+
 START_TEST(test_add) {
 	struct avl_tree *tree = create_tree();
 
@@ -451,12 +474,308 @@ START_TEST(test_get_fail) {
 
 END_TEST
 
+START_TEST(test_build_sorted) {
+	int64_t const counts[] = {0, 1, 2, 3, 4, 5, 7, 8, 100, 1000, 4095};
+
+	for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+		int64_t count = counts[c];
+		void const **values = malloc(sizeof(*values) * (count + 1));
+		void const **data = malloc(sizeof(*data) * (count + 1));
+		for (int64_t i = 0; i < count; ++i) {
+			values[i] = (void *)(2 * i);
+			data[i] = (void *)(2 * i + 1);
+		}
+
+		struct avl_tree *tree = create_tree();
+		int rc = avl_tree_build_sorted(tree, values, data, count);
+		ck_assert(rc == 0);
+		ck_assert((tree->root == NULL) == (count == 0));
+
+		// Checks the balance factors against the real heights too
+		check_tree(tree);
+
+		void const *node_data;
+		for (int64_t i = 0; i < count; ++i) {
+			ck_assert(avl_tree_get(tree, (void *)(2 * i), &node_data) == true);
+			ck_assert(node_data == (void *)(2 * i + 1));
+			ck_assert(avl_tree_get(tree, (void *)(2 * i + 1), &node_data) == false);
+		}
+
+		// The result is an ordinary tree
+		ck_assert(avl_tree_add(tree, (void *)-1, (void *)0) == true);
+		check_tree(tree);
+
+		free_tree(tree);
+		free(values);
+		free(data);
+	}
+}
+
+END_TEST
+
+START_TEST(test_build_sorted_not_empty) {
+	struct avl_tree *tree = create_tree();
+
+	ck_assert(avl_tree_add(tree, (void *)0, (void *)1) == true);
+
+	void const *values[] = {(void *)2, (void *)4};
+	int rc = avl_tree_build_sorted(tree, values, NULL, 2);
+	ck_assert(rc == -EEXIST);
+
+	void const *node_data;
+	ck_assert(avl_tree_get(tree, (void *)2, &node_data) == false);
+
+	free_tree(tree);
+}
+
+END_TEST
+
+START_TEST(test_apply_batch) {
+	struct avl_tree *tree = create_tree();
+
+	ck_assert(avl_tree_add(tree, (void *)4, (void *)5) == true);
+
+	struct avl_batch_op ops[] = {
+	    {.kind = AVL_BATCH_ADD, .value = (void *)6, .data = (void *)7},
+	    {.kind = AVL_BATCH_REMOVE, .value = (void *)4},
+	    {.kind = AVL_BATCH_ADD, .value = (void *)0, .data = (void *)1},
+	    // Same value twice: applied in the order given
+	    {.kind = AVL_BATCH_ADD, .value = (void *)2, .data = (void *)3},
+	    {.kind = AVL_BATCH_ADD, .value = (void *)2, .data = (void *)9},
+	    {.kind = AVL_BATCH_REMOVE, .value = (void *)2},
+	    {.kind = AVL_BATCH_REMOVE, .value = (void *)8},
+	};
+	int rc = avl_tree_apply_batch(tree, ops, sizeof(ops) / sizeof(ops[0]));
+	ck_assert(rc == 0);
+
+	ck_assert(ops[0].result == true);
+	ck_assert(ops[1].result == true);
+	ck_assert(ops[1].node_value == (void *)4);
+	ck_assert(ops[1].node_data == (void *)5);
+	ck_assert(ops[2].result == true);
+	ck_assert(ops[3].result == true);
+	ck_assert(ops[4].result == false);
+	ck_assert(ops[5].result == true);
+	ck_assert(ops[5].node_data == (void *)3);
+	ck_assert(ops[6].result == false);
+	ck_assert(ops[6].node_value == NULL);
+
+	void const *node_data;
+	ck_assert(avl_tree_get(tree, (void *)0, &node_data) == true);
+	ck_assert(avl_tree_get(tree, (void *)2, &node_data) == false);
+	ck_assert(avl_tree_get(tree, (void *)4, &node_data) == false);
+	ck_assert(avl_tree_get(tree, (void *)6, &node_data) == true);
+
+	check_tree(tree);
+	free_tree(tree);
+}
+
+END_TEST
+
+void _check_batch_random(uint32_t flags) {
+	struct avl_tree *batched = NULL;
+	struct avl_tree *sequential = NULL;
+	ck_assert(avl_tree_create_flags(&batched, int64_t_cmp, flags) == 0);
+	ck_assert(avl_tree_create_flags(&sequential, int64_t_cmp, flags) == 0);
+
+	struct avl_batch_op ops[1000];
+	for (int round = 0; round < 20; ++round) {
+		int64_t count = sizeof(ops) / sizeof(ops[0]);
+		for (int64_t i = 0; i < count; ++i) {
+			int64_t v = rand() % 500;
+			ops[i].kind = rand() % 3 == 0 ? AVL_BATCH_REMOVE : AVL_BATCH_ADD;
+			ops[i].value = (void *)v;
+			ops[i].data = (void *)(v + 1);
+		}
+
+		ck_assert(avl_tree_apply_batch(batched, ops, count) == 0);
+
+		// Every result matches what applying the operations one by one gives
+		for (int64_t i = 0; i < count; ++i) {
+			void const *node_value = NULL;
+			void const *node_data = NULL;
+			int rc;
+			if (ops[i].kind == AVL_BATCH_ADD) {
+				rc = avl_tree_add(sequential, ops[i].value, ops[i].data);
+			} else {
+				rc = avl_tree_remove(sequential, ops[i].value, &node_value, &node_data);
+			}
+			ck_assert(ops[i].result == rc);
+			ck_assert(ops[i].node_value == node_value);
+			ck_assert(ops[i].node_data == node_data);
+		}
+
+		check_tree(batched);
+
+		// The smallest and largest entries, and with AVL_TREE_ORDER_STATISTICS every rank, agree too
+		void const *batched_value = NULL;
+		void const *sequential_value = NULL;
+		void const *node_data;
+		ck_assert(
+		    avl_tree_min(batched, &batched_value, &node_data) ==
+		    avl_tree_min(sequential, &sequential_value, &node_data));
+		ck_assert(batched_value == sequential_value);
+		ck_assert(
+		    avl_tree_max(batched, &batched_value, &node_data) ==
+		    avl_tree_max(sequential, &sequential_value, &node_data));
+		ck_assert(batched_value == sequential_value);
+
+		if (flags & AVL_TREE_ORDER_STATISTICS) {
+			for (size_t rank = 0; rank <= 500; ++rank) {
+				ck_assert(
+				    avl_tree_select(batched, rank, &batched_value, &node_data) ==
+				    avl_tree_select(sequential, rank, &sequential_value, &node_data));
+				ck_assert(batched_value == sequential_value);
+			}
+		}
+	}
+
+	free_tree(batched);
+	free_tree(sequential);
+}
+
+START_TEST(test_apply_batch_random) {
+	_check_batch_random(0);
+	_check_batch_random(AVL_TREE_ORDER_STATISTICS);
+	_check_batch_random(AVL_TREE_PERSISTENT | AVL_TREE_ORDER_STATISTICS);
+}
+
+END_TEST
+
+START_TEST(test_get_many) {
+	struct avl_tree *tree = create_tree();
+
+	for (int64_t v = 0; v < 1000; v += 2) {
+		ck_assert(avl_tree_add(tree, (void *)v, (void *)(v + 1)) == true);
+	}
+
+	// More lookups than lanes, hits and misses mixed, and a repeated value
+	void const *values[100];
+	void const *node_data[100];
+	int found[100];
+	for (int64_t i = 0; i < 100; ++i) {
+		values[i] = (void *)((i * 37) % 1003);
+		node_data[i] = NULL;
+	}
+	values[99] = values[0];
+
+	int rc = avl_tree_get_many(tree, values, 100, node_data, found);
+
+	int expected = 0;
+	for (int64_t i = 0; i < 100; ++i) {
+		int64_t v = (int64_t)values[i];
+		if (v % 2 == 0 && v < 1000) {
+			ck_assert(found[i] == true);
+			ck_assert(node_data[i] == (void *)(v + 1));
+			++expected;
+		} else {
+			ck_assert(found[i] == false);
+			ck_assert(node_data[i] == NULL);
+		}
+	}
+	ck_assert(rc == expected);
+
+	ck_assert(avl_tree_get_many(tree, values, 0, node_data, found) == 0);
+
+	// Turned away before anything is read, since the hits could not be counted
+	ck_assert(avl_tree_get_many(tree, values, (size_t)INT_MAX + 1, node_data, found) == -EOVERFLOW);
+
+	free_tree(tree);
+}
+
+END_TEST
+
+struct record {
+	int64_t key;
+	struct avl_node link;
+	bool linked;
+};
+
+START_TEST(test_intrusive) {
+	struct avl_tree *tree = NULL;
+	ck_assert(avl_tree_create_flags(&tree, int64_t_cmp, AVL_TREE_INTRUSIVE) == 0);
+
+	struct record records[1000];
+	for (int64_t i = 0; i < 1000; ++i) {
+		records[i].key = i;
+		records[i].linked = false;
+	}
+
+	for (int i = 0; i < 20000; ++i) {
+		struct record *record = &records[rand() % 1000];
+		struct avl_node *node;
+
+		if (rand() % 2) {
+			int rc = avl_tree_link(tree, &record->link, (void *)record->key, record);
+			ck_assert(rc == !record->linked);
+			record->linked = true;
+		} else {
+			// The node handed back is the one that was linked, whatever the removal had to move
+			int rc = avl_tree_unlink(tree, (void *)record->key, &node);
+			ck_assert(rc == record->linked);
+			if (rc) {
+				ck_assert(node == &record->link);
+			}
+			record->linked = false;
+		}
+
+		ck_assert(avl_tree_find(tree, (void *)record->key, &node) == record->linked);
+		if (record->linked) {
+			ck_assert(avl_container_of(node, struct record, link) == record);
+			ck_assert(avl_node_data(node) == record);
+		}
+
+		if (i % 1000 == 0) {
+			check_tree(tree);
+		}
+	}
+
+	// The tree leaves the records alone
+	avl_tree_free(&tree, NULL, NULL);
+}
+
+END_TEST
+
+START_TEST(test_intrusive_invalid) {
+	// Each of these would free the caller's nodes
+	uint32_t others[] = {AVL_TREE_OPTIMISTIC_READS, AVL_TREE_PERSISTENT, AVL_TREE_NODE_POOL};
+	struct avl_tree *tree = NULL;
+	for (int i = 0; i < 3; ++i) {
+		uint32_t flags = AVL_TREE_INTRUSIVE | others[i];
+		ck_assert(avl_tree_create_flags(&tree, int64_t_cmp, flags) == -EINVAL);
+		ck_assert(tree == NULL);
+	}
+
+	// Only intrusive trees take caller-owned nodes
+	struct record record = {.key = 0};
+	struct avl_node *node;
+	tree = create_tree();
+	ck_assert(avl_tree_link(tree, &record.link, (void *)0, NULL) == -EINVAL);
+	ck_assert(avl_tree_unlink(tree, (void *)0, &node) == -EINVAL);
+	ck_assert(avl_tree_find(tree, (void *)0, &node) == -EINVAL);
+	free_tree(tree);
+	tree = NULL;
+
+	// And intrusive trees have no nodes of their own for avl_tree_add
+	void const *value;
+	void const *data;
+	ck_assert(avl_tree_create_flags(&tree, int64_t_cmp, AVL_TREE_INTRUSIVE) == 0);
+	ck_assert(avl_tree_add(tree, (void *)0, NULL) == -EINVAL);
+	ck_assert(avl_tree_link(tree, &record.link, (void *)0, NULL) == true);
+	ck_assert(avl_tree_remove(tree, (void *)0, &value, &data) == -EINVAL);
+	ck_assert(avl_tree_get(tree, (void *)0, &data) == true);
+	avl_tree_free(&tree, NULL, NULL);
+}
+
+END_TEST
+
 Suite *test_suite() {
 	Suite *suite = suite_create("test_suite");
 
 	TCase *tcase = tcase_create("case");
 
 	tcase_add_test(tcase, test_init);
+	tcase_add_test(tcase, test_init_writer_preference);
 
 	tcase_add_test(tcase, test_add);
 	tcase_add_test(tcase, test_add_double);
@@ -480,6 +799,16 @@ Suite *test_suite() {
 
 	tcase_add_test(tcase, test_get);
 	tcase_add_test(tcase, test_get_fail);
+	tcase_add_test(tcase, test_get_many);
+
+	tcase_add_test(tcase, test_build_sorted);
+	tcase_add_test(tcase, test_build_sorted_not_empty);
+
+	tcase_add_test(tcase, test_apply_batch);
+	tcase_add_test(tcase, test_apply_batch_random);
+
+	tcase_add_test(tcase, test_intrusive);
+	tcase_add_test(tcase, test_intrusive_invalid);
 
 	// tcase_add_test(tcase, test_balance_right_right);
 	// tcase_add_test(tcase, test_balance_right_left);
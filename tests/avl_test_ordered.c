@@ -0,0 +1,682 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "avl_test_utils.h"
+
+#define NUM_VALUES 1000
+
+// Trees hold the even numbers 0, 2, ..., 2 * (NUM_VALUES - 1), with data one more than the value
+struct avl_tree *_create_even_tree(uint32_t flags) {
+	struct avl_tree *tree = NULL;
+	ck_assert(avl_tree_create_flags(&tree, int64_t_cmp, flags) == 0);
+
+	for (int64_t i = 0; i < NUM_VALUES; ++i) {
+		int64_t v = 2 * ((i * 7919) % NUM_VALUES);
+		ck_assert(avl_tree_add(tree, (void *)v, (void *)(v + 1)) == true);
+	}
+
+	return tree;
+}
+
+START_TEST(test_cursor_empty) {
+	struct avl_tree *tree = create_tree();
+
+	struct avl_cursor cursor;
+	ck_assert(avl_cursor_open(&cursor, tree) == 0);
+	ck_assert(avl_cursor_first(&cursor) == false);
+	ck_assert(avl_cursor_last(&cursor) == false);
+	ck_assert(avl_cursor_seek(&cursor, (void *)0) == false);
+	ck_assert(avl_cursor_valid(&cursor) == false);
+	ck_assert(avl_cursor_next(&cursor) == false);
+	ck_assert(avl_cursor_prev(&cursor) == false);
+	avl_cursor_close(&cursor);
+
+	free_tree(tree);
+}
+
+END_TEST
+
+START_TEST(test_cursor_forward_backward) {
+	struct avl_tree *tree = _create_even_tree(0);
+
+	struct avl_cursor cursor;
+	ck_assert(avl_cursor_open(&cursor, tree) == 0);
+
+	int64_t expected = 0;
+	for (int rc = avl_cursor_first(&cursor); rc; rc = avl_cursor_next(&cursor)) {
+		ck_assert((int64_t)avl_cursor_value(&cursor) == expected);
+		ck_assert((int64_t)avl_cursor_data(&cursor) == expected + 1);
+		expected += 2;
+	}
+	ck_assert(expected == 2 * NUM_VALUES);
+	ck_assert(avl_cursor_valid(&cursor) == false);
+
+	for (int rc = avl_cursor_last(&cursor); rc; rc = avl_cursor_prev(&cursor)) {
+		expected -= 2;
+		ck_assert((int64_t)avl_cursor_value(&cursor) == expected);
+	}
+	ck_assert(expected == 0);
+
+	avl_cursor_close(&cursor);
+
+	// The cursor released the lock, so writers can get in again
+	ck_assert(avl_tree_add(tree, (void *)-1, NULL) == true);
+
+	free_tree(tree);
+}
+
+END_TEST
+
+START_TEST(test_cursor_seek) {
+	struct avl_tree *tree = _create_even_tree(0);
+
+	struct avl_cursor cursor;
+	ck_assert(avl_cursor_open(&cursor, tree) == 0);
+
+	for (int64_t v = -1; v < 2 * NUM_VALUES - 1; ++v) {
+		// Lands on v itself when present, otherwise on the next even number
+		int64_t expected = v < 0 ? 0 : v + (v & 1);
+		ck_assert(avl_cursor_seek(&cursor, (void *)v) == true);
+		ck_assert((int64_t)avl_cursor_value(&cursor) == expected);
+
+		// Stepping either way from a seek behaves like any other position
+		if (avl_cursor_next(&cursor)) {
+			ck_assert((int64_t)avl_cursor_value(&cursor) == expected + 2);
+			ck_assert(avl_cursor_prev(&cursor) == true);
+		} else {
+			ck_assert(expected == 2 * (NUM_VALUES - 1));
+			ck_assert(avl_cursor_seek(&cursor, (void *)v) == true);
+		}
+		ck_assert(avl_cursor_prev(&cursor) == (expected != 0));
+		if (expected != 0) {
+			ck_assert((int64_t)avl_cursor_value(&cursor) == expected - 2);
+		}
+	}
+
+	ck_assert(avl_cursor_seek(&cursor, (void *)(2 * NUM_VALUES - 1)) == false);
+
+	avl_cursor_close(&cursor);
+	free_tree(tree);
+}
+
+END_TEST
+
+START_TEST(test_cursor_nested) {
+	struct avl_tree *tree = _create_even_tree(0);
+
+	// Merging a tree with itself: two cursors and plain lookups from the same thread
+	struct avl_cursor outer;
+	struct avl_cursor inner;
+	ck_assert(avl_cursor_open(&outer, tree) == 0);
+	ck_assert(avl_cursor_open(&inner, tree) == 0);
+	ck_assert(avl_cursor_first(&outer) == true);
+	ck_assert(avl_cursor_last(&inner) == true);
+	void const *node_data;
+	ck_assert(avl_tree_get(tree, avl_cursor_value(&inner), &node_data) == true);
+	avl_cursor_close(&inner);
+	avl_cursor_close(&outer);
+	free_tree(tree);
+
+	// Writer-preferring locks would deadlock those reads as soon as a writer waits
+	tree = _create_even_tree(AVL_TREE_WRITER_PREFERENCE);
+	ck_assert(avl_cursor_open(&outer, tree) == -EINVAL);
+	free_tree(tree);
+
+	// Unless the cursor only pins a snapshot
+	tree = _create_even_tree(AVL_TREE_WRITER_PREFERENCE | AVL_TREE_PERSISTENT);
+	ck_assert(avl_cursor_open(&outer, tree) == 0);
+	ck_assert(avl_cursor_first(&outer) == true);
+	avl_cursor_close(&outer);
+	free_tree(tree);
+}
+
+END_TEST
+
+START_TEST(test_cursor_persistent) {
+	struct avl_tree *tree = _create_even_tree(AVL_TREE_PERSISTENT);
+
+	struct avl_cursor cursor;
+	ck_assert(avl_cursor_open(&cursor, tree) == 0);
+	ck_assert(avl_cursor_first(&cursor) == true);
+
+	// The cursor only pins a snapshot, so the tree can change underneath it
+	void const *node_value;
+	void const *node_data;
+	ck_assert(avl_tree_remove(tree, (void *)2, &node_value, &node_data) == true);
+	ck_assert(avl_tree_add(tree, (void *)1, NULL) == true);
+
+	ck_assert(avl_cursor_next(&cursor) == true);
+	ck_assert((int64_t)avl_cursor_value(&cursor) == 2);
+
+	avl_cursor_close(&cursor);
+	free_tree(tree);
+}
+
+END_TEST
+
+struct collected {
+	int64_t values[NUM_VALUES];
+	int count;
+	// Stop the scan once this many values were collected
+	int limit;
+};
+
+int _collect(struct avl_node const *node, void *arg) {
+	struct collected *collected = arg;
+
+	collected->values[collected->count++] = (int64_t)avl_node_value(node);
+
+	return collected->count == collected->limit ? -2 : 0;
+}
+
+START_TEST(test_range) {
+	struct avl_tree *tree = _create_even_tree(0);
+
+	for (uint32_t flags = 0; flags < 16; ++flags) {
+		for (int64_t lo = -3; lo < 2 * NUM_VALUES + 3; lo += 37) {
+			for (int64_t hi = lo - 5; hi < 2 * NUM_VALUES + 3; hi += 41) {
+				// Every even value that satisfies both bounds, in order
+				int64_t expected[NUM_VALUES];
+				int count = 0;
+				for (int64_t v = 0; v < 2 * NUM_VALUES; v += 2) {
+					if (!(flags & AVL_RANGE_LO_UNBOUNDED) &&
+					    (v < lo || (v == lo && !(flags & AVL_RANGE_LO_INCLUSIVE)))) {
+						continue;
+					}
+					if (!(flags & AVL_RANGE_HI_UNBOUNDED) &&
+					    (hi < v || (v == hi && !(flags & AVL_RANGE_HI_INCLUSIVE)))) {
+						continue;
+					}
+					expected[count++] = v;
+				}
+
+				struct collected collected = {.count = 0, .limit = -1};
+				ck_assert(avl_tree_range(tree, (void *)lo, (void *)hi, flags, _collect, &collected) == 0);
+				ck_assert(collected.count == count);
+				for (int i = 0; i < count; ++i) {
+					ck_assert(collected.values[i] == expected[i]);
+				}
+
+				collected.count = 0;
+				ck_assert(
+				    avl_tree_range_reverse(tree, (void *)lo, (void *)hi, flags, _collect, &collected) == 0);
+				ck_assert(collected.count == count);
+				for (int i = 0; i < count; ++i) {
+					ck_assert(collected.values[i] == expected[count - 1 - i]);
+				}
+			}
+		}
+	}
+
+	free_tree(tree);
+}
+
+END_TEST
+
+START_TEST(test_range_stop) {
+	struct avl_tree *tree = _create_even_tree(AVL_TREE_PERSISTENT);
+
+	uint32_t flags = AVL_RANGE_LO_INCLUSIVE;
+	struct collected collected = {.count = 0, .limit = 3};
+	ck_assert(avl_tree_range(tree, (void *)10, (void *)100, flags, _collect, &collected) == -2);
+	ck_assert(collected.count == 3);
+	ck_assert(collected.values[0] == 10);
+	ck_assert(collected.values[2] == 14);
+
+	collected.count = 0;
+	ck_assert(
+	    avl_tree_range_reverse(tree, (void *)10, (void *)100, flags, _collect, &collected) == -2);
+	ck_assert(collected.count == 3);
+	ck_assert(collected.values[0] == 98);
+	ck_assert(collected.values[2] == 94);
+
+	free_tree(tree);
+}
+
+END_TEST
+
+void _check_statistics(struct avl_tree *tree, bool const *present) {
+	check_tree(tree);
+	check_sizes(tree->root);
+
+	// Compare against counting the present values directly
+	size_t rank = 0;
+	for (int64_t v = 0; v < NUM_VALUES; ++v) {
+		size_t tree_rank;
+		ck_assert(avl_tree_rank(tree, (void *)v, &tree_rank) == present[v]);
+		ck_assert(tree_rank == rank);
+
+		if (present[v]) {
+			void const *node_value;
+			void const *node_data;
+			ck_assert(avl_tree_select(tree, rank, &node_value, &node_data) == true);
+			ck_assert((int64_t)node_value == v);
+			ck_assert((int64_t)node_data == v + 1);
+			++rank;
+		}
+	}
+
+	void const *node_value;
+	void const *node_data;
+	ck_assert(avl_tree_select(tree, rank, &node_value, &node_data) == false);
+
+	size_t count;
+	uint32_t flags = AVL_RANGE_LO_UNBOUNDED | AVL_RANGE_HI_UNBOUNDED;
+	ck_assert(avl_tree_count_range(tree, NULL, NULL, flags, &count) == 0);
+	ck_assert(count == rank);
+}
+
+void _check_order_statistics(uint32_t flags) {
+	struct avl_tree *tree = NULL;
+	ck_assert(avl_tree_create_flags(&tree, int64_t_cmp, flags | AVL_TREE_ORDER_STATISTICS) == 0);
+
+	bool present[NUM_VALUES] = {false};
+
+	for (int round = 0; round < 10; ++round) {
+		for (int i = 0; i < NUM_VALUES / 2; ++i) {
+			int64_t v = rand() % NUM_VALUES;
+			if (rand() % 2) {
+				ck_assert(avl_tree_add(tree, (void *)v, (void *)(v + 1)) == !present[v]);
+				present[v] = true;
+			} else {
+				void const *node_value;
+				void const *node_data;
+				ck_assert(avl_tree_remove(tree, (void *)v, &node_value, &node_data) == present[v]);
+				present[v] = false;
+			}
+		}
+
+		_check_statistics(tree, present);
+	}
+
+	if (flags & AVL_TREE_NODE_POOL) {
+		avl_tree_free(&tree, NULL, NULL);
+	} else {
+		free_tree(tree);
+	}
+}
+
+START_TEST(test_order_statistics) {
+	_check_order_statistics(0);
+	_check_order_statistics(AVL_TREE_PERSISTENT);
+	_check_order_statistics(AVL_TREE_NODE_POOL);
+}
+
+END_TEST
+
+START_TEST(test_order_statistics_build) {
+	struct avl_tree *tree = NULL;
+	ck_assert(avl_tree_create_flags(&tree, int64_t_cmp, AVL_TREE_ORDER_STATISTICS) == 0);
+
+	void const *values[NUM_VALUES];
+	void const *data[NUM_VALUES];
+	bool present[NUM_VALUES];
+	for (int64_t v = 0; v < NUM_VALUES; ++v) {
+		values[v] = (void *)v;
+		data[v] = (void *)(v + 1);
+		present[v] = true;
+	}
+	ck_assert(avl_tree_build_sorted(tree, values, data, NUM_VALUES) == 0);
+
+	_check_statistics(tree, present);
+
+	free_tree(tree);
+}
+
+END_TEST
+
+START_TEST(test_count_range) {
+	struct avl_tree *tree = _create_even_tree(AVL_TREE_ORDER_STATISTICS);
+
+	for (uint32_t flags = 0; flags < 16; ++flags) {
+		for (int64_t lo = -3; lo < 2 * NUM_VALUES + 3; lo += 37) {
+			for (int64_t hi = lo - 5; hi < 2 * NUM_VALUES + 3; hi += 41) {
+				// The range scan visits exactly the nodes that should be counted
+				struct collected collected = {.count = 0, .limit = -1};
+				avl_tree_range(tree, (void *)lo, (void *)hi, flags, _collect, &collected);
+
+				size_t count;
+				ck_assert(avl_tree_count_range(tree, (void *)lo, (void *)hi, flags, &count) == 0);
+				ck_assert(count == (size_t)collected.count);
+			}
+		}
+	}
+
+	free_tree(tree);
+}
+
+END_TEST
+
+START_TEST(test_order_statistics_disabled) {
+	struct avl_tree *tree = _create_even_tree(0);
+
+	size_t rank;
+	void const *node_value;
+	void const *node_data;
+	ck_assert(avl_tree_rank(tree, (void *)0, &rank) == -EINVAL);
+	ck_assert(avl_tree_select(tree, 0, &node_value, &node_data) == -EINVAL);
+	ck_assert(avl_tree_count_range(tree, (void *)0, (void *)10, 0, &rank) == -EINVAL);
+
+	free_tree(tree);
+}
+
+END_TEST
+
+START_TEST(test_order_statistics_overflow) {
+	// Trees that big do not fit in a test, so the root claims to hold as many entries as fit
+	struct avl_tree *tree = _create_even_tree(AVL_TREE_ORDER_STATISTICS);
+	uint32_t size = tree->root->size;
+	tree->root->size = UINT32_MAX;
+	ck_assert(avl_tree_add(tree, (void *)1, NULL) == -EOVERFLOW);
+	ck_assert(avl_tree_add(tree, (void *)0, NULL) == false);
+	tree->root->size = size;
+	ck_assert(avl_tree_add(tree, (void *)1, NULL) == true);
+
+	struct avl_tree *other = NULL;
+	ck_assert(avl_tree_create_flags(&other, int64_t_cmp, AVL_TREE_ORDER_STATISTICS) == 0);
+	ck_assert(avl_tree_add(other, (void *)(2 * NUM_VALUES), NULL) == true);
+
+	size = tree->root->size;
+	tree->root->size = UINT32_MAX;
+	ck_assert(avl_tree_join(tree, other) == -EOVERFLOW);
+	ck_assert(avl_tree_union(tree, other, NULL, NULL, NULL) == -EOVERFLOW);
+	ck_assert(other->root != NULL);
+	tree->root->size = size;
+	ck_assert(avl_tree_join(tree, other) == 0);
+	ck_assert(tree->root->size == NUM_VALUES + 2);
+
+	// Turned away before a single value is read
+	void const *values[1] = {NULL};
+	ck_assert(avl_tree_build_sorted(other, values, NULL, (size_t)UINT32_MAX + 1) == -EOVERFLOW);
+
+	free_tree(other);
+	free_tree(tree);
+}
+
+END_TEST
+
+START_TEST(test_neighbors) {
+	struct avl_tree *tree = _create_even_tree(0);
+
+	void const *node_value;
+	void const *node_data;
+	for (int64_t v = -2; v < 2 * NUM_VALUES + 2; ++v) {
+		int64_t last = 2 * (NUM_VALUES - 1);
+		bool even = (v & 1) == 0;
+
+		// The largest even value <= v
+		int64_t floor = even ? v : v - 1;
+		ck_assert(avl_tree_floor(tree, (void *)v, &node_value, &node_data) == (0 <= v));
+		if (0 <= v) {
+			ck_assert((int64_t)node_value == (floor < last ? floor : last));
+			ck_assert((int64_t)node_data == (int64_t)node_value + 1);
+		}
+
+		// The smallest even value >= v
+		int64_t ceiling = even ? v : v + 1;
+		ck_assert(avl_tree_ceiling(tree, (void *)v, &node_value, &node_data) == (v <= last));
+		if (v <= last) {
+			ck_assert((int64_t)node_value == (ceiling < 0 ? 0 : ceiling));
+			ck_assert((int64_t)node_data == (int64_t)node_value + 1);
+		}
+
+		ck_assert(avl_tree_lower_bound(tree, (void *)v, &node_value, &node_data) == (v <= last));
+		if (v <= last) {
+			ck_assert((int64_t)node_value == (ceiling < 0 ? 0 : ceiling));
+		}
+
+		// The smallest even value > v
+		int64_t upper = even ? v + 2 : v + 1;
+		ck_assert(avl_tree_upper_bound(tree, (void *)v, &node_value, &node_data) == (v < last));
+		if (v < last) {
+			ck_assert((int64_t)node_value == (upper < 0 ? 0 : upper));
+		}
+	}
+
+	free_tree(tree);
+}
+
+END_TEST
+
+void _check_extremes(struct avl_tree *tree, bool const *present) {
+	int64_t min = -1;
+	int64_t max = -1;
+	for (int64_t v = 0; v < NUM_VALUES; ++v) {
+		if (present[v]) {
+			min = min < 0 ? v : min;
+			max = v;
+		}
+	}
+
+	void const *node_value;
+	void const *node_data;
+	ck_assert(avl_tree_min(tree, &node_value, &node_data) == (0 <= min));
+	if (0 <= min) {
+		ck_assert((int64_t)node_value == min);
+		ck_assert((int64_t)node_data == min + 1);
+	}
+
+	ck_assert(avl_tree_max(tree, &node_value, &node_data) == (0 <= max));
+	if (0 <= max) {
+		ck_assert((int64_t)node_value == max);
+		ck_assert((int64_t)node_data == max + 1);
+	}
+}
+
+void _check_min_max(uint32_t flags) {
+	struct avl_tree *tree = NULL;
+	ck_assert(avl_tree_create_flags(&tree, int64_t_cmp, flags) == 0);
+
+	bool present[NUM_VALUES] = {false};
+	_check_extremes(tree, present);
+
+	// Small key space, so the extremes get removed and the tree emptied again and again
+	for (int i = 0; i < 20 * NUM_VALUES; ++i) {
+		int64_t v = rand() % (i < 10 * NUM_VALUES ? 8 : NUM_VALUES);
+		if (rand() % 2) {
+			ck_assert(avl_tree_add(tree, (void *)v, (void *)(v + 1)) == !present[v]);
+			present[v] = true;
+		} else {
+			void const *node_value;
+			void const *node_data;
+			ck_assert(avl_tree_remove(tree, (void *)v, &node_value, &node_data) == present[v]);
+			present[v] = false;
+		}
+
+		_check_extremes(tree, present);
+	}
+
+	free_tree(tree);
+}
+
+START_TEST(test_min_max) {
+	_check_min_max(0);
+	_check_min_max(AVL_TREE_PERSISTENT);
+}
+
+END_TEST
+
+START_TEST(test_min_max_build) {
+	struct avl_tree *tree = create_tree();
+
+	void const *values[NUM_VALUES];
+	for (int64_t v = 0; v < NUM_VALUES; ++v) {
+		values[v] = (void *)(v + 1);
+	}
+	ck_assert(avl_tree_build_sorted(tree, values, values, NUM_VALUES) == 0);
+
+	void const *node_value;
+	void const *node_data;
+	ck_assert(avl_tree_min(tree, &node_value, &node_data) == true);
+	ck_assert((int64_t)node_value == 1);
+	ck_assert(avl_tree_max(tree, &node_value, &node_data) == true);
+	ck_assert((int64_t)node_value == NUM_VALUES);
+
+	free_tree(tree);
+}
+
+END_TEST
+
+// Checks that the tree holds exactly the values lo, lo + step, ... below hi, with data one more
+void _check_contents(struct avl_tree *tree, int64_t lo, int64_t hi, int64_t step) {
+	check_tree(tree);
+	check_sizes(tree->root);
+
+	uint32_t flags = AVL_RANGE_LO_UNBOUNDED | AVL_RANGE_HI_UNBOUNDED;
+	struct collected collected = {.count = 0, .limit = -1};
+	ck_assert(avl_tree_range(tree, NULL, NULL, flags, _collect, &collected) == 0);
+
+	int count = 0;
+	for (int64_t v = lo; v < hi; v += step) {
+		ck_assert(collected.values[count++] == v);
+
+		void const *node_data;
+		ck_assert(avl_tree_get(tree, (void *)v, &node_data) == true);
+		ck_assert((int64_t)node_data == v + 1);
+	}
+	ck_assert(collected.count == count);
+
+	void const *node_value;
+	void const *node_data;
+	ck_assert(avl_tree_min(tree, &node_value, &node_data) == (count != 0));
+	ck_assert(count == 0 || (int64_t)node_value == lo);
+	ck_assert(avl_tree_max(tree, &node_value, &node_data) == (count != 0));
+	ck_assert(count == 0 || (int64_t)node_value == lo + (count - 1) * step);
+}
+
+START_TEST(test_split) {
+	int64_t const keys[] = {-5, 0, 1, 2, 501, 998, 1000, 1997, 1998, 1999, 5000};
+
+	for (size_t k = 0; k < sizeof(keys) / sizeof(*keys); ++k) {
+		struct avl_tree *tree = _create_even_tree(AVL_TREE_ORDER_STATISTICS);
+		int64_t key = keys[k];
+
+		struct avl_tree *left = NULL;
+		struct avl_tree *right = NULL;
+		ck_assert(avl_tree_split(tree, (void *)key, &left, &right) == 0);
+		ck_assert(tree->root == NULL);
+
+		// The first even value not below the key is where the right side starts
+		int64_t cut = key < 0 ? 0 : key > 2 * NUM_VALUES ? 2 * NUM_VALUES : (key + 1) / 2 * 2;
+		_check_contents(left, 0, cut, 2);
+		_check_contents(right, cut, 2 * NUM_VALUES, 2);
+
+		// Joining the halves again gives back the original tree
+		ck_assert(avl_tree_join(left, right) == 0);
+		ck_assert(right->root == NULL);
+		_check_contents(left, 0, 2 * NUM_VALUES, 2);
+
+		free_tree(tree);
+		free_tree(left);
+		free_tree(right);
+	}
+}
+
+END_TEST
+
+struct avl_tree *_create_run_tree(int64_t lo, int64_t hi) {
+	struct avl_tree *tree = NULL;
+	ck_assert(avl_tree_create_flags(&tree, int64_t_cmp, AVL_TREE_ORDER_STATISTICS) == 0);
+
+	for (int64_t v = lo; v < hi; ++v) {
+		ck_assert(avl_tree_add(tree, (void *)v, (void *)(v + 1)) == true);
+	}
+
+	return tree;
+}
+
+START_TEST(test_join) {
+	// Sizes on both sides, including very different heights in either direction; one more value
+	// is added after the first join, and all of them have to fit in struct collected
+	int64_t const sizes[][2] = {{0, 0},   {0, 5},   {5, 0},   {1, 1},    {1, 900},
+	                            {900, 1}, {3, 700}, {700, 3}, {37, 500}, {600, 390}};
+
+	for (size_t s = 0; s < sizeof(sizes) / sizeof(*sizes); ++s) {
+		int64_t middle = sizes[s][0];
+		int64_t end = middle + sizes[s][1];
+		struct avl_tree *left = _create_run_tree(0, middle);
+		struct avl_tree *right = _create_run_tree(middle, end);
+
+		ck_assert(avl_tree_join(left, right) == 0);
+		_check_contents(left, 0, end, 1);
+		_check_contents(right, 0, 0, 1);
+
+		// Trees emptied by a join can be filled again
+		ck_assert(avl_tree_add(right, (void *)end, (void *)(end + 1)) == true);
+		ck_assert(avl_tree_join(left, right) == 0);
+		_check_contents(left, 0, end + 1, 1);
+
+		free_tree(left);
+		free_tree(right);
+	}
+}
+
+END_TEST
+
+START_TEST(test_split_join_invalid) {
+	struct avl_tree *left = _create_run_tree(0, 10);
+	struct avl_tree *right = _create_run_tree(9, 20);
+
+	// Overlapping trees are left as they were
+	ck_assert(avl_tree_join(left, right) == -EINVAL);
+	ck_assert(avl_tree_join(left, left) == -EINVAL);
+	_check_contents(left, 0, 10, 1);
+	_check_contents(right, 9, 20, 1);
+	free_tree(right);
+
+	struct avl_tree *plain = NULL;
+	ck_assert(avl_tree_create(&plain, int64_t_cmp) == 0);
+	ck_assert(avl_tree_join(left, plain) == -EINVAL);
+	free_tree(plain);
+	free_tree(left);
+
+	struct avl_tree *persistent = NULL;
+	ck_assert(avl_tree_create_flags(&persistent, int64_t_cmp, AVL_TREE_PERSISTENT) == 0);
+	ck_assert(avl_tree_add(persistent, (void *)1, (void *)2) == true);
+	left = NULL;
+	right = NULL;
+	ck_assert(avl_tree_split(persistent, (void *)1, &left, &right) == -EINVAL);
+	ck_assert(left == NULL);
+	ck_assert(right == NULL);
+	free_tree(persistent);
+}
+
+END_TEST
+
+Suite *test_suite() {
+	Suite *suite = suite_create("test_suite");
+
+	TCase *tcase = tcase_create("case");
+
+	tcase_add_test(tcase, test_cursor_empty);
+	tcase_add_test(tcase, test_cursor_forward_backward);
+	tcase_add_test(tcase, test_cursor_seek);
+	tcase_add_test(tcase, test_cursor_nested);
+	tcase_add_test(tcase, test_cursor_persistent);
+
+	tcase_add_test(tcase, test_range);
+	tcase_add_test(tcase, test_range_stop);
+
+	tcase_add_test(tcase, test_order_statistics);
+	tcase_add_test(tcase, test_order_statistics_build);
+	tcase_add_test(tcase, test_count_range);
+	tcase_add_test(tcase, test_order_statistics_disabled);
+	tcase_add_test(tcase, test_order_statistics_overflow);
+
+	tcase_add_test(tcase, test_neighbors);
+	tcase_add_test(tcase, test_min_max);
+	tcase_add_test(tcase, test_min_max_build);
+
+	tcase_add_test(tcase, test_split);
+	tcase_add_test(tcase, test_join);
+	tcase_add_test(tcase, test_split_join_invalid);
+
+	suite_add_tcase(suite, tcase);
+
+	return suite;
+}
+
+int main() {
+	return run(test_suite());
+}
@@ -0,0 +1,207 @@
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "avl_test_utils.h"
+#include "avl_workers.h"
+
+// Tall enough that the walks are spread over the workers
+#define NUM_VALUES 100000
+
+struct avl_tree *_create_filled_tree(uint32_t flags) {
+	struct avl_tree *tree = NULL;
+	ck_assert(avl_tree_create_flags(&tree, int64_t_cmp, flags) == 0);
+
+	for (int64_t i = 0; i < NUM_VALUES; ++i) {
+		int64_t v = (i * 7919) % NUM_VALUES;
+		ck_assert(avl_tree_add(tree, (void *)v, (void *)(v + 1)) == true);
+	}
+
+	return tree;
+}
+
+struct visits {
+	_Atomic int64_t sum;
+	_Atomic int count;
+	// Stop once this value is visited, or never if negative
+	int64_t stop;
+};
+
+int _visit(struct avl_node const *node, void *arg) {
+	struct visits *visits = arg;
+
+	atomic_fetch_add(&visits->sum, (int64_t)avl_node_data(node));
+	atomic_fetch_add(&visits->count, 1);
+
+	return (int64_t)avl_node_value(node) == visits->stop ? -ECANCELED : 0;
+}
+
+// Runs of consecutive values: the reduction only stays one run if it is combined in order
+struct run {
+	int64_t first;
+	int64_t last;
+	int64_t count;
+	bool ordered;
+};
+
+void _run_init(void *accumulator, void *arg __attribute__((unused))) {
+	*(struct run *)accumulator = (struct run){.first = -1, .last = -1, .count = 0, .ordered = true};
+}
+
+void _run_combine(void *accumulator, void const *other, void *arg __attribute__((unused))) {
+	struct run *run = accumulator;
+	struct run const *next = other;
+
+	if (next->count == 0) {
+		return;
+	}
+	if (run->count == 0) {
+		*run = *next;
+		return;
+	}
+
+	run->ordered = run->ordered && next->ordered && run->last + 1 == next->first;
+	run->last = next->last;
+	run->count += next->count;
+}
+
+void _run_accumulate(void *accumulator, struct avl_node const *node, void *arg) {
+	struct run one;
+	_run_init(&one, arg);
+	one.first = (int64_t)avl_node_value(node);
+	one.last = one.first;
+	one.count = 1;
+
+	_run_combine(accumulator, &one, arg);
+}
+
+struct avl_reduce const run_reduce = {
+    .size = sizeof(struct run),
+    .init_func = _run_init,
+    .accumulate_func = _run_accumulate,
+    .combine_func = _run_combine,
+    .arg = NULL,
+};
+
+void _check_parallel(struct avl_workers *workers, uint32_t flags) {
+	struct avl_tree *tree = _create_filled_tree(flags);
+
+	// Every node is visited exactly once
+	struct visits visits = {.stop = -1};
+	atomic_init(&visits.sum, 0);
+	atomic_init(&visits.count, 0);
+	ck_assert(avl_tree_parallel_for_each(tree, workers, _visit, &visits) == 0);
+	ck_assert(visits.count == NUM_VALUES);
+	ck_assert(visits.sum == (int64_t)NUM_VALUES * (NUM_VALUES + 1) / 2);
+
+	// A negative return stops the walk and comes back out
+	visits.stop = NUM_VALUES / 3;
+	atomic_store(&visits.count, 0);
+	ck_assert(avl_tree_parallel_for_each(tree, workers, _visit, &visits) == -ECANCELED);
+	ck_assert(visits.count <= NUM_VALUES);
+
+	struct run run;
+	ck_assert(avl_tree_parallel_reduce(tree, workers, &run_reduce, &run) == 0);
+	ck_assert(run.ordered);
+	ck_assert(run.first == 0);
+	ck_assert(run.last == NUM_VALUES - 1);
+	ck_assert(run.count == NUM_VALUES);
+
+	if (flags & AVL_TREE_NODE_POOL) {
+		avl_tree_free(&tree, NULL, NULL);
+	} else {
+		free_tree(tree);
+	}
+
+	// Empty trees reduce to the identity
+	tree = NULL;
+	ck_assert(avl_tree_create_flags(&tree, int64_t_cmp, flags) == 0);
+	ck_assert(avl_tree_parallel_reduce(tree, workers, &run_reduce, &run) == 0);
+	ck_assert(run.count == 0);
+	avl_tree_free(&tree, NULL, NULL);
+}
+
+START_TEST(test_parallel_sequential) {
+	_check_parallel(NULL, 0);
+}
+
+END_TEST
+
+START_TEST(test_parallel) {
+	struct avl_workers *workers = NULL;
+	ck_assert(avl_workers_create(&workers, 4) == 0);
+
+	_check_parallel(workers, 0);
+	_check_parallel(workers, AVL_TREE_PERSISTENT);
+	_check_parallel(workers, AVL_TREE_NODE_POOL);
+
+	avl_workers_free(&workers);
+}
+
+END_TEST
+
+struct fib {
+	struct avl_task task;
+	struct avl_workers *workers;
+	int n;
+	int64_t result;
+};
+
+void _fib(void *arg) {
+	struct fib *fib = arg;
+
+	if (fib->n < 2) {
+		fib->result = fib->n;
+		return;
+	}
+
+	// Deeply nested forks and joins must neither deadlock nor lose tasks
+	struct fib left = {.task = {.func = _fib}, .workers = fib->workers, .n = fib->n - 1};
+	struct fib right = {.task = {.func = _fib}, .workers = fib->workers, .n = fib->n - 2};
+	left.task.arg = &left;
+	right.task.arg = &right;
+
+	avl_workers_fork(fib->workers, &left.task);
+	avl_workers_fork(fib->workers, &right.task);
+	avl_workers_join(fib->workers, &right.task);
+	avl_workers_join(fib->workers, &left.task);
+
+	fib->result = left.result + right.result;
+}
+
+START_TEST(test_workers) {
+	for (int count = 0; count <= 4; count += 2) {
+		struct avl_workers *workers = NULL;
+		ck_assert(avl_workers_create(&workers, count) == 0);
+		ck_assert(workers->count == count);
+
+		struct fib fib = {.task = {.func = _fib}, .workers = workers, .n = 20};
+		_fib(&fib);
+		ck_assert(fib.result == 6765);
+
+		avl_workers_free(&workers);
+		ck_assert(workers == NULL);
+	}
+}
+
+END_TEST
+
+Suite *test_suite() {
+	Suite *suite = suite_create("test_suite");
+
+	TCase *tcase = tcase_create("case");
+	tcase_set_timeout(tcase, 60);
+
+	tcase_add_test(tcase, test_parallel_sequential);
+	tcase_add_test(tcase, test_parallel);
+	tcase_add_test(tcase, test_workers);
+
+	suite_add_tcase(suite, tcase);
+
+	return suite;
+}
+
+int main() {
+	return run(test_suite());
+}
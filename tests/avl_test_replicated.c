@@ -0,0 +1,245 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "avl_replicated.h"
+#include "avl_test_utils.h"
+
+#define NUM_VALUES 10000
+#define NUM_REPLICAS 4
+#define NUM_THREADS 8
+
+void _check_replicated(struct avl_replicated_tree *tree, bool const *present) {
+	ck_assert(avl_replicated_synchronize(tree) == 0);
+
+	// Every replica, seen through its own threads, holds exactly the present values
+	for (int node = 0; node < NUM_REPLICAS; ++node) {
+		avl_replicated_set_node(node);
+		check_tree(tree->replicas[node].tree);
+
+		static struct collected_nodes collected;
+		collected.count = 0;
+		ck_assert(avl_replicated_traverse(tree, collect_node, &collected) == 0);
+
+		int count = 0;
+		for (int64_t v = 0; v < NUM_VALUES; ++v) {
+			void const *node_data;
+			ck_assert(avl_replicated_get(tree, (void *)v, &node_data) == present[v]);
+			if (present[v]) {
+				ck_assert((int64_t)node_data == v + 1);
+				ck_assert(collected.values[count++] == v);
+			}
+		}
+		ck_assert(collected.count == count);
+	}
+
+	avl_replicated_set_node(-1);
+}
+
+START_TEST(test_replicated) {
+	struct avl_replicated_tree *tree = NULL;
+	ck_assert(avl_replicated_create(&tree, int64_t_cmp, 0, NUM_REPLICAS) == 0);
+	ck_assert(tree->count == NUM_REPLICAS);
+
+	bool present[NUM_VALUES] = {false};
+
+	for (int round = 0; round < 10; ++round) {
+		for (int i = 0; i < NUM_VALUES; ++i) {
+			// Hop between replicas, so each one has to catch up on what the others did
+			avl_replicated_set_node(rand() % NUM_REPLICAS);
+
+			int64_t v = rand() % NUM_VALUES;
+			if (rand() % 3) {
+				ck_assert(avl_replicated_add(tree, (void *)v, (void *)(v + 1)) == !present[v]);
+				present[v] = true;
+			} else {
+				void const *node_value;
+				void const *node_data;
+				ck_assert(avl_replicated_remove(tree, (void *)v, &node_value, &node_data) == present[v]);
+				ck_assert(!present[v] || ((int64_t)node_value == v && (int64_t)node_data == v + 1));
+				present[v] = false;
+			}
+		}
+
+		_check_replicated(tree, present);
+	}
+
+	int count = 0;
+	for (int64_t v = 0; v < NUM_VALUES; ++v) {
+		count += present[v];
+	}
+
+	// Entries are handed over once, not once per replica
+	static struct collected_nodes collected;
+	collected.count = 0;
+	avl_replicated_free(&tree, collect_node, &collected);
+	ck_assert(tree == NULL);
+	ck_assert(collected.count == count);
+}
+
+END_TEST
+
+START_TEST(test_replicated_log_wrap) {
+	struct avl_replicated_tree *tree = NULL;
+	ck_assert(avl_replicated_create(&tree, int64_t_cmp, AVL_TREE_NODE_POOL, NUM_REPLICAS) == 0);
+
+	// One replica does all the writing, several logs' worth, while the others sit idle
+	bool present[NUM_VALUES] = {false};
+	avl_replicated_set_node(1);
+	for (int64_t v = 0; v < NUM_VALUES; ++v) {
+		ck_assert(avl_replicated_add(tree, (void *)v, (void *)(v + 1)) == true);
+		present[v] = true;
+	}
+	for (int64_t v = 0; v < NUM_VALUES; v += 3) {
+		void const *node_value;
+		void const *node_data;
+		ck_assert(avl_replicated_remove(tree, (void *)v, &node_value, &node_data) == true);
+		present[v] = false;
+	}
+	ck_assert(atomic_load(&tree->tail) > 2 * AVL_REPLICATED_LOG);
+
+	_check_replicated(tree, present);
+
+	avl_replicated_free(&tree, NULL, NULL);
+
+	// Replicas have to be able to free their own nodes
+	ck_assert(avl_replicated_create(&tree, int64_t_cmp, AVL_TREE_INTRUSIVE, 2) == -EINVAL);
+	ck_assert(tree == NULL);
+
+	// Without a count, there is one replica per NUMA node, and always at least one
+	ck_assert(avl_replicated_create(&tree, int64_t_cmp, 0, 0) == 0);
+	ck_assert(tree->count >= 1);
+	ck_assert(avl_replicated_add(tree, (void *)1, (void *)2) == true);
+	avl_replicated_free(&tree, NULL, NULL);
+}
+
+END_TEST
+
+START_TEST(test_replicated_failure) {
+	struct avl_replicated_tree *tree = NULL;
+	uint32_t flags = AVL_TREE_ORDER_STATISTICS;
+	ck_assert(avl_replicated_create(&tree, int64_t_cmp, flags, NUM_REPLICAS) == 0);
+
+	bool present[NUM_VALUES] = {false};
+	avl_replicated_set_node(0);
+	ck_assert(avl_replicated_add(tree, (void *)1, (void *)2) == true);
+	present[1] = true;
+
+	// Trees that big do not fit in a test, so one replica's root claims to be as large as they get
+	avl_replicated_set_node(1);
+	void const *node_data;
+	ck_assert(avl_replicated_get(tree, (void *)1, &node_data) == true);
+	struct avl_node *root = tree->replicas[1].tree->root;
+	root->size = UINT32_MAX;
+
+	// The add fails where it is made, and so never reaches the log or the other replicas
+	uint64_t tail = atomic_load(&tree->tail);
+	ck_assert(avl_replicated_add(tree, (void *)3, (void *)4) == -EOVERFLOW);
+	ck_assert(atomic_load(&tree->tail) == tail);
+	root->size = 1;
+
+	avl_replicated_set_node(2);
+	ck_assert(avl_replicated_add(tree, (void *)5, (void *)6) == true);
+	present[5] = true;
+
+	_check_replicated(tree, present);
+
+	avl_replicated_free(&tree, NULL, NULL);
+}
+
+END_TEST
+
+struct writer {
+	pthread_t thread;
+	struct avl_replicated_tree *tree;
+	int64_t first;
+};
+
+void *_write(void *arg) {
+	struct writer *writer = arg;
+
+	// Threads share replicas two by two; each owns the values congruent to its first one
+	avl_replicated_set_node(writer->first % NUM_REPLICAS);
+
+	void const *node_value;
+	void const *node_data;
+	for (int round = 0; round < 4; ++round) {
+		for (int64_t v = writer->first; v < NUM_VALUES; v += NUM_THREADS) {
+			ck_assert(avl_replicated_add(writer->tree, (void *)v, (void *)(v + 1)) == true);
+		}
+		for (int64_t v = writer->first; v < NUM_VALUES; v += NUM_THREADS) {
+			ck_assert(avl_replicated_get(writer->tree, (void *)v, &node_data) == true);
+			ck_assert((int64_t)node_data == v + 1);
+		}
+		for (int64_t v = writer->first; v < NUM_VALUES; v += 2 * NUM_THREADS) {
+			ck_assert(avl_replicated_remove(writer->tree, (void *)v, &node_value, &node_data) == true);
+			ck_assert(avl_replicated_get(writer->tree, (void *)v, &node_data) == false);
+		}
+		for (int64_t v = writer->first; v < NUM_VALUES; v += NUM_THREADS) {
+			bool kept = (v - writer->first) % (2 * NUM_THREADS) != 0;
+			ck_assert(avl_replicated_remove(writer->tree, (void *)v, &node_value, &node_data) == kept);
+		}
+	}
+	for (int64_t v = writer->first; v < NUM_VALUES; v += 2 * NUM_THREADS) {
+		ck_assert(avl_replicated_add(writer->tree, (void *)v, (void *)(v + 1)) == true);
+	}
+
+	return NULL;
+}
+
+START_TEST(test_replicated_concurrent) {
+	struct avl_replicated_tree *tree = NULL;
+	ck_assert(avl_replicated_create(&tree, int64_t_cmp, 0, NUM_REPLICAS) == 0);
+
+	static struct writer writers[NUM_THREADS];
+	for (int i = 0; i < NUM_THREADS; ++i) {
+		writers[i] = (struct writer){.tree = tree, .first = i};
+		ck_assert(pthread_create(&writers[i].thread, NULL, _write, &writers[i]) == 0);
+	}
+
+	// Meanwhile, walks of a replica that is being caught up only ever go forward
+	for (int i = 0; i < 20; ++i) {
+		avl_replicated_set_node(i);
+		static struct collected_nodes collected;
+		collected.count = 0;
+		ck_assert(avl_replicated_traverse(tree, collect_node, &collected) == 0);
+		for (int j = 1; j < collected.count; ++j) {
+			ck_assert(collected.values[j - 1] < collected.values[j]);
+		}
+	}
+
+	for (int i = 0; i < NUM_THREADS; ++i) {
+		pthread_join(writers[i].thread, NULL);
+	}
+
+	bool present[NUM_VALUES] = {false};
+	for (int64_t v = 0; v < NUM_VALUES; ++v) {
+		present[v] = v % (2 * NUM_THREADS) < NUM_THREADS;
+	}
+	_check_replicated(tree, present);
+
+	avl_replicated_free(&tree, NULL, NULL);
+}
+
+END_TEST
+
+Suite *test_suite() {
+	Suite *suite = suite_create("test_suite");
+
+	TCase *tcase = tcase_create("case");
+	tcase_set_timeout(tcase, 60);
+
+	tcase_add_test(tcase, test_replicated);
+	tcase_add_test(tcase, test_replicated_log_wrap);
+	tcase_add_test(tcase, test_replicated_failure);
+	tcase_add_test(tcase, test_replicated_concurrent);
+
+	suite_add_tcase(suite, tcase);
+
+	return suite;
+}
+
+int main() {
+	return run(test_suite());
+}
@@ -0,0 +1,249 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "avl_test_utils.h"
+#include "avl_workers.h"
+
+// Large enough that both inputs are tall enough to be split across workers
+#define UNIVERSE 20000
+
+enum set_kind { UNION, INTERSECTION, DIFFERENCE };
+
+// Which values were handed to the drop function, and with which data
+struct dropped {
+	int64_t data[UNIVERSE];
+	int count;
+};
+
+int _record_drop(struct avl_node const *node, void *arg) {
+	struct dropped *dropped = arg;
+
+	int64_t value = (int64_t)avl_node_value(node);
+	ck_assert(dropped->data[value] == 0);
+	dropped->data[value] = (int64_t)avl_node_data(node);
+	++dropped->count;
+
+	return 0;
+}
+
+// The values present in the tree have data value + offset, and nothing else is there
+void _check_contents(struct avl_tree *tree, bool const *present, int64_t const *offsets) {
+	check_tree(tree);
+	check_sizes(tree->root);
+
+	int64_t min = -1;
+	int64_t max = -1;
+	for (int64_t v = 0; v < UNIVERSE; ++v) {
+		void const *node_data;
+		ck_assert(avl_tree_get(tree, (void *)v, &node_data) == present[v]);
+		if (present[v]) {
+			ck_assert((int64_t)node_data == v + offsets[v]);
+			min = min < 0 ? v : min;
+			max = v;
+		}
+	}
+
+	void const *node_value;
+	void const *node_data;
+	ck_assert(avl_tree_min(tree, &node_value, &node_data) == (min >= 0));
+	ck_assert(min < 0 || (int64_t)node_value == min);
+	ck_assert(avl_tree_max(tree, &node_value, &node_data) == (max >= 0));
+	ck_assert(max < 0 || (int64_t)node_value == max);
+}
+
+struct avl_tree *_create_set(bool const *present, int64_t offset) {
+	struct avl_tree *tree = NULL;
+	ck_assert(avl_tree_create_flags(&tree, int64_t_cmp, AVL_TREE_ORDER_STATISTICS) == 0);
+
+	for (int64_t v = 0; v < UNIVERSE; ++v) {
+		if (present[v]) {
+			ck_assert(avl_tree_add(tree, (void *)v, (void *)(v + offset)) == true);
+		}
+	}
+
+	return tree;
+}
+
+void _check_set_op(enum set_kind kind, int a_percent, int b_percent, struct avl_workers *workers) {
+	static bool in_a[UNIVERSE];
+	static bool in_b[UNIVERSE];
+	static bool expected[UNIVERSE];
+	static int64_t offsets[UNIVERSE];
+	static struct dropped dropped;
+
+	for (int64_t v = 0; v < UNIVERSE; ++v) {
+		in_a[v] = rand() % 100 < a_percent;
+		in_b[v] = rand() % 100 < b_percent;
+	}
+
+	// Entries of the first tree have data value + 1, those of the second value + 2
+	struct avl_tree *a = _create_set(in_a, 1);
+	struct avl_tree *b = _create_set(in_b, 2);
+
+	memset(&dropped, 0, sizeof(dropped));
+	int dropped_count = 0;
+	switch (kind) {
+		case UNION:
+			ck_assert(avl_tree_union(a, b, workers, _record_drop, &dropped) == 0);
+			break;
+		case INTERSECTION:
+			ck_assert(avl_tree_intersect(a, b, workers, _record_drop, &dropped) == 0);
+			break;
+		case DIFFERENCE:
+			ck_assert(avl_tree_difference(a, b, workers, _record_drop, &dropped) == 0);
+			break;
+	}
+
+	for (int64_t v = 0; v < UNIVERSE; ++v) {
+		switch (kind) {
+			case UNION:
+				// The first tree keeps its own entry, so the second one's copy is dropped
+				expected[v] = in_a[v] || in_b[v];
+				offsets[v] = in_a[v] ? 1 : 2;
+				ck_assert(dropped.data[v] == (in_a[v] && in_b[v] ? v + 2 : 0));
+				break;
+			case INTERSECTION:
+				expected[v] = in_a[v] && in_b[v];
+				offsets[v] = 1;
+				ck_assert(dropped.data[v] == (in_a[v] && !in_b[v] ? v + 1 : 0));
+				break;
+			case DIFFERENCE:
+				expected[v] = in_a[v] && !in_b[v];
+				offsets[v] = 1;
+				ck_assert(dropped.data[v] == (in_a[v] && in_b[v] ? v + 1 : 0));
+				break;
+		}
+		dropped_count += dropped.data[v] != 0;
+	}
+	ck_assert(dropped.count == dropped_count);
+
+	_check_contents(a, expected, offsets);
+
+	// Only a union takes anything out of the second tree
+	for (int64_t v = 0; v < UNIVERSE; ++v) {
+		offsets[v] = 2;
+	}
+	if (kind == UNION) {
+		ck_assert(b->root == NULL);
+	} else {
+		_check_contents(b, in_b, offsets);
+	}
+
+	free_tree(a);
+	free_tree(b);
+}
+
+void _check_set_ops(struct avl_workers *workers) {
+	// Similar sizes, very different sizes either way, and empty inputs
+	int const percents[][2] = {{50, 50}, {90, 1}, {1, 90}, {0, 50}, {50, 0}, {100, 100}};
+
+	for (size_t i = 0; i < sizeof(percents) / sizeof(*percents); ++i) {
+		for (enum set_kind kind = UNION; kind <= DIFFERENCE; ++kind) {
+			_check_set_op(kind, percents[i][0], percents[i][1], workers);
+		}
+	}
+}
+
+START_TEST(test_set_ops) {
+	_check_set_ops(NULL);
+}
+
+END_TEST
+
+START_TEST(test_set_ops_parallel) {
+	struct avl_workers *workers = NULL;
+	ck_assert(avl_workers_create(&workers, 4) == 0);
+
+	_check_set_ops(workers);
+
+	avl_workers_free(&workers);
+	ck_assert(workers == NULL);
+}
+
+END_TEST
+
+struct record {
+	int64_t key;
+	bool dropped;
+	struct avl_node node;
+};
+
+int _record_dropped(struct avl_node const *node, void *arg __attribute__((unused))) {
+	avl_container_of(node, struct record, node)->dropped = true;
+	return 0;
+}
+
+START_TEST(test_set_ops_intrusive) {
+	static struct record records[2][100];
+
+	struct avl_tree *trees[2] = {NULL, NULL};
+	for (int t = 0; t < 2; ++t) {
+		ck_assert(avl_tree_create_flags(&trees[t], int64_t_cmp, AVL_TREE_INTRUSIVE) == 0);
+
+		// The first tree holds the multiples of 2, the second those of 3
+		for (int i = 0; i < 100; ++i) {
+			struct record *record = &records[t][i];
+			record->key = (t + 2) * i;
+			record->dropped = false;
+			ck_assert(avl_tree_link(trees[t], &record->node, (void *)record->key, record) == true);
+		}
+	}
+
+	// The records of the second tree that were also in the first are handed back
+	ck_assert(avl_tree_union(trees[0], trees[1], NULL, _record_dropped, NULL) == 0);
+	check_tree(trees[0]);
+	for (int i = 0; i < 100; ++i) {
+		ck_assert(!records[0][i].dropped);
+		ck_assert(records[1][i].dropped == (records[1][i].key < 200 && records[1][i].key % 2 == 0));
+	}
+
+	avl_tree_free(&trees[0], NULL, NULL);
+	avl_tree_free(&trees[1], NULL, NULL);
+}
+
+END_TEST
+
+START_TEST(test_set_ops_invalid) {
+	struct avl_tree *tree = create_tree();
+	struct avl_tree *other = NULL;
+	ck_assert(avl_tree_create_flags(&other, int64_t_cmp, AVL_TREE_ORDER_STATISTICS) == 0);
+
+	// Mismatched flags, the same tree twice, and trees that cannot give up their nodes
+	ck_assert(avl_tree_union(tree, other, NULL, NULL, NULL) == -EINVAL);
+	ck_assert(avl_tree_intersect(tree, tree, NULL, NULL, NULL) == -EINVAL);
+	free_tree(other);
+
+	other = NULL;
+	ck_assert(avl_tree_create_flags(&other, int64_t_cmp, AVL_TREE_NODE_POOL) == 0);
+	struct avl_tree *pooled = NULL;
+	ck_assert(avl_tree_create_flags(&pooled, int64_t_cmp, AVL_TREE_NODE_POOL) == 0);
+	ck_assert(avl_tree_difference(pooled, other, NULL, NULL, NULL) == -EINVAL);
+	avl_tree_free(&pooled, NULL, NULL);
+	avl_tree_free(&other, NULL, NULL);
+
+	free_tree(tree);
+}
+
+END_TEST
+
+Suite *test_suite() {
+	Suite *suite = suite_create("test_suite");
+
+	TCase *tcase = tcase_create("case");
+	tcase_set_timeout(tcase, 60);
+
+	tcase_add_test(tcase, test_set_ops);
+	tcase_add_test(tcase, test_set_ops_parallel);
+	tcase_add_test(tcase, test_set_ops_intrusive);
+	tcase_add_test(tcase, test_set_ops_invalid);
+
+	suite_add_tcase(suite, tcase);
+
+	return suite;
+}
+
+int main() {
+	return run(test_suite());
+}
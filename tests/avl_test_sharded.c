@@ -0,0 +1,342 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "avl_sharded.h"
+#include "avl_test_utils.h"
+
+#define NUM_VALUES 10000
+#define NUM_SHARDS 8
+#define NUM_THREADS 4
+
+struct avl_sharded_tree *_create_sharded(uint32_t flags) {
+	// Shards split 0 .. NUM_VALUES evenly to begin with
+	void const *bounds[NUM_SHARDS - 1];
+	for (int i = 0; i < NUM_SHARDS - 1; ++i) {
+		bounds[i] = (void *)(int64_t)((i + 1) * NUM_VALUES / NUM_SHARDS);
+	}
+
+	struct avl_sharded_tree *tree = NULL;
+	ck_assert(
+	    avl_sharded_create(&tree, int64_t_cmp, flags, bounds, NUM_SHARDS, NULL, NULL, NULL) == 0);
+
+	return tree;
+}
+
+void _check_sharded(struct avl_sharded_tree *tree, bool const *present) {
+	for (size_t i = 0; i < tree->count; ++i) {
+		check_tree(tree->shards[i].tree);
+	}
+
+	// Every value sits in the shard its boundaries say
+	for (size_t i = 0; i < tree->count; ++i) {
+		struct collected_nodes collected = {.count = 0};
+		avl_tree_traverse(tree->shards[i].tree, NULL, NULL, collect_node, &collected, NULL, NULL);
+		for (int j = 0; j < collected.count; ++j) {
+			ck_assert(i == 0 || (int64_t)tree->bounds[i - 1] <= collected.values[j]);
+			ck_assert(i + 1 == tree->count || collected.values[j] < (int64_t)tree->bounds[i]);
+		}
+	}
+
+	// Walking every shard in order gives exactly the present values
+	static struct collected_nodes collected;
+	collected.count = 0;
+	ck_assert(avl_sharded_traverse(tree, collect_node, &collected) == 0);
+
+	int count = 0;
+	for (int64_t v = 0; v < NUM_VALUES; ++v) {
+		void const *node_data;
+		ck_assert(avl_sharded_get(tree, (void *)v, &node_data) == present[v]);
+		if (present[v]) {
+			ck_assert((int64_t)node_data == v + 1);
+			ck_assert(collected.values[count++] == v);
+		}
+	}
+	ck_assert(collected.count == count);
+}
+
+START_TEST(test_sharded) {
+	struct avl_sharded_tree *tree = _create_sharded(0);
+
+	bool present[NUM_VALUES] = {false};
+
+	for (int round = 0; round < 10; ++round) {
+		for (int i = 0; i < NUM_VALUES; ++i) {
+			int64_t v = rand() % NUM_VALUES;
+			if (rand() % 3) {
+				ck_assert(avl_sharded_add(tree, (void *)v, (void *)(v + 1)) == !present[v]);
+				present[v] = true;
+			} else {
+				void const *node_value;
+				void const *node_data;
+				ck_assert(avl_sharded_remove(tree, (void *)v, &node_value, &node_data) == present[v]);
+				present[v] = false;
+			}
+		}
+
+		_check_sharded(tree, present);
+	}
+
+	avl_sharded_free(&tree, free_node, NULL);
+	ck_assert(tree == NULL);
+}
+
+END_TEST
+
+START_TEST(test_sharded_range) {
+	struct avl_sharded_tree *tree = _create_sharded(0);
+
+	for (int64_t v = 0; v < NUM_VALUES; v += 3) {
+		ck_assert(avl_sharded_add(tree, (void *)v, (void *)(v + 1)) == true);
+	}
+
+	for (uint32_t flags = 0; flags < 16; ++flags) {
+		for (int64_t lo = -7; lo < NUM_VALUES + 7; lo += 1111) {
+			for (int64_t hi = lo - 5; hi < NUM_VALUES + 7; hi += 1251) {
+				// The same range over a single tree holding the same values
+				int expected = 0;
+				for (int64_t v = 0; v < NUM_VALUES; v += 3) {
+					bool above = flags & AVL_RANGE_LO_UNBOUNDED || lo < v ||
+					             (lo == v && flags & AVL_RANGE_LO_INCLUSIVE);
+					bool below = flags & AVL_RANGE_HI_UNBOUNDED || v < hi ||
+					             (v == hi && flags & AVL_RANGE_HI_INCLUSIVE);
+					expected += above && below;
+				}
+
+				struct collected_nodes collected = {.count = 0};
+				ck_assert(
+				    avl_sharded_range(tree, (void *)lo, (void *)hi, flags, collect_node, &collected) == 0);
+				ck_assert(collected.count == expected);
+				for (int i = 1; i < collected.count; ++i) {
+					ck_assert(collected.values[i - 1] < collected.values[i]);
+				}
+			}
+		}
+	}
+
+	avl_sharded_free(&tree, free_node, NULL);
+}
+
+END_TEST
+
+START_TEST(test_sharded_rebalance) {
+	struct avl_sharded_tree *tree = _create_sharded(0);
+
+	// Everything lands in the first two shards
+	bool present[NUM_VALUES] = {false};
+	for (int64_t v = 0; v < NUM_VALUES / 4; ++v) {
+		ck_assert(avl_sharded_add(tree, (void *)v, (void *)(v + 1)) == true);
+		present[v] = true;
+	}
+
+	ck_assert(avl_sharded_rebalance(tree) == 0);
+	_check_sharded(tree, present);
+
+	size_t sizes[NUM_SHARDS];
+	ck_assert(avl_sharded_sizes(tree, sizes) == 0);
+	for (int i = 0; i < NUM_SHARDS; ++i) {
+		// Shares differ by one at most when the entries do not divide evenly
+		int total = NUM_VALUES / 4;
+		ck_assert(sizes[i] == (size_t)((i + 1) * total / NUM_SHARDS - i * total / NUM_SHARDS));
+	}
+
+	// Values beyond the old boundaries still find their shard
+	for (int64_t v = NUM_VALUES / 4; v < NUM_VALUES; v += 2) {
+		ck_assert(avl_sharded_add(tree, (void *)v, (void *)(v + 1)) == true);
+		present[v] = true;
+	}
+	_check_sharded(tree, present);
+	ck_assert(avl_sharded_rebalance(tree) == 0);
+	_check_sharded(tree, present);
+
+	avl_sharded_free(&tree, free_node, NULL);
+
+	// Fewer entries than shards leave the boundaries alone
+	tree = _create_sharded(0);
+	ck_assert(avl_sharded_add(tree, (void *)1, (void *)2) == true);
+	ck_assert(avl_sharded_rebalance(tree) == 0);
+	avl_sharded_free(&tree, free_node, NULL);
+
+	tree = _create_sharded(AVL_TREE_PERSISTENT);
+	ck_assert(avl_sharded_rebalance(tree) == -EINVAL);
+	avl_sharded_free(&tree, free_node, NULL);
+}
+
+END_TEST
+
+int _boxed_cmp(void const *new_value, void const *node_value) {
+	int64_t a = *(int64_t const *)new_value;
+	int64_t b = *(int64_t const *)node_value;
+	return (a > b) - (a < b);
+}
+
+int64_t *_box(int64_t value) {
+	int64_t *box = malloc(sizeof(*box));
+	ck_assert(box != NULL);
+	*box = value;
+	return box;
+}
+
+void const *_clone_box(void const *value, void *copies) {
+	++*(int *)copies;
+	return _box(*(int64_t const *)value);
+}
+
+void _release_box(void const *value, void *copies) {
+	--*(int *)copies;
+	free((void *)value);
+}
+
+START_TEST(test_sharded_owned_bounds) {
+	int copies = 0;
+	void const *bounds[NUM_SHARDS - 1];
+	for (int i = 0; i < NUM_SHARDS - 1; ++i) {
+		bounds[i] = _box((i + 1) * NUM_VALUES / NUM_SHARDS);
+	}
+
+	struct avl_sharded_tree *tree = NULL;
+	ck_assert(
+	    avl_sharded_create(
+	        &tree, _boxed_cmp, 0, bounds, NUM_SHARDS, _clone_box, _release_box, &copies) == 0);
+	ck_assert(copies == NUM_SHARDS - 1);
+
+	// The tree made copies of its own
+	for (int i = 0; i < NUM_SHARDS - 1; ++i) {
+		free((void *)bounds[i]);
+	}
+
+	for (int round = 0; round < 4; ++round) {
+		int64_t first = round * NUM_VALUES / 8;
+		for (int64_t v = first; v < first + NUM_VALUES / 4; ++v) {
+			ck_assert(avl_sharded_add(tree, _box(v), NULL) == true);
+		}
+		ck_assert(avl_sharded_rebalance(tree) == 0);
+
+		// Whichever of them became boundaries, removed values can be freed right away
+		for (int64_t v = first; v < first + NUM_VALUES / 4; v += 2) {
+			void const *node_value;
+			void const *node_data;
+			ck_assert(avl_sharded_remove(tree, &v, &node_value, &node_data) == true);
+			free((void *)node_value);
+		}
+		for (int64_t v = 0; v < NUM_VALUES; ++v) {
+			void const *node_data;
+			bool present = first <= v && v < first + NUM_VALUES / 4 && (v - first) % 2 == 1;
+			ck_assert(avl_sharded_get(tree, &v, &node_data) == present);
+		}
+
+		for (int64_t v = first + 1; v < first + NUM_VALUES / 4; v += 2) {
+			void const *node_value;
+			void const *node_data;
+			ck_assert(avl_sharded_remove(tree, &v, &node_value, &node_data) == true);
+			free((void *)node_value);
+		}
+	}
+
+	// Every copy goes back, those retired by rebalancing included
+	avl_sharded_free(&tree, NULL, NULL);
+	ck_assert(copies == 0);
+}
+
+END_TEST
+
+struct writer {
+	struct avl_sharded_tree *tree;
+	int64_t first;
+};
+
+void *_write(void *arg) {
+	struct writer *writer = arg;
+
+	// Every thread owns the values congruent to its first one, so results are predictable
+	int64_t const stride = NUM_THREADS + 1;
+	for (int round = 0; round < 4; ++round) {
+		for (int64_t v = writer->first; v < NUM_VALUES; v += stride) {
+			ck_assert(avl_sharded_add(writer->tree, (void *)v, (void *)(v + 1)) == true);
+		}
+		for (int64_t v = writer->first; v < NUM_VALUES; v += 2 * stride) {
+			void const *node_value;
+			void const *node_data;
+			ck_assert(avl_sharded_remove(writer->tree, (void *)v, &node_value, &node_data) == true);
+			ck_assert((int64_t)node_value == v);
+		}
+		for (int64_t v = writer->first; v < NUM_VALUES; v += 2 * stride) {
+			ck_assert(avl_sharded_add(writer->tree, (void *)v, (void *)(v + 1)) == true);
+		}
+		for (int64_t v = writer->first; v < NUM_VALUES; v += stride) {
+			void const *node_value;
+			void const *node_data;
+			ck_assert(avl_sharded_remove(writer->tree, (void *)v, &node_value, &node_data) == true);
+		}
+	}
+
+	return NULL;
+}
+
+START_TEST(test_sharded_concurrent_rebalance) {
+	struct avl_sharded_tree *tree = _create_sharded(0);
+
+	// A fixed population the writers never touch, which has to survive every rebalance
+	bool present[NUM_VALUES] = {false};
+	for (int64_t v = 0; v < NUM_VALUES; ++v) {
+		present[v] = v % (NUM_THREADS + 1) == NUM_THREADS;
+		if (present[v]) {
+			ck_assert(avl_sharded_add(tree, (void *)v, (void *)(v + 1)) == true);
+		}
+	}
+
+	pthread_t threads[NUM_THREADS];
+	struct writer writers[NUM_THREADS];
+	for (int i = 0; i < NUM_THREADS; ++i) {
+		writers[i].tree = tree;
+		writers[i].first = i;
+		ck_assert(pthread_create(&threads[i], NULL, _write, &writers[i]) == 0);
+	}
+
+	for (int i = 0; i < 200; ++i) {
+		ck_assert(avl_sharded_rebalance(tree) == 0);
+
+		// Walks only ever see each value once, in order
+		static struct collected_nodes collected;
+		collected.count = 0;
+		ck_assert(avl_sharded_traverse(tree, collect_node, &collected) == 0);
+		for (int j = 1; j < collected.count; ++j) {
+			ck_assert(collected.values[j - 1] < collected.values[j]);
+		}
+	}
+
+	for (int i = 0; i < NUM_THREADS; ++i) {
+		pthread_join(threads[i], NULL);
+	}
+
+	// The writers removed everything they added
+	_check_sharded(tree, present);
+	ck_assert(avl_sharded_rebalance(tree) == 0);
+	_check_sharded(tree, present);
+
+	avl_sharded_free(&tree, free_node, NULL);
+}
+
+END_TEST
+
+Suite *test_suite() {
+	Suite *suite = suite_create("test_suite");
+
+	TCase *tcase = tcase_create("case");
+	tcase_set_timeout(tcase, 60);
+
+	tcase_add_test(tcase, test_sharded);
+	tcase_add_test(tcase, test_sharded_range);
+	tcase_add_test(tcase, test_sharded_rebalance);
+	tcase_add_test(tcase, test_sharded_owned_bounds);
+	tcase_add_test(tcase, test_sharded_concurrent_rebalance);
+
+	suite_add_tcase(suite, tcase);
+
+	return suite;
+}
+
+int main() {
+	return run(test_suite());
+}
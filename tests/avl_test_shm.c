@@ -0,0 +1,216 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "avl_shm.h"
+#include "avl_test_utils.h"
+
+#define NUM_VALUES 10000
+#define NUM_CHILDREN 4
+
+struct visit {
+	int64_t previous;
+	size_t count;
+};
+
+int _visit(void const *value, void const *data, void *arg) {
+	struct visit *visit = arg;
+
+	ck_assert(visit->previous < (int64_t)value);
+	ck_assert((int64_t)data == (int64_t)value + 1);
+	visit->previous = (int64_t)value;
+	++visit->count;
+
+	return 0;
+}
+
+char const *_name() {
+	// Tests running side by side must not collide; forked children keep their parent's name
+	static char name[64];
+	if (name[0] == '\0') {
+		snprintf(name, sizeof(name), "/avl_test_shm_%d", (int)getpid());
+	}
+	return name;
+}
+
+START_TEST(test_shm) {
+	struct avl_shm_tree *tree = NULL;
+	ck_assert(avl_shm_create(&tree, _name(), int64_t_cmp, 0, NUM_VALUES) == 0);
+
+	bool present[NUM_VALUES] = {false};
+	size_t count = 0;
+
+	for (int i = 0; i < 20 * NUM_VALUES; ++i) {
+		int64_t v = rand() % NUM_VALUES;
+		if (rand() % 3) {
+			ck_assert(avl_shm_add(tree, (void *)v, (void *)(v + 1)) == !present[v]);
+			count += !present[v];
+			present[v] = true;
+		} else {
+			void const *node_value;
+			void const *node_data;
+			ck_assert(avl_shm_remove(tree, (void *)v, &node_value, &node_data) == present[v]);
+			ck_assert(!present[v] || ((int64_t)node_value == v && (int64_t)node_data == v + 1));
+			count -= present[v];
+			present[v] = false;
+		}
+	}
+
+	// A second mapping in the same process sees the same tree, wherever it lands
+	struct avl_shm_tree *other = NULL;
+	ck_assert(avl_shm_open(&other, _name(), int64_t_cmp) == 0);
+	ck_assert(other->header != tree->header);
+
+	struct visit visit = {.previous = -1, .count = 0};
+	ck_assert(avl_shm_traverse(other, _visit, &visit) == 0);
+	ck_assert(visit.count == count);
+	for (int64_t v = 0; v < NUM_VALUES; ++v) {
+		void const *node_data;
+		ck_assert(avl_shm_get(other, (void *)v, &node_data) == present[v]);
+		ck_assert(!present[v] || (int64_t)node_data == v + 1);
+	}
+
+	avl_shm_close(&other);
+	avl_shm_close(&tree);
+	ck_assert(tree == NULL);
+	ck_assert(avl_shm_unlink(_name()) == 0);
+}
+
+END_TEST
+
+START_TEST(test_shm_capacity) {
+	struct avl_shm_tree *tree = NULL;
+	ck_assert(avl_shm_create(&tree, _name(), int64_t_cmp, AVL_COMPACT_SET, 100) == 0);
+
+	// The name is taken until it is unlinked
+	struct avl_shm_tree *other = NULL;
+	ck_assert(avl_shm_create(&other, _name(), int64_t_cmp, 0, 100) == -EEXIST);
+	ck_assert(other == NULL);
+
+	for (int64_t v = 0; v < 100; ++v) {
+		ck_assert(avl_shm_add(tree, (void *)v, NULL) == true);
+	}
+	ck_assert(avl_shm_add(tree, (void *)100, NULL) == -ENOSPC);
+	ck_assert(avl_shm_add(tree, (void *)50, NULL) == false);
+
+	// Removed nodes make room again
+	void const *node_value;
+	void const *node_data;
+	ck_assert(avl_shm_remove(tree, (void *)50, &node_value, &node_data) == true);
+	ck_assert(node_data == NULL);
+	ck_assert(avl_shm_add(tree, (void *)100, NULL) == true);
+
+	avl_shm_close(&tree);
+	ck_assert(avl_shm_unlink(_name()) == 0);
+	ck_assert(avl_shm_open(&tree, _name(), int64_t_cmp) == -ENOENT);
+	ck_assert(avl_shm_unlink(_name()) == -ENOENT);
+}
+
+END_TEST
+
+int _child(int index) {
+	// Returns an exit status rather than asserting, since failures have to reach the parent
+	struct avl_shm_tree *tree = NULL;
+	if (avl_shm_open(&tree, _name(), int64_t_cmp) != 0) {
+		return 1;
+	}
+
+	// The parent's even values are there throughout; odd ones congruent to index are ours
+	int status = 0;
+	for (int round = 0; round < 5 && status == 0; ++round) {
+		for (int64_t v = 2 * index + 1; v < NUM_VALUES; v += 2 * NUM_CHILDREN) {
+			if (avl_shm_add(tree, (void *)v, (void *)(v + 1)) != true) {
+				status = 2;
+			}
+		}
+		for (int64_t v = 0; v < NUM_VALUES; v += 2) {
+			void const *node_data;
+			if (avl_shm_get(tree, (void *)v, &node_data) != true || (int64_t)node_data != v + 1) {
+				status = 3;
+			}
+		}
+		for (int64_t v = 2 * index + 1; v < NUM_VALUES; v += 4 * NUM_CHILDREN) {
+			void const *node_value;
+			void const *node_data;
+			if (avl_shm_remove(tree, (void *)v, &node_value, &node_data) != true) {
+				status = 4;
+			}
+		}
+		for (int64_t v = 2 * index + 1; v < NUM_VALUES; v += 2 * NUM_CHILDREN) {
+			void const *node_value;
+			void const *node_data;
+			bool kept = (v - 2 * index - 1) % (4 * NUM_CHILDREN) != 0;
+			if (round < 4 && avl_shm_remove(tree, (void *)v, &node_value, &node_data) != kept) {
+				status = 5;
+			}
+		}
+	}
+
+	avl_shm_close(&tree);
+	return status;
+}
+
+START_TEST(test_shm_processes) {
+	struct avl_shm_tree *tree = NULL;
+	ck_assert(avl_shm_create(&tree, _name(), int64_t_cmp, 0, NUM_VALUES) == 0);
+
+	for (int64_t v = 0; v < NUM_VALUES; v += 2) {
+		ck_assert(avl_shm_add(tree, (void *)v, (void *)(v + 1)) == true);
+	}
+
+	pid_t children[NUM_CHILDREN];
+	for (int i = 0; i < NUM_CHILDREN; ++i) {
+		children[i] = fork();
+		ck_assert(children[i] >= 0);
+		if (children[i] == 0) {
+			_exit(_child(i));
+		}
+	}
+
+	// Meanwhile, walks see every value once, in order
+	for (int i = 0; i < 20; ++i) {
+		struct visit visit = {.previous = -1, .count = 0};
+		ck_assert(avl_shm_traverse(tree, _visit, &visit) == 0);
+		ck_assert(visit.count >= NUM_VALUES / 2);
+	}
+
+	for (int i = 0; i < NUM_CHILDREN; ++i) {
+		int status;
+		ck_assert(waitpid(children[i], &status, 0) == children[i]);
+		ck_assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	}
+
+	// Each child's last round left every other one of its values in place
+	for (int64_t v = 0; v < NUM_VALUES; ++v) {
+		bool present = v % 2 == 0 || (v - 1) % (4 * NUM_CHILDREN) >= 2 * NUM_CHILDREN;
+		void const *node_data;
+		ck_assert(avl_shm_get(tree, (void *)v, &node_data) == present);
+	}
+
+	avl_shm_close(&tree);
+	ck_assert(avl_shm_unlink(_name()) == 0);
+}
+
+END_TEST
+
+Suite *test_suite() {
+	Suite *suite = suite_create("test_suite");
+
+	TCase *tcase = tcase_create("case");
+	tcase_set_timeout(tcase, 60);
+
+	tcase_add_test(tcase, test_shm);
+	tcase_add_test(tcase, test_shm_capacity);
+	tcase_add_test(tcase, test_shm_processes);
+
+	suite_add_tcase(suite, tcase);
+
+	return suite;
+}
+
+int main() {
+	return run(test_suite());
+}
@@ -0,0 +1,158 @@
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "avl_test_utils.h"
+
+#define NUM_VALUES 1000
+
+#define AVL_TYPED_NAME int64_tree
+#define AVL_TYPED_KEY int64_t
+#define AVL_TYPED_DATA int64_t
+#include "avl_typed.h"
+
+struct key {
+	uint32_t parts[3];
+};
+
+static inline int key_cmp(struct key const *a, struct key const *b) {
+	for (int i = 0; i < 3; ++i) {
+		if (a->parts[i] != b->parts[i]) {
+			return a->parts[i] < b->parts[i] ? -1 : 1;
+		}
+	}
+	return 0;
+}
+
+#define AVL_TYPED_NAME key_tree
+#define AVL_TYPED_KEY struct key
+#define AVL_TYPED_CMP key_cmp
+#include "avl_typed.h"
+
+int64_t _check_typed(struct int64_tree_node const *node, int64_t *previous) {
+	if (node == NULL) {
+		return 0;
+	}
+
+	int64_t left_height = _check_typed(node->left, previous);
+
+	// In order, and the data still belongs to its key
+	ck_assert(*previous < node->key);
+	ck_assert(node->data == node->key + 1);
+	*previous = node->key;
+
+	int64_t right_height = _check_typed(node->right, previous);
+	ck_assert(node->balance == right_height - left_height);
+
+	return 1 + (left_height < right_height ? right_height : left_height);
+}
+
+int _count(struct int64_tree_node const *node __attribute__((unused)), void *arg) {
+	++*(int *)arg;
+	return 0;
+}
+
+START_TEST(test_typed_int64) {
+	struct int64_tree *tree = NULL;
+	ck_assert(int64_tree_create(&tree) == 0);
+
+	bool present[NUM_VALUES] = {false};
+	int count = 0;
+
+	for (int i = 0; i < 20 * NUM_VALUES; ++i) {
+		int64_t v = rand() % NUM_VALUES;
+		int64_t data = 0;
+		switch (rand() % 3) {
+			case 0:
+				ck_assert(int64_tree_add(tree, v, v + 1) == !present[v]);
+				count += !present[v];
+				present[v] = true;
+				break;
+
+			case 1: {
+				int64_t node_key = 0;
+				ck_assert(int64_tree_remove(tree, v, &node_key, &data) == present[v]);
+				if (present[v]) {
+					ck_assert(node_key == v);
+					ck_assert(data == v + 1);
+					--count;
+				}
+				present[v] = false;
+				break;
+			}
+
+			default:
+				ck_assert(int64_tree_get(tree, v, &data) == present[v]);
+				if (present[v]) {
+					ck_assert(data == v + 1);
+				}
+				break;
+		}
+
+		if (i % NUM_VALUES == 0) {
+			int64_t previous = -1;
+			_check_typed(tree->root, &previous);
+		}
+	}
+
+	int visited = 0;
+	ck_assert(int64_tree_traverse(tree, NULL, NULL, _count, &visited, NULL, NULL) == 0);
+	ck_assert(visited == count);
+
+	visited = 0;
+	int64_tree_free(&tree, _count, &visited);
+	ck_assert(visited == count);
+	ck_assert(tree == NULL);
+}
+
+END_TEST
+
+START_TEST(test_typed_struct) {
+	struct key_tree *tree = NULL;
+	ck_assert(key_tree_create(&tree) == 0);
+
+	// Keys that only differ in their last part
+	for (uint32_t i = 0; i < NUM_VALUES; ++i) {
+		struct key key = {{7, 7, i * 7919 % NUM_VALUES}};
+		ck_assert(key_tree_add(tree, key, (void *)(uintptr_t)key.parts[2]) == true);
+	}
+
+	for (uint32_t i = 0; i < NUM_VALUES; ++i) {
+		struct key key = {{7, 7, i}};
+		void const *data;
+		ck_assert(key_tree_get(tree, key, &data) == true);
+		ck_assert((uintptr_t)data == i);
+
+		key.parts[1] = 8;
+		ck_assert(key_tree_get(tree, key, &data) == false);
+	}
+
+	for (uint32_t i = 0; i < NUM_VALUES; i += 2) {
+		struct key key = {{7, 7, i}};
+		struct key node_key;
+		void const *data;
+		ck_assert(key_tree_remove(tree, key, &node_key, &data) == true);
+		ck_assert(key_cmp(&key, &node_key) == 0);
+		ck_assert(key_tree_remove(tree, key, &node_key, &data) == false);
+	}
+
+	key_tree_free(&tree, NULL, NULL);
+}
+
+END_TEST
+
+Suite *test_suite() {
+	Suite *suite = suite_create("test_suite");
+
+	TCase *tcase = tcase_create("case");
+
+	tcase_add_test(tcase, test_typed_int64);
+	tcase_add_test(tcase, test_typed_struct);
+
+	suite_add_tcase(suite, tcase);
+
+	return suite;
+}
+
+int main() {
+	return run(test_suite());
+}
@@ -29,19 +29,55 @@ int _check_node(struct avl_node const *node, void *previous_value) {
 	return 0;
 }
 
+int64_t check_heights(struct avl_node const *node) {
+	if (node == NULL) {
+		return 0;
+	}
+
+	int64_t left_height = check_heights(node->left);
+	int64_t right_height = check_heights(node->right);
+
+	// The stored balance has to match the real difference in height
+	ck_assert(node->balance == right_height - left_height);
+
+	return 1 + (left_height < right_height ? right_height : left_height);
+}
+
+size_t check_sizes(struct avl_node const *node) {
+	if (node == NULL) {
+		return 0;
+	}
+
+	size_t size = 1 + check_sizes(node->left) + check_sizes(node->right);
+	ck_assert(node->size == size);
+
+	return size;
+}
+
 void check_tree(struct avl_tree *tree) {
 	size_t previous_value = INT64_MIN;
 
 	avl_tree_traverse(tree, NULL, NULL, _check_node, &previous_value, NULL, NULL);
+
+	check_heights(tree->root);
 }
 
-int _free_node(struct avl_node const *node, void *arg __attribute__((unused))) {
+int free_node(struct avl_node const *node, void *arg __attribute__((unused))) {
 	free((struct avl_node *)node);
 	return 0;
 }
 
 void free_tree(struct avl_tree *tree) {
-	avl_tree_free(&tree, _free_node, NULL);
+	avl_tree_free(&tree, free_node, NULL);
+}
+
+int collect_node(struct avl_node const *node, void *arg) {
+	struct collected_nodes *collected = arg;
+
+	ck_assert(collected->count < COLLECTED_CAPACITY);
+	collected->values[collected->count++] = (int64_t)avl_node_value(node);
+
+	return 0;
 }
 
 int run(Suite *suite) {
@@ -5,24 +5,35 @@
 
 #include "avl.h"
 
-struct avl_node {
-	void const *value;
-	void const *data;
-	struct avl_node *left;
-	struct avl_node *right;
-	int8_t balance;
-};
-
 enum weight { LEFT = -1, BALANCED = 0, RIGHT = 1 };
 
 int int64_t_cmp(void const *new_value, void const *node_value);
 
 struct avl_tree *create_tree();
 
+int64_t check_heights(struct avl_node const *node);
+
+// Checks the subtree sizes of an AVL_TREE_ORDER_STATISTICS tree and returns the node count
+size_t check_sizes(struct avl_node const *node);
+
 void check_tree(struct avl_tree *tree);
 
+// Frees a node allocated by the tree, for the free functions of every kind of tree
+int free_node(struct avl_node const *node, void *arg);
+
 void free_tree(struct avl_tree *tree);
 
+// Enough for the largest tree any test walks with collect_node
+#define COLLECTED_CAPACITY 10000
+
+struct collected_nodes {
+	int64_t values[COLLECTED_CAPACITY];
+	int count;
+};
+
+// Traversal callback appending each node's value to the struct collected_nodes in arg
+int collect_node(struct avl_node const *node, void *arg);
+
 int run(Suite *suite);
 
 #endif  // AVL_C_TESTS_AVL_TEST_UTILS_H